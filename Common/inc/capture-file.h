@@ -0,0 +1,42 @@
+#ifndef CAPTURE_FILE_H
+#define CAPTURE_FILE_H
+
+#include <stddef.h>
+
+/*
+ * Traffic capture file: what clients sent a server, written by the server's capture mode and read back by
+ * chat-replay. The file is CAPTURE_MAGIC followed by records in the order the server read them. Every number in a
+ * record is a varint (7 bits a byte, low bits first, high bit set on every byte but the last), so a typical chat
+ * frame costs 4 or 5 bytes on top of its text.
+ *
+ *     kind (1 byte) | microseconds since the previous record | connection id | length | payload (length bytes)
+ *
+ * Upload records have no payload, their length is only the count of raw bytes the client sent (file contents
+ * aren't captured).
+ */
+
+// One decoded record. payload points into the buffer it was decoded from.
+typedef struct
+{
+    int kind;                      // CAPTURE_RECORD_*
+    unsigned long long deltaMicroseconds;
+    unsigned long connectionId;    // Numbered by the server from 1, in the order clients connected
+    size_t length;                 // Payload bytes, or raw upload bytes for CAPTURE_RECORD_UPLOAD
+    const char *payload;           // NULL for records without one
+} CaptureRecord;
+
+// Function prototypes
+size_t captureEncodeRecord(unsigned char *output, const CaptureRecord *record);
+long captureDecodeRecord(const unsigned char *input, size_t inputLength, CaptureRecord *record);
+
+// Defines
+#define CAPTURE_MAGIC "CHATCAP1"      // First bytes of a capture file (the 1 is the format version)
+#define CAPTURE_MAGIC_LENGTH 8
+#define CAPTURE_RECORD_OPEN 1         // A client connected
+#define CAPTURE_RECORD_FRAME 2        // A frame from a client, without its frame end
+#define CAPTURE_RECORD_UPLOAD 3       // Raw upload bytes that followed a chunk frame (counted, not kept)
+#define CAPTURE_RECORD_CLOSE 4        // The client's connection ended
+#define CAPTURE_VARINT_MAX 10         // Longest varint (a 64 bit number)
+#define CAPTURE_RECORD_OVERHEAD (1 + 3 * CAPTURE_VARINT_MAX) // Most a record adds to its payload
+
+#endif // CAPTURE_FILE_H
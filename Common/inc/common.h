@@ -18,7 +18,40 @@
 #include <time.h>
 
 // Your code here
-#define SERVER_PORT 8888
-#define MAX_PROTOL_MESSAGE_SIZE 128
+#define SERVER_PORT 8888 // Client port when the server isn't given -portN (clients connect to HOST:PORT for another)
+#define SERVER_UNIX_SOCKET_PATH "/tmp/chat-server.sock" // Same-host clients can connect here instead of over TCP
+#define MAX_PROTOL_MESSAGE_SIZE 160 // Longest frame, room for an IPv6 client address, a 15 byte name and an 80 byte part
+#define PROTOCOL_FRAME_END '\n' // Every frame on the wire ends with this, in both directions
+
+// Control frames (sent on their own, not inside the IP|USER|COUNT|TEXT protocol message)
+#define PROTOCOL_BYE ">>bye<<"   // Client is leaving (sent as the message text)
+#define PROTOCOL_PING ">>ping<<" // Server checking an idle client is still there
+#define PROTOCOL_PONG ">>pong<<" // Client reply to a ping
+#define PROTOCOL_BUSY ">>busy<<"   // Server turning a new client away, followed by the retry-after seconds
+#define PROTOCOL_STATS ">>stats<<" // Client asking for server counters (sent as the message text)
+#define PROTOCOL_MESSAGE ">>msg<<"   // Broadcast chat line: >>msg<<SEQUENCE|SERVERMS|line
+#define PROTOCOL_RESUME ">>resume<<" // Client's first frame after a reconnect: >>resume<<LASTSEQUENCE
+
+// File sharing. Raw bytes follow chunk and data frames on the same connection, the frame end isn't looked for in them.
+#define PROTOCOL_PUT ">>put<<"           // Client starting an upload (sent as the message text): >>put<<TOTALBYTES NAME
+#define PROTOCOL_CHUNK ">>chunk<<"       // Client upload chunk: >>chunk<<LENGTH then LENGTH raw bytes
+#define PROTOCOL_GET ">>get<<"           // Client asking for a shared file: >>get<<BLOBID
+#define PROTOCOL_DATA ">>data<<"         // Server download chunk: >>data<<BLOBID|OFFSET|LENGTH|TOTAL then LENGTH raw bytes
+#define PROTOCOL_BLOB_FAIL ">>blobfail<<" // Server refusing a put or get: >>blobfail<<REASON
+#define PROTOCOL_BLOB_CHUNK_BYTES (16 * 1024)       // Largest chunk either way
+#define PROTOCOL_BLOB_MAX_BYTES (16 * 1024 * 1024)  // Largest file the server takes
+
+// Search of everything said in the room
+#define PROTOCOL_SEARCH ">>search<<"    // Client query: >>search<<WORDS [user:NAME] [after:MS] [before:MS] [limit:COUNT]
+#define PROTOCOL_SEARCH_HIT ">>hit<<"   // One match, newest first: >>hit<<SEQUENCE|SERVERMS|line
+#define PROTOCOL_SEARCH_END ">>hitend<<" // After the matches: >>hitend<<COUNT|MICROSECONDS
+
+#define PROTOCOL_BLOCKED ">>blocked<<" // Server telling a client its message was stopped by the content filter
+
+// Compressed batches, for clients on slow links
+#define PROTOCOL_COMPRESS ">>compress<<" // Client asking for a codec, server answering with the one it will use
+#define PROTOCOL_COMPRESS_LZ "lz1"       // The in-tree LZ codec with its preset dictionary (see lz.h)
+#define PROTOCOL_COMPRESS_NONE "none"    // Server declining, frames keep coming as they are
+#define PROTOCOL_COMPRESSED ">>z<<"      // Server compressed batch: >>z<<RAWLENGTH|LENGTH then LENGTH compressed bytes
 
 #endif
\ No newline at end of file
@@ -0,0 +1,35 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+/*
+ * Small LZ77 codec for compressing batches of frames on one connection. Both ends keep the same window: it starts
+ * as a preset dictionary of protocol text and then holds the tail of everything already sent compressed, so even
+ * the first small batch finds its headers to copy. Blocks are sequences of literals and back references (offset and
+ * length), with the same token layout as LZ4.
+ */
+
+// Defines needed by the types below
+#define LZ_WINDOW_BYTES 16384 // History a back reference can reach into (the preset dictionary to start with)
+
+// One direction of one connection. The compressor and the decompressor stay in step as long as every compressed
+// block is decompressed in order.
+typedef struct
+{
+    size_t windowLength;
+    unsigned char window[LZ_WINDOW_BYTES];
+} LzWindow;
+
+// Function prototypes
+void lzWindowInitialize(LzWindow *window);
+size_t lzCompress(LzWindow *window, const char *input, size_t inputLength, char *output, size_t outputSize);
+long lzDecompress(LzWindow *window, const char *input, size_t inputLength, char *output, size_t outputSize);
+
+// Defines
+#define LZ_MIN_MATCH 4                 // Shortest back reference worth a token
+#define LZ_MAX_OFFSET 65535            // Longest distance a back reference can go
+#define LZ_HASH_BITS 13                // Match finder table of 2^LZ_HASH_BITS positions
+#define LZ_COMPRESS_BOUND(length) ((length) + (length) / 255 + 16) // Room for the worst case (nothing matches)
+
+#endif // LZ_H
@@ -0,0 +1,22 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/*
+ * Byte scanning kernels for the parse and display paths. Each one has a scalar version and, on x86, SSE2 and AVX2
+ * versions; the best one the CPU supports is picked the first time any of them is called.
+ */
+
+// Function prototypes
+const char *scanFindByte(const char *data, size_t length, char byte);
+const char *scanFindPair(const char *data, size_t length, char first, char second);
+size_t scanReplacePairs(char *data, size_t length, const char *marker, const char *replacement);
+int scanIsPrintableAscii(const char *data, size_t length);
+const char *scanKernelName(void);
+
+// Defines
+#define SCAN_PRINTABLE_FIRST 0x20 // Space
+#define SCAN_PRINTABLE_LAST 0x7e  // Tilde
+
+#endif // SCAN_H
@@ -0,0 +1,91 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/*
+ * Byte ring living in shared memory, one per direction. Single producer (guarded by the owning
+ * transport's sendMutex) and single consumer. Head and tail sit on their own cache lines so the two
+ * processes don't fight over one line. Both ends can write the whole mapping, so neither trusts the indices: head
+ * and tail more than TRANSPORT_RING_SIZE apart end the connection.
+ */
+typedef struct
+{
+    unsigned int head;            // Total bytes ever written (producer only)
+    char headPadding[60];
+    unsigned int tail;            // Total bytes ever read (consumer only)
+    char tailPadding[60];
+    int consumerWaiting;          // Consumer is (about to be) asleep on its doorbell
+    char waitingPadding[60];
+    char data[];                  // TRANSPORT_RING_SIZE bytes
+} SharedRing;
+
+struct Transport;
+
+// One implementation of the transport functions
+typedef struct
+{
+    const char *name;
+    ssize_t (*send)(struct Transport *transport, const void *data, size_t length, int flags);
+    ssize_t (*receive)(struct Transport *transport, void *buffer, size_t length, int flags);
+    ssize_t (*sendFile)(struct Transport *transport, int fileDescriptor, off_t *offset, size_t length, int flags);
+    ssize_t (*receiveFile)(struct Transport *transport, int fileDescriptor, off_t *offset, size_t length);
+    void (*close)(struct Transport *transport);
+} TransportOperations;
+
+// A connection to a peer, whatever it is carried over
+typedef struct Transport
+{
+    const TransportOperations *operations;
+    int socket;                   // TCP or AF_UNIX stream socket (shared memory keeps it for setup and liveness)
+    int kind;                     // TRANSPORT_TCP, TRANSPORT_UNIX or TRANSPORT_SHARED_MEMORY
+
+    // Shared memory only
+    SharedRing *sendRing;
+    SharedRing *receiveRing;
+    int sendDoorbell;             // eventfd written to wake the peer
+    int receiveDoorbell;          // eventfd the peer writes to wake us
+    void *sharedMapping;
+    pthread_mutex_t sendMutex;    // Several server threads can send to one client
+
+    // Socket only
+    int isNonBlocking;            // Set by the first MSG_DONTWAIT file send, blocking calls then wait in poll
+    int splicePipe[2];            // Kernel buffer that received file bytes pass through, made on first use
+
+    // Bytes that arrived on the socket while switching to shared memory, handed out before anything else
+    char pendingData[4096];
+    int pendingLength;
+} Transport;
+
+// Function prototypes
+void transportInitialize(Transport *transport, int socket, int kind);
+ssize_t transportSend(Transport *transport, const void *data, size_t length, int flags);
+ssize_t transportReceive(Transport *transport, void *buffer, size_t length, int flags);
+ssize_t transportSendFile(Transport *transport, int fileDescriptor, off_t *offset, size_t length, int flags);
+ssize_t transportReceiveFile(Transport *transport, int fileDescriptor, off_t *offset, size_t length);
+int transportPollDescriptors(const Transport *transport, struct pollfd *polls);
+void transportShutdown(Transport *transport);
+void transportClose(Transport *transport);
+int transportListenUnix(const char *path, int backlog);
+int transportConnectUnix(const char *path, Transport *transport);
+int transportSplitHostPort(const char *address, char *host, size_t hostSize, int defaultPort);
+int transportOfferSharedMemory(Transport *transport);
+int transportRequestSharedMemory(Transport *transport);
+
+// Defines
+#define TRANSPORT_TCP 0
+#define TRANSPORT_UNIX 1
+#define TRANSPORT_SHARED_MEMORY 2
+
+#define TRANSPORT_UNIX_PREFIX "unix:"       // -serverunix:/path connects over an AF_UNIX socket
+#define TRANSPORT_SHM_PREFIX "shm:"         // -servershm:/path does the same then upgrades to shared memory
+#define TRANSPORT_RING_SIZE (64 * 1024)     // Bytes per direction, must be a power of two
+#define TRANSPORT_SPIN_COUNT 200            // Empty polls of a ring before sleeping on its doorbell
+#define TRANSPORT_MAX_POLL_DESCRIPTORS 2    // Most descriptors transportPollDescriptors fills in
+#define TRANSPORT_FILE_COPY_SIZE (16 * 1024) // Bytes shared memory copies per file read or write (no splice there)
+#define PROTOCOL_SHM ">>shm<<"              // Shared memory upgrade request and reply
+#define PROTOCOL_SHM_FRAME PROTOCOL_SHM "\n" // The same as sent on the wire
+
+#endif // TRANSPORT_H
@@ -0,0 +1,153 @@
+#ifndef UTF8_WIDTH_TABLE_H
+#define UTF8_WIDTH_TABLE_H
+
+// Generated by Common/tools/generate-width-table.py from Unicode 14.0.0, do not edit.
+// Only utf8.c includes this: 348 zero width ranges and 203 wide ranges, four bytes each.
+
+#include "utf8.h"
+
+static const Utf8WidthRange utf8ZeroWidthRanges[] = {
+    UTF8_RANGE(0x00300, 0x0036F), UTF8_RANGE(0x00483, 0x00489), UTF8_RANGE(0x00591, 0x005BD), UTF8_RANGE(0x005BF, 0x005BF),
+    UTF8_RANGE(0x005C1, 0x005C2), UTF8_RANGE(0x005C4, 0x005C5), UTF8_RANGE(0x005C7, 0x005C7), UTF8_RANGE(0x00600, 0x00605),
+    UTF8_RANGE(0x00610, 0x0061A), UTF8_RANGE(0x0061C, 0x0061C), UTF8_RANGE(0x0064B, 0x0065F), UTF8_RANGE(0x00670, 0x00670),
+    UTF8_RANGE(0x006D6, 0x006DD), UTF8_RANGE(0x006DF, 0x006E4), UTF8_RANGE(0x006E7, 0x006E8), UTF8_RANGE(0x006EA, 0x006ED),
+    UTF8_RANGE(0x0070F, 0x0070F), UTF8_RANGE(0x00711, 0x00711), UTF8_RANGE(0x00730, 0x0074A), UTF8_RANGE(0x007A6, 0x007B0),
+    UTF8_RANGE(0x007EB, 0x007F3), UTF8_RANGE(0x007FD, 0x007FD), UTF8_RANGE(0x00816, 0x00819), UTF8_RANGE(0x0081B, 0x00823),
+    UTF8_RANGE(0x00825, 0x00827), UTF8_RANGE(0x00829, 0x0082D), UTF8_RANGE(0x00859, 0x0085B), UTF8_RANGE(0x00890, 0x00891),
+    UTF8_RANGE(0x00898, 0x0089F), UTF8_RANGE(0x008CA, 0x00902), UTF8_RANGE(0x0093A, 0x0093A), UTF8_RANGE(0x0093C, 0x0093C),
+    UTF8_RANGE(0x00941, 0x00948), UTF8_RANGE(0x0094D, 0x0094D), UTF8_RANGE(0x00951, 0x00957), UTF8_RANGE(0x00962, 0x00963),
+    UTF8_RANGE(0x00981, 0x00981), UTF8_RANGE(0x009BC, 0x009BC), UTF8_RANGE(0x009C1, 0x009C4), UTF8_RANGE(0x009CD, 0x009CD),
+    UTF8_RANGE(0x009E2, 0x009E3), UTF8_RANGE(0x009FE, 0x009FE), UTF8_RANGE(0x00A01, 0x00A02), UTF8_RANGE(0x00A3C, 0x00A3C),
+    UTF8_RANGE(0x00A41, 0x00A42), UTF8_RANGE(0x00A47, 0x00A48), UTF8_RANGE(0x00A4B, 0x00A4D), UTF8_RANGE(0x00A51, 0x00A51),
+    UTF8_RANGE(0x00A70, 0x00A71), UTF8_RANGE(0x00A75, 0x00A75), UTF8_RANGE(0x00A81, 0x00A82), UTF8_RANGE(0x00ABC, 0x00ABC),
+    UTF8_RANGE(0x00AC1, 0x00AC5), UTF8_RANGE(0x00AC7, 0x00AC8), UTF8_RANGE(0x00ACD, 0x00ACD), UTF8_RANGE(0x00AE2, 0x00AE3),
+    UTF8_RANGE(0x00AFA, 0x00AFF), UTF8_RANGE(0x00B01, 0x00B01), UTF8_RANGE(0x00B3C, 0x00B3C), UTF8_RANGE(0x00B3F, 0x00B3F),
+    UTF8_RANGE(0x00B41, 0x00B44), UTF8_RANGE(0x00B4D, 0x00B4D), UTF8_RANGE(0x00B55, 0x00B56), UTF8_RANGE(0x00B62, 0x00B63),
+    UTF8_RANGE(0x00B82, 0x00B82), UTF8_RANGE(0x00BC0, 0x00BC0), UTF8_RANGE(0x00BCD, 0x00BCD), UTF8_RANGE(0x00C00, 0x00C00),
+    UTF8_RANGE(0x00C04, 0x00C04), UTF8_RANGE(0x00C3C, 0x00C3C), UTF8_RANGE(0x00C3E, 0x00C40), UTF8_RANGE(0x00C46, 0x00C48),
+    UTF8_RANGE(0x00C4A, 0x00C4D), UTF8_RANGE(0x00C55, 0x00C56), UTF8_RANGE(0x00C62, 0x00C63), UTF8_RANGE(0x00C81, 0x00C81),
+    UTF8_RANGE(0x00CBC, 0x00CBC), UTF8_RANGE(0x00CBF, 0x00CBF), UTF8_RANGE(0x00CC6, 0x00CC6), UTF8_RANGE(0x00CCC, 0x00CCD),
+    UTF8_RANGE(0x00CE2, 0x00CE3), UTF8_RANGE(0x00D00, 0x00D01), UTF8_RANGE(0x00D3B, 0x00D3C), UTF8_RANGE(0x00D41, 0x00D44),
+    UTF8_RANGE(0x00D4D, 0x00D4D), UTF8_RANGE(0x00D62, 0x00D63), UTF8_RANGE(0x00D81, 0x00D81), UTF8_RANGE(0x00DCA, 0x00DCA),
+    UTF8_RANGE(0x00DD2, 0x00DD4), UTF8_RANGE(0x00DD6, 0x00DD6), UTF8_RANGE(0x00E31, 0x00E31), UTF8_RANGE(0x00E34, 0x00E3A),
+    UTF8_RANGE(0x00E47, 0x00E4E), UTF8_RANGE(0x00EB1, 0x00EB1), UTF8_RANGE(0x00EB4, 0x00EBC), UTF8_RANGE(0x00EC8, 0x00ECD),
+    UTF8_RANGE(0x00F18, 0x00F19), UTF8_RANGE(0x00F35, 0x00F35), UTF8_RANGE(0x00F37, 0x00F37), UTF8_RANGE(0x00F39, 0x00F39),
+    UTF8_RANGE(0x00F71, 0x00F7E), UTF8_RANGE(0x00F80, 0x00F84), UTF8_RANGE(0x00F86, 0x00F87), UTF8_RANGE(0x00F8D, 0x00F97),
+    UTF8_RANGE(0x00F99, 0x00FBC), UTF8_RANGE(0x00FC6, 0x00FC6), UTF8_RANGE(0x0102D, 0x01030), UTF8_RANGE(0x01032, 0x01037),
+    UTF8_RANGE(0x01039, 0x0103A), UTF8_RANGE(0x0103D, 0x0103E), UTF8_RANGE(0x01058, 0x01059), UTF8_RANGE(0x0105E, 0x01060),
+    UTF8_RANGE(0x01071, 0x01074), UTF8_RANGE(0x01082, 0x01082), UTF8_RANGE(0x01085, 0x01086), UTF8_RANGE(0x0108D, 0x0108D),
+    UTF8_RANGE(0x0109D, 0x0109D), UTF8_RANGE(0x01160, 0x011FF), UTF8_RANGE(0x0135D, 0x0135F), UTF8_RANGE(0x01712, 0x01714),
+    UTF8_RANGE(0x01732, 0x01733), UTF8_RANGE(0x01752, 0x01753), UTF8_RANGE(0x01772, 0x01773), UTF8_RANGE(0x017B4, 0x017B5),
+    UTF8_RANGE(0x017B7, 0x017BD), UTF8_RANGE(0x017C6, 0x017C6), UTF8_RANGE(0x017C9, 0x017D3), UTF8_RANGE(0x017DD, 0x017DD),
+    UTF8_RANGE(0x0180B, 0x0180F), UTF8_RANGE(0x01885, 0x01886), UTF8_RANGE(0x018A9, 0x018A9), UTF8_RANGE(0x01920, 0x01922),
+    UTF8_RANGE(0x01927, 0x01928), UTF8_RANGE(0x01932, 0x01932), UTF8_RANGE(0x01939, 0x0193B), UTF8_RANGE(0x01A17, 0x01A18),
+    UTF8_RANGE(0x01A1B, 0x01A1B), UTF8_RANGE(0x01A56, 0x01A56), UTF8_RANGE(0x01A58, 0x01A5E), UTF8_RANGE(0x01A60, 0x01A60),
+    UTF8_RANGE(0x01A62, 0x01A62), UTF8_RANGE(0x01A65, 0x01A6C), UTF8_RANGE(0x01A73, 0x01A7C), UTF8_RANGE(0x01A7F, 0x01A7F),
+    UTF8_RANGE(0x01AB0, 0x01ACE), UTF8_RANGE(0x01B00, 0x01B03), UTF8_RANGE(0x01B34, 0x01B34), UTF8_RANGE(0x01B36, 0x01B3A),
+    UTF8_RANGE(0x01B3C, 0x01B3C), UTF8_RANGE(0x01B42, 0x01B42), UTF8_RANGE(0x01B6B, 0x01B73), UTF8_RANGE(0x01B80, 0x01B81),
+    UTF8_RANGE(0x01BA2, 0x01BA5), UTF8_RANGE(0x01BA8, 0x01BA9), UTF8_RANGE(0x01BAB, 0x01BAD), UTF8_RANGE(0x01BE6, 0x01BE6),
+    UTF8_RANGE(0x01BE8, 0x01BE9), UTF8_RANGE(0x01BED, 0x01BED), UTF8_RANGE(0x01BEF, 0x01BF1), UTF8_RANGE(0x01C2C, 0x01C33),
+    UTF8_RANGE(0x01C36, 0x01C37), UTF8_RANGE(0x01CD0, 0x01CD2), UTF8_RANGE(0x01CD4, 0x01CE0), UTF8_RANGE(0x01CE2, 0x01CE8),
+    UTF8_RANGE(0x01CED, 0x01CED), UTF8_RANGE(0x01CF4, 0x01CF4), UTF8_RANGE(0x01CF8, 0x01CF9), UTF8_RANGE(0x01DC0, 0x01DFF),
+    UTF8_RANGE(0x0200B, 0x0200F), UTF8_RANGE(0x0202A, 0x0202E), UTF8_RANGE(0x02060, 0x02064), UTF8_RANGE(0x02066, 0x0206F),
+    UTF8_RANGE(0x020D0, 0x020F0), UTF8_RANGE(0x02CEF, 0x02CF1), UTF8_RANGE(0x02D7F, 0x02D7F), UTF8_RANGE(0x02DE0, 0x02DFF),
+    UTF8_RANGE(0x0302A, 0x0302D), UTF8_RANGE(0x03099, 0x0309A), UTF8_RANGE(0x0A66F, 0x0A672), UTF8_RANGE(0x0A674, 0x0A67D),
+    UTF8_RANGE(0x0A69E, 0x0A69F), UTF8_RANGE(0x0A6F0, 0x0A6F1), UTF8_RANGE(0x0A802, 0x0A802), UTF8_RANGE(0x0A806, 0x0A806),
+    UTF8_RANGE(0x0A80B, 0x0A80B), UTF8_RANGE(0x0A825, 0x0A826), UTF8_RANGE(0x0A82C, 0x0A82C), UTF8_RANGE(0x0A8C4, 0x0A8C5),
+    UTF8_RANGE(0x0A8E0, 0x0A8F1), UTF8_RANGE(0x0A8FF, 0x0A8FF), UTF8_RANGE(0x0A926, 0x0A92D), UTF8_RANGE(0x0A947, 0x0A951),
+    UTF8_RANGE(0x0A980, 0x0A982), UTF8_RANGE(0x0A9B3, 0x0A9B3), UTF8_RANGE(0x0A9B6, 0x0A9B9), UTF8_RANGE(0x0A9BC, 0x0A9BD),
+    UTF8_RANGE(0x0A9E5, 0x0A9E5), UTF8_RANGE(0x0AA29, 0x0AA2E), UTF8_RANGE(0x0AA31, 0x0AA32), UTF8_RANGE(0x0AA35, 0x0AA36),
+    UTF8_RANGE(0x0AA43, 0x0AA43), UTF8_RANGE(0x0AA4C, 0x0AA4C), UTF8_RANGE(0x0AA7C, 0x0AA7C), UTF8_RANGE(0x0AAB0, 0x0AAB0),
+    UTF8_RANGE(0x0AAB2, 0x0AAB4), UTF8_RANGE(0x0AAB7, 0x0AAB8), UTF8_RANGE(0x0AABE, 0x0AABF), UTF8_RANGE(0x0AAC1, 0x0AAC1),
+    UTF8_RANGE(0x0AAEC, 0x0AAED), UTF8_RANGE(0x0AAF6, 0x0AAF6), UTF8_RANGE(0x0ABE5, 0x0ABE5), UTF8_RANGE(0x0ABE8, 0x0ABE8),
+    UTF8_RANGE(0x0ABED, 0x0ABED), UTF8_RANGE(0x0FB1E, 0x0FB1E), UTF8_RANGE(0x0FE00, 0x0FE0F), UTF8_RANGE(0x0FE20, 0x0FE2F),
+    UTF8_RANGE(0x0FEFF, 0x0FEFF), UTF8_RANGE(0x0FFF9, 0x0FFFB), UTF8_RANGE(0x101FD, 0x101FD), UTF8_RANGE(0x102E0, 0x102E0),
+    UTF8_RANGE(0x10376, 0x1037A), UTF8_RANGE(0x10A01, 0x10A03), UTF8_RANGE(0x10A05, 0x10A06), UTF8_RANGE(0x10A0C, 0x10A0F),
+    UTF8_RANGE(0x10A38, 0x10A3A), UTF8_RANGE(0x10A3F, 0x10A3F), UTF8_RANGE(0x10AE5, 0x10AE6), UTF8_RANGE(0x10D24, 0x10D27),
+    UTF8_RANGE(0x10EAB, 0x10EAC), UTF8_RANGE(0x10F46, 0x10F50), UTF8_RANGE(0x10F82, 0x10F85), UTF8_RANGE(0x11001, 0x11001),
+    UTF8_RANGE(0x11038, 0x11046), UTF8_RANGE(0x11070, 0x11070), UTF8_RANGE(0x11073, 0x11074), UTF8_RANGE(0x1107F, 0x11081),
+    UTF8_RANGE(0x110B3, 0x110B6), UTF8_RANGE(0x110B9, 0x110BA), UTF8_RANGE(0x110BD, 0x110BD), UTF8_RANGE(0x110C2, 0x110C2),
+    UTF8_RANGE(0x110CD, 0x110CD), UTF8_RANGE(0x11100, 0x11102), UTF8_RANGE(0x11127, 0x1112B), UTF8_RANGE(0x1112D, 0x11134),
+    UTF8_RANGE(0x11173, 0x11173), UTF8_RANGE(0x11180, 0x11181), UTF8_RANGE(0x111B6, 0x111BE), UTF8_RANGE(0x111C9, 0x111CC),
+    UTF8_RANGE(0x111CF, 0x111CF), UTF8_RANGE(0x1122F, 0x11231), UTF8_RANGE(0x11234, 0x11234), UTF8_RANGE(0x11236, 0x11237),
+    UTF8_RANGE(0x1123E, 0x1123E), UTF8_RANGE(0x112DF, 0x112DF), UTF8_RANGE(0x112E3, 0x112EA), UTF8_RANGE(0x11300, 0x11301),
+    UTF8_RANGE(0x1133B, 0x1133C), UTF8_RANGE(0x11340, 0x11340), UTF8_RANGE(0x11366, 0x1136C), UTF8_RANGE(0x11370, 0x11374),
+    UTF8_RANGE(0x11438, 0x1143F), UTF8_RANGE(0x11442, 0x11444), UTF8_RANGE(0x11446, 0x11446), UTF8_RANGE(0x1145E, 0x1145E),
+    UTF8_RANGE(0x114B3, 0x114B8), UTF8_RANGE(0x114BA, 0x114BA), UTF8_RANGE(0x114BF, 0x114C0), UTF8_RANGE(0x114C2, 0x114C3),
+    UTF8_RANGE(0x115B2, 0x115B5), UTF8_RANGE(0x115BC, 0x115BD), UTF8_RANGE(0x115BF, 0x115C0), UTF8_RANGE(0x115DC, 0x115DD),
+    UTF8_RANGE(0x11633, 0x1163A), UTF8_RANGE(0x1163D, 0x1163D), UTF8_RANGE(0x1163F, 0x11640), UTF8_RANGE(0x116AB, 0x116AB),
+    UTF8_RANGE(0x116AD, 0x116AD), UTF8_RANGE(0x116B0, 0x116B5), UTF8_RANGE(0x116B7, 0x116B7), UTF8_RANGE(0x1171D, 0x1171F),
+    UTF8_RANGE(0x11722, 0x11725), UTF8_RANGE(0x11727, 0x1172B), UTF8_RANGE(0x1182F, 0x11837), UTF8_RANGE(0x11839, 0x1183A),
+    UTF8_RANGE(0x1193B, 0x1193C), UTF8_RANGE(0x1193E, 0x1193E), UTF8_RANGE(0x11943, 0x11943), UTF8_RANGE(0x119D4, 0x119D7),
+    UTF8_RANGE(0x119DA, 0x119DB), UTF8_RANGE(0x119E0, 0x119E0), UTF8_RANGE(0x11A01, 0x11A0A), UTF8_RANGE(0x11A33, 0x11A38),
+    UTF8_RANGE(0x11A3B, 0x11A3E), UTF8_RANGE(0x11A47, 0x11A47), UTF8_RANGE(0x11A51, 0x11A56), UTF8_RANGE(0x11A59, 0x11A5B),
+    UTF8_RANGE(0x11A8A, 0x11A96), UTF8_RANGE(0x11A98, 0x11A99), UTF8_RANGE(0x11C30, 0x11C36), UTF8_RANGE(0x11C38, 0x11C3D),
+    UTF8_RANGE(0x11C3F, 0x11C3F), UTF8_RANGE(0x11C92, 0x11CA7), UTF8_RANGE(0x11CAA, 0x11CB0), UTF8_RANGE(0x11CB2, 0x11CB3),
+    UTF8_RANGE(0x11CB5, 0x11CB6), UTF8_RANGE(0x11D31, 0x11D36), UTF8_RANGE(0x11D3A, 0x11D3A), UTF8_RANGE(0x11D3C, 0x11D3D),
+    UTF8_RANGE(0x11D3F, 0x11D45), UTF8_RANGE(0x11D47, 0x11D47), UTF8_RANGE(0x11D90, 0x11D91), UTF8_RANGE(0x11D95, 0x11D95),
+    UTF8_RANGE(0x11D97, 0x11D97), UTF8_RANGE(0x11EF3, 0x11EF4), UTF8_RANGE(0x13430, 0x13438), UTF8_RANGE(0x16AF0, 0x16AF4),
+    UTF8_RANGE(0x16B30, 0x16B36), UTF8_RANGE(0x16F4F, 0x16F4F), UTF8_RANGE(0x16F8F, 0x16F92), UTF8_RANGE(0x16FE4, 0x16FE4),
+    UTF8_RANGE(0x1BC9D, 0x1BC9E), UTF8_RANGE(0x1BCA0, 0x1BCA3), UTF8_RANGE(0x1CF00, 0x1CF2D), UTF8_RANGE(0x1CF30, 0x1CF46),
+    UTF8_RANGE(0x1D167, 0x1D169), UTF8_RANGE(0x1D173, 0x1D182), UTF8_RANGE(0x1D185, 0x1D18B), UTF8_RANGE(0x1D1AA, 0x1D1AD),
+    UTF8_RANGE(0x1D242, 0x1D244), UTF8_RANGE(0x1DA00, 0x1DA36), UTF8_RANGE(0x1DA3B, 0x1DA6C), UTF8_RANGE(0x1DA75, 0x1DA75),
+    UTF8_RANGE(0x1DA84, 0x1DA84), UTF8_RANGE(0x1DA9B, 0x1DA9F), UTF8_RANGE(0x1DAA1, 0x1DAAF), UTF8_RANGE(0x1E000, 0x1E006),
+    UTF8_RANGE(0x1E008, 0x1E018), UTF8_RANGE(0x1E01B, 0x1E021), UTF8_RANGE(0x1E023, 0x1E024), UTF8_RANGE(0x1E026, 0x1E02A),
+    UTF8_RANGE(0x1E130, 0x1E136), UTF8_RANGE(0x1E2AE, 0x1E2AE), UTF8_RANGE(0x1E2EC, 0x1E2EF), UTF8_RANGE(0x1E8D0, 0x1E8D6),
+    UTF8_RANGE(0x1E944, 0x1E94A), UTF8_RANGE(0xE0001, 0xE0001), UTF8_RANGE(0xE0020, 0xE007F), UTF8_RANGE(0xE0100, 0xE01EF),
+};
+
+static const Utf8WidthRange utf8WideRanges[] = {
+    UTF8_RANGE(0x01100, 0x0115F), UTF8_RANGE(0x0231A, 0x0231B), UTF8_RANGE(0x02329, 0x0232A), UTF8_RANGE(0x023E9, 0x023EC),
+    UTF8_RANGE(0x023F0, 0x023F0), UTF8_RANGE(0x023F3, 0x023F3), UTF8_RANGE(0x025FD, 0x025FE), UTF8_RANGE(0x02614, 0x02615),
+    UTF8_RANGE(0x02648, 0x02653), UTF8_RANGE(0x0267F, 0x0267F), UTF8_RANGE(0x02693, 0x02693), UTF8_RANGE(0x026A1, 0x026A1),
+    UTF8_RANGE(0x026AA, 0x026AB), UTF8_RANGE(0x026BD, 0x026BE), UTF8_RANGE(0x026C4, 0x026C5), UTF8_RANGE(0x026CE, 0x026CE),
+    UTF8_RANGE(0x026D4, 0x026D4), UTF8_RANGE(0x026EA, 0x026EA), UTF8_RANGE(0x026F2, 0x026F3), UTF8_RANGE(0x026F5, 0x026F5),
+    UTF8_RANGE(0x026FA, 0x026FA), UTF8_RANGE(0x026FD, 0x026FD), UTF8_RANGE(0x02705, 0x02705), UTF8_RANGE(0x0270A, 0x0270B),
+    UTF8_RANGE(0x02728, 0x02728), UTF8_RANGE(0x0274C, 0x0274C), UTF8_RANGE(0x0274E, 0x0274E), UTF8_RANGE(0x02753, 0x02755),
+    UTF8_RANGE(0x02757, 0x02757), UTF8_RANGE(0x02795, 0x02797), UTF8_RANGE(0x027B0, 0x027B0), UTF8_RANGE(0x027BF, 0x027BF),
+    UTF8_RANGE(0x02B1B, 0x02B1C), UTF8_RANGE(0x02B50, 0x02B50), UTF8_RANGE(0x02B55, 0x02B55), UTF8_RANGE(0x02E80, 0x02E99),
+    UTF8_RANGE(0x02E9B, 0x02EF3), UTF8_RANGE(0x02F00, 0x02FD5), UTF8_RANGE(0x02FF0, 0x02FFB), UTF8_RANGE(0x03000, 0x0303E),
+    UTF8_RANGE(0x03041, 0x03096), UTF8_RANGE(0x03099, 0x030FF), UTF8_RANGE(0x03105, 0x0312F), UTF8_RANGE(0x03131, 0x0318E),
+    UTF8_RANGE(0x03190, 0x031E3), UTF8_RANGE(0x031F0, 0x0321E), UTF8_RANGE(0x03220, 0x03247), UTF8_RANGE(0x03250, 0x03A4F),
+    UTF8_RANGE(0x03A50, 0x0424F), UTF8_RANGE(0x04250, 0x04A4F), UTF8_RANGE(0x04A50, 0x04DBF), UTF8_RANGE(0x04E00, 0x055FF),
+    UTF8_RANGE(0x05600, 0x05DFF), UTF8_RANGE(0x05E00, 0x065FF), UTF8_RANGE(0x06600, 0x06DFF), UTF8_RANGE(0x06E00, 0x075FF),
+    UTF8_RANGE(0x07600, 0x07DFF), UTF8_RANGE(0x07E00, 0x085FF), UTF8_RANGE(0x08600, 0x08DFF), UTF8_RANGE(0x08E00, 0x095FF),
+    UTF8_RANGE(0x09600, 0x09DFF), UTF8_RANGE(0x09E00, 0x0A48C), UTF8_RANGE(0x0A490, 0x0A4C6), UTF8_RANGE(0x0A960, 0x0A97C),
+    UTF8_RANGE(0x0AC00, 0x0B3FF), UTF8_RANGE(0x0B400, 0x0BBFF), UTF8_RANGE(0x0BC00, 0x0C3FF), UTF8_RANGE(0x0C400, 0x0CBFF),
+    UTF8_RANGE(0x0CC00, 0x0D3FF), UTF8_RANGE(0x0D400, 0x0D7A3), UTF8_RANGE(0x0F900, 0x0FAFF), UTF8_RANGE(0x0FE10, 0x0FE19),
+    UTF8_RANGE(0x0FE30, 0x0FE52), UTF8_RANGE(0x0FE54, 0x0FE66), UTF8_RANGE(0x0FE68, 0x0FE6B), UTF8_RANGE(0x0FF01, 0x0FF60),
+    UTF8_RANGE(0x0FFE0, 0x0FFE6), UTF8_RANGE(0x16FE0, 0x16FE4), UTF8_RANGE(0x16FF0, 0x16FF1), UTF8_RANGE(0x17000, 0x177FF),
+    UTF8_RANGE(0x17800, 0x17FFF), UTF8_RANGE(0x18000, 0x187F7), UTF8_RANGE(0x18800, 0x18CD5), UTF8_RANGE(0x18D00, 0x18D08),
+    UTF8_RANGE(0x1AFF0, 0x1AFF3), UTF8_RANGE(0x1AFF5, 0x1AFFB), UTF8_RANGE(0x1AFFD, 0x1AFFE), UTF8_RANGE(0x1B000, 0x1B122),
+    UTF8_RANGE(0x1B150, 0x1B152), UTF8_RANGE(0x1B164, 0x1B167), UTF8_RANGE(0x1B170, 0x1B2FB), UTF8_RANGE(0x1F004, 0x1F004),
+    UTF8_RANGE(0x1F0CF, 0x1F0CF), UTF8_RANGE(0x1F18E, 0x1F18E), UTF8_RANGE(0x1F191, 0x1F19A), UTF8_RANGE(0x1F200, 0x1F202),
+    UTF8_RANGE(0x1F210, 0x1F23B), UTF8_RANGE(0x1F240, 0x1F248), UTF8_RANGE(0x1F250, 0x1F251), UTF8_RANGE(0x1F260, 0x1F265),
+    UTF8_RANGE(0x1F300, 0x1F320), UTF8_RANGE(0x1F32D, 0x1F335), UTF8_RANGE(0x1F337, 0x1F37C), UTF8_RANGE(0x1F37E, 0x1F393),
+    UTF8_RANGE(0x1F3A0, 0x1F3CA), UTF8_RANGE(0x1F3CF, 0x1F3D3), UTF8_RANGE(0x1F3E0, 0x1F3F0), UTF8_RANGE(0x1F3F4, 0x1F3F4),
+    UTF8_RANGE(0x1F3F8, 0x1F43E), UTF8_RANGE(0x1F440, 0x1F440), UTF8_RANGE(0x1F442, 0x1F4FC), UTF8_RANGE(0x1F4FF, 0x1F53D),
+    UTF8_RANGE(0x1F54B, 0x1F54E), UTF8_RANGE(0x1F550, 0x1F567), UTF8_RANGE(0x1F57A, 0x1F57A), UTF8_RANGE(0x1F595, 0x1F596),
+    UTF8_RANGE(0x1F5A4, 0x1F5A4), UTF8_RANGE(0x1F5FB, 0x1F64F), UTF8_RANGE(0x1F680, 0x1F6C5), UTF8_RANGE(0x1F6CC, 0x1F6CC),
+    UTF8_RANGE(0x1F6D0, 0x1F6D2), UTF8_RANGE(0x1F6D5, 0x1F6D7), UTF8_RANGE(0x1F6DD, 0x1F6DF), UTF8_RANGE(0x1F6EB, 0x1F6EC),
+    UTF8_RANGE(0x1F6F4, 0x1F6FC), UTF8_RANGE(0x1F7E0, 0x1F7EB), UTF8_RANGE(0x1F7F0, 0x1F7F0), UTF8_RANGE(0x1F90C, 0x1F93A),
+    UTF8_RANGE(0x1F93C, 0x1F945), UTF8_RANGE(0x1F947, 0x1F9FF), UTF8_RANGE(0x1FA70, 0x1FA74), UTF8_RANGE(0x1FA78, 0x1FA7C),
+    UTF8_RANGE(0x1FA80, 0x1FA86), UTF8_RANGE(0x1FA90, 0x1FAAC), UTF8_RANGE(0x1FAB0, 0x1FABA), UTF8_RANGE(0x1FAC0, 0x1FAC5),
+    UTF8_RANGE(0x1FAD0, 0x1FAD9), UTF8_RANGE(0x1FAE0, 0x1FAE7), UTF8_RANGE(0x1FAF0, 0x1FAF6), UTF8_RANGE(0x20000, 0x207FF),
+    UTF8_RANGE(0x20800, 0x20FFF), UTF8_RANGE(0x21000, 0x217FF), UTF8_RANGE(0x21800, 0x21FFF), UTF8_RANGE(0x22000, 0x227FF),
+    UTF8_RANGE(0x22800, 0x22FFF), UTF8_RANGE(0x23000, 0x237FF), UTF8_RANGE(0x23800, 0x23FFF), UTF8_RANGE(0x24000, 0x247FF),
+    UTF8_RANGE(0x24800, 0x24FFF), UTF8_RANGE(0x25000, 0x257FF), UTF8_RANGE(0x25800, 0x25FFF), UTF8_RANGE(0x26000, 0x267FF),
+    UTF8_RANGE(0x26800, 0x26FFF), UTF8_RANGE(0x27000, 0x277FF), UTF8_RANGE(0x27800, 0x27FFF), UTF8_RANGE(0x28000, 0x287FF),
+    UTF8_RANGE(0x28800, 0x28FFF), UTF8_RANGE(0x29000, 0x297FF), UTF8_RANGE(0x29800, 0x29FFF), UTF8_RANGE(0x2A000, 0x2A7FF),
+    UTF8_RANGE(0x2A800, 0x2AFFF), UTF8_RANGE(0x2B000, 0x2B7FF), UTF8_RANGE(0x2B800, 0x2BFFF), UTF8_RANGE(0x2C000, 0x2C7FF),
+    UTF8_RANGE(0x2C800, 0x2CFFF), UTF8_RANGE(0x2D000, 0x2D7FF), UTF8_RANGE(0x2D800, 0x2DFFF), UTF8_RANGE(0x2E000, 0x2E7FF),
+    UTF8_RANGE(0x2E800, 0x2EFFF), UTF8_RANGE(0x2F000, 0x2F7FF), UTF8_RANGE(0x2F800, 0x2FFFD), UTF8_RANGE(0x30000, 0x307FF),
+    UTF8_RANGE(0x30800, 0x30FFF), UTF8_RANGE(0x31000, 0x317FF), UTF8_RANGE(0x31800, 0x31FFF), UTF8_RANGE(0x32000, 0x327FF),
+    UTF8_RANGE(0x32800, 0x32FFF), UTF8_RANGE(0x33000, 0x337FF), UTF8_RANGE(0x33800, 0x33FFF), UTF8_RANGE(0x34000, 0x347FF),
+    UTF8_RANGE(0x34800, 0x34FFF), UTF8_RANGE(0x35000, 0x357FF), UTF8_RANGE(0x35800, 0x35FFF), UTF8_RANGE(0x36000, 0x367FF),
+    UTF8_RANGE(0x36800, 0x36FFF), UTF8_RANGE(0x37000, 0x377FF), UTF8_RANGE(0x37800, 0x37FFF), UTF8_RANGE(0x38000, 0x387FF),
+    UTF8_RANGE(0x38800, 0x38FFF), UTF8_RANGE(0x39000, 0x397FF), UTF8_RANGE(0x39800, 0x39FFF), UTF8_RANGE(0x3A000, 0x3A7FF),
+    UTF8_RANGE(0x3A800, 0x3AFFF), UTF8_RANGE(0x3B000, 0x3B7FF), UTF8_RANGE(0x3B800, 0x3BFFF), UTF8_RANGE(0x3C000, 0x3C7FF),
+    UTF8_RANGE(0x3C800, 0x3CFFF), UTF8_RANGE(0x3D000, 0x3D7FF), UTF8_RANGE(0x3D800, 0x3DFFF), UTF8_RANGE(0x3E000, 0x3E7FF),
+    UTF8_RANGE(0x3E800, 0x3EFFF), UTF8_RANGE(0x3F000, 0x3F7FF), UTF8_RANGE(0x3F800, 0x3FFFD),
+};
+
+#endif // UTF8_WIDTH_TABLE_H
@@ -0,0 +1,35 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stddef.h>
+
+/*
+ * UTF-8 text for the chat line: decoding with validation (no overlong forms, surrogates or code points past
+ * U+10FFFF), how many terminal columns text takes, and where text can be cut without splitting a character.
+ * Column widths come from tables generated from the Unicode data (utf8-width-table.h). Chat text is nearly
+ * always printable ASCII, which one vector scan confirms (see scan.h), and then every byte is one column.
+ */
+
+// Defines needed by the types below
+#define UTF8_RANGE_LENGTH_BITS 11 // Low bits of a packed range: how far its last code point is past its first
+
+// A run of code points with the same width: first << UTF8_RANGE_LENGTH_BITS | (last - first)
+typedef unsigned int Utf8WidthRange;
+
+// Function prototypes
+size_t utf8DecodeNext(const char *data, size_t length, unsigned int *codepoint);
+size_t utf8Encode(unsigned int codepoint, char *buffer);
+int utf8IsValid(const char *data, size_t length);
+int utf8IsAscii(const char *data, size_t length);
+int utf8CodepointWidth(unsigned int codepoint);
+int utf8DisplayWidth(const char *text, size_t length);
+size_t utf8PrefixForWidth(const char *text, size_t length, int maxColumns, size_t maxBytes, int *columns);
+size_t utf8TrimLength(const char *text, size_t length);
+size_t utf8LastCharacterStart(const char *text, size_t length);
+
+// Defines
+#define UTF8_MAX_BYTES 4 // Longest encoding of one code point
+#define UTF8_ASCII_HIGH_BITS 0x8080808080808080ull // The bit every byte of a multi-byte character has, in each byte of a word
+#define UTF8_RANGE(first, last) ((Utf8WidthRange)((first) << UTF8_RANGE_LENGTH_BITS | ((last) - (first))))
+
+#endif // UTF8_H
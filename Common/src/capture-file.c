@@ -0,0 +1,129 @@
+#include "../inc/capture-file.h"
+#include <string.h>
+
+/*
+ * FUNCTION : writeVarint
+ *
+ * DESCRIPTION : This function writes a number as a varint
+ *
+ * PARAMETERS : unsigned char *output : Where to write (room for CAPTURE_VARINT_MAX bytes).
+ *              unsigned long long value : The number.
+ *
+ * RETURNS : size_t : Bytes written.
+ */
+static size_t writeVarint(unsigned char *output, unsigned long long value)
+{
+    size_t length = 0;
+    while (value >= 0x80)
+    {
+        output[length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    output[length++] = (unsigned char)value;
+    return length;
+}
+
+/*
+ * FUNCTION : readVarint
+ *
+ * DESCRIPTION : This function reads a varint
+ *
+ * PARAMETERS : const unsigned char *input : The bytes.
+ *              size_t inputLength : How many there are.
+ *              unsigned long long *value : Set to the number.
+ *
+ * RETURNS : long : Bytes read, 0 if the varint runs past inputLength, -1 if it is longer than any 64 bit number.
+ */
+static long readVarint(const unsigned char *input, size_t inputLength, unsigned long long *value)
+{
+    *value = 0;
+    for (size_t i = 0; i < inputLength; i++)
+    {
+        if (i == CAPTURE_VARINT_MAX)
+        {
+            return -1;
+        }
+        *value |= (unsigned long long)(input[i] & 0x7f) << (7 * i);
+        if ((input[i] & 0x80) == 0)
+        {
+            return (long)i + 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : captureEncodeRecord
+ *
+ * DESCRIPTION : This function writes one record in the capture file format
+ *
+ * PARAMETERS : unsigned char *output : Where to write (room for CAPTURE_RECORD_OVERHEAD plus the payload).
+ *              const CaptureRecord *record : The record.
+ *
+ * RETURNS : size_t : Bytes written.
+ */
+size_t captureEncodeRecord(unsigned char *output, const CaptureRecord *record)
+{
+    size_t length = 0;
+    output[length++] = (unsigned char)record->kind;
+    length += writeVarint(output + length, record->deltaMicroseconds);
+    length += writeVarint(output + length, record->connectionId);
+    length += writeVarint(output + length, record->length);
+    if (record->kind != CAPTURE_RECORD_UPLOAD)
+    {
+        memcpy(output + length, record->payload, record->length);
+        length += record->length;
+    }
+    return length;
+}
+
+/*
+ * FUNCTION : captureDecodeRecord
+ *
+ * DESCRIPTION : This function reads one record from a capture file
+ *
+ * PARAMETERS : const unsigned char *input : The file from the record on.
+ *              size_t inputLength : Bytes left in the file.
+ *              CaptureRecord *record : Filled in, its payload points into input.
+ *
+ * RETURNS : long : Bytes the record took, 0 if the file ends part way through it, -1 if it is corrupt.
+ */
+long captureDecodeRecord(const unsigned char *input, size_t inputLength, CaptureRecord *record)
+{
+    if (inputLength == 0)
+    {
+        return 0;
+    }
+    record->kind = input[0];
+    if (record->kind < CAPTURE_RECORD_OPEN || record->kind > CAPTURE_RECORD_CLOSE)
+    {
+        return -1;
+    }
+
+    size_t position = 1;
+    unsigned long long fields[3];
+    for (int i = 0; i < 3; i++)
+    {
+        long fieldLength = readVarint(input + position, inputLength - position, &fields[i]);
+        if (fieldLength <= 0)
+        {
+            return fieldLength;
+        }
+        position += fieldLength;
+    }
+    record->deltaMicroseconds = fields[0];
+    record->connectionId = (unsigned long)fields[1];
+    record->length = (size_t)fields[2];
+    record->payload = NULL;
+
+    if (record->kind != CAPTURE_RECORD_UPLOAD)
+    {
+        if (record->length > inputLength - position)
+        {
+            return 0;
+        }
+        record->payload = (const char *)input + position;
+        position += record->length;
+    }
+    return (long)position;
+}
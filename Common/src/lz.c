@@ -0,0 +1,359 @@
+#include "../inc/lz.h"
+#include "../inc/common.h"
+#include <stdint.h>
+
+// What the window starts as: the text the server repeats most, so small first batches compress too.
+// Later bytes are cheaper to reach, so the most common text goes last.
+static const char presetDictionary[] =
+    PROTOCOL_BLOB_FAIL PROTOCOL_DATA PROTOCOL_SEARCH_HIT PROTOCOL_SEARCH_END PROTOCOL_PING PROTOCOL_BUSY
+    "STATS me ok= thr= drop= delay= | all thr= drop= delay= kick=\n"
+    "STATS load lvl= queue= out= lat=us rss=MB rejected= shed= slow=\n"
+    "[blob ] bytes 127.0.0.1 192.168.1. 10.0.0. "
+    "                                         \n" PROTOCOL_MESSAGE "1|1|127.0.0.1 [     ] >> ";
+
+/*
+ * FUNCTION : slideWindow
+ *
+ * DESCRIPTION : This function adds bytes to the end of a window, dropping its oldest bytes to make room
+ *
+ * PARAMETERS : LzWindow *window : The window.
+ *              const unsigned char *data : The bytes.
+ *              size_t length : How many.
+ *
+ * RETURNS : void
+ */
+static void slideWindow(LzWindow *window, const unsigned char *data, size_t length)
+{
+    if (length >= LZ_WINDOW_BYTES)
+    {
+        memcpy(window->window, data + length - LZ_WINDOW_BYTES, LZ_WINDOW_BYTES);
+        window->windowLength = LZ_WINDOW_BYTES;
+        return;
+    }
+    size_t keptLength = window->windowLength;
+    if (keptLength + length > LZ_WINDOW_BYTES)
+    {
+        keptLength = LZ_WINDOW_BYTES - length;
+        memmove(window->window, window->window + window->windowLength - keptLength, keptLength);
+    }
+    memcpy(window->window + keptLength, data, length);
+    window->windowLength = keptLength + length;
+}
+
+/*
+ * FUNCTION : hashFour
+ *
+ * DESCRIPTION : This function hashes the four bytes at a position for the match finder
+ *
+ * PARAMETERS : const unsigned char *data : The bytes.
+ *
+ * RETURNS : unsigned int : Index into the match finder table.
+ */
+static unsigned int hashFour(const unsigned char *data)
+{
+    uint32_t fourBytes;
+    memcpy(&fourBytes, data, sizeof(fourBytes));
+    return (fourBytes * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/*
+ * FUNCTION : writeLength
+ *
+ * DESCRIPTION : This function writes the part of a length that didn't fit in its token nibble (255s, then the rest)
+ *
+ * PARAMETERS : unsigned char **output : Where to write, moved past what was written.
+ *              const unsigned char *outputEnd : End of the output buffer.
+ *              size_t length : What is left of the length after the nibble's 15.
+ *
+ * RETURNS : int : 0 on success, -1 if it didn't fit.
+ */
+static int writeLength(unsigned char **output, const unsigned char *outputEnd, size_t length)
+{
+    while (length >= 255)
+    {
+        if (*output >= outputEnd)
+        {
+            return -1;
+        }
+        *(*output)++ = 255;
+        length -= 255;
+    }
+    if (*output >= outputEnd)
+    {
+        return -1;
+    }
+    *(*output)++ = (unsigned char)length;
+    return 0;
+}
+
+/*
+ * FUNCTION : readLength
+ *
+ * DESCRIPTION : This function reads the part of a length that didn't fit in its token nibble. A block that ends
+ * before the length does is corrupt, not a shorter length.
+ *
+ * PARAMETERS : const unsigned char **input : Where to read, moved past what was read.
+ *              const unsigned char *inputEnd : End of the block.
+ *              int *isCorrupt : Set when the block ends first.
+ *
+ * RETURNS : size_t : What the bytes add to the nibble's 15.
+ */
+static size_t readLength(const unsigned char **input, const unsigned char *inputEnd, int *isCorrupt)
+{
+    size_t length = 0;
+    unsigned char lengthByte;
+    do
+    {
+        if (*input >= inputEnd)
+        {
+            *isCorrupt = 1;
+            return 0;
+        }
+        lengthByte = *(*input)++;
+        length += lengthByte;
+    } while (lengthByte == 255);
+    return length;
+}
+
+/*
+ * FUNCTION : writeSequence
+ *
+ * DESCRIPTION : This function writes one token: a run of literals and then a back reference (none for the last one)
+ *
+ * PARAMETERS : unsigned char **output : Where to write, moved past what was written.
+ *              const unsigned char *outputEnd : End of the output buffer.
+ *              const unsigned char *literals : The literal bytes.
+ *              size_t literalLength : How many.
+ *              size_t offset : Distance back to copy from (0 for the last token, which has no back reference).
+ *              size_t matchLength : Bytes to copy (at least LZ_MIN_MATCH).
+ *
+ * RETURNS : int : 0 on success, -1 if it didn't fit.
+ */
+static int writeSequence(unsigned char **output, const unsigned char *outputEnd, const unsigned char *literals, size_t literalLength,
+                         size_t offset, size_t matchLength)
+{
+    if (*output >= outputEnd)
+    {
+        return -1;
+    }
+    size_t matchCode = offset != 0 ? matchLength - LZ_MIN_MATCH : 0;
+    unsigned char *token = (*output)++;
+    *token = (unsigned char)(((literalLength < 15 ? literalLength : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+
+    if (literalLength >= 15 && writeLength(output, outputEnd, literalLength - 15) < 0)
+    {
+        return -1;
+    }
+    if ((size_t)(outputEnd - *output) < literalLength)
+    {
+        return -1;
+    }
+    memcpy(*output, literals, literalLength);
+    *output += literalLength;
+
+    if (offset == 0)
+    {
+        return 0;
+    }
+    if (outputEnd - *output < 2)
+    {
+        return -1;
+    }
+    *(*output)++ = (unsigned char)(offset & 0xff);
+    *(*output)++ = (unsigned char)(offset >> 8);
+    if (matchCode >= 15 && writeLength(output, outputEnd, matchCode - 15) < 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : lzWindowInitialize
+ *
+ * DESCRIPTION : This function starts a window off with the preset dictionary (both ends must do the same)
+ *
+ * PARAMETERS : LzWindow *window : The window.
+ *
+ * RETURNS : void
+ */
+void lzWindowInitialize(LzWindow *window)
+{
+    window->windowLength = 0;
+    slideWindow(window, (const unsigned char *)presetDictionary, sizeof(presetDictionary) - 1);
+}
+
+/*
+ * FUNCTION : lzCompress
+ *
+ * DESCRIPTION : This function compresses a block. Back references can reach into the window as well as the block
+ * itself. Matches are found with a single probe of a hash table of the last position each four bytes were seen at,
+ * which is fast and finds the repeated headers and padding that make up most of the chat traffic.
+ * The window only moves on when the block compressed, so a block sent as it was leaves both ends in step.
+ *
+ * PARAMETERS : LzWindow *window : The sending end's window.
+ *              const char *input : The block.
+ *              size_t inputLength : Its length.
+ *              char *output : Where to put the compressed block.
+ *              size_t outputSize : Room in output. Anything short of inputLength is worth having.
+ *
+ * RETURNS : size_t : Length of the compressed block, or 0 if it didn't fit (or memory ran out).
+ */
+size_t lzCompress(LzWindow *window, const char *input, size_t inputLength, char *output, size_t outputSize)
+{
+    // The window and the block side by side, so a back reference is just a distance into one buffer
+    size_t totalLength = window->windowLength + inputLength;
+    unsigned char *history = malloc(totalLength);
+    int *lastSeen = malloc(sizeof(int) << LZ_HASH_BITS);
+    if (history == NULL || lastSeen == NULL)
+    {
+        free(history);
+        free(lastSeen);
+        return 0;
+    }
+    memcpy(history, window->window, window->windowLength);
+    memcpy(history + window->windowLength, input, inputLength);
+    memset(lastSeen, 0xff, sizeof(int) << LZ_HASH_BITS);
+
+    size_t position = 0;
+    for (; position + LZ_MIN_MATCH <= window->windowLength; position++)
+    {
+        lastSeen[hashFour(history + position)] = (int)position;
+    }
+
+    unsigned char *outputPosition = (unsigned char *)output;
+    const unsigned char *outputEnd = (unsigned char *)output + outputSize;
+    size_t literalStart = window->windowLength;
+    int isFull = 0;
+    position = window->windowLength;
+    while (!isFull && position + LZ_MIN_MATCH <= totalLength)
+    {
+        unsigned int hash = hashFour(history + position);
+        int candidate = lastSeen[hash];
+        lastSeen[hash] = (int)position;
+        if (candidate < 0 || position - candidate > LZ_MAX_OFFSET || memcmp(history + candidate, history + position, LZ_MIN_MATCH) != 0)
+        {
+            position++;
+            continue;
+        }
+
+        size_t matchLength = LZ_MIN_MATCH;
+        while (position + matchLength < totalLength && history[candidate + matchLength] == history[position + matchLength])
+        {
+            matchLength++;
+        }
+        isFull = writeSequence(&outputPosition, outputEnd, history + literalStart, position - literalStart,
+                               position - candidate, matchLength) < 0;
+
+        // Remember the positions inside the match too, the next line's header is usually a copy of this one's
+        for (size_t skipped = position + 1; skipped < position + matchLength && skipped + LZ_MIN_MATCH <= totalLength; skipped++)
+        {
+            lastSeen[hashFour(history + skipped)] = (int)skipped;
+        }
+        position += matchLength;
+        literalStart = position;
+    }
+    if (!isFull)
+    {
+        isFull = writeSequence(&outputPosition, outputEnd, history + literalStart, totalLength - literalStart, 0, 0) < 0;
+    }
+
+    size_t compressedLength = isFull ? 0 : (size_t)(outputPosition - (unsigned char *)output);
+    if (compressedLength != 0)
+    {
+        slideWindow(window, (const unsigned char *)input, inputLength);
+    }
+    free(history);
+    free(lastSeen);
+    return compressedLength;
+}
+
+/*
+ * FUNCTION : lzDecompress
+ *
+ * DESCRIPTION : This function decompresses a block made by lzCompress and moves the window on the same way.
+ * Every length and offset is checked, so a corrupt block is refused rather than read or written out of bounds.
+ *
+ * PARAMETERS : LzWindow *window : The receiving end's window.
+ *              const char *input : The compressed block.
+ *              size_t inputLength : Its length.
+ *              char *output : Where to put the block.
+ *              size_t outputSize : Room in output (the block's original length is enough).
+ *
+ * RETURNS : long : Length of the block, or -1 if it is corrupt, too big for output, or memory ran out.
+ */
+long lzDecompress(LzWindow *window, const char *input, size_t inputLength, char *output, size_t outputSize)
+{
+    unsigned char *history = malloc(window->windowLength + outputSize);
+    if (history == NULL)
+    {
+        return -1;
+    }
+    memcpy(history, window->window, window->windowLength);
+
+    const unsigned char *inputPosition = (const unsigned char *)input;
+    const unsigned char *inputEnd = inputPosition + inputLength;
+    size_t position = window->windowLength;
+    size_t historyEnd = window->windowLength + outputSize;
+    int isCorrupt = 0;
+    while (!isCorrupt && inputPosition < inputEnd)
+    {
+        unsigned char token = *inputPosition++;
+
+        size_t literalLength = token >> 4;
+        if (literalLength == 15)
+        {
+            literalLength += readLength(&inputPosition, inputEnd, &isCorrupt);
+        }
+        if (isCorrupt || literalLength > (size_t)(inputEnd - inputPosition) || literalLength > historyEnd - position)
+        {
+            isCorrupt = 1;
+            break;
+        }
+        memcpy(history + position, inputPosition, literalLength);
+        inputPosition += literalLength;
+        position += literalLength;
+
+        // The last token has only literals
+        if (inputPosition == inputEnd)
+        {
+            break;
+        }
+
+        if (inputEnd - inputPosition < 2)
+        {
+            isCorrupt = 1;
+            break;
+        }
+        size_t offset = inputPosition[0] | (inputPosition[1] << 8);
+        inputPosition += 2;
+        size_t matchLength = (token & 0x0f);
+        if (matchLength == 15)
+        {
+            matchLength += readLength(&inputPosition, inputEnd, &isCorrupt);
+        }
+        matchLength += LZ_MIN_MATCH;
+        if (isCorrupt || offset == 0 || offset > position || matchLength > historyEnd - position)
+        {
+            isCorrupt = 1;
+            break;
+        }
+
+        // Byte by byte, a match may overlap the bytes it is producing (runs of padding)
+        for (size_t i = 0; i < matchLength; i++)
+        {
+            history[position + i] = history[position - offset + i];
+        }
+        position += matchLength;
+    }
+
+    long outputLength = -1;
+    if (!isCorrupt)
+    {
+        outputLength = (long)(position - window->windowLength);
+        memcpy(output, history + window->windowLength, outputLength);
+        slideWindow(window, (const unsigned char *)output, outputLength);
+    }
+    free(history);
+    return outputLength;
+}
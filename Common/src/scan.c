@@ -0,0 +1,446 @@
+#include "../inc/scan.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_HAVE_X86 1
+#endif
+
+/*
+ * FUNCTION : findByteScalar
+ *
+ * DESCRIPTION : Scalar version of scanFindByte, also used for what is left after the vector loops
+ *
+ * PARAMETERS : const char *data : Bytes to search.
+ *              size_t length : Number of bytes.
+ *              char byte : Byte to find.
+ *
+ * RETURNS : const char * : The first match, or NULL.
+ */
+static const char *findByteScalar(const char *data, size_t length, char byte)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        if (data[i] == byte)
+        {
+            return data + i;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * FUNCTION : findPairScalar
+ *
+ * DESCRIPTION : Scalar version of scanFindPair, also used for what is left after the vector loops
+ *
+ * PARAMETERS : const char *data : Bytes to search.
+ *              size_t length : Number of bytes.
+ *              char first : First byte of the pair.
+ *              char second : Second byte of the pair.
+ *
+ * RETURNS : const char * : Start of the first match, or NULL.
+ */
+static const char *findPairScalar(const char *data, size_t length, char first, char second)
+{
+    for (size_t i = 0; i + 1 < length; i++)
+    {
+        if (data[i] == first && data[i + 1] == second)
+        {
+            return data + i;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * FUNCTION : isPrintableScalar
+ *
+ * DESCRIPTION : Scalar version of scanIsPrintableAscii, also used for what is left after the vector loops
+ *
+ * PARAMETERS : const char *data : Bytes to check.
+ *              size_t length : Number of bytes.
+ *
+ * RETURNS : int : 1 if every byte is printable ASCII, 0 if not.
+ */
+static int isPrintableScalar(const char *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        unsigned char character = (unsigned char)data[i];
+        if (character < SCAN_PRINTABLE_FIRST || character > SCAN_PRINTABLE_LAST)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+#ifdef SCAN_HAVE_X86
+/*
+ * FUNCTION : findByteSse2
+ *
+ * DESCRIPTION : scanFindByte 16 bytes at a time
+ *
+ * PARAMETERS : const char *data : Bytes to search.
+ *              size_t length : Number of bytes.
+ *              char byte : Byte to find.
+ *
+ * RETURNS : const char * : The first match, or NULL.
+ */
+__attribute__((target("sse2"))) static const char *findByteSse2(const char *data, size_t length, char byte)
+{
+    __m128i wanted = _mm_set1_epi8(byte);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+        int matches = _mm_movemask_epi8(_mm_cmpeq_epi8(block, wanted));
+        if (matches != 0)
+        {
+            return data + i + __builtin_ctz(matches);
+        }
+    }
+    return findByteScalar(data + i, length - i, byte);
+}
+
+/*
+ * FUNCTION : findPairSse2
+ *
+ * DESCRIPTION : scanFindPair 16 starting positions at a time (the second load is the same bytes moved along one)
+ *
+ * PARAMETERS : const char *data : Bytes to search.
+ *              size_t length : Number of bytes.
+ *              char first : First byte of the pair.
+ *              char second : Second byte of the pair.
+ *
+ * RETURNS : const char * : Start of the first match, or NULL.
+ */
+__attribute__((target("sse2"))) static const char *findPairSse2(const char *data, size_t length, char first, char second)
+{
+    __m128i wantedFirst = _mm_set1_epi8(first);
+    __m128i wantedSecond = _mm_set1_epi8(second);
+    size_t i = 0;
+    for (; i + 17 <= length; i += 16)
+    {
+        __m128i firstMatches = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i)), wantedFirst);
+        __m128i secondMatches = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i + 1)), wantedSecond);
+        int matches = _mm_movemask_epi8(_mm_and_si128(firstMatches, secondMatches));
+        if (matches != 0)
+        {
+            return data + i + __builtin_ctz(matches);
+        }
+    }
+    return findPairScalar(data + i, length - i, first, second);
+}
+
+/*
+ * FUNCTION : isPrintableSse2
+ *
+ * DESCRIPTION : scanIsPrintableAscii 16 bytes at a time. Compared as signed bytes, so anything from 0x80 up counts
+ * as below a space.
+ *
+ * PARAMETERS : const char *data : Bytes to check.
+ *              size_t length : Number of bytes.
+ *
+ * RETURNS : int : 1 if every byte is printable ASCII, 0 if not.
+ */
+__attribute__((target("sse2"))) static int isPrintableSse2(const char *data, size_t length)
+{
+    __m128i lowest = _mm_set1_epi8(SCAN_PRINTABLE_FIRST);
+    __m128i highest = _mm_set1_epi8(SCAN_PRINTABLE_LAST);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i outside = _mm_or_si128(_mm_cmplt_epi8(block, lowest), _mm_cmpgt_epi8(block, highest));
+        if (_mm_movemask_epi8(outside) != 0)
+        {
+            return 0;
+        }
+    }
+    return isPrintableScalar(data + i, length - i);
+}
+
+/*
+ * FUNCTION : findByteAvx2
+ *
+ * DESCRIPTION : scanFindByte 32 bytes at a time
+ *
+ * PARAMETERS : const char *data : Bytes to search.
+ *              size_t length : Number of bytes.
+ *              char byte : Byte to find.
+ *
+ * RETURNS : const char * : The first match, or NULL.
+ */
+__attribute__((target("avx2"))) static const char *findByteAvx2(const char *data, size_t length, char byte)
+{
+    __m256i wanted = _mm256_set1_epi8(byte);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+        unsigned int matches = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, wanted));
+        if (matches != 0)
+        {
+            _mm256_zeroupper();
+            return data + i + __builtin_ctz(matches);
+        }
+    }
+    // Clean upper halves before any SSE code runs, or every SSE instruction after this pays for the AVX to SSE
+    // transition (the compiler only adds this itself when optimizing, and never before a tail call)
+    _mm256_zeroupper();
+    return findByteSse2(data + i, length - i, byte);
+}
+
+/*
+ * FUNCTION : findPairAvx2
+ *
+ * DESCRIPTION : scanFindPair 32 starting positions at a time
+ *
+ * PARAMETERS : const char *data : Bytes to search.
+ *              size_t length : Number of bytes.
+ *              char first : First byte of the pair.
+ *              char second : Second byte of the pair.
+ *
+ * RETURNS : const char * : Start of the first match, or NULL.
+ */
+__attribute__((target("avx2"))) static const char *findPairAvx2(const char *data, size_t length, char first, char second)
+{
+    __m256i wantedFirst = _mm256_set1_epi8(first);
+    __m256i wantedSecond = _mm256_set1_epi8(second);
+    size_t i = 0;
+    for (; i + 33 <= length; i += 32)
+    {
+        __m256i firstMatches = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i)), wantedFirst);
+        __m256i secondMatches = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i + 1)), wantedSecond);
+        unsigned int matches = (unsigned int)_mm256_movemask_epi8(_mm256_and_si256(firstMatches, secondMatches));
+        if (matches != 0)
+        {
+            _mm256_zeroupper();
+            return data + i + __builtin_ctz(matches);
+        }
+    }
+    _mm256_zeroupper();
+    return findPairSse2(data + i, length - i, first, second);
+}
+
+/*
+ * FUNCTION : isPrintableAvx2
+ *
+ * DESCRIPTION : scanIsPrintableAscii 32 bytes at a time
+ *
+ * PARAMETERS : const char *data : Bytes to check.
+ *              size_t length : Number of bytes.
+ *
+ * RETURNS : int : 1 if every byte is printable ASCII, 0 if not.
+ */
+__attribute__((target("avx2"))) static int isPrintableAvx2(const char *data, size_t length)
+{
+    __m256i belowLowest = _mm256_set1_epi8(SCAN_PRINTABLE_FIRST - 1);
+    __m256i highest = _mm256_set1_epi8(SCAN_PRINTABLE_LAST);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi8(belowLowest, block), _mm256_cmpgt_epi8(block, highest));
+        if (_mm256_movemask_epi8(outside) != 0)
+        {
+            _mm256_zeroupper();
+            return 0;
+        }
+    }
+    _mm256_zeroupper();
+    return isPrintableSse2(data + i, length - i);
+}
+#endif // SCAN_HAVE_X86
+
+static const char *findByteResolve(const char *data, size_t length, char byte);
+static const char *findPairResolve(const char *data, size_t length, char first, char second);
+static int isPrintableResolve(const char *data, size_t length);
+
+// The kernels in use. They start out pointing at the resolvers, which pick the real ones on the first call.
+static const char *(*findByteKernel)(const char *, size_t, char) = findByteResolve;
+static const char *(*findPairKernel)(const char *, size_t, char, char) = findPairResolve;
+static int (*isPrintableKernel)(const char *, size_t) = isPrintableResolve;
+static const char *kernelName = NULL;
+
+/*
+ * FUNCTION : selectKernels
+ *
+ * DESCRIPTION : This function picks the best kernels for the CPU. Any thread may run it, they all pick the same.
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : void
+ */
+static void selectKernels(void)
+{
+    const char *selectedName = "scalar";
+    const char *(*selectedFindByte)(const char *, size_t, char) = findByteScalar;
+    const char *(*selectedFindPair)(const char *, size_t, char, char) = findPairScalar;
+    int (*selectedIsPrintable)(const char *, size_t) = isPrintableScalar;
+
+#ifdef SCAN_HAVE_X86
+    // May run before the constructors that normally set up the CPU model
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        selectedName = "avx2";
+        selectedFindByte = findByteAvx2;
+        selectedFindPair = findPairAvx2;
+        selectedIsPrintable = isPrintableAvx2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        selectedName = "sse2";
+        selectedFindByte = findByteSse2;
+        selectedFindPair = findPairSse2;
+        selectedIsPrintable = isPrintableSse2;
+    }
+#endif
+
+    __atomic_store_n(&findByteKernel, selectedFindByte, __ATOMIC_RELAXED);
+    __atomic_store_n(&findPairKernel, selectedFindPair, __ATOMIC_RELAXED);
+    __atomic_store_n(&isPrintableKernel, selectedIsPrintable, __ATOMIC_RELAXED);
+    __atomic_store_n(&kernelName, selectedName, __ATOMIC_RELAXED);
+}
+
+/*
+ * FUNCTION : findByteResolve
+ *
+ * DESCRIPTION : First call of scanFindByte: picks the kernels then runs the chosen one
+ *
+ * PARAMETERS : As scanFindByte.
+ *
+ * RETURNS : As scanFindByte.
+ */
+static const char *findByteResolve(const char *data, size_t length, char byte)
+{
+    selectKernels();
+    return findByteKernel(data, length, byte);
+}
+
+/*
+ * FUNCTION : findPairResolve
+ *
+ * DESCRIPTION : First call of scanFindPair: picks the kernels then runs the chosen one
+ *
+ * PARAMETERS : As scanFindPair.
+ *
+ * RETURNS : As scanFindPair.
+ */
+static const char *findPairResolve(const char *data, size_t length, char first, char second)
+{
+    selectKernels();
+    return findPairKernel(data, length, first, second);
+}
+
+/*
+ * FUNCTION : isPrintableResolve
+ *
+ * DESCRIPTION : First call of scanIsPrintableAscii: picks the kernels then runs the chosen one
+ *
+ * PARAMETERS : As scanIsPrintableAscii.
+ *
+ * RETURNS : As scanIsPrintableAscii.
+ */
+static int isPrintableResolve(const char *data, size_t length)
+{
+    selectKernels();
+    return isPrintableKernel(data, length);
+}
+
+/*
+ * FUNCTION : scanFindByte
+ *
+ * DESCRIPTION : This function finds the first occurrence of a byte (a field separator, a frame end)
+ *
+ * PARAMETERS : const char *data : Bytes to search.
+ *              size_t length : Number of bytes.
+ *              char byte : Byte to find.
+ *
+ * RETURNS : const char * : The first match, or NULL if there is none.
+ */
+const char *scanFindByte(const char *data, size_t length, char byte)
+{
+    return __atomic_load_n(&findByteKernel, __ATOMIC_RELAXED)(data, length, byte);
+}
+
+/*
+ * FUNCTION : scanFindPair
+ *
+ * DESCRIPTION : This function finds the first occurrence of a two byte marker such as >>
+ *
+ * PARAMETERS : const char *data : Bytes to search.
+ *              size_t length : Number of bytes.
+ *              char first : First byte of the marker.
+ *              char second : Second byte of the marker.
+ *
+ * RETURNS : const char * : Start of the first match, or NULL if there is none.
+ */
+const char *scanFindPair(const char *data, size_t length, char first, char second)
+{
+    return __atomic_load_n(&findPairKernel, __ATOMIC_RELAXED)(data, length, first, second);
+}
+
+/*
+ * FUNCTION : scanReplacePairs
+ *
+ * DESCRIPTION : This function replaces every two byte marker with another, left to right without overlaps
+ * (the same result as a strstr loop that carries on after each replacement)
+ *
+ * PARAMETERS : char *data : Bytes to change in place.
+ *              size_t length : Number of bytes.
+ *              const char *marker : The two bytes to look for.
+ *              const char *replacement : The two bytes to put in their place.
+ *
+ * RETURNS : size_t : Number of markers replaced.
+ */
+size_t scanReplacePairs(char *data, size_t length, const char *marker, const char *replacement)
+{
+    size_t replacedCount = 0;
+    char *dataEnd = data + length;
+    char *found = data;
+    while ((found = (char *)scanFindPair(found, dataEnd - found, marker[0], marker[1])) != NULL)
+    {
+        found[0] = replacement[0];
+        found[1] = replacement[1];
+        found += 2;
+        replacedCount++;
+    }
+    return replacedCount;
+}
+
+/*
+ * FUNCTION : scanIsPrintableAscii
+ *
+ * DESCRIPTION : This function checks that text is nothing but printable ASCII (space to tilde)
+ *
+ * PARAMETERS : const char *data : Bytes to check.
+ *              size_t length : Number of bytes.
+ *
+ * RETURNS : int : 1 if every byte is printable ASCII, 0 if not.
+ */
+int scanIsPrintableAscii(const char *data, size_t length)
+{
+    return __atomic_load_n(&isPrintableKernel, __ATOMIC_RELAXED)(data, length);
+}
+
+/*
+ * FUNCTION : scanKernelName
+ *
+ * DESCRIPTION : This function says which kernels were picked for this CPU
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : const char * : "avx2", "sse2" or "scalar".
+ */
+const char *scanKernelName(void)
+{
+    if (__atomic_load_n(&kernelName, __ATOMIC_RELAXED) == NULL)
+    {
+        selectKernels();
+    }
+    return kernelName;
+}
@@ -0,0 +1,1073 @@
+#define _GNU_SOURCE
+#include "../inc/common.h"
+#include "../inc/transport.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/un.h>
+
+// Size of one ring including its header, rounded to a cache line
+#define SHARED_RING_BYTES ((sizeof(SharedRing) + TRANSPORT_RING_SIZE + 63) & ~(size_t)63)
+
+/*
+ * FUNCTION : takePendingData
+ *
+ * DESCRIPTION : This function hands out bytes that were stashed while the transport was being set up
+ *
+ * PARAMETERS : Transport *transport : The transport to take bytes from.
+ *              void *buffer : Where to copy the bytes.
+ *              size_t length : Size of the buffer.
+ *
+ * RETURNS : ssize_t : Number of bytes copied (0 if nothing was stashed).
+ */
+static ssize_t takePendingData(Transport *transport, void *buffer, size_t length)
+{
+    if (transport->pendingLength == 0)
+    {
+        return 0;
+    }
+    size_t copyLength = (size_t)transport->pendingLength < length ? (size_t)transport->pendingLength : length;
+    memcpy(buffer, transport->pendingData, copyLength);
+    memmove(transport->pendingData, transport->pendingData + copyLength, transport->pendingLength - copyLength);
+    transport->pendingLength -= copyLength;
+    return copyLength;
+}
+
+/*
+ * FUNCTION : writeToFile
+ *
+ * DESCRIPTION : This function writes all of a buffer to a file at an offset, moving the offset along
+ *
+ * PARAMETERS : int fileDescriptor : The file.
+ *              const char *data : Bytes to write.
+ *              size_t length : Number of bytes.
+ *              off_t *offset : Where to write, advanced by what was written.
+ *
+ * RETURNS : int : 0 on success, -1 on error (errno set).
+ */
+static int writeToFile(int fileDescriptor, const char *data, size_t length, off_t *offset)
+{
+    while (length > 0)
+    {
+        ssize_t writtenBytes = pwrite(fileDescriptor, data, length, *offset);
+        if (writtenBytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        data += writtenBytes;
+        length -= writtenBytes;
+        *offset += writtenBytes;
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : shouldWaitForSocket
+ *
+ * DESCRIPTION : This function decides whether a socket call that found nothing to do should wait and try again.
+ * Once a file send has made the socket non-blocking, calls that didn't ask for MSG_DONTWAIT still expect to block.
+ *
+ * PARAMETERS : Transport *transport : The transport the call was made on.
+ *              ssize_t result : What the call returned.
+ *              int flags : The flags the caller passed.
+ *              short events : POLLIN or POLLOUT, what to wait for.
+ *
+ * RETURNS : int : 1 if it waited and the call should be made again, 0 to return the result as it is.
+ */
+static int shouldWaitForSocket(Transport *transport, ssize_t result, int flags, short events)
+{
+    if (result < 0 && errno == EINTR)
+    {
+        return 1;
+    }
+    if (result >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK) || (flags & MSG_DONTWAIT) ||
+        !__atomic_load_n(&transport->isNonBlocking, __ATOMIC_ACQUIRE))
+    {
+        return 0;
+    }
+    struct pollfd socketPoll = {transport->socket, events, 0};
+    poll(&socketPoll, 1, -1);
+    return 1;
+}
+
+/*
+ * FUNCTION : socketSend
+ *
+ * DESCRIPTION : Send for TCP and AF_UNIX transports
+ *
+ * PARAMETERS : Transport *transport : The transport to send on.
+ *              const void *data : Bytes to send.
+ *              size_t length : Number of bytes to send.
+ *              int flags : MSG_DONTWAIT or 0.
+ *
+ * RETURNS : ssize_t : Bytes sent, or -1 on error (errno set).
+ */
+static ssize_t socketSend(Transport *transport, const void *data, size_t length, int flags)
+{
+    ssize_t sentBytes;
+    do
+    {
+        sentBytes = send(transport->socket, data, length, flags | MSG_NOSIGNAL);
+    } while (shouldWaitForSocket(transport, sentBytes, flags, POLLOUT));
+    return sentBytes;
+}
+
+/*
+ * FUNCTION : socketReceive
+ *
+ * DESCRIPTION : Receive for TCP and AF_UNIX transports
+ *
+ * PARAMETERS : Transport *transport : The transport to read from.
+ *              void *buffer : Where to put the bytes.
+ *              size_t length : Size of the buffer.
+ *              int flags : MSG_DONTWAIT or 0.
+ *
+ * RETURNS : ssize_t : Bytes read, 0 when the peer closed, -1 on error (errno set).
+ */
+static ssize_t socketReceive(Transport *transport, void *buffer, size_t length, int flags)
+{
+    ssize_t pendingBytes = takePendingData(transport, buffer, length);
+    if (pendingBytes > 0)
+    {
+        return pendingBytes;
+    }
+    ssize_t receivedBytes;
+    do
+    {
+        receivedBytes = recv(transport->socket, buffer, length, flags);
+    } while (shouldWaitForSocket(transport, receivedBytes, flags, POLLIN));
+    return receivedBytes;
+}
+
+/*
+ * FUNCTION : socketSendFile
+ *
+ * DESCRIPTION : File send for TCP and AF_UNIX transports, straight from the page cache with sendfile. sendfile has
+ * no MSG_DONTWAIT, so the first call that asks for it makes the socket non-blocking for good.
+ *
+ * PARAMETERS : Transport *transport : The transport to send on.
+ *              int fileDescriptor : The file to send from.
+ *              off_t *offset : Where in the file to start, advanced by what was sent.
+ *              size_t length : Number of bytes to send.
+ *              int flags : MSG_DONTWAIT or 0.
+ *
+ * RETURNS : ssize_t : Bytes sent (0 at the end of the file), or -1 on error (errno set).
+ */
+static ssize_t socketSendFile(Transport *transport, int fileDescriptor, off_t *offset, size_t length, int flags)
+{
+    if ((flags & MSG_DONTWAIT) && !transport->isNonBlocking)
+    {
+        // Set first, so a blocking call that sees EAGAIN from here on knows to wait
+        __atomic_store_n(&transport->isNonBlocking, 1, __ATOMIC_RELEASE);
+        fcntl(transport->socket, F_SETFL, fcntl(transport->socket, F_GETFL) | O_NONBLOCK);
+    }
+    ssize_t sentBytes;
+    do
+    {
+        sentBytes = sendfile(transport->socket, fileDescriptor, offset, length);
+    } while (shouldWaitForSocket(transport, sentBytes, flags, POLLOUT));
+    return sentBytes;
+}
+
+/*
+ * FUNCTION : socketReceiveFile
+ *
+ * DESCRIPTION : File receive for TCP and AF_UNIX transports. The bytes are spliced from the socket into a pipe and
+ * from the pipe into the file, so they never pass through user space.
+ *
+ * PARAMETERS : Transport *transport : The transport to read from.
+ *              int fileDescriptor : The file to write to.
+ *              off_t *offset : Where in the file to write, advanced by what was written.
+ *              size_t length : Number of bytes to move.
+ *
+ * RETURNS : ssize_t : Bytes moved (fewer than length if the peer closed), or -1 on error (errno set).
+ */
+static ssize_t socketReceiveFile(Transport *transport, int fileDescriptor, off_t *offset, size_t length)
+{
+    size_t movedBytes = 0;
+
+    // Anything stashed during setup comes first
+    while (transport->pendingLength > 0 && movedBytes < length)
+    {
+        char pendingBuffer[512];
+        size_t wantedBytes = length - movedBytes < sizeof(pendingBuffer) ? length - movedBytes : sizeof(pendingBuffer);
+        ssize_t pendingBytes = takePendingData(transport, pendingBuffer, wantedBytes);
+        if (writeToFile(fileDescriptor, pendingBuffer, pendingBytes, offset) < 0)
+        {
+            return -1;
+        }
+        movedBytes += pendingBytes;
+    }
+
+    if (transport->splicePipe[0] < 0 && pipe2(transport->splicePipe, O_CLOEXEC) < 0)
+    {
+        return -1;
+    }
+
+    while (movedBytes < length)
+    {
+        ssize_t pipedBytes = splice(transport->socket, NULL, transport->splicePipe[1], NULL, length - movedBytes, SPLICE_F_MOVE);
+        if (pipedBytes == 0)
+        {
+            break;
+        }
+        if (pipedBytes < 0)
+        {
+            if (shouldWaitForSocket(transport, pipedBytes, 0, POLLIN))
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        while (pipedBytes > 0)
+        {
+            ssize_t writtenBytes = splice(transport->splicePipe[0], NULL, fileDescriptor, offset, pipedBytes, SPLICE_F_MOVE);
+            if (writtenBytes < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (writtenBytes <= 0)
+            {
+                // Whatever is stuck in the pipe would end up in the next file, start again with an empty one
+                close(transport->splicePipe[0]);
+                close(transport->splicePipe[1]);
+                transport->splicePipe[0] = transport->splicePipe[1] = -1;
+                return -1;
+            }
+            pipedBytes -= writtenBytes;
+            movedBytes += writtenBytes;
+        }
+    }
+    return movedBytes;
+}
+
+/*
+ * FUNCTION : closeSplicePipe
+ *
+ * DESCRIPTION : This function closes the splice pipe if it was ever made
+ *
+ * PARAMETERS : Transport *transport : The transport being closed.
+ *
+ * RETURNS : void
+ */
+static void closeSplicePipe(Transport *transport)
+{
+    if (transport->splicePipe[0] >= 0)
+    {
+        close(transport->splicePipe[0]);
+        close(transport->splicePipe[1]);
+        transport->splicePipe[0] = transport->splicePipe[1] = -1;
+    }
+}
+
+/*
+ * FUNCTION : socketClose
+ *
+ * DESCRIPTION : Close for TCP and AF_UNIX transports
+ *
+ * PARAMETERS : Transport *transport : The transport to close.
+ *
+ * RETURNS : void
+ */
+static void socketClose(Transport *transport)
+{
+    closeSplicePipe(transport);
+    close(transport->socket);
+    transport->socket = -1;
+}
+
+/*
+ * FUNCTION : refuseCorruptRing
+ *
+ * DESCRIPTION : This function ends a shared memory connection whose ring indices can't be right. The indices live
+ * in memory the peer can write, so head and tail more than TRANSPORT_RING_SIZE apart mean a broken or hostile peer,
+ * not data: the socket is shut down so both ends see the connection close.
+ *
+ * PARAMETERS : Transport *transport : The transport.
+ *
+ * RETURNS : ssize_t : -1 (errno EPROTO).
+ */
+static ssize_t refuseCorruptRing(Transport *transport)
+{
+    shutdown(transport->socket, SHUT_RDWR);
+    errno = EPROTO;
+    return -1;
+}
+
+/*
+ * FUNCTION : sharedMemorySend
+ *
+ * DESCRIPTION : Send for shared memory transports. Copies straight into the peer's ring and only makes
+ * a syscall to ring the doorbell when the peer has gone to sleep waiting for data.
+ *
+ * PARAMETERS : Transport *transport : The transport to send on.
+ *              const void *data : Bytes to send.
+ *              size_t length : Number of bytes to send.
+ *              int flags : MSG_DONTWAIT to fail with EAGAIN instead of waiting for room (or for another sender).
+ *
+ * RETURNS : ssize_t : Bytes sent, or -1 on error (errno set, EPROTO if the peer corrupted the ring).
+ */
+static ssize_t sharedMemorySend(Transport *transport, const void *data, size_t length, int flags)
+{
+    SharedRing *ring = transport->sendRing;
+    const char *bytes = (const char *)data;
+    size_t written = 0;
+
+    if (flags & MSG_DONTWAIT)
+    {
+        if (pthread_mutex_trylock(&transport->sendMutex) != 0)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+    else
+    {
+        pthread_mutex_lock(&transport->sendMutex);
+    }
+
+    while (written < length)
+    {
+        unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head - tail > TRANSPORT_RING_SIZE)
+        {
+            pthread_mutex_unlock(&transport->sendMutex);
+            return refuseCorruptRing(transport);
+        }
+        size_t space = TRANSPORT_RING_SIZE - (head - tail);
+
+        if (space == 0)
+        {
+            // Ring is full: give up if we can't wait, or if the peer has gone away
+            struct pollfd peerPoll = {transport->socket, 0, 0};
+            if (poll(&peerPoll, 1, 0) > 0 && (peerPoll.revents & (POLLHUP | POLLERR)))
+            {
+                pthread_mutex_unlock(&transport->sendMutex);
+                errno = EPIPE;
+                return written > 0 ? (ssize_t)written : -1;
+            }
+            if (flags & MSG_DONTWAIT)
+            {
+                break;
+            }
+            usleep(50);
+            continue;
+        }
+
+        // Copy as much as fits, in two pieces if it wraps around the end of the ring
+        size_t chunk = length - written < space ? length - written : space;
+        chunk = chunk < TRANSPORT_RING_SIZE ? chunk : TRANSPORT_RING_SIZE;
+        size_t offset = head & (TRANSPORT_RING_SIZE - 1);
+        size_t firstPiece = chunk < TRANSPORT_RING_SIZE - offset ? chunk : TRANSPORT_RING_SIZE - offset;
+        memcpy(ring->data + offset, bytes + written, firstPiece);
+        memcpy(ring->data, bytes + written + firstPiece, chunk - firstPiece);
+        __atomic_store_n(&ring->head, head + (unsigned int)chunk, __ATOMIC_RELEASE);
+        written += chunk;
+
+        // Full fence so the waiting flag is read after the new head is visible (pairs with the consumer)
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->consumerWaiting, __ATOMIC_RELAXED))
+        {
+            eventfd_write(transport->sendDoorbell, 1);
+        }
+    }
+    pthread_mutex_unlock(&transport->sendMutex);
+
+    if (written == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    return written;
+}
+
+/*
+ * FUNCTION : sharedMemoryReceive
+ *
+ * DESCRIPTION : Receive for shared memory transports. Spins on the ring for a little while, then sleeps on the
+ * doorbell and the socket together (the socket tells us when the peer has gone or the server reaped us).
+ * With MSG_DONTWAIT it leaves the waiting flag set instead of sleeping, so the caller can poll the descriptors
+ * from transportPollDescriptors and be woken by the next send.
+ *
+ * PARAMETERS : Transport *transport : The transport to read from.
+ *              void *buffer : Where to put the bytes.
+ *              size_t length : Size of the buffer.
+ *              int flags : MSG_DONTWAIT or 0.
+ *
+ * RETURNS : ssize_t : Bytes read, 0 when the peer closed, -1 on error (errno set, EPROTO if the peer corrupted the
+ * ring).
+ */
+static ssize_t sharedMemoryReceive(Transport *transport, void *buffer, size_t length, int flags)
+{
+    SharedRing *ring = transport->receiveRing;
+    int spins = 0;
+
+    ssize_t pendingBytes = takePendingData(transport, buffer, length);
+    if (pendingBytes > 0)
+    {
+        return pendingBytes;
+    }
+
+    while (1)
+    {
+        unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (head - tail > TRANSPORT_RING_SIZE)
+        {
+            return refuseCorruptRing(transport);
+        }
+        if (head != tail)
+        {
+            size_t available = head - tail;
+            size_t chunk = available < length ? available : length;
+            chunk = chunk < TRANSPORT_RING_SIZE ? chunk : TRANSPORT_RING_SIZE;
+            size_t offset = tail & (TRANSPORT_RING_SIZE - 1);
+            size_t firstPiece = chunk < TRANSPORT_RING_SIZE - offset ? chunk : TRANSPORT_RING_SIZE - offset;
+            memcpy(buffer, ring->data + offset, firstPiece);
+            memcpy((char *)buffer + firstPiece, ring->data, chunk - firstPiece);
+            __atomic_store_n(&ring->tail, tail + (unsigned int)chunk, __ATOMIC_RELEASE);
+            __atomic_store_n(&ring->consumerWaiting, 0, __ATOMIC_RELAXED);
+            return chunk;
+        }
+
+        if (flags & MSG_DONTWAIT)
+        {
+            // Empty the doorbell so a level-triggered poll doesn't keep firing, then arm it for the next send
+            eventfd_t doorbellCount;
+            eventfd_read(transport->receiveDoorbell, &doorbellCount);
+            __atomic_store_n(&ring->consumerWaiting, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != tail)
+            {
+                continue;
+            }
+            // The socket carries stray control frames and tells us the peer closed
+            return recv(transport->socket, buffer, length, MSG_DONTWAIT);
+        }
+
+        if (spins++ < TRANSPORT_SPIN_COUNT)
+        {
+            sched_yield();
+            continue;
+        }
+
+        // Tell the producer we are going to sleep, then check once more so a send in between isn't missed
+        __atomic_store_n(&ring->consumerWaiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+        {
+            struct pollfd waitPolls[2] = {{transport->receiveDoorbell, POLLIN, 0}, {transport->socket, POLLIN, 0}};
+            if (poll(waitPolls, 2, -1) < 0 && errno != EINTR)
+            {
+                __atomic_store_n(&ring->consumerWaiting, 0, __ATOMIC_RELAXED);
+                return -1;
+            }
+            if (waitPolls[0].revents & POLLIN)
+            {
+                eventfd_t doorbellCount;
+                eventfd_read(transport->receiveDoorbell, &doorbellCount);
+            }
+            if (waitPolls[1].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                // The socket only carries stray control frames once shared memory is up, or tells us the peer closed
+                __atomic_store_n(&ring->consumerWaiting, 0, __ATOMIC_RELAXED);
+                return recv(transport->socket, buffer, length, 0);
+            }
+        }
+        __atomic_store_n(&ring->consumerWaiting, 0, __ATOMIC_RELAXED);
+        spins = 0;
+    }
+}
+
+/*
+ * FUNCTION : sharedMemorySendFile
+ *
+ * DESCRIPTION : File send for shared memory transports. The ring is already memory both sides can see, so the file
+ * is read into a buffer and copied in like any other data.
+ *
+ * PARAMETERS : Transport *transport : The transport to send on.
+ *              int fileDescriptor : The file to send from.
+ *              off_t *offset : Where in the file to start, advanced by what was sent.
+ *              size_t length : Number of bytes to send.
+ *              int flags : MSG_DONTWAIT or 0.
+ *
+ * RETURNS : ssize_t : Bytes sent (0 at the end of the file), or -1 on error (errno set).
+ */
+static ssize_t sharedMemorySendFile(Transport *transport, int fileDescriptor, off_t *offset, size_t length, int flags)
+{
+    char fileBuffer[TRANSPORT_FILE_COPY_SIZE];
+    ssize_t readBytes = pread(fileDescriptor, fileBuffer, length < sizeof(fileBuffer) ? length : sizeof(fileBuffer), *offset);
+    if (readBytes <= 0)
+    {
+        return readBytes;
+    }
+    ssize_t sentBytes = sharedMemorySend(transport, fileBuffer, readBytes, flags);
+    if (sentBytes > 0)
+    {
+        *offset += sentBytes;
+    }
+    return sentBytes;
+}
+
+/*
+ * FUNCTION : sharedMemoryReceiveFile
+ *
+ * DESCRIPTION : File receive for shared memory transports, copied out of the ring into the file
+ *
+ * PARAMETERS : Transport *transport : The transport to read from.
+ *              int fileDescriptor : The file to write to.
+ *              off_t *offset : Where in the file to write, advanced by what was written.
+ *              size_t length : Number of bytes to move.
+ *
+ * RETURNS : ssize_t : Bytes moved (fewer than length if the peer closed), or -1 on error (errno set).
+ */
+static ssize_t sharedMemoryReceiveFile(Transport *transport, int fileDescriptor, off_t *offset, size_t length)
+{
+    char fileBuffer[TRANSPORT_FILE_COPY_SIZE];
+    size_t movedBytes = 0;
+    while (movedBytes < length)
+    {
+        size_t wantedBytes = length - movedBytes < sizeof(fileBuffer) ? length - movedBytes : sizeof(fileBuffer);
+        ssize_t receivedBytes = sharedMemoryReceive(transport, fileBuffer, wantedBytes, 0);
+        if (receivedBytes == 0)
+        {
+            break;
+        }
+        if (receivedBytes < 0 || writeToFile(fileDescriptor, fileBuffer, receivedBytes, offset) < 0)
+        {
+            return -1;
+        }
+        movedBytes += receivedBytes;
+    }
+    return movedBytes;
+}
+
+/*
+ * FUNCTION : sharedMemoryClose
+ *
+ * DESCRIPTION : Close for shared memory transports, unmaps the rings and closes the doorbells and socket
+ *
+ * PARAMETERS : Transport *transport : The transport to close.
+ *
+ * RETURNS : void
+ */
+static void sharedMemoryClose(Transport *transport)
+{
+    munmap(transport->sharedMapping, 2 * SHARED_RING_BYTES);
+    close(transport->sendDoorbell);
+    close(transport->receiveDoorbell);
+    closeSplicePipe(transport);
+    close(transport->socket);
+    transport->socket = -1;
+}
+
+// Operation tables for each kind of transport
+static const TransportOperations socketOperations = {"socket", socketSend, socketReceive, socketSendFile, socketReceiveFile, socketClose};
+static const TransportOperations sharedMemoryOperations = {"shared memory", sharedMemorySend, sharedMemoryReceive, sharedMemorySendFile,
+                                                           sharedMemoryReceiveFile, sharedMemoryClose};
+
+/*
+ * FUNCTION : transportInitialize
+ *
+ * DESCRIPTION : This function sets up a transport around a connected TCP or AF_UNIX socket
+ *
+ * PARAMETERS : Transport *transport : The transport to set up.
+ *              int socket : The connected socket.
+ *              int kind : TRANSPORT_TCP or TRANSPORT_UNIX.
+ *
+ * RETURNS : void
+ */
+void transportInitialize(Transport *transport, int socket, int kind)
+{
+    transport->operations = &socketOperations;
+    transport->socket = socket;
+    transport->kind = kind;
+    transport->sendRing = NULL;
+    transport->receiveRing = NULL;
+    transport->sendDoorbell = -1;
+    transport->receiveDoorbell = -1;
+    transport->sharedMapping = NULL;
+    transport->pendingLength = 0;
+    transport->isNonBlocking = 0;
+    transport->splicePipe[0] = transport->splicePipe[1] = -1;
+    pthread_mutex_init(&transport->sendMutex, NULL);
+}
+
+/*
+ * FUNCTION : transportSend
+ *
+ * DESCRIPTION : This function sends bytes to the peer over whatever the transport is carried on
+ *
+ * PARAMETERS : Transport *transport : The transport to send on.
+ *              const void *data : Bytes to send.
+ *              size_t length : Number of bytes to send.
+ *              int flags : MSG_DONTWAIT or 0.
+ *
+ * RETURNS : ssize_t : Bytes sent, or -1 on error (errno set).
+ */
+ssize_t transportSend(Transport *transport, const void *data, size_t length, int flags)
+{
+    return transport->operations->send(transport, data, length, flags);
+}
+
+/*
+ * FUNCTION : transportReceive
+ *
+ * DESCRIPTION : This function reads bytes from the peer, blocking until some arrive unless asked not to
+ *
+ * PARAMETERS : Transport *transport : The transport to read from.
+ *              void *buffer : Where to put the bytes.
+ *              size_t length : Size of the buffer.
+ *              int flags : MSG_DONTWAIT or 0.
+ *
+ * RETURNS : ssize_t : Bytes read, 0 when the peer closed, -1 on error (errno set, EAGAIN when nothing was waiting).
+ */
+ssize_t transportReceive(Transport *transport, void *buffer, size_t length, int flags)
+{
+    return transport->operations->receive(transport, buffer, length, flags);
+}
+
+/*
+ * FUNCTION : transportSendFile
+ *
+ * DESCRIPTION : This function sends part of a file to the peer, without copying it through user space where the
+ * transport allows
+ *
+ * PARAMETERS : Transport *transport : The transport to send on.
+ *              int fileDescriptor : The file to send from.
+ *              off_t *offset : Where in the file to start, advanced by what was sent.
+ *              size_t length : Number of bytes to send.
+ *              int flags : MSG_DONTWAIT or 0.
+ *
+ * RETURNS : ssize_t : Bytes sent (may be fewer than length, 0 at the end of the file), or -1 on error (errno set).
+ */
+ssize_t transportSendFile(Transport *transport, int fileDescriptor, off_t *offset, size_t length, int flags)
+{
+    return transport->operations->sendFile(transport, fileDescriptor, offset, length, flags);
+}
+
+/*
+ * FUNCTION : transportReceiveFile
+ *
+ * DESCRIPTION : This function moves the next bytes from the peer straight into a file, blocking until they are
+ * all there
+ *
+ * PARAMETERS : Transport *transport : The transport to read from.
+ *              int fileDescriptor : The file to write to.
+ *              off_t *offset : Where in the file to write, advanced by what was written.
+ *              size_t length : Number of bytes to move.
+ *
+ * RETURNS : ssize_t : Bytes moved (fewer than length if the peer closed), or -1 on error (errno set).
+ */
+ssize_t transportReceiveFile(Transport *transport, int fileDescriptor, off_t *offset, size_t length)
+{
+    return transport->operations->receiveFile(transport, fileDescriptor, offset, length);
+}
+
+/*
+ * FUNCTION : transportPollDescriptors
+ *
+ * DESCRIPTION : This function fills in the descriptors to poll for callers that run their own event loop. They only
+ * report new data once MSG_DONTWAIT transportReceive has been called until it failed with EAGAIN.
+ *
+ * PARAMETERS : const Transport *transport : The transport to wait on.
+ *              struct pollfd *polls : Room for TRANSPORT_MAX_POLL_DESCRIPTORS entries.
+ *
+ * RETURNS : int : Number of entries filled in.
+ */
+int transportPollDescriptors(const Transport *transport, struct pollfd *polls)
+{
+    int pollCount = 0;
+    polls[pollCount].fd = transport->socket;
+    polls[pollCount].events = POLLIN;
+    polls[pollCount].revents = 0;
+    pollCount++;
+    if (transport->kind == TRANSPORT_SHARED_MEMORY)
+    {
+        polls[pollCount].fd = transport->receiveDoorbell;
+        polls[pollCount].events = POLLIN;
+        polls[pollCount].revents = 0;
+        pollCount++;
+    }
+    return pollCount;
+}
+
+/*
+ * FUNCTION : transportShutdown
+ *
+ * DESCRIPTION : This function wakes up anything blocked in transportReceive (it will return 0),
+ * without freeing anything. Safe to call from another thread.
+ *
+ * PARAMETERS : Transport *transport : The transport to shut down.
+ *
+ * RETURNS : void
+ */
+void transportShutdown(Transport *transport)
+{
+    shutdown(transport->socket, SHUT_RDWR);
+}
+
+/*
+ * FUNCTION : transportClose
+ *
+ * DESCRIPTION : This function releases everything the transport holds
+ *
+ * PARAMETERS : Transport *transport : The transport to close.
+ *
+ * RETURNS : void
+ */
+void transportClose(Transport *transport)
+{
+    transport->operations->close(transport);
+    pthread_mutex_destroy(&transport->sendMutex);
+}
+
+/*
+ * FUNCTION : transportListenUnix
+ *
+ * DESCRIPTION : This function creates a listening AF_UNIX stream socket at a path (replacing a stale one)
+ *
+ * PARAMETERS : const char *path : Filesystem path of the socket.
+ *              int backlog : Listen backlog.
+ *
+ * RETURNS : int : The listening socket, or -1 on error.
+ */
+int transportListenUnix(const char *path, int backlog)
+{
+    struct sockaddr_un unixAddress;
+    memset(&unixAddress, 0, sizeof(unixAddress));
+    unixAddress.sun_family = AF_UNIX;
+    strncpy(unixAddress.sun_path, path, sizeof(unixAddress.sun_path) - 1);
+
+    int listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenSocket < 0)
+    {
+        return -1;
+    }
+
+    // A socket file left behind by a previous run would make bind fail
+    unlink(path);
+    if (bind(listenSocket, (struct sockaddr *)&unixAddress, sizeof(unixAddress)) < 0 || listen(listenSocket, backlog) < 0)
+    {
+        close(listenSocket);
+        return -1;
+    }
+    return listenSocket;
+}
+
+/*
+ * FUNCTION : transportConnectUnix
+ *
+ * DESCRIPTION : This function connects to a server's AF_UNIX socket
+ *
+ * PARAMETERS : const char *path : Filesystem path of the server's socket.
+ *              Transport *transport : Set up on success.
+ *
+ * RETURNS : int : 0 on success, -1 on error.
+ */
+int transportConnectUnix(const char *path, Transport *transport)
+{
+    struct sockaddr_un unixAddress;
+    memset(&unixAddress, 0, sizeof(unixAddress));
+    unixAddress.sun_family = AF_UNIX;
+    strncpy(unixAddress.sun_path, path, sizeof(unixAddress.sun_path) - 1);
+
+    int unixSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (unixSocket < 0)
+    {
+        return -1;
+    }
+    if (connect(unixSocket, (struct sockaddr *)&unixAddress, sizeof(unixAddress)) < 0)
+    {
+        close(unixSocket);
+        return -1;
+    }
+    transportInitialize(transport, unixSocket, TRANSPORT_UNIX);
+    return 0;
+}
+
+/*
+ * FUNCTION : transportSplitHostPort
+ *
+ * DESCRIPTION : This function splits HOST[:PORT] into its parts. An IPv6 address with a port goes in brackets
+ * ([::1]:8888); without one it may be bare (::1), since anything with more than one colon is taken as the host.
+ *
+ * PARAMETERS : const char *address : The text.
+ *              char *host : Set to the host, without brackets (empty for ":PORT").
+ *              size_t hostSize : Size of host.
+ *              int defaultPort : The port when the text has none.
+ *
+ * RETURNS : int : The port, or -1 if the text is malformed or the host doesn't fit.
+ */
+int transportSplitHostPort(const char *address, char *host, size_t hostSize, int defaultPort)
+{
+    const char *hostStart = address;
+    size_t hostLength;
+    const char *portText = NULL;
+    if (address[0] == '[')
+    {
+        const char *closing = strchr(address, ']');
+        if (closing == NULL || (closing[1] != '\0' && closing[1] != ':'))
+        {
+            return -1;
+        }
+        hostStart = address + 1;
+        hostLength = closing - hostStart;
+        portText = closing[1] == ':' ? closing + 2 : NULL;
+    }
+    else
+    {
+        const char *colon = strchr(address, ':');
+        if (colon != NULL && strchr(colon + 1, ':') == NULL)
+        {
+            hostLength = colon - address;
+            portText = colon + 1;
+        }
+        else
+        {
+            hostLength = strlen(address);
+        }
+    }
+    if (hostLength >= hostSize)
+    {
+        return -1;
+    }
+    memcpy(host, hostStart, hostLength);
+    host[hostLength] = '\0';
+    if (portText == NULL)
+    {
+        return defaultPort;
+    }
+
+    char *end;
+    long port = strtol(portText, &end, 10);
+    if (end == portText || *end != '\0' || port <= 0 || port > 65535)
+    {
+        return -1;
+    }
+    return port;
+}
+
+/*
+ * FUNCTION : transportOfferSharedMemory
+ *
+ * DESCRIPTION : Server side of the shared memory upgrade. Creates the two rings and doorbells, passes them to the
+ * client over the AF_UNIX socket and switches the transport over. The caller must make sure nothing else sends on
+ * the transport while this runs. Over TCP (or if anything fails) the client gets a bare reply and stays on the socket.
+ *
+ * PARAMETERS : Transport *transport : The client's transport.
+ *
+ * RETURNS : int : 0 if the transport now uses shared memory, -1 if it stayed on the socket.
+ */
+int transportOfferSharedMemory(Transport *transport)
+{
+    int memoryFile = -1;
+    int clientDoorbell = -1;
+    int serverDoorbell = -1;
+    void *mapping = MAP_FAILED;
+
+    if (transport->kind == TRANSPORT_UNIX)
+    {
+        memoryFile = memfd_create("chat-shm", MFD_CLOEXEC);
+        clientDoorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        serverDoorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (memoryFile >= 0 && ftruncate(memoryFile, 2 * SHARED_RING_BYTES) == 0)
+        {
+            mapping = mmap(NULL, 2 * SHARED_RING_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, memoryFile, 0);
+        }
+    }
+
+    if (mapping == MAP_FAILED || clientDoorbell < 0 || serverDoorbell < 0)
+    {
+        // Refuse: reply without any descriptors attached
+        send(transport->socket, PROTOCOL_SHM_FRAME, strlen(PROTOCOL_SHM_FRAME), MSG_NOSIGNAL);
+        if (mapping != MAP_FAILED)
+        {
+            munmap(mapping, 2 * SHARED_RING_BYTES);
+        }
+        if (memoryFile >= 0)
+        {
+            close(memoryFile);
+        }
+        if (clientDoorbell >= 0)
+        {
+            close(clientDoorbell);
+        }
+        if (serverDoorbell >= 0)
+        {
+            close(serverDoorbell);
+        }
+        return -1;
+    }
+
+    // The reply carries the memory and both doorbells: [memory, client->server doorbell, server->client doorbell]
+    int passedDescriptors[3] = {memoryFile, clientDoorbell, serverDoorbell};
+    char controlBuffer[CMSG_SPACE(sizeof(passedDescriptors))];
+    memset(controlBuffer, 0, sizeof(controlBuffer));
+    struct iovec replyVector = {(void *)PROTOCOL_SHM_FRAME, strlen(PROTOCOL_SHM_FRAME)};
+    struct msghdr replyHeader;
+    memset(&replyHeader, 0, sizeof(replyHeader));
+    replyHeader.msg_iov = &replyVector;
+    replyHeader.msg_iovlen = 1;
+    replyHeader.msg_control = controlBuffer;
+    replyHeader.msg_controllen = sizeof(controlBuffer);
+    struct cmsghdr *controlMessage = CMSG_FIRSTHDR(&replyHeader);
+    controlMessage->cmsg_level = SOL_SOCKET;
+    controlMessage->cmsg_type = SCM_RIGHTS;
+    controlMessage->cmsg_len = CMSG_LEN(sizeof(passedDescriptors));
+    memcpy(CMSG_DATA(controlMessage), passedDescriptors, sizeof(passedDescriptors));
+
+    int sendResult = sendmsg(transport->socket, &replyHeader, MSG_NOSIGNAL);
+    close(memoryFile);
+    if (sendResult < 0)
+    {
+        munmap(mapping, 2 * SHARED_RING_BYTES);
+        close(clientDoorbell);
+        close(serverDoorbell);
+        return -1;
+    }
+
+    // Ring 0 carries client->server, ring 1 server->client
+    transport->sharedMapping = mapping;
+    transport->receiveRing = (SharedRing *)mapping;
+    transport->sendRing = (SharedRing *)((char *)mapping + SHARED_RING_BYTES);
+    transport->receiveDoorbell = clientDoorbell;
+    transport->sendDoorbell = serverDoorbell;
+    transport->kind = TRANSPORT_SHARED_MEMORY;
+    // Published last, a thread that still sees the old operations just sends on the socket
+    __atomic_store_n(&transport->operations, &sharedMemoryOperations, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * FUNCTION : findUpgradeReply
+ *
+ * DESCRIPTION : This function looks for the server's upgrade reply among the frames stashed in pendingData
+ *
+ * PARAMETERS : const Transport *transport : The transport waiting for the reply.
+ *
+ * RETURNS : int : Offset of the reply in pendingData, or -1 if it hasn't arrived.
+ */
+static int findUpgradeReply(const Transport *transport)
+{
+    size_t replyLength = strlen(PROTOCOL_SHM_FRAME);
+    const char *searchStart = transport->pendingData;
+    const char *pendingEnd = transport->pendingData + transport->pendingLength;
+    const char *found;
+
+    // Only a whole frame counts, not the same bytes at the end of someone's chat message
+    while ((found = memmem(searchStart, pendingEnd - searchStart, PROTOCOL_SHM_FRAME, replyLength)) != NULL)
+    {
+        if (found == transport->pendingData || found[-1] == PROTOCOL_FRAME_END)
+        {
+            return found - transport->pendingData;
+        }
+        searchStart = found + 1;
+    }
+    return -1;
+}
+
+/*
+ * FUNCTION : transportRequestSharedMemory
+ *
+ * DESCRIPTION : Client side of the shared memory upgrade. Asks the server for rings over the AF_UNIX socket and waits
+ * for the reply. Anything the server broadcast before the reply is kept and handed out first by transportReceive.
+ *
+ * PARAMETERS : Transport *transport : A connected AF_UNIX transport.
+ *
+ * RETURNS : int : 0 if the transport now uses shared memory, -1 if it stayed on the socket.
+ */
+int transportRequestSharedMemory(Transport *transport)
+{
+    if (send(transport->socket, PROTOCOL_SHM_FRAME, strlen(PROTOCOL_SHM_FRAME), MSG_NOSIGNAL) < 0)
+    {
+        return -1;
+    }
+
+    while (1)
+    {
+        int passedDescriptors[3] = {-1, -1, -1};
+        char controlBuffer[CMSG_SPACE(sizeof(passedDescriptors))];
+        char *receiveSpace = transport->pendingData + transport->pendingLength;
+        size_t receiveSpaceLength = sizeof(transport->pendingData) - transport->pendingLength;
+        if (receiveSpaceLength == 0)
+        {
+            // Far more early traffic than we can hold, give up on the upgrade
+            return -1;
+        }
+
+        struct iovec receiveVector = {receiveSpace, receiveSpaceLength};
+        struct msghdr receiveHeader;
+        memset(&receiveHeader, 0, sizeof(receiveHeader));
+        receiveHeader.msg_iov = &receiveVector;
+        receiveHeader.msg_iovlen = 1;
+        receiveHeader.msg_control = controlBuffer;
+        receiveHeader.msg_controllen = sizeof(controlBuffer);
+
+        ssize_t receivedBytes = recvmsg(transport->socket, &receiveHeader, MSG_CMSG_CLOEXEC);
+        if (receivedBytes <= 0)
+        {
+            return -1;
+        }
+        transport->pendingLength += receivedBytes;
+
+        struct cmsghdr *controlMessage = CMSG_FIRSTHDR(&receiveHeader);
+        int gotDescriptors = controlMessage != NULL && controlMessage->cmsg_type == SCM_RIGHTS &&
+                             controlMessage->cmsg_len == CMSG_LEN(sizeof(passedDescriptors));
+        if (gotDescriptors)
+        {
+            memcpy(passedDescriptors, CMSG_DATA(controlMessage), sizeof(passedDescriptors));
+        }
+
+        // The reply is a frame of its own among whatever else arrived, cut it out and keep the rest
+        int replyOffset = findUpgradeReply(transport);
+        if (!gotDescriptors && replyOffset < 0)
+        {
+            continue;
+        }
+        if (replyOffset >= 0)
+        {
+            size_t replyLength = strlen(PROTOCOL_SHM_FRAME);
+            memmove(transport->pendingData + replyOffset, transport->pendingData + replyOffset + replyLength,
+                    transport->pendingLength - replyOffset - replyLength);
+            transport->pendingLength -= replyLength;
+        }
+        if (!gotDescriptors)
+        {
+            // The server refused, carry on over the socket
+            return -1;
+        }
+
+        void *mapping = mmap(NULL, 2 * SHARED_RING_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, passedDescriptors[0], 0);
+        close(passedDescriptors[0]);
+        if (mapping == MAP_FAILED)
+        {
+            close(passedDescriptors[1]);
+            close(passedDescriptors[2]);
+            return -1;
+        }
+
+        transport->sharedMapping = mapping;
+        transport->sendRing = (SharedRing *)mapping;
+        transport->receiveRing = (SharedRing *)((char *)mapping + SHARED_RING_BYTES);
+        transport->sendDoorbell = passedDescriptors[1];
+        transport->receiveDoorbell = passedDescriptors[2];
+        transport->kind = TRANSPORT_SHARED_MEMORY;
+        transport->operations = &sharedMemoryOperations;
+
+        // A caller polling the doorbell before its first read would never be woken (nothing has asked the server
+        // to ring it yet, and it may already have written). Ring it once so the first poll drains the ring.
+        __atomic_store_n(&transport->receiveRing->consumerWaiting, 1, __ATOMIC_RELAXED);
+        eventfd_write(transport->receiveDoorbell, 1);
+        return 0;
+    }
+}
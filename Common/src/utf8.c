@@ -0,0 +1,372 @@
+#include "../inc/utf8.h"
+#include "../inc/utf8-width-table.h"
+#include "../inc/scan.h"
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * FUNCTION : utf8DecodeNext
+ *
+ * DESCRIPTION : This function decodes the character at the start of some text, refusing anything that isn't
+ * well-formed UTF-8 (a stray continuation byte, a sequence cut short, an overlong form, a surrogate, or a code point
+ * past U+10FFFF)
+ *
+ * PARAMETERS : const char *data : The text.
+ *              size_t length : Bytes available (at least one).
+ *              unsigned int *codepoint : Set to the character.
+ *
+ * RETURNS : size_t : Bytes it takes, or 0 if the text doesn't start with a valid character.
+ */
+size_t utf8DecodeNext(const char *data, size_t length, unsigned int *codepoint)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    unsigned int lead = bytes[0];
+    if (lead < 0x80)
+    {
+        *codepoint = lead;
+        return 1;
+    }
+
+    size_t sequenceLength;
+    unsigned int smallest;
+    if (lead >= 0xc2 && lead <= 0xdf)
+    {
+        sequenceLength = 2;
+        smallest = 0x80;
+        *codepoint = lead & 0x1f;
+    }
+    else if (lead >= 0xe0 && lead <= 0xef)
+    {
+        sequenceLength = 3;
+        smallest = 0x800;
+        *codepoint = lead & 0x0f;
+    }
+    else if (lead >= 0xf0 && lead <= 0xf4)
+    {
+        sequenceLength = 4;
+        smallest = 0x10000;
+        *codepoint = lead & 0x07;
+    }
+    else
+    {
+        return 0;
+    }
+    if (length < sequenceLength)
+    {
+        return 0;
+    }
+
+    for (size_t i = 1; i < sequenceLength; i++)
+    {
+        if ((bytes[i] & 0xc0) != 0x80)
+        {
+            return 0;
+        }
+        *codepoint = (*codepoint << 6) | (bytes[i] & 0x3f);
+    }
+    if (*codepoint < smallest || *codepoint > 0x10ffff || (*codepoint >= 0xd800 && *codepoint <= 0xdfff))
+    {
+        return 0;
+    }
+    return sequenceLength;
+}
+
+/*
+ * FUNCTION : utf8Encode
+ *
+ * DESCRIPTION : This function writes a character as UTF-8
+ *
+ * PARAMETERS : unsigned int codepoint : The character.
+ *              char *buffer : Room for UTF8_MAX_BYTES.
+ *
+ * RETURNS : size_t : Bytes written, 0 for a surrogate or a code point past U+10FFFF.
+ */
+size_t utf8Encode(unsigned int codepoint, char *buffer)
+{
+    unsigned char *bytes = (unsigned char *)buffer;
+    if (codepoint < 0x80)
+    {
+        bytes[0] = codepoint;
+        return 1;
+    }
+    if (codepoint < 0x800)
+    {
+        bytes[0] = 0xc0 | (codepoint >> 6);
+        bytes[1] = 0x80 | (codepoint & 0x3f);
+        return 2;
+    }
+    if (codepoint >= 0xd800 && codepoint <= 0xdfff)
+    {
+        return 0;
+    }
+    if (codepoint < 0x10000)
+    {
+        bytes[0] = 0xe0 | (codepoint >> 12);
+        bytes[1] = 0x80 | ((codepoint >> 6) & 0x3f);
+        bytes[2] = 0x80 | (codepoint & 0x3f);
+        return 3;
+    }
+    if (codepoint <= 0x10ffff)
+    {
+        bytes[0] = 0xf0 | (codepoint >> 18);
+        bytes[1] = 0x80 | ((codepoint >> 12) & 0x3f);
+        bytes[2] = 0x80 | ((codepoint >> 6) & 0x3f);
+        bytes[3] = 0x80 | (codepoint & 0x3f);
+        return 4;
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : utf8IsValid
+ *
+ * DESCRIPTION : This function checks text is well-formed UTF-8
+ *
+ * PARAMETERS : const char *data : The text.
+ *              size_t length : Its length in bytes.
+ *
+ * RETURNS : int : 1 if it is, 0 if not.
+ */
+int utf8IsValid(const char *data, size_t length)
+{
+    if (scanIsPrintableAscii(data, length))
+    {
+        return 1;
+    }
+    unsigned int codepoint;
+    for (size_t offset = 0; offset < length;)
+    {
+        size_t characterLength = utf8DecodeNext(data + offset, length - offset, &codepoint);
+        if (characterLength == 0)
+        {
+            return 0;
+        }
+        offset += characterLength;
+    }
+    return 1;
+}
+
+/*
+ * FUNCTION : utf8IsAscii
+ *
+ * DESCRIPTION : This function checks text has no bytes past 0x7f (one byte per character), eight bytes at a time in
+ * a plain word. Cheaper than scanIsPrintableAscii for the few dozen bytes of a typed line: there is no kernel to call
+ * through and no vector state to set up.
+ *
+ * PARAMETERS : const char *data : The text.
+ *              size_t length : Its length in bytes.
+ *
+ * RETURNS : int : 1 if it is all ASCII, 0 if not.
+ */
+int utf8IsAscii(const char *data, size_t length)
+{
+    uint64_t highBits = 0;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        highBits |= word;
+    }
+    for (; i < length; i++)
+    {
+        highBits |= (unsigned char)data[i];
+    }
+    return (highBits & UTF8_ASCII_HIGH_BITS) == 0;
+}
+
+/*
+ * FUNCTION : isInRanges
+ *
+ * DESCRIPTION : This function binary searches a generated width table
+ *
+ * PARAMETERS : const Utf8WidthRange *ranges : The table, in code point order.
+ *              int rangeCount : Entries in it.
+ *              unsigned int codepoint : The character.
+ *
+ * RETURNS : int : 1 if one of the ranges has it, 0 if not.
+ */
+static int isInRanges(const Utf8WidthRange *ranges, int rangeCount, unsigned int codepoint)
+{
+    int low = 0;
+    int high = rangeCount - 1;
+    while (low <= high)
+    {
+        int middle = (low + high) / 2;
+        unsigned int first = ranges[middle] >> UTF8_RANGE_LENGTH_BITS;
+        unsigned int last = first + (ranges[middle] & ((1u << UTF8_RANGE_LENGTH_BITS) - 1));
+        if (codepoint < first)
+        {
+            high = middle - 1;
+        }
+        else if (codepoint > last)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : utf8CodepointWidth
+ *
+ * DESCRIPTION : This function says how many terminal columns a character takes
+ *
+ * PARAMETERS : unsigned int codepoint : The character.
+ *
+ * RETURNS : int : 0 for control characters and marks that combine with the one before, 2 for wide characters,
+ *                 1 for everything else.
+ */
+int utf8CodepointWidth(unsigned int codepoint)
+{
+    if (codepoint < 0x20 || (codepoint >= 0x7f && codepoint < 0xa0))
+    {
+        return 0;
+    }
+    // Nothing before the combining diacritics is zero width or wide
+    if (codepoint < 0x300)
+    {
+        return 1;
+    }
+    if (isInRanges(utf8ZeroWidthRanges, sizeof(utf8ZeroWidthRanges) / sizeof(utf8ZeroWidthRanges[0]), codepoint))
+    {
+        return 0;
+    }
+    if (codepoint >= 0x1100 && isInRanges(utf8WideRanges, sizeof(utf8WideRanges) / sizeof(utf8WideRanges[0]), codepoint))
+    {
+        return 2;
+    }
+    return 1;
+}
+
+/*
+ * FUNCTION : utf8DisplayWidth
+ *
+ * DESCRIPTION : This function works out how many terminal columns text takes. A byte that isn't part of a valid
+ * character counts as one column (it is shown as a replacement).
+ *
+ * PARAMETERS : const char *text : The text.
+ *              size_t length : Its length in bytes.
+ *
+ * RETURNS : int : Columns.
+ */
+int utf8DisplayWidth(const char *text, size_t length)
+{
+    int columns;
+    utf8PrefixForWidth(text, length, -1, length, &columns);
+    return columns;
+}
+
+/*
+ * FUNCTION : utf8PrefixForWidth
+ *
+ * DESCRIPTION : This function finds how much of some text fits in a number of columns and bytes without cutting a
+ * character in two. Marks that combine with a character stay with it, or are left out with it.
+ *
+ * PARAMETERS : const char *text : The text.
+ *              size_t length : Its length in bytes.
+ *              int maxColumns : Columns available (-1 for no limit).
+ *              size_t maxBytes : Bytes available.
+ *              int *columns : Set to the columns the part that fits takes.
+ *
+ * RETURNS : size_t : Bytes of the text that fit.
+ */
+size_t utf8PrefixForWidth(const char *text, size_t length, int maxColumns, size_t maxBytes, int *columns)
+{
+    // Printable ASCII is one byte and one column per character
+    if (scanIsPrintableAscii(text, length))
+    {
+        size_t fitLength = length < maxBytes ? length : maxBytes;
+        if (maxColumns >= 0 && fitLength > (size_t)maxColumns)
+        {
+            fitLength = maxColumns;
+        }
+        *columns = fitLength;
+        return fitLength;
+    }
+
+    size_t offset = 0;
+    int usedColumns = 0;
+    while (offset < length)
+    {
+        unsigned int codepoint;
+        size_t characterLength = utf8DecodeNext(text + offset, length - offset, &codepoint);
+        int characterColumns = characterLength == 0 ? 1 : utf8CodepointWidth(codepoint);
+        if (characterLength == 0)
+        {
+            characterLength = 1;
+        }
+
+        // The character and the marks that go on it, all or nothing
+        size_t clusterLength = characterLength;
+        while (offset + clusterLength < length)
+        {
+            size_t markLength = utf8DecodeNext(text + offset + clusterLength, length - offset - clusterLength, &codepoint);
+            if (markLength == 0 || codepoint < 0x300 || utf8CodepointWidth(codepoint) != 0)
+            {
+                break;
+            }
+            clusterLength += markLength;
+        }
+        if (offset + clusterLength > maxBytes || (maxColumns >= 0 && usedColumns + characterColumns > maxColumns))
+        {
+            break;
+        }
+        offset += clusterLength;
+        usedColumns += characterColumns;
+    }
+    *columns = usedColumns;
+    return offset;
+}
+
+/*
+ * FUNCTION : utf8TrimLength
+ *
+ * DESCRIPTION : This function shortens a cut so it doesn't end part way through a character
+ *
+ * PARAMETERS : const char *text : The text, at least length bytes.
+ *              size_t length : Where the cut would be.
+ *
+ * RETURNS : size_t : Where the cut should be (length, or up to three bytes before it).
+ */
+size_t utf8TrimLength(const char *text, size_t length)
+{
+    if (length == 0)
+    {
+        return 0;
+    }
+    size_t characterStart = utf8LastCharacterStart(text, length);
+    unsigned char lead = ((const unsigned char *)text)[characterStart];
+    size_t sequenceLength = lead >= 0xf0 ? 4 : lead >= 0xe0 ? 3 : lead >= 0xc0 ? 2 : 1;
+    return length - characterStart < sequenceLength ? characterStart : length;
+}
+
+/*
+ * FUNCTION : utf8LastCharacterStart
+ *
+ * DESCRIPTION : This function finds where the last character of some text starts (for deleting it)
+ *
+ * PARAMETERS : const char *text : The text.
+ *              size_t length : Its length in bytes.
+ *
+ * RETURNS : size_t : Offset of the last character, 0 for empty text.
+ */
+size_t utf8LastCharacterStart(const char *text, size_t length)
+{
+    const unsigned char *bytes = (const unsigned char *)text;
+    size_t characterStart = length;
+    while (characterStart > 0 && length - characterStart < UTF8_MAX_BYTES)
+    {
+        characterStart--;
+        if ((bytes[characterStart] & 0xc0) != 0x80)
+        {
+            return characterStart;
+        }
+    }
+    // Only continuation bytes: treat the last one as a character of its own
+    return length > 0 ? length - 1 : 0;
+}
@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+# Writes Common/inc/utf8-width-table.h: the code points a terminal draws in no columns (combining marks, format
+# characters) and in two (East Asian wide and fullwidth), as packed ranges for utf8CodepointWidth to search.
+# Run from the top of the tree (make width-tables) when moving to a newer Unicode version.
+import sys
+import unicodedata
+
+LENGTH_BITS = 11                      # Must match UTF8_RANGE_LENGTH_BITS in utf8.h
+MAX_LENGTH = (1 << LENGTH_BITS) - 1
+
+
+def is_zero_width(codepoint):
+    if codepoint == 0x00AD:
+        # Soft hyphen is shown as a hyphen
+        return False
+    if 0x1160 <= codepoint <= 0x11FF or codepoint == 0x200B:
+        # Hangul vowels and finals join the syllable before them
+        return True
+    return unicodedata.category(chr(codepoint)) in ('Mn', 'Me', 'Cf')
+
+
+# Unassigned code points here are reserved for ideographs and default to wide
+DEFAULT_WIDE = ((0x3400, 0x4DBF), (0x4E00, 0x9FFF), (0xF900, 0xFAFF), (0x20000, 0x2FFFD), (0x30000, 0x3FFFD))
+
+
+def is_wide(codepoint):
+    if unicodedata.category(chr(codepoint)) == 'Cn':
+        return any(first <= codepoint <= last for first, last in DEFAULT_WIDE)
+    return unicodedata.east_asian_width(chr(codepoint)) in ('W', 'F')
+
+
+def ranges(predicate):
+    found = []
+    start = None
+    for codepoint in range(0x110000 + 1):
+        matches = codepoint <= 0x10FFFF and not 0xD800 <= codepoint <= 0xDFFF and predicate(codepoint)
+        if matches and start is None:
+            start = codepoint
+        elif not matches and start is not None:
+            last = codepoint - 1
+            while last - start > MAX_LENGTH:
+                found.append((start, start + MAX_LENGTH))
+                start += MAX_LENGTH + 1
+            found.append((start, last))
+            start = None
+    return found
+
+
+def table(name, found):
+    lines = ['static const Utf8WidthRange %s[] = {' % name]
+    row = []
+    for first, last in found:
+        row.append('UTF8_RANGE(0x%05X, 0x%05X)' % (first, last))
+        if len(row) == 4:
+            lines.append('    ' + ', '.join(row) + ',')
+            row = []
+    if row:
+        lines.append('    ' + ', '.join(row) + ',')
+    lines.append('};')
+    return '\n'.join(lines)
+
+
+zero_width = ranges(is_zero_width)
+wide = ranges(is_wide)
+output = sys.stdout if len(sys.argv) < 2 else open(sys.argv[1], 'w')
+output.write('''#ifndef UTF8_WIDTH_TABLE_H
+#define UTF8_WIDTH_TABLE_H
+
+// Generated by Common/tools/generate-width-table.py from Unicode %s, do not edit.
+// Only utf8.c includes this: %d zero width ranges and %d wide ranges, four bytes each.
+
+#include "utf8.h"
+
+%s
+
+%s
+
+#endif // UTF8_WIDTH_TABLE_H
+''' % (unicodedata.unidata_version, len(zero_width), len(wide),
+       table('utf8ZeroWidthRanges', zero_width), table('utf8WideRanges', wide)))
@@ -0,0 +1,91 @@
+#ifndef CHAT_BENCH_H
+#define CHAT_BENCH_H
+
+/*
+ * chat-bench: per-message cost of the hot functions on the chat path, measured in process over generated message
+ * corpora of several sizes. Each case is warmed up, then timed over several repetitions; the best ns/op is kept
+ * along with the heap allocations per op. The whole set is run a few rounds, interleaved so a slow patch of the
+ * machine doesn't land on one case, and each case reports its median round and the spread between its rounds.
+ * Results can be saved as a baseline and later runs on the same machine compared against it; the comparison only
+ * reports unless asked to fail.
+ * With -latencyADDRESS it instead measures broadcast latency against a running server: how long a chat message
+ * takes to come back to its sender as a broadcast.
+ */
+
+#include "../../chat-client/inc/chat-client-library.h"
+#include "../../chat-server/inc/protocol.h"
+#include "../../chat-server/inc/content-filter.h"
+#include "../../Common/inc/scan.h"
+#include "../../Common/inc/lz.h"
+#include <limits.h>
+#include <netinet/tcp.h>
+
+// Defines needed by the types below
+#define BENCH_CORPUS_SIZE 256      // Messages in each size class (cases cycle through them)
+#define BENCH_NAME_SIZE 32         // case/class
+#define BENCH_MAX_RESULTS 64
+#define BENCH_BATCH_LINES 32       // Broadcast lines in the batch the compressor is run on
+
+// Messages of one size class, in every form the cases need
+typedef struct
+{
+    const char *name;
+    int minLength;                 // Message text length range
+    int maxLength;
+    char texts[BENCH_CORPUS_SIZE][MAX_PROTOL_MESSAGE_SIZE];   // What the user typed
+    char frames[BENCH_CORPUS_SIZE][MAX_PROTOL_MESSAGE_SIZE];  // The client frame carrying it
+    char lines[BENCH_CORPUS_SIZE][MAX_PROTOL_MESSAGE_SIZE];   // The broadcast line the server makes of it
+    ProtocolMessage parsed[BENCH_CORPUS_SIZE];
+    char batch[BENCH_BATCH_LINES * MAX_PROTOL_MESSAGE_SIZE]; // Lines as a replay sends them, for the compressor
+    size_t batchLength;
+} BenchCorpus;
+
+// One function under measurement. run does one op on message index of a corpus.
+typedef struct
+{
+    const char *name;
+    int maxLength;                 // Longest message it makes sense on (split only sees what a client can type)
+    void (*run)(BenchCorpus *corpus, int index);
+} BenchCase;
+
+// What one case measured on one size class
+typedef struct
+{
+    char name[BENCH_NAME_SIZE];
+    double nsPerOp;                // Fastest repetition (the one least disturbed by the rest of the machine)
+    double allocationsPerOp;
+    double spreadPercent;          // How much slower the slowest round was than the fastest (run-to-run noise)
+} BenchResult;
+
+// Function prototypes
+void buildCorpus(BenchCorpus *corpus, unsigned int seed);
+int loadBenchFilter(void);
+BenchResult runBenchCase(const BenchCase *benchCase, BenchCorpus *corpus);
+BenchResult combineRounds(const BenchResult *rounds, int roundCount);
+int saveBaseline(const char *path, const BenchResult *results, int resultCount);
+int compareBaseline(const char *path, const BenchResult *results, int resultCount, double regressionPercent);
+int runLatencyProbe(const char *serverAddress, int sampleCount);
+
+// Defines
+#define BENCH_WARMUP_MS 50                 // Untimed running before the repetitions (caches, branch predictors, CPU clock)
+#define BENCH_REPETITIONS 15               // Timed runs per case, the fastest is reported
+#define BENCH_ROUNDS 3                     // Times the whole set is run (without -rounds), the median round is reported
+#define BENCH_MAX_ROUNDS 15
+#define BENCH_MIN_RUN_MS 10                // Each timed run is made at least this long
+#define BENCH_REGRESSION_PERCENT 25        // Slowdown allowed on top of both runs' spread (without -regression)
+#define BENCH_ALLOCATION_SLACK 0.01        // Allocations per op allowed over the baseline
+#define BENCH_SAVE_SWITCH "-save"          // -savePATH: write the results as the new baseline
+#define BENCH_BASELINE_SWITCH "-baseline"  // -baselinePATH: compare against a saved baseline
+#define BENCH_REGRESSION_SWITCH "-regression" // -regressionPERCENT: slowdown allowed before a case counts as regressed
+#define BENCH_STRICT_SWITCH "-strict"      // Exit 1 when a case regressed (the comparison only reports without it)
+#define BENCH_ROUNDS_SWITCH "-rounds"      // -roundsN: times the whole set is run
+#define BENCH_FILTER_PATTERNS 64           // Patterns in the content filter list the filter case runs with
+#define BENCH_LATENCY_SWITCH "-latency"    // -latencyADDRESS: measure broadcast latency against that server instead
+#define BENCH_SAMPLES_SWITCH "-samples"    // -samplesN: messages the latency probe times (BENCH_LATENCY_SAMPLES without it)
+#define BENCH_LATENCY_SAMPLES 200
+#define BENCH_LATENCY_SENDERS 8            // Connections the probe's messages take turns on
+#define BENCH_LATENCY_INTERVAL_MS 30       // Gap between messages, keeps every sender under the server's rate limit
+#define BENCH_LATENCY_TIMEOUT_MS 1000      // A message not back by then counts as lost
+#define BENCH_LATENCY_BUFFER_SIZE 4096
+
+#endif // CHAT_BENCH_H
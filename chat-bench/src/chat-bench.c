@@ -0,0 +1,794 @@
+#include "../inc/chat-bench.h"
+
+// Heap allocations made by the process so far (every one of them goes through the wrappers below)
+static unsigned long allocationCount = 0;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+
+/*
+ * FUNCTION : malloc
+ *
+ * DESCRIPTION : This function counts an allocation and hands it to the C library. Defining malloc, calloc and
+ * realloc here puts them in front of the C library's for the whole process, the code under test included.
+ *
+ * PARAMETERS : size_t size : Bytes wanted.
+ *
+ * RETURNS : void * : The memory, or NULL.
+ */
+void *malloc(size_t size)
+{
+    __atomic_add_fetch(&allocationCount, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+/*
+ * FUNCTION : calloc
+ *
+ * DESCRIPTION : This function counts an allocation and hands it to the C library (see malloc)
+ *
+ * PARAMETERS : size_t count : Number of elements.
+ *              size_t size : Bytes in each.
+ *
+ * RETURNS : void * : The zeroed memory, or NULL.
+ */
+void *calloc(size_t count, size_t size)
+{
+    __atomic_add_fetch(&allocationCount, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+/*
+ * FUNCTION : realloc
+ *
+ * DESCRIPTION : This function counts an allocation and hands it to the C library (see malloc)
+ *
+ * PARAMETERS : void *pointer : Memory to resize, or NULL.
+ *              size_t size : Bytes wanted.
+ *
+ * RETURNS : void * : The memory, or NULL.
+ */
+void *realloc(void *pointer, size_t size)
+{
+    __atomic_add_fetch(&allocationCount, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(pointer, size);
+}
+
+// Words the generated messages are made of, the first few are also in the filter's pattern list
+static const char *corpusWords[] = {
+    "darn", "heck", "spam", "scam", "lol", "ok", "yes", "no", "the", "a", "is", "on", "at", "shift", "change", "meeting",
+    "server", "client", "message", "tonight", "tomorrow", "anyone", "around", "coffee", "deploy", "rollback", "ticket",
+    "queue", "latency", "hello", "thanks", "see", "you", "later", "brb", "afk", "what", "when", "where", "why", "how",
+    ">>", "->", ":)", "!!", "??", "https://example.com/a/very/long/path/without/any/spaces/in/it", "|", "...",
+};
+
+// Size classes of message text (the longest still fits a frame of MAX_PROTOL_MESSAGE_SIZE)
+static BenchCorpus corpora[] = {
+    {.name = "short", .minLength = 1, .maxLength = 20},
+    {.name = "medium", .minLength = 21, .maxLength = 40},
+    {.name = "long", .minLength = 41, .maxLength = 80},
+    {.name = "max", .minLength = 81, .maxLength = 100},
+};
+
+/*
+ * FUNCTION : monotonicNanoseconds
+ *
+ * DESCRIPTION : This function reads the monotonic clock the runs are timed with
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : long long : Nanoseconds since an arbitrary point.
+ */
+static long long monotonicNanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/*
+ * FUNCTION : nextRandom
+ *
+ * DESCRIPTION : This function steps a xorshift generator, so every run measures the same corpora
+ *
+ * PARAMETERS : unsigned int *state : The generator (never 0).
+ *
+ * RETURNS : unsigned int : The next number.
+ */
+static unsigned int nextRandom(unsigned int *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/*
+ * FUNCTION : buildCorpus
+ *
+ * DESCRIPTION : This function fills a size class with messages made of random words (and the odd arrow, separator
+ * or long unbroken link), cut to a random length in the class's range, and the frames and lines made from them
+ *
+ * PARAMETERS : BenchCorpus *corpus : The size class, its name and length range set.
+ *              unsigned int seed : Generator seed (not 0).
+ *
+ * RETURNS : void
+ */
+void buildCorpus(BenchCorpus *corpus, unsigned int seed)
+{
+    static const char *addresses[] = {"127.0.0.1", "192.168.1.20", "10.0.0.7", "172.16.254.3"};
+    static const char *userNames[] = {"alice", "bob", "carol", "dave", "eve"};
+    size_t wordCount = sizeof(corpusWords) / sizeof(corpusWords[0]);
+
+    for (int i = 0; i < BENCH_CORPUS_SIZE; i++)
+    {
+        int length = corpus->minLength + (int)(nextRandom(&seed) % (corpus->maxLength - corpus->minLength + 1));
+        char *text = corpus->texts[i];
+        int textLength = 0;
+        while (textLength < length)
+        {
+            textLength += snprintf(text + textLength, MAX_PROTOL_MESSAGE_SIZE - textLength, "%s%s", textLength > 0 ? " " : "",
+                                   corpusWords[nextRandom(&seed) % wordCount]);
+            if (textLength >= MAX_PROTOL_MESSAGE_SIZE)
+            {
+                textLength = MAX_PROTOL_MESSAGE_SIZE - 1;
+            }
+        }
+        text[length] = '\0';
+
+        snprintf(corpus->frames[i], sizeof(corpus->frames[i]), "%s|%s|%d|%s", addresses[nextRandom(&seed) % 4],
+                 userNames[nextRandom(&seed) % 5], 0, text);
+        parseProtocolMessage(corpus->frames[i], &corpus->parsed[i]);
+        formatBroadcastMessage(&corpus->parsed[i], corpus->lines[i], sizeof(corpus->lines[i]));
+    }
+
+    // What a replay of these lines looks like on the wire
+    corpus->batchLength = 0;
+    for (int i = 0; i < BENCH_BATCH_LINES; i++)
+    {
+        corpus->batchLength += snprintf(corpus->batch + corpus->batchLength, sizeof(corpus->batch) - corpus->batchLength, "%s%d|%lld|%s%c",
+                                        PROTOCOL_MESSAGE, 1000 + i, 1700000000000LL + i * 250, corpus->lines[i], PROTOCOL_FRAME_END);
+    }
+}
+
+/*
+ * FUNCTION : loadBenchFilter
+ *
+ * DESCRIPTION : This function loads a content filter list of BENCH_FILTER_PATTERNS patterns: the filter words the
+ * corpora use, then made up ones so the automaton has a realistic number of states
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : int : 0 on success, -1 on error.
+ */
+int loadBenchFilter(void)
+{
+    char path[] = "/tmp/chat-bench-filter-XXXXXX";
+    int patternFile = mkstemp(path);
+    if (patternFile < 0)
+    {
+        return -1;
+    }
+    FILE *patterns = fdopen(patternFile, "w");
+    if (patterns == NULL)
+    {
+        close(patternFile);
+        unlink(path);
+        return -1;
+    }
+    fprintf(patterns, "darn\nheck\n%sspam\n%sscam\n", CONTENT_FILTER_BLOCK_PREFIX, CONTENT_FILTER_BLOCK_PREFIX);
+    unsigned int seed = 2024;
+    for (int i = 4; i < BENCH_FILTER_PATTERNS; i++)
+    {
+        char pattern[9];
+        int patternLength = 4 + (int)(nextRandom(&seed) % 5);
+        for (int j = 0; j < patternLength; j++)
+        {
+            pattern[j] = (char)('a' + nextRandom(&seed) % 26);
+        }
+        pattern[patternLength] = '\0';
+        fprintf(patterns, "%s\n", pattern);
+    }
+    fclose(patterns);
+
+    int loadResult = contentFilterLoad(path);
+    unlink(path);
+    return loadResult;
+}
+
+/*
+ * FUNCTION : benchSplit
+ *
+ * DESCRIPTION : One op of the split case: the client cutting a typed message into its two frames
+ *
+ * PARAMETERS : BenchCorpus *corpus : The size class.
+ *              int index : Message to use.
+ *
+ * RETURNS : void
+ */
+static void benchSplit(BenchCorpus *corpus, int index)
+{
+    static char firstPart[MAX_PROTOL_MESSAGE_SIZE];
+    static char secondPart[MAX_PROTOL_MESSAGE_SIZE];
+    splitMessage(corpus->texts[index], firstPart, secondPart);
+}
+
+/*
+ * FUNCTION : benchParse
+ *
+ * DESCRIPTION : One op of the parse case: the server splitting a client frame into its fields
+ *
+ * PARAMETERS : BenchCorpus *corpus : The size class.
+ *              int index : Message to use.
+ *
+ * RETURNS : void
+ */
+static void benchParse(BenchCorpus *corpus, int index)
+{
+    static ProtocolMessage message;
+    parseProtocolMessage(corpus->frames[index], &message);
+}
+
+/*
+ * FUNCTION : benchFormat
+ *
+ * DESCRIPTION : One op of the format case: the server building the broadcast line
+ *
+ * PARAMETERS : BenchCorpus *corpus : The size class.
+ *              int index : Message to use.
+ *
+ * RETURNS : void
+ */
+static void benchFormat(BenchCorpus *corpus, int index)
+{
+    static char line[MAX_PROTOL_MESSAGE_SIZE];
+    formatBroadcastMessage(&corpus->parsed[index], line, sizeof(line));
+}
+
+/*
+ * FUNCTION : benchArrows
+ *
+ * DESCRIPTION : One op of the arrow case: the client turning the arrows of its own line around for display. The
+ * line is left as it was turned, the next op on it turns it back, so no copy is timed.
+ *
+ * PARAMETERS : BenchCorpus *corpus : The size class.
+ *              int index : Message to use.
+ *
+ * RETURNS : void
+ */
+static void benchArrows(BenchCorpus *corpus, int index)
+{
+    static unsigned char isTurned[BENCH_CORPUS_SIZE * 4];
+    unsigned char *turned = &isTurned[(corpus - corpora) * BENCH_CORPUS_SIZE + index];
+    char *line = corpus->lines[index];
+    scanReplacePairs(line, strlen(line), *turned ? "<<" : ">>", *turned ? ">>" : "<<");
+    *turned = !*turned;
+}
+
+/*
+ * FUNCTION : benchFilter
+ *
+ * DESCRIPTION : One op of the filter case: the content filter over a message text (copied first, masking changes
+ * it in place)
+ *
+ * PARAMETERS : BenchCorpus *corpus : The size class.
+ *              int index : Message to use.
+ *
+ * RETURNS : void
+ */
+static void benchFilter(BenchCorpus *corpus, int index)
+{
+    static char text[MAX_PROTOL_MESSAGE_SIZE];
+    memcpy(text, corpus->texts[index], sizeof(text));
+    contentFilterApply(text);
+}
+
+/*
+ * FUNCTION : benchCompress
+ *
+ * DESCRIPTION : One op of the compress case: a batch of BENCH_BATCH_LINES replayed lines through the connection
+ * compressor (index is not used, the batch is the same every time)
+ *
+ * PARAMETERS : BenchCorpus *corpus : The size class.
+ *              int index : Not used.
+ *
+ * RETURNS : void
+ */
+static void benchCompress(BenchCorpus *corpus, int index)
+{
+    static LzWindow window;
+    static int isWindowReady = 0;
+    static char compressed[LZ_COMPRESS_BOUND(BENCH_BATCH_LINES * MAX_PROTOL_MESSAGE_SIZE)];
+    (void)index;
+    if (!isWindowReady)
+    {
+        lzWindowInitialize(&window);
+        isWindowReady = 1;
+    }
+    lzCompress(&window, corpus->batch, corpus->batchLength, compressed, sizeof(compressed));
+}
+
+// The cases, in the order they are run
+static const BenchCase benchCases[] = {
+    {"split", CLIENT_MSG_PART_LENGTH * 2, benchSplit},
+    {"parse", MAX_PROTOL_MESSAGE_SIZE, benchParse},
+    {"format", MAX_PROTOL_MESSAGE_SIZE, benchFormat},
+    {"arrows", MAX_PROTOL_MESSAGE_SIZE, benchArrows},
+    {"filter", MAX_PROTOL_MESSAGE_SIZE, benchFilter},
+    {"compress", MAX_PROTOL_MESSAGE_SIZE, benchCompress},
+};
+
+/*
+ * FUNCTION : timeIterations
+ *
+ * DESCRIPTION : This function runs a case a number of times, cycling through the corpus
+ *
+ * PARAMETERS : const BenchCase *benchCase : The case.
+ *              BenchCorpus *corpus : The size class.
+ *              long iterations : Ops to run.
+ *
+ * RETURNS : long long : Nanoseconds they took.
+ */
+static long long timeIterations(const BenchCase *benchCase, BenchCorpus *corpus, long iterations)
+{
+    long long startNs = monotonicNanoseconds();
+    for (long i = 0; i < iterations; i++)
+    {
+        benchCase->run(corpus, (int)(i & (BENCH_CORPUS_SIZE - 1)));
+    }
+    return monotonicNanoseconds() - startNs;
+}
+
+/*
+ * FUNCTION : compareDoubles
+ *
+ * DESCRIPTION : qsort comparison for the repetition times
+ *
+ * PARAMETERS : const void *first : A double.
+ *              const void *second : Another.
+ *
+ * RETURNS : int : Negative, zero or positive as first is less than, equal to or more than second.
+ */
+static int compareDoubles(const void *first, const void *second)
+{
+    double difference = *(const double *)first - *(const double *)second;
+    return difference < 0 ? -1 : difference > 0;
+}
+
+/*
+ * FUNCTION : runBenchCase
+ *
+ * DESCRIPTION : This function measures one case on one size class. The op count per run is doubled until a run
+ * takes BENCH_MIN_RUN_MS, the case is then run untimed for BENCH_WARMUP_MS, and then timed BENCH_REPETITIONS times.
+ *
+ * PARAMETERS : const BenchCase *benchCase : The case.
+ *              BenchCorpus *corpus : The size class.
+ *
+ * RETURNS : BenchResult : Best ns/op and allocations/op.
+ */
+BenchResult runBenchCase(const BenchCase *benchCase, BenchCorpus *corpus)
+{
+    BenchResult result;
+    snprintf(result.name, sizeof(result.name), "%s/%s", benchCase->name, corpus->name);
+
+    long iterations = BENCH_CORPUS_SIZE;
+    while (timeIterations(benchCase, corpus, iterations) < BENCH_MIN_RUN_MS * 1000000LL)
+    {
+        iterations *= 2;
+    }
+    long long warmupEndNs = monotonicNanoseconds() + BENCH_WARMUP_MS * 1000000LL;
+    while (monotonicNanoseconds() < warmupEndNs)
+    {
+        timeIterations(benchCase, corpus, iterations);
+    }
+
+    // The fastest repetition is kept: interference from the rest of the machine only ever makes a run slower
+    double nsPerOp[BENCH_REPETITIONS];
+    unsigned long allocationsBefore = __atomic_load_n(&allocationCount, __ATOMIC_RELAXED);
+    for (int i = 0; i < BENCH_REPETITIONS; i++)
+    {
+        nsPerOp[i] = (double)timeIterations(benchCase, corpus, iterations) / iterations;
+    }
+    unsigned long allocations = __atomic_load_n(&allocationCount, __ATOMIC_RELAXED) - allocationsBefore;
+
+    qsort(nsPerOp, BENCH_REPETITIONS, sizeof(double), compareDoubles);
+    result.nsPerOp = nsPerOp[0];
+    result.allocationsPerOp = (double)allocations / ((double)iterations * BENCH_REPETITIONS);
+    result.spreadPercent = 0;
+    return result;
+}
+
+/*
+ * FUNCTION : combineRounds
+ *
+ * DESCRIPTION : This function turns one case's results from every round into the one that is reported: the median
+ * round's ns/op, and how far apart the fastest and slowest rounds were
+ *
+ * PARAMETERS : const BenchResult *rounds : The case's result in each round.
+ *              int roundCount : How many rounds.
+ *
+ * RETURNS : BenchResult : Median ns/op, the most allocations/op any round made, and the spread.
+ */
+BenchResult combineRounds(const BenchResult *rounds, int roundCount)
+{
+    BenchResult result = rounds[0];
+    double nsPerOp[BENCH_MAX_ROUNDS];
+    for (int i = 0; i < roundCount; i++)
+    {
+        nsPerOp[i] = rounds[i].nsPerOp;
+        if (rounds[i].allocationsPerOp > result.allocationsPerOp)
+        {
+            result.allocationsPerOp = rounds[i].allocationsPerOp;
+        }
+    }
+    qsort(nsPerOp, roundCount, sizeof(double), compareDoubles);
+    result.nsPerOp = nsPerOp[roundCount / 2];
+    result.spreadPercent = (nsPerOp[roundCount - 1] - nsPerOp[0]) * 100 / nsPerOp[0];
+    return result;
+}
+
+/*
+ * FUNCTION : saveBaseline
+ *
+ * DESCRIPTION : This function writes results to a baseline file, one "name ns/op allocations/op spread%" line each.
+ * The numbers only mean something on the machine that saved them.
+ *
+ * PARAMETERS : const char *path : The file.
+ *              const BenchResult *results : The results.
+ *              int resultCount : How many.
+ *
+ * RETURNS : int : 0 on success, -1 on error.
+ */
+int saveBaseline(const char *path, const BenchResult *results, int resultCount)
+{
+    FILE *baseline = fopen(path, "w");
+    if (baseline == NULL)
+    {
+        return -1;
+    }
+    fprintf(baseline, "# chat-bench baseline (this machine only): case/class ns/op allocations/op spread%%\n");
+    for (int i = 0; i < resultCount; i++)
+    {
+        fprintf(baseline, "%s %.2f %.3f %.1f\n", results[i].name, results[i].nsPerOp, results[i].allocationsPerOp, results[i].spreadPercent);
+    }
+    return fclose(baseline) == 0 ? 0 : -1;
+}
+
+/*
+ * FUNCTION : compareBaseline
+ *
+ * DESCRIPTION : This function prints each result next to its baseline. A case is a regression when it allocates
+ * more per op, or is slower by more than regressionPercent on top of the spread of both runs: a change inside the
+ * noise the repetitions showed says nothing about the code.
+ *
+ * PARAMETERS : const char *path : The baseline file.
+ *              const BenchResult *results : The results.
+ *              int resultCount : How many.
+ *              double regressionPercent : Slowdown allowed.
+ *
+ * RETURNS : int : Number of regressions, or -1 if the baseline can't be read.
+ */
+int compareBaseline(const char *path, const BenchResult *results, int resultCount, double regressionPercent)
+{
+    FILE *baseline = fopen(path, "r");
+    if (baseline == NULL)
+    {
+        return -1;
+    }
+    BenchResult saved[BENCH_MAX_RESULTS];
+    int savedCount = 0;
+    char line[128];
+    while (savedCount < BENCH_MAX_RESULTS && fgets(line, sizeof(line), baseline) != NULL)
+    {
+        if (line[0] != '#' &&
+            sscanf(line, "%31s %lf %lf", saved[savedCount].name, &saved[savedCount].nsPerOp, &saved[savedCount].allocationsPerOp) == 3)
+        {
+            // Baselines saved before the spread was recorded count as noiseless
+            if (sscanf(line, "%*s %*f %*f %lf", &saved[savedCount].spreadPercent) != 1)
+            {
+                saved[savedCount].spreadPercent = 0;
+            }
+            savedCount++;
+        }
+    }
+    fclose(baseline);
+
+    int regressionCount = 0;
+    printf("\n%-20s %12s %12s %9s %9s\n", "vs baseline", "ns/op", "allocs/op", "change", "allowed");
+    for (int i = 0; i < resultCount; i++)
+    {
+        const BenchResult *match = NULL;
+        for (int j = 0; j < savedCount && match == NULL; j++)
+        {
+            match = strcmp(saved[j].name, results[i].name) == 0 ? &saved[j] : NULL;
+        }
+        if (match == NULL)
+        {
+            printf("%-20s %12s %12s %9s %9s\n", results[i].name, "-", "-", "new", "-");
+            continue;
+        }
+        double change = (results[i].nsPerOp - match->nsPerOp) * 100 / match->nsPerOp;
+        double allowedPercent = regressionPercent + match->spreadPercent + results[i].spreadPercent;
+        int isRegression = change > allowedPercent || results[i].allocationsPerOp > match->allocationsPerOp + BENCH_ALLOCATION_SLACK;
+        printf("%-20s %12.1f %12.3f %+8.1f%% %8.1f%%%s\n", results[i].name, match->nsPerOp, match->allocationsPerOp, change,
+               allowedPercent, isRegression ? "  REGRESSION" : "");
+        regressionCount += isRegression;
+    }
+    return regressionCount;
+}
+
+/*
+ * FUNCTION : waitForBroadcast
+ *
+ * DESCRIPTION : This function reads what the server sends on a connection until a line containing marker arrives
+ *
+ * PARAMETERS : Transport *transport : The connection.
+ *              const char *marker : Text the wanted line contains.
+ *              long long deadlineNs : When to give up.
+ *
+ * RETURNS : int : 0 when the line came, -1 on timeout or a closed connection.
+ */
+static int waitForBroadcast(Transport *transport, const char *marker, long long deadlineNs)
+{
+    char readBuffer[BENCH_LATENCY_BUFFER_SIZE];
+    size_t bufferedLength = 0;
+    while (1)
+    {
+        ssize_t receivedBytes = transportReceive(transport, readBuffer + bufferedLength, sizeof(readBuffer) - 1 - bufferedLength, MSG_DONTWAIT);
+        if (receivedBytes == 0 || (receivedBytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            return -1;
+        }
+        if (receivedBytes < 0)
+        {
+            long long waitMs = (deadlineNs - monotonicNanoseconds()) / 1000000;
+            struct pollfd socketPoll = {transport->socket, POLLIN, 0};
+            if (waitMs < 0 || poll(&socketPoll, 1, (int)waitMs + 1) == 0)
+            {
+                return -1;
+            }
+            continue;
+        }
+
+        // Look through the complete lines, keep the partial one at the front
+        bufferedLength += receivedBytes;
+        readBuffer[bufferedLength] = '\0';
+        char *lineStart = readBuffer;
+        char *lineEnd;
+        while ((lineEnd = memchr(lineStart, PROTOCOL_FRAME_END, readBuffer + bufferedLength - lineStart)) != NULL)
+        {
+            *lineEnd = '\0';
+            if (strstr(lineStart, marker) != NULL)
+            {
+                return 0;
+            }
+            lineStart = lineEnd + 1;
+        }
+        bufferedLength -= lineStart - readBuffer;
+        memmove(readBuffer, lineStart, bufferedLength);
+        if (bufferedLength >= sizeof(readBuffer) - 1)
+        {
+            bufferedLength = 0;
+        }
+    }
+}
+
+/*
+ * FUNCTION : runLatencyProbe
+ *
+ * DESCRIPTION : This function times chat messages from being sent to coming back to their sender as a broadcast,
+ * one at a time, taking turns over BENCH_LATENCY_SENDERS connections, and prints the distribution. Every sender
+ * also hears the others' messages, which are read and thrown away between samples.
+ *
+ * PARAMETERS : const char *serverAddress : Anything the client accepts.
+ *              int sampleCount : Messages to time.
+ *
+ * RETURNS : int : 0 on success, -1 if the probe couldn't connect or no message came back.
+ */
+int runLatencyProbe(const char *serverAddress, int sampleCount)
+{
+    Transport senders[BENCH_LATENCY_SENDERS];
+    for (int i = 0; i < BENCH_LATENCY_SENDERS; i++)
+    {
+        if (connectToServer(serverAddress, &senders[i]) < 0)
+        {
+            perror("connect failed");
+            while (--i >= 0)
+            {
+                transportClose(&senders[i]);
+            }
+            return -1;
+        }
+        // A small frame must go out at once, and a resume past everything means nothing is replayed to us
+        int socketOption = 1;
+        if (senders[i].kind == TRANSPORT_TCP)
+        {
+            setsockopt(senders[i].socket, IPPROTO_TCP, TCP_NODELAY, &socketOption, sizeof(socketOption));
+        }
+        char resumeFrame[64];
+        int resumeLength = snprintf(resumeFrame, sizeof(resumeFrame), "%s%lu%c", PROTOCOL_RESUME, ULONG_MAX, PROTOCOL_FRAME_END);
+        transportSend(&senders[i], resumeFrame, resumeLength, 0);
+    }
+
+    double *latencies = malloc(sampleCount * sizeof(double));
+    int latencyCount = 0;
+    int lostCount = 0;
+    char drainBuffer[BENCH_LATENCY_BUFFER_SIZE];
+    for (int i = 0; latencies != NULL && i < sampleCount; i++)
+    {
+        Transport *sender = &senders[i % BENCH_LATENCY_SENDERS];
+        char frame[MAX_PROTOL_MESSAGE_SIZE];
+        char marker[32];
+        snprintf(marker, sizeof(marker), "latency #%d#", i);
+        int frameLength = snprintf(frame, sizeof(frame), "127.0.0.1|bench|0|%s%c", marker, PROTOCOL_FRAME_END);
+
+        long long sentNs = monotonicNanoseconds();
+        if (transportSend(sender, frame, frameLength, 0) == frameLength &&
+            waitForBroadcast(sender, marker, sentNs + BENCH_LATENCY_TIMEOUT_MS * 1000000LL) == 0)
+        {
+            latencies[latencyCount++] = (monotonicNanoseconds() - sentNs) / 1000.0;
+        }
+        else
+        {
+            lostCount++;
+        }
+
+        for (int j = 0; j < BENCH_LATENCY_SENDERS; j++)
+        {
+            while (transportReceive(&senders[j], drainBuffer, sizeof(drainBuffer), MSG_DONTWAIT) > 0)
+            {
+            }
+        }
+        struct timespec intervalEnd;
+        long long intervalEndNs = sentNs + BENCH_LATENCY_INTERVAL_MS * 1000000LL;
+        intervalEnd.tv_sec = intervalEndNs / 1000000000LL;
+        intervalEnd.tv_nsec = intervalEndNs % 1000000000LL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &intervalEnd, NULL);
+    }
+    for (int i = 0; i < BENCH_LATENCY_SENDERS; i++)
+    {
+        transportClose(&senders[i]);
+    }
+    if (latencyCount == 0)
+    {
+        free(latencies);
+        printf("No broadcast came back from %s (%d lost)\n", serverAddress, lostCount);
+        return -1;
+    }
+
+    qsort(latencies, latencyCount, sizeof(double), compareDoubles);
+    printf("broadcast latency (us) samples=%d lost=%d min=%.1f p50=%.1f p90=%.1f p99=%.1f max=%.1f\n", latencyCount, lostCount,
+           latencies[0], latencies[latencyCount / 2], latencies[latencyCount * 9 / 10], latencies[latencyCount * 99 / 100],
+           latencies[latencyCount - 1]);
+    free(latencies);
+    return 0;
+}
+
+/*
+ * FUNCTION : main
+ *
+ * DESCRIPTION : The main function builds the corpora, runs every case on every size class it makes sense on and
+ * prints the results, then saves them as the baseline (-savePATH) or checks them against it (-baselinePATH, which
+ * only fails the run with -strict).
+ * With -latencyADDRESS it runs the broadcast latency probe instead.
+ *
+ * PARAMETERS : int argc : The number of command-line arguments.
+ *              char *argv[] : The array of command-line argument strings.
+ *
+ * RETURNS : int : 0 for success, 1 if something failed or (with -strict) a case regressed.
+ */
+int main(int argc, char *argv[])
+{
+    const char *savePath = NULL;
+    const char *baselinePath = NULL;
+    double regressionPercent = BENCH_REGRESSION_PERCENT;
+    int isStrict = 0;
+    int roundCount = BENCH_ROUNDS;
+    const char *latencyServer = NULL;
+    int sampleCount = BENCH_LATENCY_SAMPLES;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], BENCH_SAVE_SWITCH, strlen(BENCH_SAVE_SWITCH)) == 0)
+        {
+            savePath = argv[i] + strlen(BENCH_SAVE_SWITCH);
+        }
+        else if (strncmp(argv[i], BENCH_BASELINE_SWITCH, strlen(BENCH_BASELINE_SWITCH)) == 0)
+        {
+            baselinePath = argv[i] + strlen(BENCH_BASELINE_SWITCH);
+        }
+        else if (strncmp(argv[i], BENCH_REGRESSION_SWITCH, strlen(BENCH_REGRESSION_SWITCH)) == 0)
+        {
+            regressionPercent = atof(argv[i] + strlen(BENCH_REGRESSION_SWITCH));
+        }
+        else if (strcmp(argv[i], BENCH_STRICT_SWITCH) == 0)
+        {
+            isStrict = 1;
+        }
+        else if (strncmp(argv[i], BENCH_ROUNDS_SWITCH, strlen(BENCH_ROUNDS_SWITCH)) == 0 &&
+                 atoi(argv[i] + strlen(BENCH_ROUNDS_SWITCH)) > 0 && atoi(argv[i] + strlen(BENCH_ROUNDS_SWITCH)) <= BENCH_MAX_ROUNDS)
+        {
+            roundCount = atoi(argv[i] + strlen(BENCH_ROUNDS_SWITCH));
+        }
+        else if (strncmp(argv[i], BENCH_LATENCY_SWITCH, strlen(BENCH_LATENCY_SWITCH)) == 0)
+        {
+            latencyServer = argv[i] + strlen(BENCH_LATENCY_SWITCH);
+        }
+        else if (strncmp(argv[i], BENCH_SAMPLES_SWITCH, strlen(BENCH_SAMPLES_SWITCH)) == 0 &&
+                 atoi(argv[i] + strlen(BENCH_SAMPLES_SWITCH)) > 0)
+        {
+            sampleCount = atoi(argv[i] + strlen(BENCH_SAMPLES_SWITCH));
+        }
+        else
+        {
+            printf("Usage: chat-bench [%sPATH] [%sPATH] [%sPERCENT] [%s] [%sN] | %sADDRESS [%sN]\n", BENCH_SAVE_SWITCH,
+                   BENCH_BASELINE_SWITCH, BENCH_REGRESSION_SWITCH, BENCH_STRICT_SWITCH, BENCH_ROUNDS_SWITCH, BENCH_LATENCY_SWITCH,
+                   BENCH_SAMPLES_SWITCH);
+            return 1;
+        }
+    }
+    if (latencyServer != NULL)
+    {
+        return runLatencyProbe(latencyServer, sampleCount) < 0 ? 1 : 0;
+    }
+
+    int corpusCount = sizeof(corpora) / sizeof(corpora[0]);
+    for (int i = 0; i < corpusCount; i++)
+    {
+        buildCorpus(&corpora[i], 0x9e3779b9u + i);
+    }
+    if (loadBenchFilter() < 0)
+    {
+        perror("filter failed");
+        return 1;
+    }
+
+    // Every case once per round, so drift in the machine's speed is shared out rather than landing on one case
+    static BenchResult roundResults[BENCH_MAX_RESULTS][BENCH_MAX_ROUNDS];
+    int resultCount = 0;
+    for (int round = 0; round < roundCount; round++)
+    {
+        printf("Round %d of %d\n", round + 1, roundCount);
+        fflush(stdout);
+        resultCount = 0;
+        for (size_t i = 0; i < sizeof(benchCases) / sizeof(benchCases[0]); i++)
+        {
+            for (int j = 0; j < corpusCount; j++)
+            {
+                if (corpora[j].minLength <= benchCases[i].maxLength)
+                {
+                    roundResults[resultCount++][round] = runBenchCase(&benchCases[i], &corpora[j]);
+                }
+            }
+        }
+    }
+
+    BenchResult results[BENCH_MAX_RESULTS];
+    printf("%-20s %12s %12s %9s\n", "case/class", "ns/op", "allocs/op", "spread");
+    for (int i = 0; i < resultCount; i++)
+    {
+        results[i] = combineRounds(roundResults[i], roundCount);
+        printf("%-20s %12.1f %12.3f %8.1f%%\n", results[i].name, results[i].nsPerOp, results[i].allocationsPerOp, results[i].spreadPercent);
+    }
+
+    if (savePath != NULL && saveBaseline(savePath, results, resultCount) < 0)
+    {
+        perror("saving the baseline failed");
+        return 1;
+    }
+    if (baselinePath != NULL)
+    {
+        int regressionCount = compareBaseline(baselinePath, results, resultCount, regressionPercent);
+        if (regressionCount < 0)
+        {
+            printf("No baseline at %s (make bench-baseline saves one)\n", baselinePath);
+            return 0;
+        }
+        if (regressionCount > 0)
+        {
+            printf("%d regression(s) against %s%s\n", regressionCount, baselinePath, isStrict ? "" : " (report only, -strict fails on them)");
+            return isStrict ? 1 : 0;
+        }
+    }
+    return 0;
+}
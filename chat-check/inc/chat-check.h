@@ -0,0 +1,38 @@
+#ifndef CHAT_CHECK_H
+#define CHAT_CHECK_H
+
+/*
+ * chat-check: correctness cases for the text and compression code the client and server share, the edges a chat
+ * corpus never reaches: UTF-8 that must be refused (overlong forms, surrogates, sequences cut short), combining
+ * marks and wide characters where a line is cut at 40 columns, and compressed blocks that are malformed or cut
+ * short. Each case prints ok, or FAIL with what it found, and the run fails if any case does.
+ */
+
+#include "../../chat-client/inc/chat-client-library.h"
+#include "../../Common/inc/utf8.h"
+#include "../../Common/inc/lz.h"
+
+// Defines needed by the types below
+#define CHECK_FAILURE_SIZE 256 // What a failed case says about it
+
+// One case. run returns 0 when everything it checks holds, otherwise -1 with failure set.
+typedef struct
+{
+    const char *name;
+    int (*run)(char *failure);
+} CheckCase;
+
+// Function prototypes
+int checkDecodesAs(const char *bytes, size_t length, size_t expectedLength, char *failure);
+int checkSplitParts(const char *text, const char *expectedFirst, const char *expectedSecond, char *failure);
+int checkPrefix(const char *text, int maxColumns, size_t maxBytes, size_t expectedLength, int expectedColumns, char *failure);
+int checkRoundTrip(LzWindow *compressor, LzWindow *decompressor, const char *block, size_t length, char *failure);
+int checkRefused(const LzWindow *window, const char *compressed, size_t compressedLength, size_t outputSize, char *failure);
+
+// Defines
+#define CHECK_WIDE "\xe4\xb8\xad"     // U+4E2D, two columns
+#define CHECK_ACUTE "\xcc\x81"        // U+0301 COMBINING ACUTE ACCENT, no columns of its own
+#define CHECK_LZ_BLOCK_BYTES 4096     // Largest block the compression cases make
+#define CHECK_LZ_BLOCKS 8             // Blocks the round trip sends through one pair of windows
+
+#endif // CHAT_CHECK_H
@@ -0,0 +1,608 @@
+#include "../inc/chat-check.h"
+
+/*
+ * FUNCTION : describeBytes
+ *
+ * DESCRIPTION : This function writes text out for a failure message, printable ASCII as it is and every other byte
+ * as \xNN, shortening a run of one repeated character to CHARACTERxCOUNT
+ *
+ * PARAMETERS : const char *text : The text.
+ *              size_t length : Its length in bytes.
+ *              char *buffer : Where to write it.
+ *              size_t bufferSize : Size of the buffer.
+ *
+ * RETURNS : const char * : buffer.
+ */
+static const char *describeBytes(const char *text, size_t length, char *buffer, size_t bufferSize)
+{
+    size_t used = 0;
+    buffer[0] = '\0';
+    for (size_t i = 0; i < length && used + 12 < bufferSize;)
+    {
+        size_t runLength = 1;
+        while (i + runLength < length && text[i + runLength] == text[i])
+        {
+            runLength++;
+        }
+        unsigned char byte = (unsigned char)text[i];
+        used += snprintf(buffer + used, bufferSize - used, byte >= 0x20 && byte < 0x7f ? "%c" : "\\x%02x", byte);
+        if (runLength > 3)
+        {
+            used += snprintf(buffer + used, bufferSize - used, "x%zu", runLength);
+            i += runLength;
+        }
+        else
+        {
+            i++;
+        }
+    }
+    return buffer;
+}
+
+/*
+ * FUNCTION : repeatText
+ *
+ * DESCRIPTION : This function appends a piece of text to a buffer a number of times
+ *
+ * PARAMETERS : char *buffer : The buffer, terminated (with room for the result).
+ *              const char *piece : What to append.
+ *              int count : How many times.
+ *
+ * RETURNS : char * : buffer.
+ */
+static char *repeatText(char *buffer, const char *piece, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        strcat(buffer, piece);
+    }
+    return buffer;
+}
+
+/*
+ * FUNCTION : checkDecodesAs
+ *
+ * DESCRIPTION : This function checks how the first character of some bytes decodes, and that the bytes as a whole
+ * are valid exactly when that character is all of them
+ *
+ * PARAMETERS : const char *bytes : The bytes.
+ *              size_t length : How many there are.
+ *              size_t expectedLength : Bytes the first character should take, 0 if it should be refused.
+ *              char *failure : Room for CHECK_FAILURE_SIZE, set when the check fails.
+ *
+ * RETURNS : int : 0 if it holds, -1 if not.
+ */
+int checkDecodesAs(const char *bytes, size_t length, size_t expectedLength, char *failure)
+{
+    char description[CHECK_FAILURE_SIZE];
+    unsigned int codepoint;
+    size_t decodedLength = utf8DecodeNext(bytes, length, &codepoint);
+    int isValid = utf8IsValid(bytes, length);
+    if (decodedLength != expectedLength || isValid != (expectedLength == length))
+    {
+        snprintf(failure, CHECK_FAILURE_SIZE, "%s decoded as %zu bytes (valid %d), expected %zu",
+                 describeBytes(bytes, length, description, sizeof(description)), decodedLength, isValid, expectedLength);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : checkPrefix
+ *
+ * DESCRIPTION : This function checks how much of some text utf8PrefixForWidth says fits
+ *
+ * PARAMETERS : const char *text : The text.
+ *              int maxColumns : Columns available.
+ *              size_t maxBytes : Bytes available.
+ *              size_t expectedLength : Bytes that should fit.
+ *              int expectedColumns : Columns they should take.
+ *              char *failure : Room for CHECK_FAILURE_SIZE, set when the check fails.
+ *
+ * RETURNS : int : 0 if it holds, -1 if not.
+ */
+int checkPrefix(const char *text, int maxColumns, size_t maxBytes, size_t expectedLength, int expectedColumns, char *failure)
+{
+    char description[CHECK_FAILURE_SIZE];
+    int columns;
+    size_t fitLength = utf8PrefixForWidth(text, strlen(text), maxColumns, maxBytes, &columns);
+    if (fitLength != expectedLength || columns != expectedColumns)
+    {
+        snprintf(failure, CHECK_FAILURE_SIZE, "%s in %d columns and %zu bytes: %zu bytes and %d columns fit, expected %zu and %d",
+                 describeBytes(text, strlen(text), description, sizeof(description)), maxColumns, maxBytes, fitLength, columns,
+                 expectedLength, expectedColumns);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : checkSplitParts
+ *
+ * DESCRIPTION : This function checks where splitMessage cuts a line, and that both parts are what the server
+ * accepts: valid UTF-8, within CLIENT_MSG_PART_LENGTH columns and CLIENT_MSG_PART_BYTES bytes, and not starting
+ * with a mark cut off from its character
+ *
+ * PARAMETERS : const char *text : The line.
+ *              const char *expectedFirst : The first part it should give.
+ *              const char *expectedSecond : The second part it should give.
+ *              char *failure : Room for CHECK_FAILURE_SIZE, set when the check fails.
+ *
+ * RETURNS : int : 0 if it holds, -1 if not.
+ */
+int checkSplitParts(const char *text, const char *expectedFirst, const char *expectedSecond, char *failure)
+{
+    char firstPart[CLIENT_MSG_PART_BYTES + 1];
+    char secondPart[CLIENT_MSG_PART_BYTES + 1];
+    char firstDescription[CHECK_FAILURE_SIZE / 2];
+    char secondDescription[CHECK_FAILURE_SIZE / 2];
+    splitMessage(text, firstPart, secondPart);
+
+    const char *parts[2] = {firstPart, secondPart};
+    for (int i = 0; i < 2; i++)
+    {
+        size_t partLength = strlen(parts[i]);
+        unsigned int codepoint = 0;
+        if (partLength > 0)
+        {
+            utf8DecodeNext(parts[i], partLength, &codepoint);
+        }
+        if (!utf8IsValid(parts[i], partLength) || partLength > CLIENT_MSG_PART_BYTES ||
+            utf8DisplayWidth(parts[i], partLength) > CLIENT_MSG_PART_LENGTH || (codepoint >= 0x300 && utf8CodepointWidth(codepoint) == 0))
+        {
+            snprintf(failure, CHECK_FAILURE_SIZE, "part %d is not one the server takes: %s", i + 1,
+                     describeBytes(parts[i], partLength, firstDescription, sizeof(firstDescription)));
+            return -1;
+        }
+    }
+    if (strcmp(firstPart, expectedFirst) != 0 || strcmp(secondPart, expectedSecond) != 0)
+    {
+        snprintf(failure, CHECK_FAILURE_SIZE, "split as %s | %s",
+                 describeBytes(firstPart, strlen(firstPart), firstDescription, sizeof(firstDescription)),
+                 describeBytes(secondPart, strlen(secondPart), secondDescription, sizeof(secondDescription)));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : checkOverlongForms
+ *
+ * DESCRIPTION : This function checks that a character encoded in more bytes than it needs is refused, and the
+ * shortest form of each length is not
+ *
+ * PARAMETERS : char *failure : Set when a check fails.
+ *
+ * RETURNS : int : 0 if every check holds, -1 if not.
+ */
+static int checkOverlongForms(char *failure)
+{
+    return checkDecodesAs("\xc0\xaf", 2, 0, failure) < 0 || checkDecodesAs("\xc1\xbf", 2, 0, failure) < 0 ||
+                   checkDecodesAs("\xe0\x80\xaf", 3, 0, failure) < 0 || checkDecodesAs("\xe0\x9f\xbf", 3, 0, failure) < 0 ||
+                   checkDecodesAs("\xf0\x80\x80\xaf", 4, 0, failure) < 0 || checkDecodesAs("\xf0\x8f\xbf\xbf", 4, 0, failure) < 0 ||
+                   checkDecodesAs("\xc2\x80", 2, 2, failure) < 0 || checkDecodesAs("\xe0\xa0\x80", 3, 3, failure) < 0 ||
+                   checkDecodesAs("\xf0\x90\x80\x80", 4, 4, failure) < 0
+               ? -1
+               : 0;
+}
+
+/*
+ * FUNCTION : checkSurrogates
+ *
+ * DESCRIPTION : This function checks that UTF-16 surrogates and code points past U+10FFFF are refused, both decoding
+ * and encoding, and the code points either side of the surrogates are not
+ *
+ * PARAMETERS : char *failure : Set when a check fails.
+ *
+ * RETURNS : int : 0 if every check holds, -1 if not.
+ */
+static int checkSurrogates(char *failure)
+{
+    if (checkDecodesAs("\xed\xa0\x80", 3, 0, failure) < 0 || checkDecodesAs("\xed\xbf\xbf", 3, 0, failure) < 0 ||
+        checkDecodesAs("\xed\x9f\xbf", 3, 3, failure) < 0 || checkDecodesAs("\xee\x80\x80", 3, 3, failure) < 0 ||
+        checkDecodesAs("\xf4\x8f\xbf\xbf", 4, 4, failure) < 0 || checkDecodesAs("\xf4\x90\x80\x80", 4, 0, failure) < 0 ||
+        checkDecodesAs("\xf5\x80\x80\x80", 4, 0, failure) < 0)
+    {
+        return -1;
+    }
+    char encoded[UTF8_MAX_BYTES];
+    if (utf8Encode(0xd800, encoded) != 0 || utf8Encode(0xdfff, encoded) != 0 || utf8Encode(0x110000, encoded) != 0)
+    {
+        snprintf(failure, CHECK_FAILURE_SIZE, "a surrogate or a code point past U+10FFFF was encoded");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : checkTruncatedSequences
+ *
+ * DESCRIPTION : This function checks that a character cut short (by the end of the text or a byte that isn't a
+ * continuation) is refused, counts a column per byte, and that a cut is moved back to before it
+ *
+ * PARAMETERS : char *failure : Set when a check fails.
+ *
+ * RETURNS : int : 0 if every check holds, -1 if not.
+ */
+static int checkTruncatedSequences(char *failure)
+{
+    if (checkDecodesAs("\xc3", 1, 0, failure) < 0 || checkDecodesAs("\xe2\x82", 2, 0, failure) < 0 ||
+        checkDecodesAs("\xf0\x9f\x98", 3, 0, failure) < 0 || checkDecodesAs("\xe2\x28\xa1", 3, 0, failure) < 0 ||
+        checkDecodesAs("\x80", 1, 0, failure) < 0)
+    {
+        return -1;
+    }
+    if (utf8TrimLength("a\xe2\x82\xac", 3) != 1 || utf8TrimLength("a\xe2\x82\xac", 2) != 1 || utf8TrimLength("a\xe2\x82\xac", 4) != 4)
+    {
+        snprintf(failure, CHECK_FAILURE_SIZE, "a cut through a\\xe2\\x82\\xac wasn't moved back to 1");
+        return -1;
+    }
+
+    // What a terminal shows for each byte it can't decode is one replacement character
+    return checkPrefix("ab\xe2\x82", 40, 80, 4, 4, failure) < 0 || checkPrefix("ab\xe2\x82", 3, 80, 3, 3, failure) < 0 ? -1 : 0;
+}
+
+/*
+ * FUNCTION : checkCombiningMarks
+ *
+ * DESCRIPTION : This function checks that a combining mark at the 40 column limit stays with its character, in
+ * the prefix that fits and where a line is split, and is left out with it when there are no bytes for both
+ *
+ * PARAMETERS : char *failure : Set when a check fails.
+ *
+ * RETURNS : int : 0 if every check holds, -1 if not.
+ */
+static int checkCombiningMarks(char *failure)
+{
+    char text[MAX_PROTOL_MESSAGE_SIZE] = "";
+    char first[MAX_PROTOL_MESSAGE_SIZE] = "";
+    char second[MAX_PROTOL_MESSAGE_SIZE] = "";
+
+    // The 40th column is an e with its accent
+    repeatText(text, "a", 39);
+    strcat(text, "e" CHECK_ACUTE "xyz");
+    if (checkPrefix(text, 40, 80, 42, 40, failure) < 0 || checkPrefix(text, 40, 41, 39, 39, failure) < 0)
+    {
+        return -1;
+    }
+
+    // Split right after the accent, with no space to split at instead
+    text[0] = '\0';
+    repeatText(repeatText(text, "a", 40), CHECK_ACUTE, 1);
+    repeatText(text, "b", 40);
+    repeatText(repeatText(first, "a", 40), CHECK_ACUTE, 1);
+    repeatText(second, "b", 40);
+    return checkSplitParts(text, first, second, failure);
+}
+
+/*
+ * FUNCTION : checkWideCharacters
+ *
+ * DESCRIPTION : This function checks that a two column character that would straddle the 40 column limit is left
+ * out whole, in the prefix that fits and where a line is split, and that a line of them splits with nothing lost
+ *
+ * PARAMETERS : char *failure : Set when a check fails.
+ *
+ * RETURNS : int : 0 if every check holds, -1 if not.
+ */
+static int checkWideCharacters(char *failure)
+{
+    char text[MAX_PROTOL_MESSAGE_SIZE] = "";
+    char first[MAX_PROTOL_MESSAGE_SIZE] = "";
+    char second[MAX_PROTOL_MESSAGE_SIZE] = "";
+
+    // Columns 40 and 41
+    repeatText(text, "a", 39);
+    strcat(text, CHECK_WIDE "b");
+    if (checkPrefix(text, 40, 80, 39, 39, failure) < 0 || checkPrefix(text, 41, 80, 42, 41, failure) < 0)
+    {
+        return -1;
+    }
+
+    // No cut at column 40 exists, the first part ends before the wide character and the second is cut to 40 columns
+    text[0] = '\0';
+    repeatText(text, "a", 39);
+    strcat(text, CHECK_WIDE);
+    repeatText(text, "b", 39);
+    repeatText(first, "a", 39);
+    repeatText(repeatText(second, CHECK_WIDE, 1), "b", 38);
+    if (checkSplitParts(text, first, second, failure) < 0)
+    {
+        return -1;
+    }
+
+    // 30 wide characters are 60 columns and 90 bytes, too many bytes for one part however the columns fall
+    text[0] = '\0';
+    first[0] = '\0';
+    second[0] = '\0';
+    repeatText(text, CHECK_WIDE, 30);
+    repeatText(first, CHECK_WIDE, 15);
+    repeatText(second, CHECK_WIDE, 15);
+    return checkSplitParts(text, first, second, failure);
+}
+
+/*
+ * FUNCTION : checkRoundTrip
+ *
+ * DESCRIPTION : This function compresses a block and decompresses it again, and checks it comes back as it was
+ * with both windows still in step
+ *
+ * PARAMETERS : LzWindow *compressor : The sending end's window.
+ *              LzWindow *decompressor : The receiving end's window.
+ *              const char *block : The block.
+ *              size_t length : Its length (at most CHECK_LZ_BLOCK_BYTES).
+ *              char *failure : Room for CHECK_FAILURE_SIZE, set when the check fails.
+ *
+ * RETURNS : int : 0 if it holds, -1 if not.
+ */
+int checkRoundTrip(LzWindow *compressor, LzWindow *decompressor, const char *block, size_t length, char *failure)
+{
+    static char compressed[LZ_COMPRESS_BOUND(CHECK_LZ_BLOCK_BYTES)];
+    static char decompressed[CHECK_LZ_BLOCK_BYTES];
+    size_t compressedLength = lzCompress(compressor, block, length, compressed, sizeof(compressed));
+    if (compressedLength == 0)
+    {
+        snprintf(failure, CHECK_FAILURE_SIZE, "a %zu byte block didn't compress into LZ_COMPRESS_BOUND", length);
+        return -1;
+    }
+    long decompressedLength = lzDecompress(decompressor, compressed, compressedLength, decompressed, length);
+    if (decompressedLength != (long)length || memcmp(decompressed, block, length) != 0)
+    {
+        snprintf(failure, CHECK_FAILURE_SIZE, "a %zu byte block (%zu compressed) came back as %ld bytes%s", length, compressedLength,
+                 decompressedLength, decompressedLength == (long)length ? " that differ" : "");
+        return -1;
+    }
+    if (compressor->windowLength != decompressor->windowLength ||
+        memcmp(compressor->window, decompressor->window, compressor->windowLength) != 0)
+    {
+        snprintf(failure, CHECK_FAILURE_SIZE, "the windows are out of step after a %zu byte block", length);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : checkRefused
+ *
+ * DESCRIPTION : This function checks that a block is refused, and that refusing it leaves the window as it was. The
+ * block is decompressed from a copy of exactly its length, so a read past the end has nothing to find.
+ *
+ * PARAMETERS : const LzWindow *window : The receiving end's window (a copy is used).
+ *              const char *compressed : The block.
+ *              size_t compressedLength : Its length.
+ *              size_t outputSize : Room given for what it decompresses to.
+ *              char *failure : Room for CHECK_FAILURE_SIZE, set when the check fails.
+ *
+ * RETURNS : int : 0 if it holds, -1 if not.
+ */
+int checkRefused(const LzWindow *window, const char *compressed, size_t compressedLength, size_t outputSize, char *failure)
+{
+    static LzWindow decompressor;
+    static char decompressed[CHECK_LZ_BLOCK_BYTES];
+    char description[CHECK_FAILURE_SIZE / 2];
+    char *exactCopy = malloc(compressedLength > 0 ? compressedLength : 1);
+    if (exactCopy == NULL)
+    {
+        snprintf(failure, CHECK_FAILURE_SIZE, "out of memory");
+        return -1;
+    }
+    memcpy(exactCopy, compressed, compressedLength);
+    decompressor = *window;
+    long decompressedLength = lzDecompress(&decompressor, exactCopy, compressedLength, decompressed, outputSize);
+    free(exactCopy);
+    if (decompressedLength >= 0 || decompressor.windowLength != window->windowLength ||
+        memcmp(decompressor.window, window->window, window->windowLength) != 0)
+    {
+        snprintf(failure, CHECK_FAILURE_SIZE, "%s into %zu bytes gave %ld%s",
+                 describeBytes(compressed, compressedLength, description, sizeof(description)), outputSize, decompressedLength,
+                 decompressedLength < 0 ? " but moved the window" : "");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : checkLzRoundTrip
+ *
+ * DESCRIPTION : This function sends blocks of every kind the server compresses, and some it never does, through one
+ * pair of windows: broadcast lines, padding runs longer than a length byte holds, bytes that don't compress, a
+ * single byte, and a block as big as the window
+ *
+ * PARAMETERS : char *failure : Set when a check fails.
+ *
+ * RETURNS : int : 0 if every check holds, -1 if not.
+ */
+static int checkLzRoundTrip(char *failure)
+{
+    static LzWindow compressor;
+    static LzWindow decompressor;
+    static char block[CHECK_LZ_BLOCK_BYTES];
+    lzWindowInitialize(&compressor);
+    lzWindowInitialize(&decompressor);
+
+    unsigned int seed = 0x2545f491u;
+    for (int i = 0; i < CHECK_LZ_BLOCKS; i++)
+    {
+        size_t length = 0;
+        if (i % 4 == 0)
+        {
+            // Broadcast lines, the usual case
+            for (int line = 0; length + MAX_PROTOL_MESSAGE_SIZE < sizeof(block); line++)
+            {
+                length += snprintf(block + length, sizeof(block) - length, ">>msg<<%d|17000000%05d|10.0.0.%d [user%d] >> line %d of block %-20d\n",
+                                   i * 100 + line, line * 37, line % 7, line % 5, line, i);
+            }
+        }
+        else if (i % 4 == 1)
+        {
+            // A match far longer than 15 + 255, so its length takes several bytes
+            memset(block, ' ', sizeof(block));
+            length = sizeof(block);
+        }
+        else if (i % 4 == 2)
+        {
+            // Nothing to match
+            for (length = 0; length < sizeof(block) / 2; length++)
+            {
+                seed = seed * 1103515245u + 12345u;
+                block[length] = (char)(seed >> 16);
+            }
+        }
+        else
+        {
+            block[0] = 'x';
+            length = 1;
+        }
+        if (checkRoundTrip(&compressor, &decompressor, block, length, failure) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : checkLzMalformed
+ *
+ * DESCRIPTION : This function checks that blocks no compressor makes are refused: a back reference to offset 0 or
+ * from before the window, lengths that run past the input or the output, a length cut off before its extra bytes,
+ * and an offset cut in half
+ *
+ * PARAMETERS : char *failure : Set when a check fails.
+ *
+ * RETURNS : int : 0 if every check holds, -1 if not.
+ */
+static int checkLzMalformed(char *failure)
+{
+    static LzWindow window;
+    lzWindowInitialize(&window);
+
+    // One literal then a match: token 0x10, 'a', offset (little endian)
+    static const char zeroOffset[] = {0x10, 'a', 0x00, 0x00};
+    static const char farOffset[] = {0x10, 'a', (char)0xff, (char)0xff};
+    static const char halfOffset[] = {0x10, 'a', 0x01};
+    // 15 + 255 + 255 literals announced, only a handful there
+    static const char longLiterals[] = {(char)0xf0, (char)0xff, (char)0xff, 0x10, 'a', 'b', 'c'};
+    // A match length whose extra bytes never end, or never start
+    static const char missingMatchLength[] = {0x1f, 'a', 0x01, 0x00};
+    static const char endlessMatch[] = {0x1f, 'a', 0x01, 0x00, (char)0xff, (char)0xff};
+    // Valid, but more than the room given for it
+    static const char tenLiterals[] = {(char)0xa0, '0', '1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    static const char longRun[] = {0x1f, 'a', 0x01, 0x00, 0x40};
+    return checkRefused(&window, zeroOffset, sizeof(zeroOffset), 64, failure) < 0 ||
+                   checkRefused(&window, farOffset, sizeof(farOffset), 64, failure) < 0 ||
+                   checkRefused(&window, halfOffset, sizeof(halfOffset), 64, failure) < 0 ||
+                   checkRefused(&window, longLiterals, sizeof(longLiterals), CHECK_LZ_BLOCK_BYTES, failure) < 0 ||
+                   checkRefused(&window, endlessMatch, sizeof(endlessMatch), 64, failure) < 0 ||
+                   checkRefused(&window, missingMatchLength, sizeof(missingMatchLength), 64, failure) < 0 ||
+                   checkRefused(&window, tenLiterals, sizeof(tenLiterals), 9, failure) < 0 ||
+                   checkRefused(&window, longRun, sizeof(longRun), 64, failure) < 0
+               ? -1
+               : 0;
+}
+
+/*
+ * FUNCTION : checkLzTruncated
+ *
+ * DESCRIPTION : This function decompresses every prefix of a real block and every copy of it with one byte changed.
+ * Each must be refused, or give output no bigger than the room for it (a prefix that ends where a token does is a
+ * valid, shorter block, and must give the start of the original; one that only loses the empty last token gives
+ * all of it).
+ *
+ * PARAMETERS : char *failure : Set when a check fails.
+ *
+ * RETURNS : int : 0 if every check holds, -1 if not.
+ */
+static int checkLzTruncated(char *failure)
+{
+    static LzWindow compressor;
+    static LzWindow decompressor;
+    static char block[CHECK_LZ_BLOCK_BYTES / 4];
+    static char compressed[LZ_COMPRESS_BOUND(sizeof(block))];
+    static char decompressed[sizeof(block)];
+    lzWindowInitialize(&compressor);
+
+    size_t length = 0;
+    for (int line = 0; length + MAX_PROTOL_MESSAGE_SIZE < sizeof(block); line++)
+    {
+        length += snprintf(block + length, sizeof(block) - length, ">>msg<<%d|1700000000%03d|127.0.0.1 [bob  ] >> %-40s\n", line,
+                           line, line % 2 ? "hello" : "same again");
+    }
+    size_t compressedLength = lzCompress(&compressor, block, length, compressed, sizeof(compressed));
+
+    for (size_t prefixLength = 1; prefixLength < compressedLength; prefixLength++)
+    {
+        lzWindowInitialize(&decompressor);
+        char *exactCopy = malloc(prefixLength);
+        if (exactCopy == NULL)
+        {
+            snprintf(failure, CHECK_FAILURE_SIZE, "out of memory");
+            return -1;
+        }
+        memcpy(exactCopy, compressed, prefixLength);
+        long decompressedLength = lzDecompress(&decompressor, exactCopy, prefixLength, decompressed, length);
+        free(exactCopy);
+        if (decompressedLength > (long)length || (decompressedLength >= 0 && memcmp(decompressed, block, decompressedLength) != 0))
+        {
+            snprintf(failure, CHECK_FAILURE_SIZE, "the first %zu of %zu compressed bytes gave %ld bytes", prefixLength, compressedLength,
+                     decompressedLength);
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < compressedLength; i++)
+    {
+        for (int flip = 1; flip < 256; flip <<= 1)
+        {
+            lzWindowInitialize(&decompressor);
+            compressed[i] ^= flip;
+            long decompressedLength = lzDecompress(&decompressor, compressed, compressedLength, decompressed, length);
+            compressed[i] ^= flip;
+            if (decompressedLength > (long)length)
+            {
+                snprintf(failure, CHECK_FAILURE_SIZE, "flipping %02x at byte %zu gave %ld bytes into %zu", flip, i, decompressedLength, length);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Every case, in the order they are run
+static const CheckCase checkCases[] = {
+    {"utf8/overlong", checkOverlongForms},
+    {"utf8/surrogate", checkSurrogates},
+    {"utf8/truncated", checkTruncatedSequences},
+    {"utf8/combining", checkCombiningMarks},
+    {"utf8/wide", checkWideCharacters},
+    {"lz/round-trip", checkLzRoundTrip},
+    {"lz/malformed", checkLzMalformed},
+    {"lz/truncated", checkLzTruncated},
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+    {
+        printf("Usage: %s\n", argv[0]);
+        return 1;
+    }
+
+    int failedCount = 0;
+    int caseCount = sizeof(checkCases) / sizeof(checkCases[0]);
+    for (int i = 0; i < caseCount; i++)
+    {
+        char failure[CHECK_FAILURE_SIZE] = "";
+        if (checkCases[i].run(failure) < 0)
+        {
+            printf("FAIL %-20s %s\n", checkCases[i].name, failure);
+            failedCount++;
+        }
+        else
+        {
+            printf("ok   %s\n", checkCases[i].name);
+        }
+    }
+    printf("%d of %d cases failed\n", failedCount, caseCount);
+    return failedCount > 0 ? 1 : 0;
+}
@@ -0,0 +1,166 @@
+#ifndef CHAT_CLIENT_LIBRARY_H
+#define CHAT_CLIENT_LIBRARY_H
+
+/*
+ * libchatclient: the connection side of the chat client with no user interface attached. Each ChatClient is driven
+ * from an event loop (chatClientPoll, or chatClientPollDescriptors/chatClientTimeoutMs/chatClientProcess for a loop
+ * of your own) and reports what happens through callbacks, so one process can run hundreds of them.
+ */
+
+#include "../../Common/inc/common.h"
+#include "../../Common/inc/transport.h"
+#include "../../Common/inc/lz.h"
+#include "../../Common/inc/utf8.h"
+
+// Defines needed by the types below
+#define CHAT_CLIENT_UNSENT_QUEUE_LENGTH 32      // Messages sent while reconnecting that are kept to send afterwards
+#define CHAT_CLIENT_RECEIVE_BUFFER_SIZE 4096    // Bytes read from the server at once (any number of frames)
+#define CHAT_CLIENT_USER_NAME_SIZE 16           // 5 columns of UTF-8 (at most 15 bytes) and the terminator
+#define CHAT_CLIENT_BLOB_FAILURE_SIZE 64        // Reason the server gave for the last refused put or get
+#define CLIENT_RESOLVE_MAX_ADDRESSES 8          // Addresses kept for one server name (and tried when connecting)
+#define CHAT_CLIENT_REPLAY_BUFFER_SIZE ((CHAT_CLIENT_UNSENT_QUEUE_LENGTH + 2) * (MAX_PROTOL_MESSAGE_SIZE + 1)) // Frames
+                                                // queued on a new connection: compression, resume and the unsent ones
+
+struct ChatClient;
+
+// One chat line from the server
+typedef struct
+{
+    unsigned long sequence;  // 0 if the server didn't number it
+    long long serverMs;      // When the server stamped it, 0 if it didn't
+    char *text;              // The line as the server formatted it (the callback may change it in place)
+    int isOwnMessage;        // Sent by this client
+    int isSearchResult;      // A match for chatClientSearch rather than a new line
+} ChatMessage;
+
+// What the library calls back with. Any pointer can be NULL.
+typedef struct
+{
+    void (*onMessage)(struct ChatClient *client, ChatMessage *message);
+    void (*onEvent)(struct ChatClient *client, int event, int detail); // CHAT_CLIENT_EVENT_*
+    // Part of a shared file asked for with chatClientRequestBlob, in order, until offset + length reaches totalLength
+    void (*onBlobData)(struct ChatClient *client, unsigned long blobId, size_t offset, const char *data, size_t length, size_t totalLength);
+} ChatClientCallbacks;
+
+// Addresses a server name resolved to, kept so a reconnect doesn't wait on the resolver again
+typedef struct
+{
+    char host[256];
+    int port;
+    struct sockaddr_storage addresses[CLIENT_RESOLVE_MAX_ADDRESSES]; // IPv6 and IPv4 taking turns, best first
+    socklen_t addressLengths[CLIENT_RESOLVE_MAX_ADDRESSES];
+    int addressCount;         // 0 until a lookup has answered
+    int isResolving;          // A lookup thread is running for it (it isn't reused until that finishes)
+    long long resolvedAtMs;   // When the addresses were looked up (monotonic, 0 once they have failed to connect)
+    long long lastUsedMs;
+} ResolvedServer;
+
+// A TCP connect made a step at a time, so a reconnect never blocks the event loop (see connectAttemptStep)
+typedef struct
+{
+    char host[256];
+    int port;
+    struct sockaddr_storage addresses[CLIENT_RESOLVE_MAX_ADDRESSES];
+    socklen_t addressLengths[CLIENT_RESOLVE_MAX_ADDRESSES];
+    int addressCount;                 // 0 while the name is still being looked up
+    struct pollfd attempts[CLIENT_RESOLVE_MAX_ADDRESSES]; // One per address tried (fd -1 once it is over)
+    int attemptCount;
+    int pendingCount;                 // Attempts still waiting for an answer
+    long long nextAttemptMs;          // When the next address is tried, or the lookup checked again (monotonic)
+    long long deadlineMs;             // When the lookup, then the connect, is given up on
+} ConnectAttempt;
+
+// Connection to the server and the IP the server will see for us
+typedef struct ChatClient
+{
+    Transport transport;
+    char clientIP[256];
+    char userName[CHAT_CLIENT_USER_NAME_SIZE];
+    char serverAddress[256];          // What connectToServer is given, used again to reconnect
+    unsigned long lastSequence;       // Number of the last chat line delivered (0 before the first one)
+    pthread_mutex_t connectionMutex;  // Held to send, and while the connection is swapped
+    int isConnected;
+    int isLeaving;                    // Said bye, so a disconnect is the end rather than something to recover from
+    time_t connectedAt;
+    long long reconnectAtMs;          // When the next reconnect attempt is due (monotonic, while not connected)
+    int reconnectAttempt;             // Attempts since the last connection that held up
+    int retryAfterSeconds;            // From a busy frame, the next reconnect waits at least this long
+    int isReconnecting;               // reconnection is under way
+    ConnectAttempt reconnection;
+    char replayFrames[CHAT_CLIENT_REPLAY_BUFFER_SIZE]; // Frames for a new connection, sent as the socket takes them
+    size_t replayLength;              // 0 once they are all out, frames sent meanwhile queue behind them
+    size_t replaySent;
+    char unsentMessages[CHAT_CLIENT_UNSENT_QUEUE_LENGTH][MAX_PROTOL_MESSAGE_SIZE];
+    int unsentCount;
+    unsigned long connectionNumber;   // Counts connections, so a long upload notices one was swapped under it
+    char receiveBuffer[CHAT_CLIENT_RECEIVE_BUFFER_SIZE]; // A partial frame waiting for the rest of it
+    int receivedLength;
+    unsigned long incomingBlobId;     // Download chunk being received (after its data frame)
+    size_t incomingOffset;
+    size_t incomingRemaining;         // Raw bytes of it still to come, 0 when reading frames
+    size_t incomingTotal;
+    char blobFailure[CHAT_CLIENT_BLOB_FAILURE_SIZE];
+    int wantsCompression;             // Ask the server to compress what it sends (set before chatClientConnect)
+    LzWindow *decompressor;           // Set once the server agreed, in step with its compressor for this connection
+    char *compressedBlock;            // Compressed block being received (after its header frame)
+    size_t compressedLength;
+    size_t compressedReceived;        // Bytes of it so far, the block is complete at compressedLength
+    size_t compressedRawLength;       // What it decompresses to
+    ChatClientCallbacks callbacks;
+    void *context;                    // Whatever the caller wants to keep with the client
+} ChatClient;
+
+// Function prototypes
+void chatClientInitialize(ChatClient *client, const char *userName, const char *serverAddress, const ChatClientCallbacks *callbacks, void *context);
+int chatClientConnect(ChatClient *client);
+void chatClientSendText(ChatClient *client, const char *text);
+int chatClientSendFile(ChatClient *client, const char *path);
+void chatClientRequestBlob(ChatClient *client, unsigned long blobId);
+void chatClientSearch(ChatClient *client, const char *query);
+int chatClientPollDescriptors(ChatClient *client, struct pollfd *polls);
+int chatClientTimeoutMs(ChatClient *client);
+void chatClientProcess(ChatClient *client);
+int chatClientPoll(ChatClient **clients, int clientCount, int timeoutMs);
+void chatClientClose(ChatClient *client);
+int connectToServer(const char *serverIpAddress, Transport *transport);
+int resolveServerAddress(const char *host, int port, struct sockaddr_storage *addresses, socklen_t *addressLengths);
+void expireServerAddress(const char *host, int port);
+int connectToFirstAddress(const struct sockaddr_storage *addresses, const socklen_t *addressLengths, int addressCount);
+void connectAttemptStart(ConnectAttempt *attempt, const char *host, int port);
+int connectAttemptStep(ConnectAttempt *attempt);
+int connectAttemptPollDescriptors(const ConnectAttempt *attempt, struct pollfd *polls);
+int connectAttemptTimeoutMs(const ConnectAttempt *attempt);
+void connectAttemptAbandon(ConnectAttempt *attempt);
+void getClientIp(int socket, char *ipBuffer, size_t bufferSize);
+void splitMessage(const char *fullString, char *firstPart, char *secondPart);
+void sendProtocolMessage(const char *message, ChatClient *client);
+long reconnectDelayMs(int attempt, int retryAfterSeconds);
+
+// Defines
+#define CLIENT_MSG_PART_LENGTH 40 // Max length of msg parts, in terminal columns
+#define CLIENT_MSG_PART_BYTES 80  // Max bytes of a part, so the frame stays under MAX_PROTOL_MESSAGE_SIZE whatever the text
+#define CLIENT_USER_NAME_LENGTH 5 // Max columns of a user name (the server pads names to this)
+#define CLIENT_RECONNECT_BASE_MS 500 // Backoff before the first reconnect attempt, doubled each attempt
+#define CLIENT_RECONNECT_MAX_MS 30000 // Longest backoff between reconnect attempts
+#define CLIENT_RECONNECT_STABLE_SECONDS 10 // A connection that lasted this long resets the backoff
+#define CLIENT_BLOB_NAME_LENGTH 40 // Longest file name sent with a put (the rest is cut off)
+#define CLIENT_RESOLVE_CACHE_SIZE 8        // Server names whose addresses are kept
+#define CLIENT_RESOLVE_CACHE_SECONDS 60    // Addresses are looked up again after this long (the old ones are used meanwhile)
+#define CLIENT_RESOLVE_TIMEOUT_MS 2000     // Longest a connect waits for a name never resolved before (the lookup carries on)
+#define CLIENT_CONNECT_ATTEMPT_DELAY_MS 250 // Head start each address gets before the next is tried alongside it
+#define CLIENT_CONNECT_TIMEOUT_MS 10000    // Longest a connect waits for any address to answer
+#define CLIENT_CONNECT_PENDING -2          // connectAttemptStep: no answer yet
+#define CHAT_CLIENT_MAX_POLL_DESCRIPTORS CLIENT_RESOLVE_MAX_ADDRESSES // A reconnect's attempts (a transport has fewer)
+#define CHAT_CLIENT_MAX_COMPRESSED_BYTES (1024 * 1024) // Largest compressed block (either size) accepted from the server
+
+#define CHAT_CLIENT_EVENT_DISCONNECTED 1 // Lost the server, detail is the errno (0 when it closed), reconnecting
+#define CHAT_CLIENT_EVENT_RECONNECTED 2  // Back, missed lines follow
+#define CHAT_CLIENT_EVENT_BUSY 3         // Server turned us away, detail is its retry-after seconds
+#define CHAT_CLIENT_EVENT_MISSED 4       // Lines were lost before the next one (more than the server kept)
+#define CHAT_CLIENT_EVENT_UNSENT 5       // A message was dropped, detail is how many were already waiting
+#define CHAT_CLIENT_EVENT_CLOSED 6       // The server closed after our bye, nothing more will happen
+#define CHAT_CLIENT_EVENT_BLOB_FAILED 7  // The server refused a put or get, the reason is in blobFailure
+#define CHAT_CLIENT_EVENT_SEARCH_DONE 8  // Every match for a search has been delivered, detail is how many
+#define CHAT_CLIENT_EVENT_BLOCKED 9      // The server's content filter stopped one of our messages
+
+#endif // CHAT_CLIENT_LIBRARY_H
@@ -2,31 +2,51 @@
 #define CHAT_CLIENT_H
 
 
+// Wide character input (wget_wch) needs the ncursesw declarations
+#define NCURSES_WIDECHAR 1
 #include <ncurses.h>
-#include "../../Common/inc/common.h"
+#include <fcntl.h>
+#include <locale.h>
+#include "chat-client-library.h"
+#include "../../Common/inc/scan.h"
 
 // Function prototypes
 void initializeNcursesWindows(void);
-int connectToServer(const char *serverIpAddress, int *socketFileDescriptor);
 void *handleReceivedMessage(void *arg);
-int startReceivingThread(int *socketFileDescriptor);
-void handleUserInput(char *clientName, char *clientIP, int *socketFileDescriptor);
-void cleanup(int *socketFileDescriptor);
+void formatDisplayMessage(ChatMessage *message, char *displayMessage, size_t displaySize);
+void showChatMessage(ChatClient *client, ChatMessage *message);
+void showClientEvent(ChatClient *client, int event, int detail);
+void printChatMessage(ChatClient *client, ChatMessage *message);
+void printClientEvent(ChatClient *client, int event, int detail);
+void showNotice(const char *notice);
+void saveBlobData(ChatClient *client, unsigned long blobId, size_t offset, const char *data, size_t length, size_t totalLength);
+void sendUserLine(ChatClient *client, const char *line);
+int startReceivingThread(ChatClient *client);
+void handleUserInput(ChatClient *client);
+void limitUserLine(char *line);
+int runHeadless(ChatClient *client);
+void cleanup(ChatClient *client);
 // void getLocalIP(char *ipBuffer, size_t bufferSize);
-void getClientIp(int socket, char *ipBuffer, size_t bufferSize);
-void splitMessage(const char *fullString, char *firstPart, char *secondPart);
 void checkHostName(int hostname);
 void checkHostEntryDetails(struct hostent *hostentry);
 void ipAddressFormatter(char *IPbuffer);
-void sendProtocolMessage(const char *message, int socketFileDescriptor);
 void updateUserInputWindow(WINDOW *inputWin, const char *currentBuffer, int userInputIndex);
 int getUserName(char *userArg, char* userName);
 int getServerAddress(char *serverArgument, char *serverAddress);
 
 // Defines
 #define CLIENT_INPUT_MARKER ">"
-#define CLIENT_MAX_MSG_SIZE 81 // Message size used for MAX in client
-#define CLIENT_MSG_PART_LENGTH 40 // Max length of msg parts
+#define CLIENT_MAX_MSG_COLUMNS 80 // Longest message in terminal columns (two parts)
+#define CLIENT_MAX_MSG_SIZE (2 * CLIENT_MSG_PART_BYTES + 2) // Message size used for MAX in client (bytes, two parts,
+                                                           // the space between them and the terminator)
+#define CLIENT_HEADLESS_SWITCH "--headless" // Lines from stdin are sent, received lines go to stdout, no ncurses
+#define CLIENT_COMPRESS_SWITCH "--compress" // Ask the server to compress replays and backlogs (for slow links)
+#define CLIENT_HEADLESS_INPUT_SIZE 4096 // Bytes of stdin read at once
+#define CLIENT_SEND_COMMAND "/send " // Shares the file at the path that follows
+#define CLIENT_GET_COMMAND "/get "   // Downloads the shared file with the id that follows
+#define CLIENT_BLOB_FILE_FORMAT "blob-%lu" // Where a downloaded file is saved
+#define CLIENT_SEARCH_COMMAND "/search " // Searches the room for the query that follows
+#define CLIENT_SEARCH_RESULT_MARKER "? " // In front of a line that was found rather than just said
 #define CHAT_TITLE "========= RECEIVED MESSAGES ========="
 #define INPUT_TITLE "========= USER INPUT ========="
 
@@ -0,0 +1,1835 @@
+#include "../inc/chat-client-library.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/*
+ * FUNCTION : monotonicMilliseconds
+ *
+ * DESCRIPTION : This function reads the monotonic clock, used for reconnect deadlines
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : long long : Milliseconds since an arbitrary point.
+ */
+static long long monotonicMilliseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*
+ * FUNCTION : reportEvent
+ *
+ * DESCRIPTION : This function passes an event on to the caller's callback, if it set one
+ *
+ * PARAMETERS : ChatClient *client : The client the event happened to.
+ *              int event : CHAT_CLIENT_EVENT_*.
+ *              int detail : Depends on the event.
+ *
+ * RETURNS : void
+ */
+static void reportEvent(ChatClient *client, int event, int detail)
+{
+    if (client->callbacks.onEvent != NULL)
+    {
+        client->callbacks.onEvent(client, event, detail);
+    }
+}
+
+/*
+CHANGED THIS:
+Instead of using getifaddrs(), this function uses getsockname() to obtain the local IP address from the socket.
+*/
+void getClientIp(int socket, char *ipBuffer, size_t bufferSize)
+{
+    struct sockaddr_storage localAddr;
+    socklen_t addrLen = sizeof(localAddr);
+    if (getsockname(socket, (struct sockaddr *)&localAddr, &addrLen) == 0)
+    {
+        struct sockaddr_in6 *ipv6Address = (struct sockaddr_in6 *)&localAddr;
+        if (localAddr.ss_family == AF_INET)
+        {
+            inet_ntop(AF_INET, &((struct sockaddr_in *)&localAddr)->sin_addr, ipBuffer, bufferSize);
+        }
+        else if (localAddr.ss_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&ipv6Address->sin6_addr))
+        {
+            // IPv4 through a dual-stack socket, shown the usual way
+            inet_ntop(AF_INET, &ipv6Address->sin6_addr.s6_addr[12], ipBuffer, bufferSize);
+        }
+        else if (localAddr.ss_family == AF_INET6)
+        {
+            inet_ntop(AF_INET6, &ipv6Address->sin6_addr, ipBuffer, bufferSize);
+        }
+        else
+        {
+            // AF_UNIX (or shared memory) peers are on the same host as the server
+            strncpy(ipBuffer, "127.0.0.1", bufferSize);
+        }
+    }
+    else
+    {
+        strncpy(ipBuffer, "0.0.0.0", bufferSize);
+    }
+}
+
+/*
+ * FUNCTION : splitMessage
+ *
+ * DESCRIPTION : This function splits a message into two parts if the message is longer than 40 columns
+ * It will try to do in a graceful way if possible: at the space nearest the middle that leaves both parts short
+ * enough, otherwise at the character nearest the middle. Lengths are in terminal columns, a part never ends
+ * part way through a character and always fits in CLIENT_MSG_PART_BYTES.
+ *
+ * PARAMETERS : const char *fullString : The full message to split (UTF-8).
+ *              char *firstPart : Buffer to store the first part of the message (CLIENT_MSG_PART_BYTES + 1).
+ *              char *secondPart : Buffer to store the second part of the message (CLIENT_MSG_PART_BYTES + 1).
+ *
+ * RETURNS : void
+ */
+void splitMessage(const char *fullString, char *firstPart, char *secondPart)
+{
+    // Text never takes more columns than it has bytes, so a short one fits whatever is in it
+    size_t fullStringLength = strlen(fullString);
+    if (fullStringLength <= CLIENT_MSG_PART_LENGTH)
+    {
+        memcpy(firstPart, fullString, fullStringLength + 1);
+        secondPart[0] = '\0';
+        return;
+    }
+    int isAscii = utf8IsAscii(fullString, fullStringLength);
+    int fullStringWidth = isAscii ? (int)fullStringLength : utf8DisplayWidth(fullString, fullStringLength);
+    int partWidth;
+    if (fullStringWidth <= CLIENT_MSG_PART_LENGTH && fullStringLength <= CLIENT_MSG_PART_BYTES)
+    {
+        memcpy(firstPart, fullString, fullStringLength + 1);
+        secondPart[0] = '\0';
+        return;
+    }
+
+    // The first part has to end between these columns for both parts to fit
+    int minSplit = fullStringWidth - CLIENT_MSG_PART_LENGTH;
+    int maxSplit = CLIENT_MSG_PART_LENGTH;
+    int midPoint = fullStringWidth / 2;
+
+    // Walk the characters, keeping the best space and the character boundary nearest the middle (for ASCII a
+    // column is a byte, so only the bytes either side of the middle are looked at, nearest first)
+    size_t spaceSplit = 0;
+    int spaceDistance = -1;
+    size_t middleSplit = midPoint;
+    int middleDistance = 0;
+    if (isAscii)
+    {
+        for (int splitOffset = 0; splitOffset <= maxSplit - minSplit && spaceDistance < 0; splitOffset++)
+        {
+            int lowerHalfMessage = midPoint - splitOffset;
+            int upperHalfMessage = midPoint + splitOffset;
+            if (lowerHalfMessage >= minSplit && lowerHalfMessage <= maxSplit && fullString[lowerHalfMessage] == ' ')
+            {
+                spaceSplit = lowerHalfMessage;
+                spaceDistance = splitOffset;
+            }
+            else if (upperHalfMessage >= minSplit && upperHalfMessage <= maxSplit && fullString[upperHalfMessage] == ' ')
+            {
+                spaceSplit = upperHalfMessage;
+                spaceDistance = splitOffset;
+            }
+        }
+    }
+    else
+    {
+        // A wide character can straddle every column in range (or the bytes don't allow any), then the last boundary
+        // the first part fits up to is used
+        middleDistance = -1;
+        size_t lastFitSplit = 0;
+        size_t offset = 0;
+        int column = 0;
+        while (offset < fullStringLength)
+        {
+            unsigned int codepoint;
+            size_t characterLength = utf8DecodeNext(fullString + offset, fullStringLength - offset, &codepoint);
+            int characterColumns = characterLength == 0 ? 1 : utf8CodepointWidth(codepoint);
+            if (characterLength == 0)
+            {
+                characterLength = 1;
+            }
+            // A mark that combines with the character before it is never cut off from it
+            if (characterColumns == 0 && codepoint >= 0x300)
+            {
+                offset += characterLength;
+                continue;
+            }
+
+            // Both parts have to fit in bytes as well (a space there is dropped)
+            int distance = column > midPoint ? column - midPoint : midPoint - column;
+            int isFirstFitting = column <= maxSplit && offset <= CLIENT_MSG_PART_BYTES;
+            int isInRange = isFirstFitting && column >= minSplit &&
+                            fullStringLength - offset <= CLIENT_MSG_PART_BYTES + (fullString[offset] == ' ' ? 1 : 0);
+            if (isInRange && (middleDistance < 0 || distance < middleDistance))
+            {
+                middleSplit = offset;
+                middleDistance = distance;
+            }
+            if (fullString[offset] == ' ' && isInRange && (spaceDistance < 0 || distance < spaceDistance))
+            {
+                spaceSplit = offset;
+                spaceDistance = distance;
+            }
+            if (isFirstFitting)
+            {
+                lastFitSplit = offset;
+            }
+            column += characterColumns;
+            offset += characterLength;
+        }
+        if (middleDistance < 0)
+        {
+            middleSplit = lastFitSplit;
+        }
+    }
+
+    // A space in the right place is dropped, otherwise it is most likely a big word in the middle and is cut
+    size_t splitIndex = spaceDistance >= 0 ? spaceSplit : middleSplit;
+    const char *secondStart = fullString + splitIndex + (spaceDistance >= 0 ? 1 : 0);
+    size_t secondAvailable = fullString + fullStringLength - secondStart;
+
+    size_t firstLength;
+    size_t secondLength;
+    if (isAscii)
+    {
+        firstLength = splitIndex < CLIENT_MSG_PART_LENGTH ? splitIndex : CLIENT_MSG_PART_LENGTH;
+        secondLength = secondAvailable < CLIENT_MSG_PART_LENGTH ? secondAvailable : CLIENT_MSG_PART_LENGTH;
+    }
+    else
+    {
+        firstLength = utf8PrefixForWidth(fullString, splitIndex, CLIENT_MSG_PART_LENGTH, CLIENT_MSG_PART_BYTES, &partWidth);
+        secondLength = utf8PrefixForWidth(secondStart, secondAvailable, CLIENT_MSG_PART_LENGTH, CLIENT_MSG_PART_BYTES, &partWidth);
+    }
+    memcpy(firstPart, fullString, firstLength);
+    firstPart[firstLength] = '\0';
+    memcpy(secondPart, secondStart, secondLength);
+    secondPart[secondLength] = '\0';
+}
+
+/*
+ * FUNCTION : copyAddresses
+ *
+ * DESCRIPTION : This function takes the addresses a lookup returned, IPv6 and IPv4 taking turns (starting with the
+ * family the resolver put first), so a connect that tries them in order soon gets to the other family if one is
+ * broken.
+ *
+ * PARAMETERS : const struct addrinfo *results : What getaddrinfo returned.
+ *              struct sockaddr_storage *addresses : Room for CLIENT_RESOLVE_MAX_ADDRESSES.
+ *              socklen_t *addressLengths : Set to the length of each address.
+ *
+ * RETURNS : int : Number of addresses taken.
+ */
+static int copyAddresses(const struct addrinfo *results, struct sockaddr_storage *addresses, socklen_t *addressLengths)
+{
+    const struct addrinfo *next[2] = {results, results};
+    int firstFamily = results != NULL ? results->ai_family : AF_INET6;
+    int addressCount = 0;
+    for (int turn = 0; addressCount < CLIENT_RESOLVE_MAX_ADDRESSES && (next[0] != NULL || next[1] != NULL); turn ^= 1)
+    {
+        // next[0] walks the first family, next[1] every other one
+        while (next[turn] != NULL && ((next[turn]->ai_family == firstFamily) != (turn == 0) ||
+                                      next[turn]->ai_addrlen > sizeof(struct sockaddr_storage)))
+        {
+            next[turn] = next[turn]->ai_next;
+        }
+        if (next[turn] != NULL)
+        {
+            memcpy(&addresses[addressCount], next[turn]->ai_addr, next[turn]->ai_addrlen);
+            addressLengths[addressCount++] = next[turn]->ai_addrlen;
+            next[turn] = next[turn]->ai_next;
+        }
+    }
+    return addressCount;
+}
+
+static ResolvedServer resolvedServers[CLIENT_RESOLVE_CACHE_SIZE];
+static pthread_mutex_t resolverMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resolverAnswered = PTHREAD_COND_INITIALIZER;
+
+/*
+ * FUNCTION : resolveServerThread
+ *
+ * DESCRIPTION : This function looks a server name up on a thread of its own, so a slow or broken resolver holds up
+ * nobody: whoever is waiting gives up after CLIENT_RESOLVE_TIMEOUT_MS and the answer still lands in the cache for
+ * the next connect. A failed lookup leaves any addresses from before in place.
+ *
+ * PARAMETERS : void *entryPointer : The ResolvedServer to fill in (not reused while isResolving is set).
+ *
+ * RETURNS : void * : NULL.
+ */
+static void *resolveServerThread(void *entryPointer)
+{
+    ResolvedServer *entry = entryPointer;
+    char service[16];
+    snprintf(service, sizeof(service), "%d", entry->port);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG | AI_NUMERICSERV;
+    struct addrinfo *results;
+    int error = getaddrinfo(entry->host, service, &hints, &results);
+
+    pthread_mutex_lock(&resolverMutex);
+    if (error == 0)
+    {
+        entry->addressCount = copyAddresses(results, entry->addresses, entry->addressLengths);
+        entry->resolvedAtMs = monotonicMilliseconds();
+        freeaddrinfo(results);
+    }
+    entry->isResolving = 0;
+    pthread_cond_broadcast(&resolverAnswered);
+    pthread_mutex_unlock(&resolverMutex);
+    return NULL;
+}
+
+/*
+ * FUNCTION : lookupServerAddress
+ *
+ * DESCRIPTION : This function finds the addresses to try for a server, waiting up to waitMs for a name never
+ * resolved before (see resolveServerAddress). With a wait of 0 it never blocks: a name still being looked up just
+ * has no addresses yet.
+ *
+ * PARAMETERS : const char *host : Name or numeric address of the server.
+ *              int port : Its port.
+ *              struct sockaddr_storage *addresses : Room for CLIENT_RESOLVE_MAX_ADDRESSES.
+ *              socklen_t *addressLengths : Set to the length of each address.
+ *              int waitMs : Longest wait for the lookup.
+ *
+ * RETURNS : int : Number of addresses, or -1 if there are none (yet).
+ */
+static int lookupServerAddress(const char *host, int port, struct sockaddr_storage *addresses, socklen_t *addressLengths, int waitMs)
+{
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    struct addrinfo *results;
+    if (getaddrinfo(host, service, &hints, &results) == 0)
+    {
+        int addressCount = copyAddresses(results, addresses, addressLengths);
+        freeaddrinfo(results);
+        return addressCount;
+    }
+    if (strlen(host) >= sizeof(resolvedServers[0].host))
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&resolverMutex);
+    long long nowMs = monotonicMilliseconds();
+    ResolvedServer *entry = NULL;
+    ResolvedServer *oldestEntry = NULL;
+    for (int i = 0; i < CLIENT_RESOLVE_CACHE_SIZE && entry == NULL; i++)
+    {
+        if (resolvedServers[i].port == port && strcmp(resolvedServers[i].host, host) == 0)
+        {
+            entry = &resolvedServers[i];
+        }
+        else if (!resolvedServers[i].isResolving &&
+                 (oldestEntry == NULL || resolvedServers[i].lastUsedMs < oldestEntry->lastUsedMs))
+        {
+            oldestEntry = &resolvedServers[i];
+        }
+    }
+    if (entry == NULL && oldestEntry == NULL)
+    {
+        // Every entry is waiting on a lookup
+        pthread_mutex_unlock(&resolverMutex);
+        return -1;
+    }
+    if (entry == NULL)
+    {
+        entry = oldestEntry;
+        snprintf(entry->host, sizeof(entry->host), "%s", host);
+        entry->port = port;
+        entry->addressCount = 0;
+        entry->resolvedAtMs = 0;
+    }
+    entry->lastUsedMs = nowMs;
+
+    int isStale = entry->addressCount == 0 || entry->resolvedAtMs == 0 ||
+                  nowMs - entry->resolvedAtMs >= CLIENT_RESOLVE_CACHE_SECONDS * 1000LL;
+    if (isStale && !entry->isResolving)
+    {
+        pthread_t resolverThread;
+        entry->isResolving = 1;
+        if (pthread_create(&resolverThread, NULL, resolveServerThread, entry) == 0)
+        {
+            pthread_detach(resolverThread);
+        }
+        else
+        {
+            entry->isResolving = 0;
+        }
+    }
+
+    // Only a name with no addresses at all waits for the lookup
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += waitMs / 1000;
+    deadline.tv_nsec += (waitMs % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    while (waitMs > 0 && entry->addressCount == 0 && entry->isResolving)
+    {
+        if (pthread_cond_timedwait(&resolverAnswered, &resolverMutex, &deadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+
+    int addressCount = entry->addressCount;
+    memcpy(addresses, entry->addresses, addressCount * sizeof(entry->addresses[0]));
+    memcpy(addressLengths, entry->addressLengths, addressCount * sizeof(entry->addressLengths[0]));
+    pthread_mutex_unlock(&resolverMutex);
+    return addressCount > 0 ? addressCount : -1;
+}
+
+/*
+ * FUNCTION : resolveServerAddress
+ *
+ * DESCRIPTION : This function finds the addresses to try for a server. A numeric address never reaches the resolver.
+ * A name is looked up once and kept for CLIENT_RESOLVE_CACHE_SECONDS; after that the addresses it had are used
+ * straight away while a fresh lookup runs behind them, so only the very first connect to a name waits on DNS, and
+ * never for more than CLIENT_RESOLVE_TIMEOUT_MS.
+ *
+ * PARAMETERS : const char *host : Name or numeric address of the server.
+ *              int port : Its port.
+ *              struct sockaddr_storage *addresses : Room for CLIENT_RESOLVE_MAX_ADDRESSES.
+ *              socklen_t *addressLengths : Set to the length of each address.
+ *
+ * RETURNS : int : Number of addresses, or -1 if there are none (yet).
+ */
+int resolveServerAddress(const char *host, int port, struct sockaddr_storage *addresses, socklen_t *addressLengths)
+{
+    return lookupServerAddress(host, port, addresses, addressLengths, CLIENT_RESOLVE_TIMEOUT_MS);
+}
+
+/*
+ * FUNCTION : expireServerAddress
+ *
+ * DESCRIPTION : This function marks a server name's addresses as due for a fresh lookup, when none of them could be
+ * connected to. They are still used until the lookup answers, in case it is the network that is down and not the
+ * server that moved.
+ *
+ * PARAMETERS : const char *host : Name the server was connected by.
+ *              int port : Its port.
+ *
+ * RETURNS : void
+ */
+void expireServerAddress(const char *host, int port)
+{
+    pthread_mutex_lock(&resolverMutex);
+    for (int i = 0; i < CLIENT_RESOLVE_CACHE_SIZE; i++)
+    {
+        if (resolvedServers[i].port == port && strcmp(resolvedServers[i].host, host) == 0)
+        {
+            resolvedServers[i].resolvedAtMs = 0;
+        }
+    }
+    pthread_mutex_unlock(&resolverMutex);
+}
+
+/*
+ * FUNCTION : beginConnectAttempts
+ *
+ * DESCRIPTION : This function gets a connect ready to try the addresses it has, the first one straight away
+ *
+ * PARAMETERS : ConnectAttempt *attempt : The connect, its addresses filled in.
+ *              int addressCount : How many there are.
+ *
+ * RETURNS : void
+ */
+static void beginConnectAttempts(ConnectAttempt *attempt, int addressCount)
+{
+    long long nowMs = monotonicMilliseconds();
+    attempt->addressCount = addressCount;
+    attempt->attemptCount = 0;
+    attempt->pendingCount = 0;
+    attempt->nextAttemptMs = nowMs;
+    attempt->deadlineMs = nowMs + CLIENT_CONNECT_TIMEOUT_MS;
+}
+
+/*
+ * FUNCTION : connectAttemptStart
+ *
+ * DESCRIPTION : This function starts a connect to a server by name or address. Nothing happens until the first
+ * connectAttemptStep, which is where the name is looked up.
+ *
+ * PARAMETERS : ConnectAttempt *attempt : The connect to start.
+ *              const char *host : Name or numeric address of the server.
+ *              int port : Its port.
+ *
+ * RETURNS : void
+ */
+void connectAttemptStart(ConnectAttempt *attempt, const char *host, int port)
+{
+    snprintf(attempt->host, sizeof(attempt->host), "%s", host);
+    attempt->port = port;
+    beginConnectAttempts(attempt, 0);
+    attempt->deadlineMs = attempt->nextAttemptMs + CLIENT_RESOLVE_TIMEOUT_MS;
+}
+
+/*
+ * FUNCTION : connectAttemptAbandon
+ *
+ * DESCRIPTION : This function closes whatever attempts a connect still has going
+ *
+ * PARAMETERS : ConnectAttempt *attempt : The connect.
+ *
+ * RETURNS : void
+ */
+void connectAttemptAbandon(ConnectAttempt *attempt)
+{
+    for (int i = 0; i < attempt->attemptCount; i++)
+    {
+        if (attempt->attempts[i].fd >= 0)
+        {
+            close(attempt->attempts[i].fd);
+            attempt->attempts[i].fd = -1;
+        }
+    }
+    attempt->pendingCount = 0;
+}
+
+/*
+ * FUNCTION : connectAttemptStep
+ *
+ * DESCRIPTION : This function moves a connect on as far as it can go without waiting. Until the name has addresses
+ * the lookup is checked again every CLIENT_CONNECT_ATTEMPT_DELAY_MS, for up to CLIENT_RESOLVE_TIMEOUT_MS. Then the
+ * addresses are tried happy eyeballs style (RFC 8305): the first one, and each CLIENT_CONNECT_ATTEMPT_DELAY_MS
+ * without an answer (or as soon as an attempt fails) the next one alongside it, so a dead address or a broken IPv6
+ * route costs a quarter of a second rather than a whole connect timeout. Call it again once
+ * connectAttemptPollDescriptors shows an answer or connectAttemptTimeoutMs runs out.
+ *
+ * PARAMETERS : ConnectAttempt *attempt : The connect.
+ *
+ * RETURNS : int : The connected socket (blocking), CLIENT_CONNECT_PENDING while there is no answer yet, or -1 if
+ *                 the name didn't resolve or no address answered within CLIENT_CONNECT_TIMEOUT_MS.
+ */
+int connectAttemptStep(ConnectAttempt *attempt)
+{
+    long long nowMs = monotonicMilliseconds();
+    if (attempt->addressCount == 0)
+    {
+        int addressCount = lookupServerAddress(attempt->host, attempt->port, attempt->addresses, attempt->addressLengths, 0);
+        if (addressCount <= 0)
+        {
+            attempt->nextAttemptMs = nowMs + CLIENT_CONNECT_ATTEMPT_DELAY_MS;
+            return nowMs < attempt->deadlineMs ? CLIENT_CONNECT_PENDING : -1;
+        }
+        beginConnectAttempts(attempt, addressCount);
+    }
+
+    // Answers to the attempts made so far
+    int connectedSocket = -1;
+    if (attempt->pendingCount > 0 && poll(attempt->attempts, attempt->attemptCount, 0) > 0)
+    {
+        for (int i = 0; i < attempt->attemptCount && connectedSocket < 0; i++)
+        {
+            if (attempt->attempts[i].fd < 0 || attempt->attempts[i].revents == 0)
+            {
+                continue;
+            }
+            int socketError = 0;
+            socklen_t errorLength = sizeof(socketError);
+            getsockopt(attempt->attempts[i].fd, SOL_SOCKET, SO_ERROR, &socketError, &errorLength);
+            if (socketError == 0)
+            {
+                connectedSocket = attempt->attempts[i].fd;
+            }
+            else
+            {
+                close(attempt->attempts[i].fd);
+                attempt->nextAttemptMs = nowMs;
+            }
+            attempt->attempts[i].fd = -1;
+            attempt->pendingCount--;
+        }
+    }
+
+    // Then the next address, if its turn has come
+    while (connectedSocket < 0 && attempt->attemptCount < attempt->addressCount && nowMs >= attempt->nextAttemptMs)
+    {
+        const struct sockaddr_storage *address = &attempt->addresses[attempt->attemptCount];
+        int attemptSocket = socket(address->ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        struct pollfd *attemptPoll = &attempt->attempts[attempt->attemptCount];
+        *attemptPoll = (struct pollfd){-1, POLLOUT, 0};
+        attempt->nextAttemptMs = nowMs + CLIENT_CONNECT_ATTEMPT_DELAY_MS;
+        if (attemptSocket >= 0 && connect(attemptSocket, (const struct sockaddr *)address, attempt->addressLengths[attempt->attemptCount]) == 0)
+        {
+            connectedSocket = attemptSocket;
+        }
+        else if (attemptSocket >= 0 && errno == EINPROGRESS)
+        {
+            attemptPoll->fd = attemptSocket;
+            attempt->pendingCount++;
+        }
+        else
+        {
+            // Failed at once (no route, family not supported), go straight on to the next address
+            if (attemptSocket >= 0)
+            {
+                close(attemptSocket);
+            }
+            attempt->nextAttemptMs = nowMs;
+        }
+        attempt->attemptCount++;
+    }
+
+    if (connectedSocket < 0)
+    {
+        int isOver = nowMs >= attempt->deadlineMs || (attempt->pendingCount == 0 && attempt->attemptCount == attempt->addressCount);
+        if (!isOver)
+        {
+            return CLIENT_CONNECT_PENDING;
+        }
+    }
+
+    // The attempts that lost
+    connectAttemptAbandon(attempt);
+    if (connectedSocket >= 0)
+    {
+        fcntl(connectedSocket, F_SETFL, fcntl(connectedSocket, F_GETFL, 0) & ~O_NONBLOCK);
+    }
+    return connectedSocket;
+}
+
+/*
+ * FUNCTION : connectAttemptPollDescriptors
+ *
+ * DESCRIPTION : This function fills in what to poll for a connect's answers
+ *
+ * PARAMETERS : const ConnectAttempt *attempt : The connect.
+ *              struct pollfd *polls : Room for CLIENT_RESOLVE_MAX_ADDRESSES entries.
+ *
+ * RETURNS : int : Number of entries filled in (0 while the name is being looked up).
+ */
+int connectAttemptPollDescriptors(const ConnectAttempt *attempt, struct pollfd *polls)
+{
+    int pollCount = 0;
+    for (int i = 0; i < attempt->attemptCount; i++)
+    {
+        if (attempt->attempts[i].fd >= 0)
+        {
+            polls[pollCount++] = (struct pollfd){attempt->attempts[i].fd, POLLOUT, 0};
+        }
+    }
+    return pollCount;
+}
+
+/*
+ * FUNCTION : connectAttemptTimeoutMs
+ *
+ * DESCRIPTION : This function says how long a connect can be left before connectAttemptStep has to run whether or
+ * not any of its descriptors were polled: until the next address is due, the lookup is checked again or it gives up
+ *
+ * PARAMETERS : const ConnectAttempt *attempt : The connect.
+ *
+ * RETURNS : int : Milliseconds (0 to run it now).
+ */
+int connectAttemptTimeoutMs(const ConnectAttempt *attempt)
+{
+    long long waitUntilMs = attempt->deadlineMs;
+    if ((attempt->addressCount == 0 || attempt->attemptCount < attempt->addressCount) && attempt->nextAttemptMs < waitUntilMs)
+    {
+        waitUntilMs = attempt->nextAttemptMs;
+    }
+    long long remainingMs = waitUntilMs - monotonicMilliseconds();
+    return remainingMs > 0 ? (int)remainingMs : 0;
+}
+
+/*
+ * FUNCTION : connectToFirstAddress
+ *
+ * DESCRIPTION : This function connects to whichever of a server's addresses answers first (see connectAttemptStep),
+ * waiting for the answer
+ *
+ * PARAMETERS : const struct sockaddr_storage *addresses : The addresses, best first.
+ *              const socklen_t *addressLengths : Length of each.
+ *              int addressCount : How many there are.
+ *
+ * RETURNS : int : The connected socket (blocking), or -1 if no address answered within CLIENT_CONNECT_TIMEOUT_MS.
+ */
+int connectToFirstAddress(const struct sockaddr_storage *addresses, const socklen_t *addressLengths, int addressCount)
+{
+    if (addressCount <= 0)
+    {
+        return -1;
+    }
+    ConnectAttempt attempt;
+    if (addressCount > CLIENT_RESOLVE_MAX_ADDRESSES)
+    {
+        addressCount = CLIENT_RESOLVE_MAX_ADDRESSES;
+    }
+    memcpy(attempt.addresses, addresses, addressCount * sizeof(addresses[0]));
+    memcpy(attempt.addressLengths, addressLengths, addressCount * sizeof(addressLengths[0]));
+    beginConnectAttempts(&attempt, addressCount);
+
+    int connectedSocket;
+    while ((connectedSocket = connectAttemptStep(&attempt)) == CLIENT_CONNECT_PENDING)
+    {
+        poll(attempt.attempts, attempt.attemptCount, connectAttemptTimeoutMs(&attempt));
+    }
+    return connectedSocket;
+}
+
+/*
+ * FUNCTION : connectToServer
+ *
+ * DESCRIPTION : This function connects to the server over TCP, by name or by IPv4 or IPv6 address, trying every
+ * address the name has (see resolveServerAddress and connectToFirstAddress).
+ * A server address of unix:<path> connects over an AF_UNIX socket instead of TCP, and shm:<path> does the same
+ * then asks the server to move the connection onto shared memory rings. A TCP address can end in :PORT for a
+ * server that isn't on SERVER_PORT, with an IPv6 address in brackets ([::1]:8889).
+ *
+ * PARAMETERS : const char *serverIpAddress : The server name or address (or unix:/shm: path) as a string.
+ *              Transport *transport : Set up to talk to the server on success.
+ *
+ * RETURNS : int : 0 on success, -1 on error.
+ */
+int connectToServer(const char *serverIpAddress, Transport *transport)
+{
+    // Same-host transports skip the TCP stack entirely
+    if (strncmp(serverIpAddress, TRANSPORT_UNIX_PREFIX, strlen(TRANSPORT_UNIX_PREFIX)) == 0)
+    {
+        return transportConnectUnix(serverIpAddress + strlen(TRANSPORT_UNIX_PREFIX), transport);
+    }
+    if (strncmp(serverIpAddress, TRANSPORT_SHM_PREFIX, strlen(TRANSPORT_SHM_PREFIX)) == 0)
+    {
+        if (transportConnectUnix(serverIpAddress + strlen(TRANSPORT_SHM_PREFIX), transport) < 0)
+        {
+            return -1;
+        }
+        // If the server refuses we just stay on the AF_UNIX socket
+        transportRequestSharedMemory(transport);
+        return 0;
+    }
+
+    // host:port picks a server on another port (several nodes on one host)
+    char serverHost[256];
+    int serverPort = transportSplitHostPort(serverIpAddress, serverHost, sizeof(serverHost), SERVER_PORT);
+    if (serverPort < 0 || serverHost[0] == '\0')
+    {
+        return -1;
+    }
+
+    struct sockaddr_storage addresses[CLIENT_RESOLVE_MAX_ADDRESSES];
+    socklen_t addressLengths[CLIENT_RESOLVE_MAX_ADDRESSES];
+    int addressCount = resolveServerAddress(serverHost, serverPort, addresses, addressLengths);
+    if (addressCount < 0)
+    {
+        return -1;
+    }
+    int serverSocket = connectToFirstAddress(addresses, addressLengths, addressCount);
+    if (serverSocket < 0)
+    {
+        expireServerAddress(serverHost, serverPort);
+        return -1;
+    }
+
+    // CHANGED THIS: Removed global clientIP usage.
+    // Instead, main will call getLocalIP and store it in the ClientStruct.
+    transportInitialize(transport, serverSocket, TRANSPORT_TCP);
+    return 0;
+}
+
+/*
+ * FUNCTION : chatClientInitialize
+ *
+ * DESCRIPTION : This function sets up a client that isn't connected yet
+ *
+ * PARAMETERS : ChatClient *client : The client to set up.
+ *              const char *userName : Name shown with our messages (up to 5 characters).
+ *              const char *serverAddress : Anything connectToServer accepts.
+ *              const ChatClientCallbacks *callbacks : Where messages and events go (copied).
+ *              void *context : Kept in client->context for the callbacks.
+ *
+ * RETURNS : void
+ */
+void chatClientInitialize(ChatClient *client, const char *userName, const char *serverAddress, const ChatClientCallbacks *callbacks, void *context)
+{
+    // Nothing connected yet, so chatClientClose is safe if the connect fails
+    transportInitialize(&client->transport, -1, TRANSPORT_TCP);
+    strncpy(client->clientIP, "0.0.0.0", sizeof(client->clientIP));
+    strncpy(client->userName, userName, sizeof(client->userName) - 1);
+    client->userName[sizeof(client->userName) - 1] = '\0';
+    strncpy(client->serverAddress, serverAddress, sizeof(client->serverAddress) - 1);
+    client->serverAddress[sizeof(client->serverAddress) - 1] = '\0';
+    client->lastSequence = 0;
+    pthread_mutex_init(&client->connectionMutex, NULL);
+    client->isConnected = 0;
+    client->isLeaving = 0;
+    client->connectedAt = 0;
+    client->reconnectAtMs = 0;
+    client->reconnectAttempt = 0;
+    client->retryAfterSeconds = 0;
+    client->isReconnecting = 0;
+    client->replayLength = 0;
+    client->replaySent = 0;
+    client->unsentCount = 0;
+    client->connectionNumber = 0;
+    client->receivedLength = 0;
+    client->incomingRemaining = 0;
+    client->blobFailure[0] = '\0';
+    client->wantsCompression = 0;
+    client->decompressor = NULL;
+    client->compressedBlock = NULL;
+    client->callbacks = *callbacks;
+    client->context = context;
+}
+
+/*
+ * FUNCTION : requestCompression
+ *
+ * DESCRIPTION : This function asks the server to compress what it sends on a new connection, if the client wants
+ * that. It goes before anything else, a resume included, so the missed lines come compressed.
+ *
+ * PARAMETERS : ChatClient *client : The client, just connected.
+ *
+ * RETURNS : void
+ */
+static void requestCompression(ChatClient *client)
+{
+    if (client->wantsCompression)
+    {
+        char compressFrame[] = PROTOCOL_COMPRESS PROTOCOL_COMPRESS_LZ "\n";
+        transportSend(&client->transport, compressFrame, strlen(compressFrame), 0);
+    }
+}
+
+/*
+ * FUNCTION : chatClientConnect
+ *
+ * DESCRIPTION : This function makes the first connection to the server (blocking). Once it has worked, lost
+ * connections are made again by chatClientProcess.
+ *
+ * PARAMETERS : ChatClient *client : The client to connect.
+ *
+ * RETURNS : int : 0 on success, -1 on error.
+ */
+int chatClientConnect(ChatClient *client)
+{
+    if (connectToServer(client->serverAddress, &client->transport) < 0)
+    {
+        return -1;
+    }
+    getClientIp(client->transport.socket, client->clientIP, sizeof(client->clientIP));
+    requestCompression(client);
+    client->isConnected = 1;
+    client->connectedAt = time(NULL);
+    client->connectionNumber++;
+    return 0;
+}
+
+/*
+ * FUNCTION : queueReplayFrame
+ *
+ * DESCRIPTION : This function adds a frame to those waiting to go out on a new connection. connectionMutex must be
+ * held.
+ *
+ * PARAMETERS : ChatClient *client : The client.
+ *              const char *frame : The frame, its frame end included.
+ *              size_t length : Its length.
+ *
+ * RETURNS : int : 0 on success, -1 if there is no room for it.
+ */
+static int queueReplayFrame(ChatClient *client, const char *frame, size_t length)
+{
+    if (client->replayLength + length > sizeof(client->replayFrames))
+    {
+        return -1;
+    }
+    memcpy(client->replayFrames + client->replayLength, frame, length);
+    client->replayLength += length;
+    return 0;
+}
+
+/*
+ * FUNCTION : queueUnsentMessages
+ *
+ * DESCRIPTION : This function moves the messages kept while there was no connection to the frames waiting to go out,
+ * in order. connectionMutex must be held.
+ *
+ * PARAMETERS : ChatClient *client : The client.
+ *
+ * RETURNS : void
+ */
+static void queueUnsentMessages(ChatClient *client)
+{
+    int queuedCount = 0;
+    while (queuedCount < client->unsentCount)
+    {
+        char frame[MAX_PROTOL_MESSAGE_SIZE + 1];
+        int len = snprintf(frame, sizeof(frame), "%s%c", client->unsentMessages[queuedCount], PROTOCOL_FRAME_END);
+        if (queueReplayFrame(client, frame, len) < 0)
+        {
+            break;
+        }
+        queuedCount++;
+    }
+    client->unsentCount -= queuedCount;
+    memmove(client->unsentMessages, client->unsentMessages[queuedCount], client->unsentCount * sizeof(client->unsentMessages[0]));
+}
+
+/*
+ * FUNCTION : sendReplayFrames
+ *
+ * DESCRIPTION : This function sends as much as it can of the frames waiting to go out on a new connection, then any
+ * messages that had no room behind them. connectionMutex must be held.
+ *
+ * PARAMETERS : ChatClient *client : The client, connected.
+ *              int flags : MSG_DONTWAIT from the event loop, 0 to wait until they are all out.
+ *
+ * RETURNS : int : 0 if they are all out or the socket is full, -1 if the connection failed.
+ */
+static int sendReplayFrames(ChatClient *client, int flags)
+{
+    while (client->replaySent < client->replayLength)
+    {
+        ssize_t sentBytes = transportSend(&client->transport, client->replayFrames + client->replaySent,
+                                          client->replayLength - client->replaySent, flags);
+        if (sentBytes < 0)
+        {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+        }
+        client->replaySent += sentBytes;
+        if (client->replaySent == client->replayLength)
+        {
+            client->replayLength = 0;
+            client->replaySent = 0;
+            queueUnsentMessages(client);
+        }
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : sendProtocolMessage
+ *
+ * DESCRIPTION : This function sends a formatted message to the server as one frame. While the client is reconnecting
+ * (or if the send fails) the message is kept and sent once the connection is back, and while the frames for a new
+ * connection are still going out it queues behind them.
+ *
+ * PARAMETERS : const char *message : The message to send.
+ *              ChatClient *client : The connection to the server.
+ *
+ * RETURNS : void
+ */
+void sendProtocolMessage(const char *message, ChatClient *client)
+{
+    // Get the length of the message, and end the frame
+    char frame[MAX_PROTOL_MESSAGE_SIZE + 1];
+    int len = snprintf(frame, sizeof(frame), "%s%c", message, PROTOCOL_FRAME_END);
+    int droppedWith = -1;
+
+    pthread_mutex_lock(&client->connectionMutex);
+    // Write to the server
+    if (client->isConnected &&
+        (client->replayLength > 0 ? queueReplayFrame(client, frame, len) == 0 : transportSend(&client->transport, frame, len, 0) == len))
+    {
+        pthread_mutex_unlock(&client->connectionMutex);
+        return;
+    }
+
+    // Not connected right now: keep it for after the reconnect (a pong is pointless by then)
+    if (strcmp(message, PROTOCOL_PONG) != 0)
+    {
+        if (client->unsentCount < CHAT_CLIENT_UNSENT_QUEUE_LENGTH)
+        {
+            strncpy(client->unsentMessages[client->unsentCount], message, MAX_PROTOL_MESSAGE_SIZE - 1);
+            client->unsentMessages[client->unsentCount][MAX_PROTOL_MESSAGE_SIZE - 1] = '\0';
+            client->unsentCount++;
+        }
+        else
+        {
+            droppedWith = client->unsentCount;
+        }
+    }
+    pthread_mutex_unlock(&client->connectionMutex);
+
+    if (droppedWith >= 0)
+    {
+        reportEvent(client, CHAT_CLIENT_EVENT_UNSENT, droppedWith);
+    }
+}
+
+/*
+ * FUNCTION : chatClientSendText
+ *
+ * DESCRIPTION : This function sends a line the user typed, split in two if it is longer than 40 columns.
+ * Sending the bye text marks the client as leaving, so the server closing afterwards isn't reconnected.
+ *
+ * PARAMETERS : ChatClient *client : The client to send from.
+ *              const char *text : The line (without a newline).
+ *
+ * RETURNS : void
+ */
+void chatClientSendText(ChatClient *client, const char *text)
+{
+    char protocolMsg[MAX_PROTOL_MESSAGE_SIZE];
+    char messagePartOne[CLIENT_MSG_PART_BYTES + 1] = {"0"};
+    char messagePartTwo[CLIENT_MSG_PART_BYTES + 1] = {"0"};
+
+    if (strcmp(text, PROTOCOL_BYE) == 0)
+    {
+        client->isLeaving = 1;
+    }
+
+    // If the message is 40 columns or less
+    size_t textLength = strlen(text);
+    if (textLength <= CLIENT_MSG_PART_LENGTH || (textLength <= CLIENT_MSG_PART_BYTES && utf8DisplayWidth(text, textLength) <= CLIENT_MSG_PART_LENGTH))
+    {
+        // Send a single message
+        snprintf(protocolMsg, sizeof(protocolMsg), "%s|%s|0|%s", client->clientIP, client->userName, text);
+        sendProtocolMessage(protocolMsg, client);
+    }
+    // Otherwise split the message and send both parts
+    else
+    {
+        // Split the message into two parts.
+        splitMessage(text, messagePartOne, messagePartTwo);
+        snprintf(protocolMsg, sizeof(protocolMsg), "%s|%s|1|%s", client->clientIP, client->userName, messagePartOne);
+        sendProtocolMessage(protocolMsg, client);
+        snprintf(protocolMsg, sizeof(protocolMsg), "%s|%s|2|%s", client->clientIP, client->userName, messagePartTwo);
+        sendProtocolMessage(protocolMsg, client);
+    }
+}
+
+/*
+ * FUNCTION : sendFileChunk
+ *
+ * DESCRIPTION : This function sends one upload chunk: its frame, then the file bytes straight from the page cache.
+ * connectionMutex must be held, so no other frame lands in the middle of the raw bytes.
+ *
+ * PARAMETERS : ChatClient *client : The uploading client.
+ *              int fileDescriptor : The file.
+ *              off_t *offset : Where the chunk starts, advanced past it.
+ *              size_t chunkLength : Bytes in the chunk.
+ *
+ * RETURNS : int : 0 on success, -1 if the connection failed part way.
+ */
+static int sendFileChunk(ChatClient *client, int fileDescriptor, off_t *offset, size_t chunkLength)
+{
+    char chunkFrame[MAX_PROTOL_MESSAGE_SIZE];
+    int chunkFrameLength = snprintf(chunkFrame, sizeof(chunkFrame), "%s%zu%c", PROTOCOL_CHUNK, chunkLength, PROTOCOL_FRAME_END);
+    if (transportSend(&client->transport, chunkFrame, chunkFrameLength, 0) != chunkFrameLength)
+    {
+        return -1;
+    }
+    while (chunkLength > 0)
+    {
+        ssize_t sentBytes = transportSendFile(&client->transport, fileDescriptor, offset, chunkLength, 0);
+        if (sentBytes <= 0)
+        {
+            return -1;
+        }
+        chunkLength -= sentBytes;
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : chatClientSendFile
+ *
+ * DESCRIPTION : This function shares a file with the room. It is uploaded in chunks (the send blocks until it is
+ * all out), and the server announces it as a chat line with the id to get it by. Chat frames from other threads
+ * can go out between chunks.
+ *
+ * PARAMETERS : ChatClient *client : The client to send from.
+ *              const char *path : The file.
+ *
+ * RETURNS : int : 0 once the file is sent, -1 if it couldn't be opened, was empty or too big, or the connection
+ *                 was lost (errno set).
+ */
+int chatClientSendFile(ChatClient *client, const char *path)
+{
+    int fileDescriptor = open(path, O_RDONLY | O_CLOEXEC);
+    if (fileDescriptor < 0)
+    {
+        return -1;
+    }
+    struct stat fileStatus;
+    if (fstat(fileDescriptor, &fileStatus) < 0)
+    {
+        int savedErrno = errno;
+        close(fileDescriptor);
+        errno = savedErrno;
+        return -1;
+    }
+    if (fileStatus.st_size == 0 || fileStatus.st_size > PROTOCOL_BLOB_MAX_BYTES)
+    {
+        close(fileDescriptor);
+        errno = EFBIG;
+        return -1;
+    }
+
+    const char *fileName = strrchr(path, '/') != NULL ? strrchr(path, '/') + 1 : path;
+    char putFrame[MAX_PROTOL_MESSAGE_SIZE + 1];
+    pthread_mutex_lock(&client->connectionMutex);
+    int putFrameLength = snprintf(putFrame, sizeof(putFrame), "%s|%s|0|%s%lld %.*s%c", client->clientIP, client->userName, PROTOCOL_PUT,
+                                  (long long)fileStatus.st_size, CLIENT_BLOB_NAME_LENGTH, fileName, PROTOCOL_FRAME_END);
+    unsigned long uploadConnection = client->connectionNumber;
+    // The upload waits anyway, so the frames for a new connection are waited for too rather than overtaken
+    int isSent = client->isConnected && sendReplayFrames(client, 0) == 0 &&
+                 transportSend(&client->transport, putFrame, putFrameLength, 0) == putFrameLength;
+    pthread_mutex_unlock(&client->connectionMutex);
+
+    off_t offset = 0;
+    while (isSent && offset < fileStatus.st_size)
+    {
+        size_t chunkLength = fileStatus.st_size - offset < PROTOCOL_BLOB_CHUNK_BYTES ? fileStatus.st_size - offset : PROTOCOL_BLOB_CHUNK_BYTES;
+
+        // The lock is let go between chunks so pongs and chat lines aren't stuck behind a big file
+        pthread_mutex_lock(&client->connectionMutex);
+        isSent = client->isConnected && client->connectionNumber == uploadConnection &&
+                 sendFileChunk(client, fileDescriptor, &offset, chunkLength) == 0;
+        if (!isSent && client->isConnected && client->connectionNumber == uploadConnection)
+        {
+            // Cut off part way through a chunk, the connection can't be used any more. The reader sees it go.
+            transportShutdown(&client->transport);
+        }
+        pthread_mutex_unlock(&client->connectionMutex);
+    }
+    close(fileDescriptor);
+    if (!isSent)
+    {
+        errno = ECONNRESET;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : chatClientRequestBlob
+ *
+ * DESCRIPTION : This function asks the server for a shared file. It arrives through the onBlobData callback, with
+ * chat lines carrying on in between.
+ *
+ * PARAMETERS : ChatClient *client : The client.
+ *              unsigned long blobId : The id from the announcement.
+ *
+ * RETURNS : void
+ */
+void chatClientRequestBlob(ChatClient *client, unsigned long blobId)
+{
+    char getFrame[MAX_PROTOL_MESSAGE_SIZE];
+    snprintf(getFrame, sizeof(getFrame), "%s%lu", PROTOCOL_GET, blobId);
+    sendProtocolMessage(getFrame, client);
+}
+
+/*
+ * FUNCTION : chatClientSearch
+ *
+ * DESCRIPTION : This function searches everything said in the room. The matches arrive through onMessage with
+ * isSearchResult set, newest first, followed by CHAT_CLIENT_EVENT_SEARCH_DONE.
+ *
+ * PARAMETERS : ChatClient *client : The client.
+ *              const char *query : Words that must all be in a line, and optionally user:NAME, after:MS, before:MS
+ *                                  and limit:COUNT.
+ *
+ * RETURNS : void
+ */
+void chatClientSearch(ChatClient *client, const char *query)
+{
+    char searchFrame[MAX_PROTOL_MESSAGE_SIZE];
+    snprintf(searchFrame, sizeof(searchFrame), "%s%s", PROTOCOL_SEARCH, query);
+    sendProtocolMessage(searchFrame, client);
+}
+
+/*
+ * FUNCTION : reconnectDelayMs
+ *
+ * DESCRIPTION : This function works out how long to wait before the next reconnect attempt: exponential backoff with
+ * full jitter (a random time up to the backoff), so clients dropped by the same server restart come back spread out
+ * instead of all at once. A busy server's retry-after is a floor, spread over up to twice as long.
+ *
+ * PARAMETERS : int attempt : Attempts already made since the connection was lost.
+ *              int retryAfterSeconds : Retry-after from a busy frame, 0 if there wasn't one.
+ *
+ * RETURNS : long : Milliseconds to wait.
+ */
+long reconnectDelayMs(int attempt, int retryAfterSeconds)
+{
+    if (retryAfterSeconds > 0)
+    {
+        long retryAfterMs = retryAfterSeconds * 1000L;
+        return retryAfterMs + random() % retryAfterMs;
+    }
+
+    long backoffMs = CLIENT_RECONNECT_MAX_MS;
+    if (attempt < 16)
+    {
+        backoffMs = CLIENT_RECONNECT_BASE_MS << attempt;
+    }
+    if (backoffMs > CLIENT_RECONNECT_MAX_MS)
+    {
+        backoffMs = CLIENT_RECONNECT_MAX_MS;
+    }
+    return random() % (backoffMs + 1);
+}
+
+/*
+ * FUNCTION : scheduleReconnect
+ *
+ * DESCRIPTION : This function picks the time of the next reconnect attempt
+ *
+ * PARAMETERS : ChatClient *client : The disconnected client.
+ *
+ * RETURNS : void
+ */
+static void scheduleReconnect(ChatClient *client)
+{
+    client->reconnectAtMs = monotonicMilliseconds() + reconnectDelayMs(client->reconnectAttempt, client->retryAfterSeconds);
+    client->retryAfterSeconds = 0;
+    client->reconnectAttempt++;
+}
+
+/*
+ * FUNCTION : handleDisconnect
+ *
+ * DESCRIPTION : This function closes a lost connection and, unless we said bye, schedules the reconnect
+ *
+ * PARAMETERS : ChatClient *client : The client that lost its connection.
+ *              int errorNumber : errno from the failed read, 0 if the server closed.
+ *
+ * RETURNS : void
+ */
+static void handleDisconnect(ChatClient *client, int errorNumber)
+{
+    pthread_mutex_lock(&client->connectionMutex);
+    client->isConnected = 0;
+    transportClose(&client->transport);
+    client->replayLength = 0;
+    client->replaySent = 0;
+    pthread_mutex_unlock(&client->connectionMutex);
+
+    // A frame cut off by the disconnect is useless on the new connection, and so is the rest of a download.
+    // Compression is asked for again on every connection.
+    client->receivedLength = 0;
+    client->incomingRemaining = 0;
+    free(client->decompressor);
+    client->decompressor = NULL;
+    free(client->compressedBlock);
+    client->compressedBlock = NULL;
+
+    if (client->isLeaving)
+    {
+        reportEvent(client, CHAT_CLIENT_EVENT_CLOSED, 0);
+        return;
+    }
+
+    // Only a connection that held up for a while starts the backoff again from the bottom
+    if (time(NULL) - client->connectedAt >= CLIENT_RECONNECT_STABLE_SECONDS)
+    {
+        client->reconnectAttempt = 0;
+    }
+    scheduleReconnect(client);
+    reportEvent(client, CHAT_CLIENT_EVENT_DISCONNECTED, errorNumber);
+}
+
+/*
+ * FUNCTION : finishReconnect
+ *
+ * DESCRIPTION : This function puts a new connection to use. It first asks the server to resume after the last line
+ * delivered, so only the missed lines are sent, then the messages sent in the meantime go out. They are queued, not
+ * sent: chatClientProcess sends them as the socket takes them.
+ *
+ * PARAMETERS : ChatClient *client : The client, its transport just connected.
+ *
+ * RETURNS : void
+ */
+static void finishReconnect(ChatClient *client)
+{
+    pthread_mutex_lock(&client->connectionMutex);
+    getClientIp(client->transport.socket, client->clientIP, sizeof(client->clientIP));
+    client->replayLength = 0;
+    client->replaySent = 0;
+    if (client->wantsCompression)
+    {
+        char compressFrame[] = PROTOCOL_COMPRESS PROTOCOL_COMPRESS_LZ "\n";
+        queueReplayFrame(client, compressFrame, strlen(compressFrame));
+    }
+
+    // Has to be the first frame on the new connection (after the compression request)
+    if (client->lastSequence != 0)
+    {
+        char resumeFrame[MAX_PROTOL_MESSAGE_SIZE];
+        int resumeLength = snprintf(resumeFrame, sizeof(resumeFrame), "%s%lu%c", PROTOCOL_RESUME, client->lastSequence, PROTOCOL_FRAME_END);
+        queueReplayFrame(client, resumeFrame, resumeLength);
+    }
+
+    // Then what was sent while disconnected, in order
+    queueUnsentMessages(client);
+    client->isConnected = 1;
+    client->connectedAt = time(NULL);
+    client->connectionNumber++;
+    if (sendReplayFrames(client, MSG_DONTWAIT) < 0)
+    {
+        transportShutdown(&client->transport);
+    }
+    pthread_mutex_unlock(&client->connectionMutex);
+
+    reportEvent(client, CHAT_CLIENT_EVENT_RECONNECTED, 0);
+}
+
+/*
+ * FUNCTION : continueReconnect
+ *
+ * DESCRIPTION : This function moves a reconnect on as far as it goes without waiting, and puts the connection to
+ * use once it is made
+ *
+ * PARAMETERS : ChatClient *client : The reconnecting client.
+ *
+ * RETURNS : void
+ */
+static void continueReconnect(ChatClient *client)
+{
+    int serverSocket = connectAttemptStep(&client->reconnection);
+    if (serverSocket == CLIENT_CONNECT_PENDING)
+    {
+        return;
+    }
+    client->isReconnecting = 0;
+    if (serverSocket < 0)
+    {
+        // Addresses that all failed are looked up again next time
+        if (client->reconnection.addressCount > 0)
+        {
+            expireServerAddress(client->reconnection.host, client->reconnection.port);
+        }
+        scheduleReconnect(client);
+        return;
+    }
+
+    // Nobody else touches the transport while isConnected is 0
+    transportInitialize(&client->transport, serverSocket, TRANSPORT_TCP);
+    finishReconnect(client);
+}
+
+/*
+ * FUNCTION : tryReconnect
+ *
+ * DESCRIPTION : This function starts a reconnect attempt. Over TCP nothing here waits: the lookup and the connect
+ * are moved on by chatClientProcess as their descriptors and timeouts come up. A unix: or shm: server is on the
+ * same host and is connected to straight away.
+ *
+ * PARAMETERS : ChatClient *client : The disconnected client.
+ *
+ * RETURNS : void
+ */
+static void tryReconnect(ChatClient *client)
+{
+    if (strncmp(client->serverAddress, TRANSPORT_UNIX_PREFIX, strlen(TRANSPORT_UNIX_PREFIX)) == 0 ||
+        strncmp(client->serverAddress, TRANSPORT_SHM_PREFIX, strlen(TRANSPORT_SHM_PREFIX)) == 0)
+    {
+        if (connectToServer(client->serverAddress, &client->transport) < 0)
+        {
+            scheduleReconnect(client);
+            return;
+        }
+        finishReconnect(client);
+        return;
+    }
+
+    char serverHost[256];
+    int serverPort = transportSplitHostPort(client->serverAddress, serverHost, sizeof(serverHost), SERVER_PORT);
+    if (serverPort < 0 || serverHost[0] == '\0')
+    {
+        scheduleReconnect(client);
+        return;
+    }
+    connectAttemptStart(&client->reconnection, serverHost, serverPort);
+    client->isReconnecting = 1;
+    continueReconnect(client);
+}
+
+/*
+ * FUNCTION : handleReceivedFrame
+ *
+ * DESCRIPTION : This function deals with one frame from the server: answers pings, reports a busy server,
+ * and hands chat lines to the caller once, in order (a resume can repeat lines that arrived just before it)
+ *
+ * PARAMETERS : ChatClient *client : The client the frame arrived on.
+ *              char *frame : The frame, without its frame end.
+ *
+ * RETURNS : void
+ */
+static void handleReceivedFrame(ChatClient *client, char *frame)
+{
+    ChatMessage message = {0, 0, frame, 0, 0};
+
+    // Answer a heartbeat ping
+    if (strcmp(frame, PROTOCOL_PING) == 0)
+    {
+        sendProtocolMessage(PROTOCOL_PONG, client);
+        return;
+    }
+    // A download chunk: >>data<<BLOBID|OFFSET|LENGTH|TOTAL, its raw bytes follow (see deliverBlobData)
+    if (strncmp(frame, PROTOCOL_DATA, strlen(PROTOCOL_DATA)) == 0)
+    {
+        char *field = frame + strlen(PROTOCOL_DATA);
+        client->incomingBlobId = strtoul(field, &field, 10);
+        client->incomingOffset = strtoull(*field == '|' ? field + 1 : field, &field, 10);
+        client->incomingRemaining = strtoull(*field == '|' ? field + 1 : field, &field, 10);
+        client->incomingTotal = strtoull(*field == '|' ? field + 1 : field, &field, 10);
+        return;
+    }
+    if (strncmp(frame, PROTOCOL_BLOB_FAIL, strlen(PROTOCOL_BLOB_FAIL)) == 0)
+    {
+        snprintf(client->blobFailure, sizeof(client->blobFailure), "%s", frame + strlen(PROTOCOL_BLOB_FAIL));
+        reportEvent(client, CHAT_CLIENT_EVENT_BLOB_FAILED, 0);
+        return;
+    }
+    // The server turned us away, the reconnect waits at least as long as it said
+    if (strncmp(frame, PROTOCOL_BUSY, strlen(PROTOCOL_BUSY)) == 0)
+    {
+        client->retryAfterSeconds = atoi(frame + strlen(PROTOCOL_BUSY));
+        reportEvent(client, CHAT_CLIENT_EVENT_BUSY, client->retryAfterSeconds);
+        return;
+    }
+
+    // The server agreed to compress, blocks follow from here on. Its window starts over each time it agrees.
+    if (strcmp(frame, PROTOCOL_COMPRESS PROTOCOL_COMPRESS_LZ) == 0)
+    {
+        if (client->decompressor == NULL)
+        {
+            client->decompressor = malloc(sizeof(LzWindow));
+        }
+        if (client->decompressor != NULL)
+        {
+            lzWindowInitialize(client->decompressor);
+        }
+        else
+        {
+            transportShutdown(&client->transport);
+        }
+        return;
+    }
+    if (strncmp(frame, PROTOCOL_COMPRESS, strlen(PROTOCOL_COMPRESS)) == 0)
+    {
+        return;
+    }
+    // A compressed block: >>z<<RAWLENGTH|LENGTH, its bytes follow (see inflateCompressedBlock)
+    if (strncmp(frame, PROTOCOL_COMPRESSED, strlen(PROTOCOL_COMPRESSED)) == 0)
+    {
+        char *field = frame + strlen(PROTOCOL_COMPRESSED);
+        client->compressedRawLength = strtoull(field, &field, 10);
+        client->compressedLength = strtoull(*field == '|' ? field + 1 : field, &field, 10);
+        client->compressedReceived = 0;
+        client->compressedBlock = NULL;
+        if (client->decompressor != NULL && client->compressedLength > 0 && client->compressedLength <= CHAT_CLIENT_MAX_COMPRESSED_BYTES &&
+            client->compressedRawLength <= CHAT_CLIENT_MAX_COMPRESSED_BYTES)
+        {
+            client->compressedBlock = malloc(client->compressedLength);
+        }
+        if (client->compressedBlock == NULL)
+        {
+            // Nothing after this can be read in step with the server
+            transportShutdown(&client->transport);
+        }
+        return;
+    }
+
+    if (strcmp(frame, PROTOCOL_BLOCKED) == 0)
+    {
+        reportEvent(client, CHAT_CLIENT_EVENT_BLOCKED, 0);
+        return;
+    }
+    if (strncmp(frame, PROTOCOL_SEARCH_END, strlen(PROTOCOL_SEARCH_END)) == 0)
+    {
+        reportEvent(client, CHAT_CLIENT_EVENT_SEARCH_DONE, atoi(frame + strlen(PROTOCOL_SEARCH_END)));
+        return;
+    }
+
+    // Chat lines come numbered and stamped by the server: >>msg<<SEQUENCE|SERVERMS|line. Search matches look the
+    // same but are old lines, they don't count towards what has been delivered.
+    message.isSearchResult = strncmp(frame, PROTOCOL_SEARCH_HIT, strlen(PROTOCOL_SEARCH_HIT)) == 0;
+    if (message.isSearchResult || strncmp(frame, PROTOCOL_MESSAGE, strlen(PROTOCOL_MESSAGE)) == 0)
+    {
+        char *field = frame + strlen(message.isSearchResult ? PROTOCOL_SEARCH_HIT : PROTOCOL_MESSAGE);
+        message.sequence = strtoul(field, &field, 10);
+        if (*field == '|')
+        {
+            long long serverMs = strtoll(field + 1, &field, 10);
+            if (*field == '|')
+            {
+                message.serverMs = serverMs;
+                message.text = field + 1;
+            }
+        }
+
+        if (!message.isSearchResult)
+        {
+            // Already delivered
+            if (client->lastSequence != 0 && message.sequence <= client->lastSequence)
+            {
+                return;
+            }
+            if (client->lastSequence != 0 && message.sequence > client->lastSequence + 1)
+            {
+                reportEvent(client, CHAT_CLIENT_EVENT_MISSED, (int)(message.sequence - client->lastSequence - 1));
+            }
+            client->lastSequence = message.sequence;
+        }
+    }
+
+    // Check if the received message starts with our clientIP
+    message.isOwnMessage = strncmp(message.text, client->clientIP, strlen(client->clientIP)) == 0;
+    if (client->callbacks.onMessage != NULL)
+    {
+        client->callbacks.onMessage(client, &message);
+    }
+}
+
+/*
+ * FUNCTION : deliverBlobData
+ *
+ * DESCRIPTION : This function hands raw download bytes that followed a data frame to the caller
+ *
+ * PARAMETERS : ChatClient *client : The client.
+ *              const char *data : The bytes (no more than incomingRemaining).
+ *              size_t length : Number of bytes.
+ *
+ * RETURNS : void
+ */
+static void deliverBlobData(ChatClient *client, const char *data, size_t length)
+{
+    if (client->callbacks.onBlobData != NULL)
+    {
+        client->callbacks.onBlobData(client, client->incomingBlobId, client->incomingOffset, data, length, client->incomingTotal);
+    }
+    client->incomingOffset += length;
+    client->incomingRemaining -= length;
+}
+
+/*
+ * FUNCTION : inflateCompressedBlock
+ *
+ * DESCRIPTION : This function decompresses a block once all of its bytes are in and delivers the frames inside it.
+ * A block that doesn't decompress leaves the client out of step with the server, so the connection is dropped and
+ * the reconnect (with its resume) gets the lines back.
+ *
+ * PARAMETERS : ChatClient *client : The client, compressedBlock holds the whole block.
+ *
+ * RETURNS : void
+ */
+static void inflateCompressedBlock(ChatClient *client)
+{
+    char *frames = malloc(client->compressedRawLength + 1);
+    long framesLength = -1;
+    if (frames != NULL)
+    {
+        framesLength = lzDecompress(client->decompressor, client->compressedBlock, client->compressedLength, frames, client->compressedRawLength);
+    }
+    free(client->compressedBlock);
+    client->compressedBlock = NULL;
+    if (framesLength < 0)
+    {
+        free(frames);
+        transportShutdown(&client->transport);
+        return;
+    }
+
+    // Blocks hold whole frames only
+    char *frameStart = frames;
+    char *framesEnd = frames + framesLength;
+    char *frameEnd;
+    while (frameStart < framesEnd && (frameEnd = memchr(frameStart, PROTOCOL_FRAME_END, framesEnd - frameStart)) != NULL)
+    {
+        *frameEnd = '\0';
+        handleReceivedFrame(client, frameStart);
+        frameStart = frameEnd + 1;
+    }
+    free(frames);
+}
+
+/*
+ * FUNCTION : chatClientPollDescriptors
+ *
+ * DESCRIPTION : This function fills in what to poll for a client before calling chatClientProcess
+ *
+ * PARAMETERS : ChatClient *client : The client.
+ *              struct pollfd *polls : Room for CHAT_CLIENT_MAX_POLL_DESCRIPTORS entries.
+ *
+ * RETURNS : int : Number of entries filled in (0 while waiting to reconnect, see chatClientTimeoutMs).
+ */
+int chatClientPollDescriptors(ChatClient *client, struct pollfd *polls)
+{
+    if (!client->isConnected)
+    {
+        // A reconnect under way waits for its connect attempts to answer
+        return client->isReconnecting ? connectAttemptPollDescriptors(&client->reconnection, polls) : 0;
+    }
+    int pollCount = transportPollDescriptors(&client->transport, polls);
+    if (client->replayLength > 0)
+    {
+        // Frames for the new connection still to go out
+        polls[0].events |= POLLOUT;
+    }
+    return pollCount;
+}
+
+/*
+ * FUNCTION : chatClientTimeoutMs
+ *
+ * DESCRIPTION : This function says how long the caller can wait before chatClientProcess has to run whether or not
+ * anything was polled
+ *
+ * PARAMETERS : ChatClient *client : The client.
+ *
+ * RETURNS : int : Milliseconds (0 to run it now), or -1 to wait for the descriptors alone.
+ */
+int chatClientTimeoutMs(ChatClient *client)
+{
+    if (client->isConnected)
+    {
+        // Bytes stashed while the transport was set up never show up on the descriptors
+        return client->transport.pendingLength > 0 ? 0 : -1;
+    }
+    if (client->isReconnecting)
+    {
+        return connectAttemptTimeoutMs(&client->reconnection);
+    }
+    if (client->isLeaving)
+    {
+        return -1;
+    }
+    long long remainingMs = client->reconnectAtMs - monotonicMilliseconds();
+    return remainingMs > 0 ? (int)remainingMs : 0;
+}
+
+/*
+ * FUNCTION : chatClientProcess
+ *
+ * DESCRIPTION : This function does whatever a client has waiting without blocking on the server: sends what it can
+ * of the frames queued for a new connection, reads everything that has arrived and delivers every complete frame,
+ * notices a lost connection, and starts or moves on a reconnect. Only one thread may call it for a given client.
+ *
+ * PARAMETERS : ChatClient *client : The client.
+ *
+ * RETURNS : void
+ */
+void chatClientProcess(ChatClient *client)
+{
+    if (!client->isConnected)
+    {
+        if (client->isReconnecting)
+        {
+            continueReconnect(client);
+        }
+        else if (!client->isLeaving && monotonicMilliseconds() >= client->reconnectAtMs)
+        {
+            tryReconnect(client);
+        }
+        return;
+    }
+
+    if (client->replayLength > 0)
+    {
+        pthread_mutex_lock(&client->connectionMutex);
+        if (sendReplayFrames(client, MSG_DONTWAIT) < 0)
+        {
+            // The read below sees the connection go
+            transportShutdown(&client->transport);
+        }
+        pthread_mutex_unlock(&client->connectionMutex);
+    }
+
+    // Read until there is nothing left, which is also what re-arms the descriptors
+    while (client->isConnected)
+    {
+        ssize_t numberOfBytesRead = transportReceive(&client->transport, client->receiveBuffer + client->receivedLength,
+                                                     sizeof(client->receiveBuffer) - 1 - client->receivedLength, MSG_DONTWAIT);
+        if (numberOfBytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        {
+            break;
+        }
+        // If there were no bytes read, the server disconnected
+        if (numberOfBytesRead <= 0)
+        {
+            handleDisconnect(client, numberOfBytesRead == 0 ? 0 : errno);
+            break;
+        }
+
+        client->receivedLength += numberOfBytesRead;
+        // Deliver every complete frame, and the raw bytes that follow a download chunk frame
+        char *frameStart = client->receiveBuffer;
+        char *bufferEnd = client->receiveBuffer + client->receivedLength;
+        char *frameEnd;
+        while (frameStart < bufferEnd)
+        {
+            if (client->compressedBlock != NULL)
+            {
+                size_t rawLength = bufferEnd - frameStart;
+                if (rawLength > client->compressedLength - client->compressedReceived)
+                {
+                    rawLength = client->compressedLength - client->compressedReceived;
+                }
+                memcpy(client->compressedBlock + client->compressedReceived, frameStart, rawLength);
+                client->compressedReceived += rawLength;
+                frameStart += rawLength;
+                if (client->compressedReceived == client->compressedLength)
+                {
+                    inflateCompressedBlock(client);
+                }
+                continue;
+            }
+            if (client->incomingRemaining > 0)
+            {
+                size_t rawLength = bufferEnd - frameStart;
+                if (rawLength > client->incomingRemaining)
+                {
+                    rawLength = client->incomingRemaining;
+                }
+                deliverBlobData(client, frameStart, rawLength);
+                frameStart += rawLength;
+                continue;
+            }
+
+            frameEnd = memchr(frameStart, PROTOCOL_FRAME_END, bufferEnd - frameStart);
+            if (frameEnd == NULL)
+            {
+                break;
+            }
+            *frameEnd = '\0';
+            handleReceivedFrame(client, frameStart);
+            frameStart = frameEnd + 1;
+        }
+        // Keep a partial frame for the next read (a frame longer than the buffer is delivered in pieces)
+        client->receivedLength -= frameStart - client->receiveBuffer;
+        memmove(client->receiveBuffer, frameStart, client->receivedLength);
+        if (client->receivedLength == sizeof(client->receiveBuffer) - 1)
+        {
+            client->receiveBuffer[client->receivedLength] = '\0';
+            handleReceivedFrame(client, client->receiveBuffer);
+            client->receivedLength = 0;
+        }
+    }
+}
+
+// What chatClientPoll polls, kept per calling thread and only ever grown, so a turn of the loop doesn't allocate
+static __thread struct pollfd *pollBuffer = NULL;
+static __thread int *firstPollBuffer = NULL;
+static __thread int pollBufferClients = 0;
+
+/*
+ * FUNCTION : chatClientPoll
+ *
+ * DESCRIPTION : This function is one turn of an event loop over any number of clients: waits until one of them has
+ * something to do (or the timeout passes) and runs chatClientProcess for the ones that do
+ *
+ * PARAMETERS : ChatClient **clients : The clients.
+ *              int clientCount : How many there are.
+ *              int timeoutMs : Longest wait, -1 for no limit.
+ *
+ * RETURNS : int : Number of clients processed, or -1 on error (errno set).
+ */
+int chatClientPoll(ChatClient **clients, int clientCount, int timeoutMs)
+{
+    if (clientCount <= 0)
+    {
+        return poll(NULL, 0, timeoutMs) < 0 && errno != EINTR ? -1 : 0;
+    }
+    if (clientCount > pollBufferClients)
+    {
+        struct pollfd *newPolls = realloc(pollBuffer, sizeof(struct pollfd) * CHAT_CLIENT_MAX_POLL_DESCRIPTORS * clientCount);
+        if (newPolls != NULL)
+        {
+            pollBuffer = newPolls;
+        }
+        int *newFirstPolls = realloc(firstPollBuffer, sizeof(int) * (clientCount + 1));
+        if (newFirstPolls != NULL)
+        {
+            firstPollBuffer = newFirstPolls;
+        }
+        if (newPolls == NULL || newFirstPolls == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        pollBufferClients = clientCount;
+    }
+    struct pollfd *polls = pollBuffer;
+    int *firstPoll = firstPollBuffer;
+
+    // Each client's descriptors sit together, firstPoll[i]..firstPoll[i + 1]
+    int pollCount = 0;
+    for (int i = 0; i < clientCount; i++)
+    {
+        firstPoll[i] = pollCount;
+        pollCount += chatClientPollDescriptors(clients[i], polls + pollCount);
+        int clientTimeoutMs = chatClientTimeoutMs(clients[i]);
+        if (clientTimeoutMs >= 0 && (timeoutMs < 0 || clientTimeoutMs < timeoutMs))
+        {
+            timeoutMs = clientTimeoutMs;
+        }
+    }
+    firstPoll[clientCount] = pollCount;
+
+    if (poll(polls, pollCount, timeoutMs) < 0 && errno != EINTR)
+    {
+        return -1;
+    }
+
+    int processedCount = 0;
+    for (int i = 0; i < clientCount; i++)
+    {
+        int isReady = chatClientTimeoutMs(clients[i]) == 0;
+        for (int p = firstPoll[i]; p < firstPoll[i + 1]; p++)
+        {
+            isReady |= polls[p].revents != 0;
+        }
+        if (isReady)
+        {
+            chatClientProcess(clients[i]);
+            processedCount++;
+        }
+    }
+    return processedCount;
+}
+
+/*
+ * FUNCTION : chatClientClose
+ *
+ * DESCRIPTION : This function closes the connection and releases what the client holds
+ *
+ * PARAMETERS : ChatClient *client : The client.
+ *
+ * RETURNS : void
+ */
+void chatClientClose(ChatClient *client)
+{
+    pthread_mutex_lock(&client->connectionMutex);
+    // A lost connection was closed when it was lost
+    if (client->isConnected)
+    {
+        transportClose(&client->transport);
+    }
+    client->isConnected = 0;
+    client->isLeaving = 1;
+    pthread_mutex_unlock(&client->connectionMutex);
+    pthread_mutex_destroy(&client->connectionMutex);
+    if (client->isReconnecting)
+    {
+        connectAttemptAbandon(&client->reconnection);
+        client->isReconnecting = 0;
+    }
+    free(client->decompressor);
+    client->decompressor = NULL;
+    free(client->compressedBlock);
+    client->compressedBlock = NULL;
+}
@@ -1,13 +1,8 @@
 #include "../inc/chat-client.h"
 
 /*
-CHANGED THIS: Removed global clientIP. Instead, we will use ClientStruct in main.
+CHANGED THIS: Removed global clientIP. Instead, we will use the ChatClient in main (declared in chat-client-library.h).
 */
-typedef struct
-{
-    int socketFD;
-    char clientIP[256];
-} ClientStruct;
 
 // Ncurses Windows
 WINDOW *receivedMessagesWindow,
@@ -16,8 +11,8 @@ WINDOW *receivedMessagesWindow,
     *receivedTitle,
     *inputTitle;
 
-// Buffer for received messages
-char receiveBuffer[MAX_PROTOL_MESSAGE_SIZE];
+// Set once the server has closed after our bye, stops the input and receiving loops
+volatile int isChatFinished = 0;
 
 /*
  * FUNCTION : getLocalIP
@@ -67,141 +62,6 @@ char receiveBuffer[MAX_PROTOL_MESSAGE_SIZE];
 //     strncpy(ipBuffer, "0.0.0.0", bufferSize);
 // }
 
-/*
-CHANGED THIS:
-Instead of using getifaddrs(), this function uses getsockname() to obtain the local IP address from the socket.
-*/
-void getClientIp(int socket, char *ipBuffer, size_t bufferSize)
-{
-    struct sockaddr_in localAddr;
-    socklen_t addrLen = sizeof(localAddr);
-    if (getsockname(socket, (struct sockaddr *)&localAddr, &addrLen) == 0)
-    {
-        inet_ntop(AF_INET, &localAddr.sin_addr, ipBuffer, bufferSize);
-    }
-    else
-    {
-        strncpy(ipBuffer, "0.0.0.0", bufferSize);
-    }
-}
-
-/*
- * FUNCTION : splitMessage
- *
- * DESCRIPTION : This function splits a message into two parts if the message is longer than 40 characters
- * It will try to do in a graceful way if possible
- *
- * PARAMETERS : const char *fullString : The full message to split.
- *              char *firstPart : Buffer to store the first part of the message.
- *              char *secondPart : Buffer to store the second part of the message.
- *
- * RETURNS : void
- */
-void splitMessage(const char *fullString, char *firstPart, char *secondPart)
-{
-    int fullStringLength = strlen(fullString);
-    if (fullStringLength <= CLIENT_MSG_PART_LENGTH)
-    {
-        strncpy(firstPart, fullString, CLIENT_MSG_PART_LENGTH);
-        firstPart[CLIENT_MSG_PART_LENGTH] = '\0';
-        secondPart[0] = '\0';
-        return;
-    }
-
-    // Get the MINIMUM split location (-40)
-    int minSplit = fullStringLength - CLIENT_MSG_PART_LENGTH;
-
-    // Max split assigned 40 to start
-    int maxSplit = CLIENT_MSG_PART_LENGTH;
-
-    // Divide to get possible mid-point of full message
-    int midPoint = fullStringLength / 2;
-
-    // PLaceholder for split index
-    int splitIndex = -1;
-
-    // Iterate over the the message to find where to potentially split it (checking for a space in the middle or close to it)
-    for (
-        // Start the offset at 0
-        int splitOffset = 0;
-        // WHILE the split offset is LESS than or EQUAL to the max (string length - 40)
-        splitOffset <= (maxSplit - minSplit);
-        // Increment the split offset to keep checking
-        splitOffset++)
-    {
-        // Index of the lower half of the message by subtracting the midpoint from the split offset
-        int lowerHalfMessage = midPoint - splitOffset;
-
-        if (
-            // If the lower half of the message split is GREATER or EQUAL to minsplit
-            lowerHalfMessage >= minSplit &&
-            // AND the lower half is LESS THAN or EQUAL to the maxsplit
-            lowerHalfMessage <= maxSplit &&
-            // And the index of the full string is a SPACE (proper split!)
-            fullString[lowerHalfMessage] == ' ')
-        {
-            // Assign the split index to the current index of the space!
-            splitIndex = lowerHalfMessage;
-            break;
-        }
-
-        // Set the upper half to be the midpoint + the split offset (if the above IF was not used)
-        // This attempts to split at the best possible location in a not great case
-        // Calculate where the upper half of the message is using the mid point and the split offset
-        int upperHalfMessage = midPoint + splitOffset;
-
-        if (
-            // Is the upper hald of the message is GREATER or EQUAL to the MINIMUM split index
-            upperHalfMessage >= minSplit &&
-            // AND the upper half is LESS than or EQUAL to the MAXIMUM split index
-            upperHalfMessage <= maxSplit &&
-            // AND the character is a SPACE!
-            fullString[upperHalfMessage] == ' ')
-        {
-            // Set the split index to be the location of the best possible split location
-            splitIndex = upperHalfMessage;
-            break;
-        }
-    }
-
-    // If the split index is -1, split it right down the middle (no space, no best split, just cut it in half)
-    if (splitIndex == -1)
-    {
-        splitIndex = midPoint;
-    }
-
-    // If there was a space in the middle of the message (easiest case!), split it there!
-    if (fullString[splitIndex] == ' ')
-    {
-        // Copy the first part of the split using the split index
-        strncpy(firstPart, fullString, splitIndex);
-        // Set the last character of the first part to be a null term (proper string yo!)
-        firstPart[splitIndex] = '\0';
-        // Get the second half of the string using the FULL length and subtracting the location of the split +1 to offset
-        // the split
-        int secondHalfLength = fullStringLength - (splitIndex + 1);
-        if (secondHalfLength > CLIENT_MSG_PART_LENGTH)
-        {
-            secondHalfLength = CLIENT_MSG_PART_LENGTH;
-        }
-        // Copy the second part and add a null terminator
-        strncpy(secondPart, fullString + splitIndex + 1, secondHalfLength);
-        secondPart[secondHalfLength] = '\0';
-    }
-    // Otherwise, just cut the whole thing in half, most likely it was a big word in the middle of a large message
-    else
-    {
-        strncpy(firstPart, fullString, splitIndex);
-        firstPart[splitIndex] = '\0';
-        int secondLen = fullStringLength - splitIndex;
-        if (secondLen > CLIENT_MSG_PART_LENGTH)
-        {
-            secondLen = CLIENT_MSG_PART_LENGTH;
-        }
-        strncpy(secondPart, fullString + splitIndex, secondLen);
-        secondPart[secondLen] = '\0';
-    }
-}
 
 /*
  * FUNCTION : initializeNcursesWindows
@@ -214,6 +74,8 @@ void splitMessage(const char *fullString, char *firstPart, char *secondPart)
  */
 void initializeNcursesWindows(void)
 {
+    // Take the terminal's character set from the environment, so UTF-8 is read and drawn as characters
+    setlocale(LC_ALL, "");
     initscr();
     cbreak();
     noecho();
@@ -286,285 +148,371 @@ void initializeNcursesWindows(void)
     wrefresh(userInputWindow); // Refresh the input window to update the cursor position
 }
 
+
 /*
- * FUNCTION : connectToServer
+ * FUNCTION : handleReceivedMessage
  *
- * DESCRIPTION : This function creates a socket, binds it to a port, and connects to the server
+ * DESCRIPTION : This function runs in a separate thread to keep checking for messages from the chat server.
+ * The library does the reading and reconnecting and calls showChatMessage/showClientEvent for what it finds.
  *
- * PARAMETERS : const char *serverIpAddress : The server IP address as a string.
- *              int *socketFileDescriptor : Pointer to an integer to store the created socket file descriptor.
+ * PARAMETERS : void *arg : Pointer to the ChatClient structure.
  *
- * RETURNS : int : 0 on success, -1 on error.
+ * RETURNS : void * : Always returns NULL.
  */
-int connectToServer(const char *serverIpAddress, int *socketFileDescriptor)
+void *handleReceivedMessage(void *arg)
 {
-    // Setup a struct to hold the socket info
-    struct sockaddr_in serverAddress;
-
-    // Setup the socket using IPv4
-    *socketFileDescriptor = socket(AF_INET, SOCK_STREAM, 0);
-    if (*socketFileDescriptor < 0)
+    ChatClient *client = (ChatClient *)arg;
+    // Keep checking for messages in this loop
+    while (!isChatFinished)
     {
-        return -1;
+        chatClientPoll(&client, 1, -1);
     }
+    // Return NULL because you have to return something
+    return NULL;
+}
 
-    // Setup a socketaddr_in struct for the client
-    struct sockaddr_in localAddress;
-    memset(&localAddress, 0, sizeof(localAddress));
-    localAddress.sin_family = AF_INET;
-    localAddress.sin_addr.s_addr = htonl(INADDR_ANY);
-    localAddress.sin_port = 0;
-
-    // Bind the client socket
-    if (bind(*socketFileDescriptor, (struct sockaddr *)&localAddress, sizeof(localAddress)) < 0)
+/*
+ * FUNCTION : formatDisplayMessage
+ *
+ * DESCRIPTION : This function formats a chat line the way it is shown: with the server's time (our own with the
+ * arrows turned around)
+ *
+ * PARAMETERS : ChatMessage *message : The line from the server.
+ *              char *displayMessage : Buffer for the formatted line.
+ *              size_t displaySize : Size of the buffer.
+ *
+ * RETURNS : void
+ */
+void formatDisplayMessage(ChatMessage *message, char *displayMessage, size_t displaySize)
+{
+    // Get current time (the server's, when it stamped the line)
+    time_t now;
+    struct tm *timeInfo;
+    time(&now);
+    if (message->serverMs != 0)
     {
-        perror("bind failed");
-        close(*socketFileDescriptor);
-        return -1;
+        now = (time_t)(message->serverMs / 1000);
     }
 
-    // memory to store the address information
-    memset(&serverAddress, 0, sizeof(serverAddress));
-    serverAddress.sin_family = AF_INET;
-    serverAddress.sin_port = htons(SERVER_PORT);
-
-    /*
-    CHANGED THIS: Use gethostbyname to resolve the server address from a hostname.
-    */
-    struct hostent *hostEntry = gethostbyname(serverIpAddress);
-    if (hostEntry == NULL)
-    {
-        herror("gethostbyname failed");
-        return -1;
-    }
-    memcpy(&serverAddress.sin_addr, hostEntry->h_addr_list[0], hostEntry->h_length);
-    /* End CHANGED THIS */
+    // Use local time
+    timeInfo = localtime(&now);
+    // Get hours, minutes, and seconds
+    int hours = timeInfo->tm_hour;
+    int minutes = timeInfo->tm_min;
+    int seconds = timeInfo->tm_sec;
 
-    // Connect
-    if (connect(*socketFileDescriptor, (struct sockaddr *)&serverAddress, sizeof(serverAddress)) < 0)
+    // Check if the received message is one of ours
+    if (message->isOwnMessage)
     {
-        close(*socketFileDescriptor);
-        printf("ERROR CONNECTING TO SERVER!!\n\n");
-        return -1;
+        // Replace the >> with <<
+        scanReplacePairs(message->text, strlen(message->text), ">>", "<<");
     }
 
-    // CHANGED THIS: Removed global clientIP usage.
-    // Instead, main will call getLocalIP and store it in the ClientStruct.
-    return 0;
+    // Format the message (an old line found by a search is marked as one)
+    snprintf(displayMessage, displaySize, "%s%s(%02d:%02d:%02d)", message->isSearchResult ? CLIENT_SEARCH_RESULT_MARKER : "",
+             message->text, hours, minutes, seconds);
 }
 
 /*
- * FUNCTION : handleReceivedMessage
+ * FUNCTION : showChatMessage
  *
- * DESCRIPTION : This function runs in a separate thread to keep checking for messages from the chat server
- * Messages are displayed using ncurses
+ * DESCRIPTION : This function shows a chat line in the received messages window
  *
- * PARAMETERS : void *arg : Pointer to the ClientStruct structure.
+ * PARAMETERS : ChatClient *client : The client it arrived on.
+ *              ChatMessage *message : The line from the server.
  *
- * RETURNS : void * : Always returns NULL.
+ * RETURNS : void
  */
-void *handleReceivedMessage(void *arg)
+void showChatMessage(ChatClient *client, ChatMessage *message)
 {
-    ClientStruct *clientDetails = (ClientStruct *)arg;
-    int socketFileDescriptor = clientDetails->socketFD;
-    char localReceiveBuffer[MAX_PROTOL_MESSAGE_SIZE];
-    // Keep checking for messages in this loop
-    while (1)
-    {
-        // Get current time
-        time_t now;
-        struct tm *timeInfo;
-        // Read from the socket
-        ssize_t numberOfBytesRead = read(socketFileDescriptor, localReceiveBuffer, MAX_PROTOL_MESSAGE_SIZE - 1);
-        // If there are more than 0 bytes, there was a message
-        if (numberOfBytesRead > 0)
-        {
-            localReceiveBuffer[numberOfBytesRead] = '\0';
-            // Check if the received message starts with our clientIP
-            if (strncmp(localReceiveBuffer, clientDetails->clientIP, strlen(clientDetails->clientIP)) == 0)
-            {
-                // Get the time
-                time(&now);
-                // Use local time
-                timeInfo = localtime(&now);
-                // Get hours, minutes, and seconds
-                int hours = timeInfo->tm_hour;
-                int minutes = timeInfo->tm_min;
-                int seconds = timeInfo->tm_sec;
-                char displayMessage[MAX_PROTOL_MESSAGE_SIZE + 20]; // extra space for plus sign and null terminator
-                // If the message is from the client, change the >> to <<
-                // localReceiveBuffer[24] = '<';
-                // localReceiveBuffer[25] = '<';
-
-                // Replace the >> with <<
-                char *arrowPosition = strstr(localReceiveBuffer, ">>");
-                while (arrowPosition != NULL)
-                {
-                    arrowPosition[0] = '<';
-                    arrowPosition[1] = '<';
-                    arrowPosition = strstr(arrowPosition + 2, ">>");
-                }
+    char displayMessage[MAX_PROTOL_MESSAGE_SIZE + 20]; // extra space for plus sign and null terminator
+    formatDisplayMessage(message, displayMessage, sizeof(displayMessage));
 
-                // Format the message
-                snprintf(displayMessage, sizeof(displayMessage), "%s(%02d:%02d:%02d)", localReceiveBuffer, hours, minutes, seconds);
+    // Print to the curses window
+    wprintw(receivedMessagesWindow, "%s\n", displayMessage);
+    // Refresh curses window
+    wrefresh(receivedMessagesWindow);
+    // Move cursor to row 1, column 3 of the input window (after your input marker)
+    wmove(userInputWindow, 1, 3);
+    // Ensure the cursor is visible
+    curs_set(1);
+    // Refresh the input window to update the cursor position
+    wrefresh(userInputWindow);
+}
 
-                // Print to the curses window
-                wprintw(receivedMessagesWindow, "%s\n", displayMessage);
-            }
-            else
-            {
-                time(&now);
-                timeInfo = localtime(&now);
-                // Get hours, minutes, and seconds
-                int hours = timeInfo->tm_hour;
-                int minutes = timeInfo->tm_min;
-                int seconds = timeInfo->tm_sec;
-                char displayMessage[MAX_PROTOL_MESSAGE_SIZE + 20];
-                snprintf(displayMessage, sizeof(displayMessage), "%s(%02d:%02d:%02d)", localReceiveBuffer, hours, minutes, seconds);
-                wprintw(receivedMessagesWindow, "%s\n", displayMessage);
-            }
-            // Refresh curses window
-            wrefresh(receivedMessagesWindow);
-            // Move cursor to row 1, column 3 of the input window (after your input marker)
-            wmove(userInputWindow, 1, 3);
-            // Ensure the cursor is visible
-            curs_set(1);
-            // Refresh the input window to update the cursor position
-            wrefresh(userInputWindow);
-        }
-        // If there were no bytes read, the server disconnected
-        else if (numberOfBytesRead == 0)
+/*
+ * FUNCTION : showClientEvent
+ *
+ * DESCRIPTION : This function tells the user about the connection in the received messages window
+ *
+ * PARAMETERS : ChatClient *client : The client it happened to.
+ *              int event : CHAT_CLIENT_EVENT_*.
+ *              int detail : Depends on the event.
+ *
+ * RETURNS : void
+ */
+void showClientEvent(ChatClient *client, int event, int detail)
+{
+    switch (event)
+    {
+    case CHAT_CLIENT_EVENT_DISCONNECTED:
+        if (detail == 0)
         {
-            wprintw(receivedMessagesWindow, "Server disconnected.\n");
-            wrefresh(receivedMessagesWindow);
-            break;
+            wprintw(receivedMessagesWindow, "Server disconnected, reconnecting...\n");
         }
-        // Check for any errors
-        else if (errno != EAGAIN && errno != EWOULDBLOCK)
+        else
         {
-            wprintw(receivedMessagesWindow, "handleReceivedMessage() : Read error: %s\n", strerror(errno));
-            wrefresh(receivedMessagesWindow);
-            break;
+            wprintw(receivedMessagesWindow, "handleReceivedMessage() : Read error: %s, reconnecting...\n", strerror(detail));
         }
-        // Wait for a short time between messages
-        usleep(50000);
+        break;
+    case CHAT_CLIENT_EVENT_RECONNECTED:
+        wprintw(receivedMessagesWindow, "Reconnected.\n");
+        break;
+    case CHAT_CLIENT_EVENT_BUSY:
+        wprintw(receivedMessagesWindow, "Server busy, retry after %d seconds.\n", detail);
+        break;
+    case CHAT_CLIENT_EVENT_MISSED:
+        wprintw(receivedMessagesWindow, "-- Some messages were missed --\n");
+        break;
+    case CHAT_CLIENT_EVENT_UNSENT:
+        // Error
+        wprintw(receivedMessagesWindow, "Failed to send message: not connected and %d messages already waiting\n", detail);
+        break;
+    case CHAT_CLIENT_EVENT_CLOSED:
+        wprintw(receivedMessagesWindow, "Server disconnected.\n");
+        isChatFinished = 1;
+        break;
+    case CHAT_CLIENT_EVENT_BLOB_FAILED:
+        wprintw(receivedMessagesWindow, "File not shared or sent: %s\n", client->blobFailure);
+        break;
+    case CHAT_CLIENT_EVENT_SEARCH_DONE:
+        wprintw(receivedMessagesWindow, "-- %d found --\n", detail);
+        break;
+    case CHAT_CLIENT_EVENT_BLOCKED:
+        wprintw(receivedMessagesWindow, "Message not sent: blocked by the server's filter\n");
+        break;
     }
-    // Return NULL because you have to return something
-    return NULL;
+    wrefresh(receivedMessagesWindow);
 }
 
 /*
- * FUNCTION : startReceivingThread
+ * FUNCTION : printChatMessage
  *
- * DESCRIPTION : This function starts a thread that runs handleReceivedMessage to get messages from the server
+ * DESCRIPTION : This function writes a chat line to stdout in headless mode, formatted as it would be shown
  *
- * PARAMETERS : int *socketFileDescriptor : Pointer to the socket file descriptor.
+ * PARAMETERS : ChatClient *client : The client it arrived on.
+ *              ChatMessage *message : The line from the server.
  *
- * RETURNS : int : 0 on success, -1 on error.
+ * RETURNS : void
+ */
+void printChatMessage(ChatClient *client, ChatMessage *message)
+{
+    char displayMessage[MAX_PROTOL_MESSAGE_SIZE + 20];
+    formatDisplayMessage(message, displayMessage, sizeof(displayMessage));
+    printf("%s\n", displayMessage);
+}
+
+/*
+ * FUNCTION : printClientEvent
+ *
+ * DESCRIPTION : This function reports connection changes on stderr in headless mode, so stdout only has chat lines
+ *
+ * PARAMETERS : ChatClient *client : The client it happened to.
+ *              int event : CHAT_CLIENT_EVENT_*.
+ *              int detail : Depends on the event.
+ *
+ * RETURNS : void
  */
-int startReceivingThread(int *socketFileDescriptor)
+void printClientEvent(ChatClient *client, int event, int detail)
 {
-    // CHANGED THIS: Updated parameter to allocate a ClientStruct structure.
-    ClientStruct *clientDetails = (ClientStruct *)malloc(sizeof(ClientStruct));
-    if (clientDetails == NULL)
+    switch (event)
     {
-        perror("malloc failed");
-        return -1;
+    case CHAT_CLIENT_EVENT_DISCONNECTED:
+        fprintf(stderr, "Server disconnected (%s), reconnecting...\n", detail == 0 ? "closed" : strerror(detail));
+        break;
+    case CHAT_CLIENT_EVENT_RECONNECTED:
+        fprintf(stderr, "Reconnected.\n");
+        break;
+    case CHAT_CLIENT_EVENT_BUSY:
+        fprintf(stderr, "Server busy, retry after %d seconds.\n", detail);
+        break;
+    case CHAT_CLIENT_EVENT_MISSED:
+        fprintf(stderr, "-- Some messages were missed --\n");
+        break;
+    case CHAT_CLIENT_EVENT_UNSENT:
+        fprintf(stderr, "Failed to send message: not connected and %d messages already waiting\n", detail);
+        break;
+    case CHAT_CLIENT_EVENT_CLOSED:
+        isChatFinished = 1;
+        break;
+    case CHAT_CLIENT_EVENT_BLOB_FAILED:
+        fprintf(stderr, "File not shared or sent: %s\n", client->blobFailure);
+        break;
+    case CHAT_CLIENT_EVENT_SEARCH_DONE:
+        fprintf(stderr, "-- %d found --\n", detail);
+        break;
+    case CHAT_CLIENT_EVENT_BLOCKED:
+        fprintf(stderr, "Message not sent: blocked by the server's filter\n");
+        break;
     }
-    clientDetails->socketFD = *socketFileDescriptor;
-    // Assume main has already filled in the client's IP in clientDetails->clientIP.
-    // If not, we can call getLocalIP here, but main already does that.
-    pthread_t receivingThread;
-    // Start the thread using the handleReceivedMessage() function
-    if (pthread_create(&receivingThread, NULL, handleReceivedMessage, clientDetails) != 0)
+}
+
+/*
+ * FUNCTION : showNotice
+ *
+ * DESCRIPTION : This function tells the user about something the client did itself, in the received messages window
+ * or on stderr in headless mode
+ *
+ * PARAMETERS : const char *notice : The line to show.
+ *
+ * RETURNS : void
+ */
+void showNotice(const char *notice)
+{
+    if (receivedMessagesWindow != NULL)
     {
-        free(clientDetails);
-        return -1;
+        wprintw(receivedMessagesWindow, "%s\n", notice);
+        wrefresh(receivedMessagesWindow);
+    }
+    else
+    {
+        fprintf(stderr, "%s\n", notice);
     }
-    pthread_detach(receivingThread);
-    return 0;
 }
 
 /*
- * FUNCTION : sendProtocolMessage
+ * FUNCTION : saveBlobData
  *
- * DESCRIPTION : This function sends a formatted message to the server
+ * DESCRIPTION : Download callback, writes each piece of a shared file to blob-ID in the current directory
  *
- * PARAMETERS : const char *message : The message to send.
- *              int socketFileDescriptor : The socket file descriptor to use for sending.
+ * PARAMETERS : ChatClient *client : The client it arrived on.
+ *              unsigned long blobId : The file's id.
+ *              size_t offset : Where the piece goes.
+ *              const char *data : The piece.
+ *              size_t length : Its length.
+ *              size_t totalLength : Size of the whole file.
  *
  * RETURNS : void
  */
-void sendProtocolMessage(const char *message, int socketFileDescriptor)
+void saveBlobData(ChatClient *client, unsigned long blobId, size_t offset, const char *data, size_t length, size_t totalLength)
 {
-    // Get the length of the message
-    int len = strlen(message);
-    // Write to the socket
-    if (write(socketFileDescriptor, message, len) < 0)
+    char fileName[64];
+    char notice[128];
+    snprintf(fileName, sizeof(fileName), CLIENT_BLOB_FILE_FORMAT, blobId);
+
+    int fileDescriptor = open(fileName, O_WRONLY | O_CREAT | O_CLOEXEC | (offset == 0 ? O_TRUNC : 0), 0644);
+    if (fileDescriptor < 0 || pwrite(fileDescriptor, data, length, offset) != (ssize_t)length)
     {
-        // Error
-        wprintw(receivedMessagesWindow, "Failed to send message: %s\n", strerror(errno));
-        wrefresh(receivedMessagesWindow);
+        snprintf(notice, sizeof(notice), "Failed to save %s: %s", fileName, strerror(errno));
+        showNotice(notice);
+    }
+    else if (offset + length == totalLength)
+    {
+        snprintf(notice, sizeof(notice), "Saved %s (%zu bytes)", fileName, totalLength);
+        showNotice(notice);
+    }
+    if (fileDescriptor >= 0)
+    {
+        close(fileDescriptor);
+    }
+}
+
+/*
+ * FUNCTION : sendUserLine
+ *
+ * DESCRIPTION : This function sends a line the user entered, or runs it if it is a command
+ * (/send PATH to share a file, /get ID to download one, /search QUERY to search the room)
+ *
+ * PARAMETERS : ChatClient *client : The connection to the server.
+ *              const char *line : The line (without a newline).
+ *
+ * RETURNS : void
+ */
+void sendUserLine(ChatClient *client, const char *line)
+{
+    if (strncmp(line, CLIENT_SEND_COMMAND, strlen(CLIENT_SEND_COMMAND)) == 0)
+    {
+        if (chatClientSendFile(client, line + strlen(CLIENT_SEND_COMMAND)) < 0)
+        {
+            char notice[128];
+            snprintf(notice, sizeof(notice), "Failed to share %s: %s", line + strlen(CLIENT_SEND_COMMAND), strerror(errno));
+            showNotice(notice);
+        }
+        return;
+    }
+    if (strncmp(line, CLIENT_GET_COMMAND, strlen(CLIENT_GET_COMMAND)) == 0)
+    {
+        chatClientRequestBlob(client, strtoul(line + strlen(CLIENT_GET_COMMAND), NULL, 10));
+        return;
+    }
+    if (strncmp(line, CLIENT_SEARCH_COMMAND, strlen(CLIENT_SEARCH_COMMAND)) == 0)
+    {
+        chatClientSearch(client, line + strlen(CLIENT_SEARCH_COMMAND));
+        return;
+    }
+    // Split (if it needs it) and send
+    chatClientSendText(client, line);
+}
+
+/*
+ * FUNCTION : startReceivingThread
+ *
+ * DESCRIPTION : This function starts a thread that runs handleReceivedMessage to get messages from the server
+ *
+ * PARAMETERS : ChatClient *client : The connection to the server (lives in main for the whole run).
+ *
+ * RETURNS : int : 0 on success, -1 on error.
+ */
+int startReceivingThread(ChatClient *client)
+{
+    pthread_t receivingThread;
+    // Start the thread using the handleReceivedMessage() function
+    if (pthread_create(&receivingThread, NULL, handleReceivedMessage, client) != 0)
+    {
+        return -1;
     }
+    pthread_detach(receivingThread);
+    return 0;
 }
 
 /*
  * FUNCTION : handleUserInput
  *
- * DESCRIPTION : This function handles user input from the ncurses window, and sends messages it to the server
+ * DESCRIPTION : This function handles user input from the ncurses window, and sends messages it to the server.
+ * Characters are read whole (any language) and kept as UTF-8, the line is limited by the columns it takes.
  *
- * PARAMETERS : char *clientName : The name of the client.
- *              char *clientIP : The IP address of the client.
- *              int *socketFileDescriptor : Pointer to the socket file descriptor.
+ * PARAMETERS : ChatClient *client : The connection to the server.
  *
  * RETURNS : void
  */
-void handleUserInput(char *clientName, char *clientIP, int *socketFileDescriptor)
+void handleUserInput(ChatClient *client)
 {
-    // clientIP is now available to send to the server or to be used to verify the broadcast.
     char sendBuffer[CLIENT_MAX_MSG_SIZE] = {0};
-    int userInputIndex = 0;
-    int currentCharacterAscii;
-    while (1)
+    int userInputIndex = 0;   // Bytes typed
+    int userInputColumns = 0; // Columns they take
+    wint_t currentCharacter;
+    while (!isChatFinished)
     {
         // Get user input from the ncurses window userInputWindow
-        currentCharacterAscii = wgetch(userInputWindow);
+        int inputKind = wget_wch(userInputWindow, &currentCharacter);
         // Check if there was an error getting the character
-        if (currentCharacterAscii == ERR)
+        if (inputKind == ERR)
         {
             usleep(50000);
             continue;
         }
+        int isBackspace = (inputKind == KEY_CODE_YES && currentCharacter == KEY_BACKSPACE) ||
+                          (inputKind == OK && (currentCharacter == 0x7f || currentCharacter == '\b'));
+
         // When the user presses enter, and there is something they typed
-        if (currentCharacterAscii == '\n' && userInputIndex > 0)
+        if (inputKind == OK && currentCharacter == '\n' && userInputIndex > 0)
         {
             sendBuffer[userInputIndex] = '\0';
-            int bufferLength = strlen(sendBuffer);
-            char protocolMsg[MAX_PROTOL_MESSAGE_SIZE];
-            char messagePartOne[CLIENT_MSG_PART_LENGTH + 1] = {"0"};
-            char messagePartTwo[CLIENT_MSG_PART_LENGTH + 1] = {"0"};
-            // If the message is 40 characters or less
-            if (bufferLength <= CLIENT_MSG_PART_LENGTH)
-            {
-                // Send a single message
-                snprintf(protocolMsg, sizeof(protocolMsg), "%s|%s|0|%s", clientIP, clientName, sendBuffer);
-                sendProtocolMessage(protocolMsg, *socketFileDescriptor);
-            }
-            // Otherwise split the message and send both parts
-            else
-            {
-                // Split the message into two parts.
-                splitMessage(sendBuffer, messagePartOne, messagePartTwo);
-                snprintf(protocolMsg, sizeof(protocolMsg), "%s|%s|1|%s", clientIP, clientName, messagePartOne);
-                sendProtocolMessage(protocolMsg, *socketFileDescriptor);
-                // Small delay to give the first message time to arrive
-                usleep(50000);
-                snprintf(protocolMsg, sizeof(protocolMsg), "%s|%s|2|%s", clientIP, clientName, messagePartTwo);
-                sendProtocolMessage(protocolMsg, *socketFileDescriptor);
-            }
+            sendUserLine(client, sendBuffer);
             // Clear the input
             memset(sendBuffer, 0, sizeof(sendBuffer));
             userInputIndex = 0; // reset index counter
+            userInputColumns = 0;
             // Erase the user text from the window
             werase(userInputWindow);
             // TO ensure the box is drawn every time, I had issues getting the ncurses stuff to work how we needed
@@ -573,44 +521,178 @@ void handleUserInput(char *clientName, char *clientIP, int *socketFileDescriptor
             // Move the cursor back to the input
             wmove(userInputWindow, 1, 3);
             wrefresh(userInputWindow);
+            continue;
         }
-        // If anything other than enter was typed
-        else if (currentCharacterAscii != '\n')
+        if (isBackspace && userInputIndex > 0)
         {
-            // Check if the input is less than the max size (-1 because the macro accounts for null terms)
-            if (userInputIndex < CLIENT_MAX_MSG_SIZE - 1)
+            // Take off the whole last character
+            userInputIndex = utf8LastCharacterStart(sendBuffer, userInputIndex);
+            sendBuffer[userInputIndex] = '\0';
+            userInputColumns = utf8DisplayWidth(sendBuffer, userInputIndex);
+        }
+        // If a character other than enter was typed (function keys and control characters aren't text)
+        else if (inputKind == OK && currentCharacter >= 0x20 && currentCharacter != 0x7f)
+        {
+            char encoded[UTF8_MAX_BYTES];
+            size_t encodedLength = utf8Encode(currentCharacter, encoded);
+            int characterColumns = utf8CodepointWidth(currentCharacter);
+            // Check the input still fits, in columns and in bytes (-1 because the macro accounts for null terms)
+            if (encodedLength == 0 || userInputColumns + characterColumns > CLIENT_MAX_MSG_COLUMNS ||
+                userInputIndex + encodedLength > CLIENT_MAX_MSG_SIZE - 1)
             {
-                // Add the character to the buffer, increment the input index tracker
-                sendBuffer[userInputIndex++] = currentCharacterAscii;
-                sendBuffer[userInputIndex] = '\0'; // Set the next character to be a null terminator
-                // TO ensure the box is drawn every time, I had issues getting the ncurses stuff to work how we needed
-                box(userInputWindow, 0, 0);
-                mvwprintw(userInputWindow, 1, 1, "%s %s", CLIENT_INPUT_MARKER, sendBuffer);
-                wmove(userInputWindow, 1, 3 + userInputIndex);
-                wrefresh(userInputWindow);
+                continue;
             }
+            // Add the character to the buffer, increment the input index tracker
+            memcpy(sendBuffer + userInputIndex, encoded, encodedLength);
+            userInputIndex += encodedLength;
+            userInputColumns += characterColumns;
+            sendBuffer[userInputIndex] = '\0'; // Set the next character to be a null terminator
+        }
+        else
+        {
+            continue;
         }
+
+        // TO ensure the box is drawn every time, I had issues getting the ncurses stuff to work how we needed
+        werase(userInputWindow);
+        box(userInputWindow, 0, 0);
+        mvwprintw(userInputWindow, 1, 1, "%s %s", CLIENT_INPUT_MARKER, sendBuffer);
+        wmove(userInputWindow, 1, 3 + userInputColumns);
+        wrefresh(userInputWindow);
     }
 }
 
+/*
+ * FUNCTION : limitUserLine
+ *
+ * DESCRIPTION : This function cuts a line to what the input window would take (CLIENT_MAX_MSG_COLUMNS columns and
+ * CLIENT_MAX_MSG_SIZE bytes), never part way through a character
+ *
+ * PARAMETERS : char *line : The line, cut in place.
+ *
+ * RETURNS : void
+ */
+void limitUserLine(char *line)
+{
+    int lineColumns;
+    line[utf8PrefixForWidth(line, strlen(line), CLIENT_MAX_MSG_COLUMNS, CLIENT_MAX_MSG_SIZE - 1, &lineColumns)] = '\0';
+}
+
+/*
+ * FUNCTION : runHeadless
+ *
+ * DESCRIPTION : This function is the client without ncurses, for bots and scripts. Each line on stdin is sent (cut to
+ * what the input window would take), each chat line received is written to stdout, and connection changes go to
+ * stderr. At the end of stdin it says bye and waits for the server to close.
+ *
+ * PARAMETERS : ChatClient *client : The connection to the server.
+ *
+ * RETURNS : int : 0 once finished, -1 on error.
+ */
+int runHeadless(ChatClient *client)
+{
+    char inputBuffer[CLIENT_HEADLESS_INPUT_SIZE];
+    int inputLength = 0;
+    int isInputOpen = 1;
+
+    // Scripts reading our output want every line as it arrives
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    while (!isChatFinished)
+    {
+        struct pollfd polls[1 + CHAT_CLIENT_MAX_POLL_DESCRIPTORS];
+        int pollCount = 0;
+        if (isInputOpen)
+        {
+            polls[pollCount].fd = STDIN_FILENO;
+            polls[pollCount].events = POLLIN;
+            polls[pollCount].revents = 0;
+            pollCount++;
+        }
+        pollCount += chatClientPollDescriptors(client, polls + pollCount);
+        if (poll(polls, pollCount, chatClientTimeoutMs(client)) < 0 && errno != EINTR)
+        {
+            perror("poll failed");
+            return -1;
+        }
+
+        if (isInputOpen && polls[0].revents != 0)
+        {
+            ssize_t bytesRead = read(STDIN_FILENO, inputBuffer + inputLength, sizeof(inputBuffer) - 1 - inputLength);
+            if (bytesRead <= 0)
+            {
+                // A last line without a newline still counts
+                if (inputLength > 0)
+                {
+                    inputBuffer[inputLength] = '\0';
+                    limitUserLine(inputBuffer);
+                    chatClientSendText(client, inputBuffer);
+                }
+                isInputOpen = 0;
+                chatClientSendText(client, PROTOCOL_BYE);
+                // Nobody to say it to while disconnected
+                if (!client->isConnected)
+                {
+                    break;
+                }
+            }
+            else
+            {
+                inputLength += bytesRead;
+                char *lineStart = inputBuffer;
+                char *lineEnd;
+                while ((lineEnd = memchr(lineStart, '\n', inputBuffer + inputLength - lineStart)) != NULL)
+                {
+                    *lineEnd = '\0';
+                    if (lineEnd > lineStart && lineEnd[-1] == '\r')
+                    {
+                        lineEnd[-1] = '\0';
+                    }
+                    limitUserLine(lineStart);
+                    if (lineStart[0] != '\0')
+                    {
+                        sendUserLine(client, lineStart);
+                    }
+                    lineStart = lineEnd + 1;
+                }
+                inputLength -= lineStart - inputBuffer;
+                memmove(inputBuffer, lineStart, inputLength);
+                // A line too long for the buffer is cut like any other
+                if (inputLength == sizeof(inputBuffer) - 1)
+                {
+                    limitUserLine(inputBuffer);
+                    chatClientSendText(client, inputBuffer);
+                    inputLength = 0;
+                }
+            }
+        }
+
+        chatClientProcess(client);
+    }
+    return 0;
+}
+
 /*
  * FUNCTION : cleanup
  *
- * DESCRIPTION : Closes all the ncurses windows and closes the socket
+ * DESCRIPTION : Closes all the ncurses windows and closes the connection
  *
- * PARAMETERS : int *socketFileDescriptor : Pointer to the socket file descriptor to close.
+ * PARAMETERS : ChatClient *client : The connection to close.
  *
  * RETURNS : void
  */
-void cleanup(int *socketFileDescriptor)
+void cleanup(ChatClient *client)
 {
-    // Close the socket, delete the windows
-    close(*socketFileDescriptor);
-    delwin(receivedMessagesWindow);
-    delwin(userInputWindow);
-    delwin(inputTitle);
-    delwin(receivedTitle);
-    endwin();
+    // Close the connection, delete the windows
+    chatClientClose(client);
+    if (receivedMessagesWindow != NULL)
+    {
+        delwin(receivedMessagesWindow);
+        delwin(userInputWindow);
+        delwin(inputTitle);
+        delwin(receivedTitle);
+        endwin();
+    }
 }
 
 /*
@@ -630,8 +712,9 @@ int getUserName(char *userArg, char *userName)
     {
         // Parse and set username var if if not blank past the switch -user
         userArg += strlen("-user"); // iterate past the -user
-        // Check to make sure strlen is valid 5 chars
-        if (strlen(userArg) > 5)
+        // Check to make sure the name is valid UTF-8 that takes 5 columns at most
+        if (strlen(userArg) >= CHAT_CLIENT_USER_NAME_SIZE || !utf8IsValid(userArg, strlen(userArg)) ||
+            utf8DisplayWidth(userArg, strlen(userArg)) > CLIENT_USER_NAME_LENGTH)
         {
             printf("User name exceedes the 5 character limit!\n");
             printf("Usage: <arg1> <arg2> <arg3>\nWhere arg1 is the exe, arg2 is the user, arg3 is the server name.\n");
@@ -686,6 +769,7 @@ int getServerAddress(char *serverArgument, char *serverAddress)
                 {
                     // Ip address is valid
                     strcpy(serverAddress, serverArgument);
+                    return 1;
                 }
                 else
                 {
@@ -695,12 +779,18 @@ int getServerAddress(char *serverArgument, char *serverAddress)
                     return -4;
                 }
             }
-            else if (result == 0)
+            else if (result == 0 || strchr(serverArgument, ':') != NULL)
             {
-                // Else we have a server name
+                // Else we have a server name (or an IPv6 address, or a name or address with a port)
                 strcpy(serverAddress, serverArgument);
                 return 1;
             }
+            else
+            {
+                printf("Server switch Ip Address is INVALID!\n");
+                printf("Usage: <arg1> <arg2> <arg3>\nWhere arg1 is the exe, arg2 is the user, arg3 is the server name or Ip address.\n");
+                return -4;
+            }
         }
         else
         {
@@ -717,11 +807,13 @@ int getServerAddress(char *serverArgument, char *serverAddress)
     }
 }
 
+
 /*
  * FUNCTION : main
  *
  * DESCRIPTION : The main function processes command-line arguments, connects to the server, initializes ncurses windows,
- *               starts the receiving thread, and handles user input.
+ *               starts the receiving thread, and handles user input. With --headless after the server name it skips
+ *               ncurses and works from stdin and stdout instead, with --compress it asks the server to compress.
  *
  * PARAMETERS : int argc : The number of command-line arguments.
  *              char *argv[] : The array of command-line argument strings.
@@ -730,18 +822,38 @@ int getServerAddress(char *serverArgument, char *serverAddress)
  */
 int main(int argc, char *argv[])
 {
-    /*
-    CHANGED THIS: Removed global clientIP; using ClientStruct to store socket and client IP.
-    */
-    ClientStruct clientDetails;
+    ChatClient client;
+    int isHeadless = 0;
+
+    // Different clients pick different reconnect delays
+    srandom((unsigned int)time(NULL) ^ (unsigned int)getpid());
 
-    char userName[6];
+    char userName[CHAT_CLIENT_USER_NAME_SIZE];
     char serverName[256] = "Ip address used";
+    int wantsCompression = 0;
+    int isUsageWrong = argc < 3;
+    // Switches after the server name, in any order
+    for (int i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], CLIENT_HEADLESS_SWITCH) == 0)
+        {
+            isHeadless = 1;
+        }
+        else if (strcmp(argv[i], CLIENT_COMPRESS_SWITCH) == 0)
+        {
+            wantsCompression = 1;
+        }
+        else
+        {
+            isUsageWrong = 1;
+        }
+    }
     // Check if arg count is valid
-    if (argc != 3)
+    if (isUsageWrong)
     {
         printf("Not Enough Arguments\n");
-        printf("Usage: <arg1> <arg2> <arg3>\nWhere arg1 is the exe, arg2 is the user, arg3 is the server name.\n");
+        printf("Usage: <arg1> <arg2> <arg3> [%s] [%s]\nWhere arg1 is the exe, arg2 is the user, arg3 is the server name.\n",
+               CLIENT_HEADLESS_SWITCH, CLIENT_COMPRESS_SWITCH);
         exit(EXIT_FAILURE);
     }
 
@@ -761,27 +873,35 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
 
-    // Attempt to connect to the server, store socket in clientDetails.socketFD
-    if (connectToServer(serverName, &clientDetails.socketFD) < 0)
+    // Messages and connection changes go to the windows, or to stdout/stderr without them
+    ChatClientCallbacks callbacks = {showChatMessage, showClientEvent, saveBlobData};
+    if (isHeadless)
+    {
+        callbacks.onMessage = printChatMessage;
+        callbacks.onEvent = printClientEvent;
+    }
+    chatClientInitialize(&client, userName, serverName, &callbacks, NULL);
+    client.wantsCompression = wantsCompression;
+
+    // Attempt to connect to the server
+    if (chatClientConnect(&client) < 0)
     {
-        cleanup(&clientDetails.socketFD);
+        printf("ERROR CONNECTING TO SERVER!!\n\n");
+        cleanup(&client);
         exit(EXIT_FAILURE);
     }
 
-    // CHANGED THIS: Get the client's IP address and store it in clientDetails.clientIP
-    // getLocalIP(clientDetails.clientIP, sizeof(clientDetails.clientIP));
-    // After connectToServer() returns successfully:
-    getClientIp(clientDetails.socketFD, clientDetails.clientIP, sizeof(clientDetails.clientIP));
+    if (isHeadless)
+    {
+        int headlessResult = runHeadless(&client);
+        cleanup(&client);
+        return headlessResult < 0 ? EXIT_FAILURE : 0;
+    }
 
     // Initialize the ncurses windows
     initializeNcursesWindows();
-    // THIS WAS CHANGED: Use 'host' from gethostname() instead of hostDetails->h_name.
-    // wprintw(receivedMessagesWindow, "Host Name: %s\n", host);
-    // wprintw(receivedMessagesWindow, "CLIENT IP: %s\n", clientIP);
-    // wprintw(receivedMessagesWindow, "Server : %s\n", serverName);
-    // wrefresh(receivedMessagesWindow);
-    startReceivingThread(&clientDetails.socketFD);
-    handleUserInput(userName, clientDetails.clientIP, &clientDetails.socketFD);
-    cleanup(&clientDetails.socketFD);
+    startReceivingThread(&client);
+    handleUserInput(&client);
+    cleanup(&client);
     return 0;
 }
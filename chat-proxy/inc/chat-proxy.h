@@ -0,0 +1,117 @@
+#ifndef CHAT_PROXY_H
+#define CHAT_PROXY_H
+
+/*
+ * chat-proxy: a TCP proxy for localhost that sits between clients and chat-server and makes the link between them
+ * worse on purpose, so slow readers and awkward framing can be tried again and again without special hardware.
+ * Clients connect to the proxy's port, and every connection gets one of its own to the server. Bytes read in either
+ * direction are held until they are due (the delay plus some jitter, rounded up to the next coalescing tick so that
+ * several frames arrive together), then written no faster than the rate allows, in random fragments if asked. While a
+ * direction is stalled its reading side isn't read at all, so the sender sees a reader that has stopped: for the
+ * server that is a client whose output queue fills up. Impairments are seeded, a run with the same switches and seed
+ * makes the same choices.
+ */
+
+#include "../../Common/inc/common.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <netinet/tcp.h>
+
+// Defines needed by the types below
+#define PROXY_MAX_LINKS 256 // Client connections proxied at once
+
+// Bytes read from one side, waiting to be written to the other
+typedef struct ProxyChunk
+{
+    struct ProxyChunk *next;
+    long long dueNs;       // Monotonic time it may be written from
+    size_t length;
+    size_t offset;         // Bytes already written
+    char data[];
+} ProxyChunk;
+
+// One way through a link
+typedef struct
+{
+    int fromSocket;         // Read from
+    int toSocket;           // Written to
+    int isImpaired;         // The impairments apply this way
+    int isReadClosed;       // The reading side has finished (the writing side is shut once the queue is empty)
+    int isWriteBlocked;     // The last write would have blocked, wait for the socket to take more
+    int isWriteShut;        // The writing side has been shut after the reading side finished
+    ProxyChunk *head;
+    ProxyChunk *tail;
+    size_t queuedBytes;
+    long long lastDueNs;    // Due time of the newest chunk (jitter never reorders bytes)
+    long long nextWriteNs;  // Earliest time for the next write (the gap after a fragment, or waiting for the rate)
+    double tokens;          // Bytes the rate allows right now
+    long long tokensNs;     // When tokens was last topped up
+    unsigned long bytes;    // Bytes written
+    unsigned long writes;
+    unsigned long stalls;   // Stalls that began while this direction was open
+    int wasStalled;
+} ProxyDirection;
+
+// A client connection and the proxy's connection to the server for it
+typedef struct
+{
+    int isOpen;
+    unsigned long id;
+    ProxyDirection up;      // Client to server
+    ProxyDirection down;    // Server to client
+} ProxyLink;
+
+// What the switches ask for
+typedef struct
+{
+    int listenPort;
+    char serverHost[256];
+    int serverPort;
+    int delayMs;            // Added to every byte one way
+    int jitterMs;           // Up to this much more, at random
+    long rateBytes;         // Bytes a second one way, 0 for no cap
+    int fragmentBytes;      // Writes are 1 to this many bytes, 0 for as much as is due
+    int fragmentGapUs;      // Time between fragments
+    int coalesceMs;         // Bytes are released on ticks this far apart, 0 to release them when due
+    int stallMs;            // Reading stops for this long...
+    int stallPeriodMs;      // ...at the start of every period this long
+    int receiveBufferBytes; // SO_RCVBUF of the impaired reading sockets, 0 for the system default
+    int isUpImpaired;
+    int isDownImpaired;
+    unsigned int seed;
+} ProxyOptions;
+
+// Function prototypes
+int parseProxyArguments(int argc, char *argv[], ProxyOptions *options);
+int openListeningSocket(int port);
+int connectToUpstream(const ProxyOptions *options);
+void openLink(ProxyLink *link, int clientSocket, int serverSocket, const ProxyOptions *options);
+void closeLink(ProxyLink *link);
+int readDirection(ProxyDirection *direction, const ProxyOptions *options, long long nowNs);
+int writeDirection(ProxyDirection *direction, const ProxyOptions *options, long long nowNs);
+int isDirectionStalled(const ProxyDirection *direction, const ProxyOptions *options, long long nowNs);
+long long nextDirectionEventNs(const ProxyDirection *direction, const ProxyOptions *options, long long nowNs);
+
+// Defines
+#define PROXY_LISTEN_SWITCH "-listen"       // -listenPORT: port clients connect to (PROXY_DEFAULT_LISTEN_PORT without it)
+#define PROXY_SERVER_SWITCH "-server"       // -serverHOST[:PORT]: the chat server (127.0.0.1:SERVER_PORT without it)
+#define PROXY_DELAY_SWITCH "-delay"         // -delayMS: one way latency
+#define PROXY_JITTER_SWITCH "-jitter"       // -jitterMS: extra random latency
+#define PROXY_RATE_SWITCH "-rate"           // -rateBYTES: bytes a second one way
+#define PROXY_FRAGMENT_SWITCH "-fragment"   // -fragmentBYTES[:GAPUS]: split writes into random pieces, GAPUS apart
+#define PROXY_COALESCE_SWITCH "-coalesce"   // -coalesceMS: hold bytes and release them together on ticks
+#define PROXY_STALL_SWITCH "-stall"         // -stallMS:PERIODMS: stop reading for MS at the start of every PERIODMS
+#define PROXY_RCVBUF_SWITCH "-rcvbuf"       // -rcvbufBYTES: small receive buffers, so stalls reach the sender sooner
+#define PROXY_DIRECTION_SWITCH "-direction" // -directionup|down|both: which way the impairments apply (both without it)
+#define PROXY_SEED_SWITCH "-seed"           // -seedN: seed for the random choices (1 without it)
+#define PROXY_DEFAULT_LISTEN_PORT 8899
+#define PROXY_DEFAULT_SERVER "127.0.0.1"
+#define PROXY_DEFAULT_FRAGMENT_GAP_US 1000  // Long enough for the reader to see each fragment on its own
+#define PROXY_READ_SIZE 16384               // Bytes read from a socket at once
+#define PROXY_WRITE_SIZE 65536              // Most bytes gathered from the queue for one write
+#define PROXY_MAX_QUEUED_BYTES (256 * 1024) // Reading one way stops while this much is waiting, so a cap pushes back
+#define PROXY_RATE_BURST_MS 20              // The rate may be used up this far ahead (at least one byte)
+#define PROXY_IDLE_POLL_MS 1000             // Longest poll when nothing is due
+
+#endif // CHAT_PROXY_H
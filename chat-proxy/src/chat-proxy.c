@@ -0,0 +1,729 @@
+#include "../inc/chat-proxy.h"
+
+// Random choices (jitter and fragment sizes), seeded by -seed
+static unsigned int randomState = 1;
+
+/*
+ * FUNCTION : monotonicNanoseconds
+ *
+ * DESCRIPTION : This function reads the monotonic clock every due time is on
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : long long : Nanoseconds since an arbitrary point.
+ */
+static long long monotonicNanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/*
+ * FUNCTION : nextRandom
+ *
+ * DESCRIPTION : This function steps a xorshift generator, so a run with the same seed impairs the same way
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : unsigned int : The next number.
+ */
+static unsigned int nextRandom(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+/*
+ * FUNCTION : parseProxyArguments
+ *
+ * DESCRIPTION : This function reads the switches (see chat-proxy.h), any order, each at most once in effect
+ *
+ * PARAMETERS : int argc : The number of command-line arguments.
+ *              char *argv[] : The command-line arguments.
+ *              ProxyOptions *options : Filled in, starting from the defaults.
+ *
+ * RETURNS : int : 0 on success, -1 if an argument isn't understood.
+ */
+int parseProxyArguments(int argc, char *argv[], ProxyOptions *options)
+{
+    memset(options, 0, sizeof(*options));
+    options->listenPort = PROXY_DEFAULT_LISTEN_PORT;
+    snprintf(options->serverHost, sizeof(options->serverHost), "%s", PROXY_DEFAULT_SERVER);
+    options->serverPort = SERVER_PORT;
+    options->fragmentGapUs = PROXY_DEFAULT_FRAGMENT_GAP_US;
+    options->isUpImpaired = 1;
+    options->isDownImpaired = 1;
+    options->seed = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        char *end = NULL;
+        if (strncmp(argv[i], PROXY_LISTEN_SWITCH, strlen(PROXY_LISTEN_SWITCH)) == 0)
+        {
+            options->listenPort = strtol(argv[i] + strlen(PROXY_LISTEN_SWITCH), &end, 10);
+            if (options->listenPort <= 0 || options->listenPort > 65535)
+            {
+                return -1;
+            }
+        }
+        else if (strncmp(argv[i], PROXY_SERVER_SWITCH, strlen(PROXY_SERVER_SWITCH)) == 0)
+        {
+            const char *address = argv[i] + strlen(PROXY_SERVER_SWITCH);
+            const char *portSeparator = strrchr(address, ':');
+            size_t hostLength = portSeparator != NULL ? (size_t)(portSeparator - address) : strlen(address);
+            if (hostLength == 0 || hostLength >= sizeof(options->serverHost))
+            {
+                return -1;
+            }
+            memcpy(options->serverHost, address, hostLength);
+            options->serverHost[hostLength] = '\0';
+            if (portSeparator != NULL)
+            {
+                options->serverPort = strtol(portSeparator + 1, &end, 10);
+                if (options->serverPort <= 0 || options->serverPort > 65535)
+                {
+                    return -1;
+                }
+            }
+        }
+        else if (strncmp(argv[i], PROXY_DELAY_SWITCH, strlen(PROXY_DELAY_SWITCH)) == 0)
+        {
+            options->delayMs = strtol(argv[i] + strlen(PROXY_DELAY_SWITCH), &end, 10);
+        }
+        else if (strncmp(argv[i], PROXY_JITTER_SWITCH, strlen(PROXY_JITTER_SWITCH)) == 0)
+        {
+            options->jitterMs = strtol(argv[i] + strlen(PROXY_JITTER_SWITCH), &end, 10);
+        }
+        else if (strncmp(argv[i], PROXY_RATE_SWITCH, strlen(PROXY_RATE_SWITCH)) == 0)
+        {
+            options->rateBytes = strtol(argv[i] + strlen(PROXY_RATE_SWITCH), &end, 10);
+        }
+        else if (strncmp(argv[i], PROXY_FRAGMENT_SWITCH, strlen(PROXY_FRAGMENT_SWITCH)) == 0)
+        {
+            options->fragmentBytes = strtol(argv[i] + strlen(PROXY_FRAGMENT_SWITCH), &end, 10);
+            if (*end == ':')
+            {
+                options->fragmentGapUs = strtol(end + 1, &end, 10);
+            }
+        }
+        else if (strncmp(argv[i], PROXY_COALESCE_SWITCH, strlen(PROXY_COALESCE_SWITCH)) == 0)
+        {
+            options->coalesceMs = strtol(argv[i] + strlen(PROXY_COALESCE_SWITCH), &end, 10);
+        }
+        else if (strncmp(argv[i], PROXY_STALL_SWITCH, strlen(PROXY_STALL_SWITCH)) == 0)
+        {
+            options->stallMs = strtol(argv[i] + strlen(PROXY_STALL_SWITCH), &end, 10);
+            if (*end != ':')
+            {
+                return -1;
+            }
+            options->stallPeriodMs = strtol(end + 1, &end, 10);
+            if (options->stallPeriodMs <= 0 || options->stallMs > options->stallPeriodMs)
+            {
+                return -1;
+            }
+        }
+        else if (strncmp(argv[i], PROXY_RCVBUF_SWITCH, strlen(PROXY_RCVBUF_SWITCH)) == 0)
+        {
+            options->receiveBufferBytes = strtol(argv[i] + strlen(PROXY_RCVBUF_SWITCH), &end, 10);
+        }
+        else if (strncmp(argv[i], PROXY_DIRECTION_SWITCH, strlen(PROXY_DIRECTION_SWITCH)) == 0)
+        {
+            const char *direction = argv[i] + strlen(PROXY_DIRECTION_SWITCH);
+            options->isUpImpaired = strcmp(direction, "up") == 0 || strcmp(direction, "both") == 0;
+            options->isDownImpaired = strcmp(direction, "down") == 0 || strcmp(direction, "both") == 0;
+            if (!options->isUpImpaired && !options->isDownImpaired)
+            {
+                return -1;
+            }
+            continue;
+        }
+        else if (strncmp(argv[i], PROXY_SEED_SWITCH, strlen(PROXY_SEED_SWITCH)) == 0)
+        {
+            options->seed = strtoul(argv[i] + strlen(PROXY_SEED_SWITCH), &end, 10);
+            if (options->seed == 0)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            return -1;
+        }
+
+        // Every number has to be all there is and not negative
+        if (end == NULL || *end != '\0' || options->delayMs < 0 || options->jitterMs < 0 || options->rateBytes < 0 ||
+            options->fragmentBytes < 0 || options->fragmentGapUs < 0 || options->coalesceMs < 0 || options->stallMs < 0 ||
+            options->receiveBufferBytes < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : openListeningSocket
+ *
+ * DESCRIPTION : This function opens the socket clients connect to (loopback only, the proxy is a test tool)
+ *
+ * PARAMETERS : int port : The port.
+ *
+ * RETURNS : int : The socket, or -1 on error.
+ */
+int openListeningSocket(int port)
+{
+    int listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenSocket < 0)
+    {
+        return -1;
+    }
+    int isReused = 1;
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &isReused, sizeof(isReused));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (bind(listenSocket, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(listenSocket, SOMAXCONN) < 0)
+    {
+        close(listenSocket);
+        return -1;
+    }
+    fcntl(listenSocket, F_SETFL, fcntl(listenSocket, F_GETFL) | O_NONBLOCK);
+    return listenSocket;
+}
+
+/*
+ * FUNCTION : connectToUpstream
+ *
+ * DESCRIPTION : This function connects to the chat server for a new client. The receive buffer is set before
+ * connecting (the window is agreed then) when the server to client direction is impaired and -rcvbuf asks for it.
+ *
+ * PARAMETERS : const ProxyOptions *options : Where the server is.
+ *
+ * RETURNS : int : The socket, or -1 on error.
+ */
+int connectToUpstream(const ProxyOptions *options)
+{
+    char portText[16];
+    snprintf(portText, sizeof(portText), "%d", options->serverPort);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *addresses;
+    if (getaddrinfo(options->serverHost, portText, &hints, &addresses) != 0)
+    {
+        return -1;
+    }
+
+    int serverSocket = -1;
+    for (struct addrinfo *address = addresses; address != NULL && serverSocket < 0; address = address->ai_next)
+    {
+        serverSocket = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (serverSocket < 0)
+        {
+            continue;
+        }
+        if (options->isDownImpaired && options->receiveBufferBytes > 0)
+        {
+            setsockopt(serverSocket, SOL_SOCKET, SO_RCVBUF, &options->receiveBufferBytes, sizeof(options->receiveBufferBytes));
+        }
+        if (connect(serverSocket, address->ai_addr, address->ai_addrlen) < 0)
+        {
+            close(serverSocket);
+            serverSocket = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    return serverSocket;
+}
+
+/*
+ * FUNCTION : openLink
+ *
+ * DESCRIPTION : This function sets up a link for a connected client and its server connection. Both sockets are made
+ * non-blocking and send every write as it is made (no Nagle), so fragments reach the other end as fragments.
+ *
+ * PARAMETERS : ProxyLink *link : A closed link to use.
+ *              int clientSocket : The accepted client.
+ *              int serverSocket : The connection to the server.
+ *              const ProxyOptions *options : The impairments.
+ *
+ * RETURNS : void
+ */
+void openLink(ProxyLink *link, int clientSocket, int serverSocket, const ProxyOptions *options)
+{
+    static unsigned long nextLinkId = 1;
+    long long nowNs = monotonicNanoseconds();
+    int isNoDelay = 1;
+    int sockets[2] = {clientSocket, serverSocket};
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl(sockets[i], F_SETFL, fcntl(sockets[i], F_GETFL) | O_NONBLOCK);
+        setsockopt(sockets[i], IPPROTO_TCP, TCP_NODELAY, &isNoDelay, sizeof(isNoDelay));
+    }
+    if (options->isUpImpaired && options->receiveBufferBytes > 0)
+    {
+        setsockopt(clientSocket, SOL_SOCKET, SO_RCVBUF, &options->receiveBufferBytes, sizeof(options->receiveBufferBytes));
+    }
+
+    memset(link, 0, sizeof(*link));
+    link->isOpen = 1;
+    link->id = nextLinkId++;
+    link->up.fromSocket = clientSocket;
+    link->up.toSocket = serverSocket;
+    link->up.isImpaired = options->isUpImpaired;
+    link->down.fromSocket = serverSocket;
+    link->down.toSocket = clientSocket;
+    link->down.isImpaired = options->isDownImpaired;
+    ProxyDirection *directions[2] = {&link->up, &link->down};
+    for (int i = 0; i < 2; i++)
+    {
+        directions[i]->tokensNs = nowNs;
+    }
+    printf("link %lu open\n", link->id);
+}
+
+/*
+ * FUNCTION : closeLink
+ *
+ * DESCRIPTION : This function closes both sockets of a link, drops what it was holding and says what went through
+ *
+ * PARAMETERS : ProxyLink *link : The link.
+ *
+ * RETURNS : void
+ */
+void closeLink(ProxyLink *link)
+{
+    ProxyDirection *directions[2] = {&link->up, &link->down};
+    for (int i = 0; i < 2; i++)
+    {
+        while (directions[i]->head != NULL)
+        {
+            ProxyChunk *chunk = directions[i]->head;
+            directions[i]->head = chunk->next;
+            free(chunk);
+        }
+        directions[i]->tail = NULL;
+    }
+    close(link->up.fromSocket);
+    close(link->down.fromSocket);
+    printf("link %lu closed: up bytes=%lu writes=%lu stalls=%lu, down bytes=%lu writes=%lu stalls=%lu, dropped=%zu\n",
+           link->id, link->up.bytes, link->up.writes, link->up.stalls, link->down.bytes, link->down.writes,
+           link->down.stalls, link->up.queuedBytes + link->down.queuedBytes);
+    fflush(stdout);
+    link->isOpen = 0;
+}
+
+/*
+ * FUNCTION : isDirectionStalled
+ *
+ * DESCRIPTION : This function says whether reading one way is stopped right now: for -stallMS the start of every
+ * period, counted from the proxy's clock so every link stalls together (like a machine that stops reading)
+ *
+ * PARAMETERS : const ProxyDirection *direction : The direction.
+ *              const ProxyOptions *options : The impairments.
+ *              long long nowNs : The time.
+ *
+ * RETURNS : int : 1 if it is stalled, 0 if not.
+ */
+int isDirectionStalled(const ProxyDirection *direction, const ProxyOptions *options, long long nowNs)
+{
+    if (!direction->isImpaired || options->stallMs <= 0)
+    {
+        return 0;
+    }
+    long long periodNs = options->stallPeriodMs * 1000000LL;
+    return nowNs % periodNs < options->stallMs * 1000000LL;
+}
+
+/*
+ * FUNCTION : readDirection
+ *
+ * DESCRIPTION : This function reads what one side has sent and queues it for the other with its due time: now plus
+ * the delay and some jitter, never before the bytes ahead of it, and rounded up to the next coalescing tick
+ *
+ * PARAMETERS : ProxyDirection *direction : The direction to read.
+ *              const ProxyOptions *options : The impairments.
+ *              long long nowNs : The time.
+ *
+ * RETURNS : int : 0 if the link is still good, -1 if it failed and has to be closed.
+ */
+int readDirection(ProxyDirection *direction, const ProxyOptions *options, long long nowNs)
+{
+    char readBuffer[PROXY_READ_SIZE];
+    ssize_t readLength = recv(direction->fromSocket, readBuffer, sizeof(readBuffer), MSG_DONTWAIT);
+    if (readLength < 0)
+    {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    }
+    if (readLength == 0)
+    {
+        direction->isReadClosed = 1;
+        return 0;
+    }
+
+    ProxyChunk *chunk = malloc(sizeof(ProxyChunk) + readLength);
+    if (chunk == NULL)
+    {
+        return -1;
+    }
+    long long dueNs = nowNs;
+    if (direction->isImpaired)
+    {
+        dueNs += options->delayMs * 1000000LL;
+        if (options->jitterMs > 0)
+        {
+            dueNs += (long long)(nextRandom() % (options->jitterMs * 1000u + 1)) * 1000LL;
+        }
+        if (options->coalesceMs > 0)
+        {
+            long long tickNs = options->coalesceMs * 1000000LL;
+            dueNs = (dueNs + tickNs - 1) / tickNs * tickNs;
+        }
+    }
+    if (dueNs < direction->lastDueNs)
+    {
+        dueNs = direction->lastDueNs;
+    }
+    direction->lastDueNs = dueNs;
+
+    chunk->next = NULL;
+    chunk->dueNs = dueNs;
+    chunk->length = readLength;
+    chunk->offset = 0;
+    memcpy(chunk->data, readBuffer, readLength);
+    if (direction->tail != NULL)
+    {
+        direction->tail->next = chunk;
+    }
+    else
+    {
+        direction->head = chunk;
+    }
+    direction->tail = chunk;
+    direction->queuedBytes += readLength;
+    return 0;
+}
+
+/*
+ * FUNCTION : writeDirection
+ *
+ * DESCRIPTION : This function writes what is due one way, as much as the rate allows: everything that is due in one
+ * write, or one random fragment if -fragment is on. Once the reading side has finished and nothing is left the
+ * writing side is shut, so the other end sees the close.
+ *
+ * PARAMETERS : ProxyDirection *direction : The direction to write.
+ *              const ProxyOptions *options : The impairments.
+ *              long long nowNs : The time.
+ *
+ * RETURNS : int : 0 if the link is still good, -1 if it failed and has to be closed.
+ */
+int writeDirection(ProxyDirection *direction, const ProxyOptions *options, long long nowNs)
+{
+    int isRateCapped = direction->isImpaired && options->rateBytes > 0;
+    if (isRateCapped)
+    {
+        double burstBytes = options->rateBytes * PROXY_RATE_BURST_MS / 1000.0;
+        if (burstBytes < 1)
+        {
+            burstBytes = 1;
+        }
+        direction->tokens += (nowNs - direction->tokensNs) * options->rateBytes / 1e9;
+        if (direction->tokens > burstBytes)
+        {
+            direction->tokens = burstBytes;
+        }
+        direction->tokensNs = nowNs;
+    }
+
+    while (direction->head != NULL && direction->head->dueNs <= nowNs && nowNs >= direction->nextWriteNs)
+    {
+        size_t allowed = PROXY_WRITE_SIZE;
+        if (direction->isImpaired && options->fragmentBytes > 0)
+        {
+            allowed = 1 + nextRandom() % options->fragmentBytes;
+        }
+        if (isRateCapped)
+        {
+            if (direction->tokens < 1)
+            {
+                direction->nextWriteNs = nowNs + (long long)((1 - direction->tokens) * 1e9 / options->rateBytes) + 1;
+                return 0;
+            }
+            allowed = allowed < (size_t)direction->tokens ? allowed : (size_t)direction->tokens;
+        }
+
+        // Gather what is due, across chunks, into one write
+        char writeBuffer[PROXY_WRITE_SIZE];
+        size_t gathered = 0;
+        for (ProxyChunk *chunk = direction->head; chunk != NULL && chunk->dueNs <= nowNs && gathered < allowed; chunk = chunk->next)
+        {
+            size_t take = chunk->length - chunk->offset;
+            take = take < allowed - gathered ? take : allowed - gathered;
+            memcpy(writeBuffer + gathered, chunk->data + chunk->offset, take);
+            gathered += take;
+        }
+
+        ssize_t written = send(direction->toSocket, writeBuffer, gathered, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (written < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            {
+                direction->isWriteBlocked = 1;
+                return 0;
+            }
+            return -1;
+        }
+        direction->isWriteBlocked = 0;
+        direction->bytes += written;
+        direction->writes++;
+        direction->queuedBytes -= written;
+        if (isRateCapped)
+        {
+            direction->tokens -= written;
+        }
+
+        // Let go of what was written
+        size_t remaining = written;
+        while (remaining > 0)
+        {
+            ProxyChunk *chunk = direction->head;
+            size_t take = chunk->length - chunk->offset;
+            take = take < remaining ? take : remaining;
+            chunk->offset += take;
+            remaining -= take;
+            if (chunk->offset == chunk->length)
+            {
+                direction->head = chunk->next;
+                if (direction->head == NULL)
+                {
+                    direction->tail = NULL;
+                }
+                free(chunk);
+            }
+        }
+
+        if (direction->isImpaired && options->fragmentBytes > 0)
+        {
+            direction->nextWriteNs = nowNs + options->fragmentGapUs * 1000LL;
+        }
+    }
+
+    if (direction->isReadClosed && direction->head == NULL && !direction->isWriteShut)
+    {
+        shutdown(direction->toSocket, SHUT_WR);
+        direction->isWriteShut = 1;
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : nextDirectionEventNs
+ *
+ * DESCRIPTION : This function works out when one direction next needs looking at without a socket becoming ready: the
+ * head chunk falling due, the gap after a fragment or the rate ending, or a stall starting or ending
+ *
+ * PARAMETERS : const ProxyDirection *direction : The direction.
+ *              const ProxyOptions *options : The impairments.
+ *              long long nowNs : The time.
+ *
+ * RETURNS : long long : Monotonic time, or -1 if nothing is coming.
+ */
+long long nextDirectionEventNs(const ProxyDirection *direction, const ProxyOptions *options, long long nowNs)
+{
+    long long eventNs = -1;
+    if (direction->head != NULL && !direction->isWriteBlocked)
+    {
+        eventNs = direction->head->dueNs > direction->nextWriteNs ? direction->head->dueNs : direction->nextWriteNs;
+    }
+    if (direction->isImpaired && options->stallMs > 0 && !direction->isReadClosed)
+    {
+        long long periodNs = options->stallPeriodMs * 1000000LL;
+        long long periodStartNs = nowNs - nowNs % periodNs;
+        long long stallEndNs = periodStartNs + options->stallMs * 1000000LL;
+        long long changeNs = nowNs < stallEndNs ? stallEndNs : periodStartNs + periodNs;
+        if (eventNs < 0 || changeNs < eventNs)
+        {
+            eventNs = changeNs;
+        }
+    }
+    return eventNs;
+}
+
+/*
+ * FUNCTION : main
+ *
+ * DESCRIPTION : The main function accepts clients, connects each to the server and moves bytes both ways through the
+ * impairments until it is killed. One thread does it all with poll: a direction is read while it isn't stalled and
+ * hasn't queued too much, written when it has something due, and the poll wakes for the next due time.
+ *
+ * PARAMETERS : int argc : The number of command-line arguments.
+ *              char *argv[] : The array of command-line argument strings.
+ *
+ * RETURNS : int : Exit status (0 for success, non-zero for error).
+ */
+int main(int argc, char *argv[])
+{
+    ProxyOptions options;
+    if (parseProxyArguments(argc, argv, &options) < 0)
+    {
+        printf("Usage: chat-proxy [%sPORT] [%sHOST[:PORT]] [%sMS] [%sMS] [%sBYTES] [%sBYTES[:GAPUS]] [%sMS] [%sMS:PERIODMS]\n"
+               "                  [%sBYTES] [%sup|down|both] [%sN]\n",
+               PROXY_LISTEN_SWITCH, PROXY_SERVER_SWITCH, PROXY_DELAY_SWITCH, PROXY_JITTER_SWITCH, PROXY_RATE_SWITCH,
+               PROXY_FRAGMENT_SWITCH, PROXY_COALESCE_SWITCH, PROXY_STALL_SWITCH, PROXY_RCVBUF_SWITCH, PROXY_DIRECTION_SWITCH,
+               PROXY_SEED_SWITCH);
+        exit(EXIT_FAILURE);
+    }
+    randomState = options.seed;
+
+    int listenSocket = openListeningSocket(options.listenPort);
+    if (listenSocket < 0)
+    {
+        perror("listen failed");
+        exit(EXIT_FAILURE);
+    }
+    // A peer that goes away mid-write should close its link, not the proxy
+    signal(SIGPIPE, SIG_IGN);
+    printf("proxy 127.0.0.1:%d -> %s:%d delay=%dms jitter=%dms rate=%ld B/s fragment=%d gap=%dus coalesce=%dms "
+           "stall=%d/%dms rcvbuf=%d direction=%s seed=%u\n",
+           options.listenPort, options.serverHost, options.serverPort, options.delayMs, options.jitterMs, options.rateBytes,
+           options.fragmentBytes, options.fragmentGapUs, options.coalesceMs, options.stallMs, options.stallPeriodMs,
+           options.receiveBufferBytes, options.isUpImpaired && options.isDownImpaired ? "both" : options.isUpImpaired ? "up" : "down",
+           options.seed);
+    fflush(stdout);
+
+    static ProxyLink links[PROXY_MAX_LINKS];
+    static struct pollfd polls[1 + PROXY_MAX_LINKS * 2];
+    static ProxyLink *pollLinks[1 + PROXY_MAX_LINKS * 2];
+    while (1)
+    {
+        long long nowNs = monotonicNanoseconds();
+        long long wakeNs = nowNs + PROXY_IDLE_POLL_MS * 1000000LL;
+        int pollCount = 0;
+        polls[pollCount].fd = listenSocket;
+        polls[pollCount].events = POLLIN;
+        pollLinks[pollCount++] = NULL;
+
+        for (int i = 0; i < PROXY_MAX_LINKS; i++)
+        {
+            ProxyLink *link = &links[i];
+            if (!link->isOpen)
+            {
+                continue;
+            }
+            // Each socket is read for one direction and written for the other
+            ProxyDirection *readers[2] = {&link->up, &link->down};
+            ProxyDirection *writers[2] = {&link->down, &link->up};
+            for (int j = 0; j < 2; j++)
+            {
+                ProxyDirection *reader = readers[j];
+                ProxyDirection *writer = writers[j];
+                short events = 0;
+                if (!reader->isReadClosed && reader->queuedBytes < PROXY_MAX_QUEUED_BYTES)
+                {
+                    int isStalled = isDirectionStalled(reader, &options, nowNs);
+                    if (isStalled && !reader->wasStalled)
+                    {
+                        reader->stalls++;
+                    }
+                    reader->wasStalled = isStalled;
+                    events |= isStalled ? 0 : POLLIN;
+                }
+                if (writer->isWriteBlocked)
+                {
+                    events |= POLLOUT;
+                }
+                // A socket with nothing to wait for is left out (a finished one would report a hang up every time)
+                polls[pollCount].fd = events != 0 ? reader->fromSocket : -1;
+                polls[pollCount].events = events;
+                pollLinks[pollCount++] = link;
+
+                long long eventNs = nextDirectionEventNs(reader, &options, nowNs);
+                if (eventNs >= 0 && eventNs < wakeNs)
+                {
+                    wakeNs = eventNs;
+                }
+            }
+        }
+
+        int timeoutMs = wakeNs <= nowNs ? 0 : (int)((wakeNs - nowNs + 999999) / 1000000);
+        if (poll(polls, pollCount, timeoutMs) < 0 && errno != EINTR)
+        {
+            perror("poll failed");
+            exit(EXIT_FAILURE);
+        }
+        nowNs = monotonicNanoseconds();
+
+        // New clients, each with its own server connection
+        if (polls[0].revents & POLLIN)
+        {
+            int clientSocket = accept(listenSocket, NULL, NULL);
+            if (clientSocket >= 0)
+            {
+                int slot = 0;
+                while (slot < PROXY_MAX_LINKS && links[slot].isOpen)
+                {
+                    slot++;
+                }
+                int serverSocket = slot < PROXY_MAX_LINKS ? connectToUpstream(&options) : -1;
+                if (serverSocket < 0)
+                {
+                    printf("turned a client away: %s\n", slot < PROXY_MAX_LINKS ? "server unreachable" : "too many links");
+                    close(clientSocket);
+                }
+                else
+                {
+                    openLink(&links[slot], clientSocket, serverSocket, &options);
+                }
+            }
+        }
+
+        // Read whatever is ready, then write whatever is due (also for links that had no events, timers ran out)
+        for (int i = 1; i < pollCount; i++)
+        {
+            ProxyLink *link = pollLinks[i];
+            if (!link->isOpen || (polls[i].revents & (POLLIN | POLLHUP | POLLERR)) == 0)
+            {
+                continue;
+            }
+            ProxyDirection *reader = polls[i].fd == link->up.fromSocket ? &link->up : &link->down;
+            polls[i].fd = -1;
+            if ((polls[i].events & POLLIN) && readDirection(reader, &options, nowNs) < 0)
+            {
+                closeLink(link);
+            }
+            else if (polls[i].revents & POLLERR)
+            {
+                closeLink(link);
+            }
+        }
+        for (int i = 0; i < PROXY_MAX_LINKS; i++)
+        {
+            ProxyLink *link = &links[i];
+            if (!link->isOpen)
+            {
+                continue;
+            }
+            link->up.isWriteBlocked = 0;
+            link->down.isWriteBlocked = 0;
+            if (writeDirection(&link->up, &options, nowNs) < 0 || writeDirection(&link->down, &options, nowNs) < 0)
+            {
+                closeLink(link);
+                continue;
+            }
+            // Done once both sides have finished and everything has been passed on
+            if (link->up.isReadClosed && link->down.isReadClosed && link->up.head == NULL && link->down.head == NULL)
+            {
+                closeLink(link);
+            }
+        }
+    }
+    return 0;
+}
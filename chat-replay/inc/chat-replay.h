@@ -0,0 +1,57 @@
+#ifndef CHAT_REPLAY_H
+#define CHAT_REPLAY_H
+
+/*
+ * chat-replay: plays a traffic capture (chat-server -capturePATH) back against a server, every captured connection
+ * on a connection of its own, with the gaps between records scaled by the chosen speed. Each connection can be
+ * played several times over to multiply the load. What the server sends back is read and counted, never parsed.
+ */
+
+#include "../../chat-client/inc/chat-client-library.h"
+#include "../../Common/inc/capture-file.h"
+#include <sys/mman.h>
+
+// Defines needed by the types below
+#define REPLAY_MAX_CONNECTIONS 1024 // Replayed connections open at once (captured connections times copies)
+
+// One connection to the server playing a captured one
+typedef struct
+{
+    unsigned long capturedId;  // Connection id in the capture
+    int isOpen;                // Connected and not closed by either end yet
+    Transport transport;
+} ReplayConnection;
+
+// How the replay went (printed at the end)
+typedef struct
+{
+    unsigned long records;           // Records read from the capture
+    unsigned long connectionsOpened;
+    unsigned long connectFailures;
+    unsigned long closedByServer;    // Connections the server ended before the capture did (a bye, or turned away)
+    unsigned long framesSent;
+    unsigned long bytesSent;         // Frames and upload bytes
+    unsigned long sendFailures;
+    unsigned long recordsSkipped;    // Records for a connection that wasn't open
+    unsigned long bytesReceived;
+    long long maxLagNs;              // Furthest behind its scheduled time a record was played
+    unsigned long long capturedUs;   // Time the capture covers
+} ReplayTotals;
+
+// Function prototypes
+int parseReplayArguments(int argc, char *argv[], const char **serverAddress, double *speed, int *copies);
+void drainConnections(ReplayConnection *connections, ReplayTotals *totals, long long deadlineNs);
+void playRecord(ReplayConnection *connections, const CaptureRecord *record, const char *serverAddress, int copies, ReplayTotals *totals);
+void sendToConnection(ReplayConnection *connection, const char *data, size_t length, ReplayTotals *totals);
+void printReplayTotals(const ReplayTotals *totals, long long elapsedNs, double speed, int copies);
+
+// Defines
+#define REPLAY_SERVER_SWITCH "-server"   // -serverADDRESS: anything the client accepts (127.0.0.1 without it)
+#define REPLAY_SPEED_SWITCH "-speed"     // -speedX: play X times faster than captured (1 without it, 0 for no waits)
+#define REPLAY_COPIES_SWITCH "-copies"   // -copiesN: play every captured connection N times at once (1 without it)
+#define REPLAY_DEFAULT_SERVER "127.0.0.1"
+#define REPLAY_DRAIN_MS 1000             // Time left for the server's answers after the last record
+#define REPLAY_READ_BUFFER_SIZE 65536    // Bytes read from a connection at once (and thrown away)
+#define REPLAY_UPLOAD_CHUNK_SIZE 4096    // Zero bytes sent at once in place of a captured upload
+
+#endif // CHAT_REPLAY_H
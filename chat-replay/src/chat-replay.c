@@ -0,0 +1,383 @@
+#include "../inc/chat-replay.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+/*
+ * FUNCTION : monotonicNanoseconds
+ *
+ * DESCRIPTION : This function reads the monotonic clock the replay is scheduled on
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : long long : Nanoseconds since an arbitrary point.
+ */
+static long long monotonicNanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/*
+ * FUNCTION : parseReplayArguments
+ *
+ * DESCRIPTION : This function reads the switches after the capture file: -serverADDRESS, -speedX and -copiesN
+ *
+ * PARAMETERS : int argc : The number of command-line arguments.
+ *              char *argv[] : The command-line arguments (the capture file is argv[1]).
+ *              const char **serverAddress : Set to the -server address, left alone without one.
+ *              double *speed : Set to the -speed factor, left alone without one.
+ *              int *copies : Set to the -copies count, left alone without one.
+ *
+ * RETURNS : int : 0 on success, -1 if an argument isn't understood.
+ */
+int parseReplayArguments(int argc, char *argv[], const char **serverAddress, double *speed, int *copies)
+{
+    for (int i = 2; i < argc; i++)
+    {
+        if (strncmp(argv[i], REPLAY_SERVER_SWITCH, strlen(REPLAY_SERVER_SWITCH)) == 0)
+        {
+            *serverAddress = argv[i] + strlen(REPLAY_SERVER_SWITCH);
+        }
+        else if (strncmp(argv[i], REPLAY_SPEED_SWITCH, strlen(REPLAY_SPEED_SWITCH)) == 0)
+        {
+            char *end;
+            *speed = strtod(argv[i] + strlen(REPLAY_SPEED_SWITCH), &end);
+            if (*end != '\0' || *speed < 0)
+            {
+                return -1;
+            }
+        }
+        else if (strncmp(argv[i], REPLAY_COPIES_SWITCH, strlen(REPLAY_COPIES_SWITCH)) == 0)
+        {
+            *copies = atoi(argv[i] + strlen(REPLAY_COPIES_SWITCH));
+            if (*copies <= 0 || *copies > REPLAY_MAX_CONNECTIONS)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            return -1;
+        }
+    }
+    return (*serverAddress)[0] == '\0' ? -1 : 0;
+}
+
+/*
+ * FUNCTION : drainConnections
+ *
+ * DESCRIPTION : This function reads whatever the server sends on every open connection until a deadline, so its
+ * output queues never back up because of us. Connections the server closes are marked closed.
+ *
+ * PARAMETERS : ReplayConnection *connections : REPLAY_MAX_CONNECTIONS connections.
+ *              ReplayTotals *totals : Where the bytes read are counted.
+ *              long long deadlineNs : Monotonic time to return at (in the past to only read what is there).
+ *
+ * RETURNS : void
+ */
+void drainConnections(ReplayConnection *connections, ReplayTotals *totals, long long deadlineNs)
+{
+    static struct pollfd polls[REPLAY_MAX_CONNECTIONS * TRANSPORT_MAX_POLL_DESCRIPTORS];
+    static int pollOwners[REPLAY_MAX_CONNECTIONS * TRANSPORT_MAX_POLL_DESCRIPTORS];
+    static char readBuffer[REPLAY_READ_BUFFER_SIZE];
+
+    do
+    {
+        int pollCount = 0;
+        int hasPending = 0;
+        for (int i = 0; i < REPLAY_MAX_CONNECTIONS; i++)
+        {
+            if (!connections[i].isOpen)
+            {
+                continue;
+            }
+            int added = transportPollDescriptors(&connections[i].transport, polls + pollCount);
+            for (int j = 0; j < added; j++)
+            {
+                pollOwners[pollCount + j] = i;
+            }
+            pollCount += added;
+            // Bytes stashed while the transport was set up never show up on the descriptors
+            hasPending |= connections[i].transport.pendingLength > 0;
+        }
+
+        long long remainingNs = deadlineNs - monotonicNanoseconds();
+        int timeoutMs = hasPending || remainingNs <= 0 ? 0 : (int)((remainingNs + 999999) / 1000000);
+        if (pollCount == 0)
+        {
+            if (timeoutMs > 0)
+            {
+                struct timespec wait = {remainingNs / 1000000000LL, remainingNs % 1000000000LL};
+                nanosleep(&wait, NULL);
+            }
+            return;
+        }
+        if (poll(polls, pollCount, timeoutMs) < 0 && errno != EINTR)
+        {
+            perror("poll failed");
+            return;
+        }
+
+        for (int i = 0; i < pollCount; i++)
+        {
+            ReplayConnection *connection = &connections[pollOwners[i]];
+            if (!connection->isOpen || (polls[i].revents == 0 && connection->transport.pendingLength == 0))
+            {
+                continue;
+            }
+            while (1)
+            {
+                ssize_t readLength = transportReceive(&connection->transport, readBuffer, sizeof(readBuffer), MSG_DONTWAIT);
+                if (readLength < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                {
+                    break;
+                }
+                if (readLength <= 0)
+                {
+                    transportClose(&connection->transport);
+                    connection->isOpen = 0;
+                    totals->closedByServer++;
+                    break;
+                }
+                totals->bytesReceived += readLength;
+            }
+        }
+    } while (monotonicNanoseconds() < deadlineNs);
+}
+
+/*
+ * FUNCTION : sendToConnection
+ *
+ * DESCRIPTION : This function sends bytes on a replayed connection, closing it if the server is gone
+ *
+ * PARAMETERS : ReplayConnection *connection : The connection.
+ *              const char *data : The bytes.
+ *              size_t length : How many.
+ *              ReplayTotals *totals : Where the bytes (or the failure) are counted.
+ *
+ * RETURNS : void
+ */
+void sendToConnection(ReplayConnection *connection, const char *data, size_t length, ReplayTotals *totals)
+{
+    size_t sentLength = 0;
+    while (sentLength < length)
+    {
+        ssize_t sendResult = transportSend(&connection->transport, data + sentLength, length - sentLength, 0);
+        if (sendResult < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sendResult <= 0)
+        {
+            transportClose(&connection->transport);
+            connection->isOpen = 0;
+            totals->sendFailures++;
+            return;
+        }
+        sentLength += sendResult;
+    }
+    totals->bytesSent += length;
+}
+
+/*
+ * FUNCTION : playRecord
+ *
+ * DESCRIPTION : This function does what one captured record says on every copy of its connection: connects, sends
+ * the frame (or as many zero bytes as the upload had) or closes
+ *
+ * PARAMETERS : ReplayConnection *connections : REPLAY_MAX_CONNECTIONS connections.
+ *              const CaptureRecord *record : The record.
+ *              const char *serverAddress : Where to connect.
+ *              int copies : Connections to open for each captured one.
+ *              ReplayTotals *totals : Counters.
+ *
+ * RETURNS : void
+ */
+void playRecord(ReplayConnection *connections, const CaptureRecord *record, const char *serverAddress, int copies, ReplayTotals *totals)
+{
+    if (record->kind == CAPTURE_RECORD_OPEN)
+    {
+        int slot = 0;
+        for (int copy = 0; copy < copies; copy++)
+        {
+            while (slot < REPLAY_MAX_CONNECTIONS && connections[slot].isOpen)
+            {
+                slot++;
+            }
+            if (slot == REPLAY_MAX_CONNECTIONS || connectToServer(serverAddress, &connections[slot].transport) < 0)
+            {
+                totals->connectFailures++;
+                continue;
+            }
+            connections[slot].capturedId = record->connectionId;
+            connections[slot].isOpen = 1;
+            totals->connectionsOpened++;
+        }
+        return;
+    }
+
+    int isPlayed = 0;
+    for (int i = 0; i < REPLAY_MAX_CONNECTIONS; i++)
+    {
+        ReplayConnection *connection = &connections[i];
+        if (!connection->isOpen || connection->capturedId != record->connectionId)
+        {
+            continue;
+        }
+        isPlayed = 1;
+
+        if (record->kind == CAPTURE_RECORD_FRAME)
+        {
+            char frame[MAX_PROTOL_MESSAGE_SIZE + 1];
+            // The server never captures a frame it threw away for being too long
+            size_t frameLength = record->length < MAX_PROTOL_MESSAGE_SIZE ? record->length : MAX_PROTOL_MESSAGE_SIZE;
+            memcpy(frame, record->payload, frameLength);
+            frame[frameLength] = PROTOCOL_FRAME_END;
+            sendToConnection(connection, frame, frameLength + 1, totals);
+            totals->framesSent++;
+        }
+        else if (record->kind == CAPTURE_RECORD_UPLOAD)
+        {
+            static const char zeroBytes[REPLAY_UPLOAD_CHUNK_SIZE];
+            size_t remaining = record->length;
+            while (remaining > 0 && connection->isOpen)
+            {
+                size_t chunkLength = remaining < sizeof(zeroBytes) ? remaining : sizeof(zeroBytes);
+                sendToConnection(connection, zeroBytes, chunkLength, totals);
+                remaining -= chunkLength;
+            }
+        }
+        else
+        {
+            transportClose(&connection->transport);
+            connection->isOpen = 0;
+        }
+    }
+    if (!isPlayed)
+    {
+        totals->recordsSkipped++;
+    }
+}
+
+/*
+ * FUNCTION : printReplayTotals
+ *
+ * DESCRIPTION : This function prints how the replay went
+ *
+ * PARAMETERS : const ReplayTotals *totals : The counters.
+ *              long long elapsedNs : How long the replay took.
+ *              double speed : The -speed it ran at.
+ *              int copies : The -copies it ran with.
+ *
+ * RETURNS : void
+ */
+void printReplayTotals(const ReplayTotals *totals, long long elapsedNs, double speed, int copies)
+{
+    printf("replayed %lu records in %.3f s (captured %.3f s, speed %g, copies %d)\n", totals->records, elapsedNs / 1e9,
+           totals->capturedUs / 1e6, speed, copies);
+    printf("connections opened=%lu failed=%lu closed-by-server=%lu\n", totals->connectionsOpened, totals->connectFailures,
+           totals->closedByServer);
+    printf("sent frames=%lu bytes=%lu failures=%lu skipped=%lu\n", totals->framesSent, totals->bytesSent, totals->sendFailures,
+           totals->recordsSkipped);
+    printf("received bytes=%lu\n", totals->bytesReceived);
+    printf("max lag=%.3f ms\n", totals->maxLagNs / 1e6);
+}
+
+/*
+ * FUNCTION : main
+ *
+ * DESCRIPTION : The main function maps the capture file and plays its records in order, each at its captured time
+ * divided by the speed, reading the server's answers while it waits. Once the capture is done the server gets a
+ * moment to finish answering, then every connection is closed and the totals are printed.
+ *
+ * PARAMETERS : int argc : The number of command-line arguments.
+ *              char *argv[] : The array of command-line argument strings.
+ *
+ * RETURNS : int : Exit status (0 for success, non-zero for error).
+ */
+int main(int argc, char *argv[])
+{
+    const char *serverAddress = REPLAY_DEFAULT_SERVER;
+    double speed = 1;
+    int copies = 1;
+    if (argc < 2 || parseReplayArguments(argc, argv, &serverAddress, &speed, &copies) < 0)
+    {
+        printf("Usage: chat-replay CAPTUREFILE [%sADDRESS] [%sX] [%sN]\n", REPLAY_SERVER_SWITCH, REPLAY_SPEED_SWITCH, REPLAY_COPIES_SWITCH);
+        exit(EXIT_FAILURE);
+    }
+
+    int captureFile = open(argv[1], O_RDONLY);
+    struct stat captureStat;
+    if (captureFile < 0 || fstat(captureFile, &captureStat) < 0)
+    {
+        perror("capture file");
+        exit(EXIT_FAILURE);
+    }
+    size_t captureLength = captureStat.st_size;
+    const unsigned char *capture = captureLength > 0 ? mmap(NULL, captureLength, PROT_READ, MAP_PRIVATE, captureFile, 0) : MAP_FAILED;
+    close(captureFile);
+    if (capture == MAP_FAILED || captureLength < CAPTURE_MAGIC_LENGTH || memcmp(capture, CAPTURE_MAGIC, CAPTURE_MAGIC_LENGTH) != 0)
+    {
+        printf("%s is not a capture file\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    madvise((void *)capture, captureLength, MADV_SEQUENTIAL);
+
+    // A server that closes on us mid-send should show up as a failed send, not end the replay
+    signal(SIGPIPE, SIG_IGN);
+
+    static ReplayConnection connections[REPLAY_MAX_CONNECTIONS];
+    ReplayTotals totals;
+    memset(&totals, 0, sizeof(totals));
+
+    long long startNs = monotonicNanoseconds();
+    size_t position = CAPTURE_MAGIC_LENGTH;
+    while (position < captureLength)
+    {
+        CaptureRecord record;
+        long recordLength = captureDecodeRecord(capture + position, captureLength - position, &record);
+        if (recordLength <= 0)
+        {
+            // A capture cut off by a killed server just ends early
+            if (recordLength < 0)
+            {
+                printf("corrupt record at byte %zu, stopping\n", position);
+            }
+            break;
+        }
+        position += recordLength;
+        totals.records++;
+        totals.capturedUs += record.deltaMicroseconds;
+
+        // Wait for the record's time, reading answers meanwhile. At speed 0 only what has arrived is read.
+        long long dueNs = startNs;
+        if (speed > 0)
+        {
+            dueNs += (long long)(totals.capturedUs * 1000.0 / speed);
+        }
+        drainConnections(connections, &totals, dueNs);
+
+        long long lagNs = monotonicNanoseconds() - dueNs;
+        if (speed > 0 && lagNs > totals.maxLagNs)
+        {
+            totals.maxLagNs = lagNs;
+        }
+        playRecord(connections, &record, serverAddress, copies, &totals);
+    }
+
+    drainConnections(connections, &totals, monotonicNanoseconds() + REPLAY_DRAIN_MS * 1000000LL);
+    long long elapsedNs = monotonicNanoseconds() - startNs;
+    for (int i = 0; i < REPLAY_MAX_CONNECTIONS; i++)
+    {
+        if (connections[i].isOpen)
+        {
+            transportClose(&connections[i].transport);
+            connections[i].isOpen = 0;
+        }
+    }
+    munmap((void *)capture, captureLength);
+    printReplayTotals(&totals, elapsedNs, speed, copies);
+    return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+// Load signals the admission controller watches, and the level it derived from them
+typedef struct
+{
+    int pendingBroadcasts;           // Chat frames queued for or being broadcast by the worker pool
+    long long broadcastLatencyNs;    // Smoothed time from a frame being read to its broadcast being queued for everyone
+    long long residentBytes;         // Resident memory of the process, sampled from /proc
+    int level;                       // ADMISSION_NORMAL, ADMISSION_ELEVATED or ADMISSION_OVERLOAD
+    unsigned long sessionsRejected;  // Connections turned away with a busy frame
+    unsigned long framesShed;        // Low priority frames dropped because of load
+} AdmissionState;
+
+// Function prototypes
+void admissionBroadcastStarted(void);
+void admissionBroadcastFinished(long long startedNs);
+void admissionSample(void);
+int admissionLevel(void);
+void admissionCountRejected(void);
+void admissionCountShed(void);
+
+// Shared state (read by the stats verb)
+extern AdmissionState admissionState;
+
+// Defines
+#define ADMISSION_NORMAL 0   // Accept everything as fast as it arrives
+#define ADMISSION_ELEVATED 1 // Accept in small batches with a pause in between
+#define ADMISSION_OVERLOAD 2 // Turn new sessions away and shed low priority traffic
+
+#define ADMISSION_QUEUE_ELEVATED 32              // Pending chat frames
+#define ADMISSION_QUEUE_OVERLOAD 64
+#define ADMISSION_LATENCY_ELEVATED_US 5000       // Smoothed broadcast latency
+#define ADMISSION_LATENCY_OVERLOAD_US 20000
+#define ADMISSION_MEMORY_ELEVATED_MB 256         // Resident memory
+#define ADMISSION_MEMORY_OVERLOAD_MB 512
+
+#define ADMISSION_ACCEPT_BATCH 16                // Accepts per pass at normal load
+#define ADMISSION_ELEVATED_ACCEPT_BATCH 4        // Accepts per pass at elevated load
+#define ADMISSION_ELEVATED_PAUSE_MS 50           // Pause between accept batches at elevated load
+#define ADMISSION_RETRY_AFTER_SECONDS 5          // Retry hint sent to rejected clients
+
+#endif // ADMISSION_H
@@ -0,0 +1,45 @@
+#ifndef BLOB_STORE_H
+#define BLOB_STORE_H
+
+#include "output-queue.h"
+#include <pthread.h>
+#include <sys/types.h>
+
+// Defines needed by the types below
+#define BLOB_STORE_CAPACITY 64 // Shared files kept, the oldest is dropped for a new one
+#define BLOB_NAME_SIZE 64      // Longest file name kept with a blob, with the terminator
+
+// A shared file, spooled to an unlinked temporary file as it is uploaded and sent from there with sendfile.
+// Whoever holds a reference (the store, an upload, each download) keeps the file open.
+typedef struct
+{
+    int referenceCount;
+    unsigned long blobId;    // 0 until it is published
+    int fileDescriptor;
+    size_t length;           // Size the uploader announced
+    size_t receivedLength;   // Bytes spooled so far
+    char name[BLOB_NAME_SIZE];
+} Blob;
+
+// The room's shared files, looked up by id for downloads
+typedef struct
+{
+    pthread_mutex_t storeMutex;
+    unsigned long nextBlobId;           // Id the next published blob gets
+    Blob *blobs[BLOB_STORE_CAPACITY];   // Blob n lives at n % BLOB_STORE_CAPACITY
+} BlobStore;
+
+// Function prototypes
+void blobStoreInitialize(BlobStore *store);
+Blob *blobCreate(size_t length, const char *name);
+int blobSpoolBytes(Blob *blob, const char *data, size_t length);
+int blobSpoolFromTransport(Blob *blob, Transport *transport, size_t length);
+unsigned long blobStorePublish(BlobStore *store, Blob *blob);
+Blob *blobStoreFind(BlobStore *store, unsigned long blobId);
+void blobRelease(Blob *blob);
+int blobQueueDownload(Blob *blob, OutputQueue *queue);
+
+// Defines
+#define BLOB_SPOOL_DIRECTORY "/tmp" // Where uploads are spooled (unlinked straight away)
+
+#endif // BLOB_STORE_H
@@ -2,15 +2,158 @@
 #define CHAT_SERVER_H
 
 #include "../../Common/inc/common.h"
+#include "../../Common/inc/transport.h"
+#include "timer-wheel.h"
+#include "rate-limit.h"
+#include "server-clock.h"
+#include "admission.h"
+#include "epoch.h"
+#include "worker-pool.h"
+#include "output-queue.h"
+#include "protocol.h"
+#include "history.h"
+#include "blob-store.h"
+#include "search-index.h"
+#include "content-filter.h"
+#include "federation.h"
+#include "traffic-capture.h"
+#include "message-trace.h"
+#include "low-latency.h"
+#include "state-snapshot.h"
+#include "memory-budget.h"
+#include <signal.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/random.h>
+
+// Defines needed by the types below
+#define MAX_CLIENTS 10
+#define CLIENT_READ_BUFFER_SIZE 4096 // Bytes a reader pulls in at once (any number of frames)
+
+// A chat frame read from a client, waiting for the worker pool
+typedef struct InboundFrame
+{
+    struct InboundFrame *next;
+    long long receivedNs; // When the reader queued it (admission latency covers the wait for a worker)
+    TraceSpan *span;      // Stage timings if the sampler picked it, NULL otherwise
+    char text[];
+} InboundFrame;
+
+// Per-client state, one per slot in clientSocketList (same index)
+typedef struct
+{
+    int socket;           // Client socket, -1 when the slot is free
+    Transport transport;  // How bytes get to and from the client (TCP, AF_UNIX or shared memory)
+    TimerEntry idleTimer; // Heartbeat/idle timer on the heartbeat wheel
+    TokenBucket rateLimit; // Ingest rate limit for chat frames
+    unsigned long framesDropped; // Chat frames thrown away by the rate limit
+    unsigned long framesDelayed; // Chat frames held back by the rate limit
+    int isLeaving;               // Taken out of the subscriber snapshot, waiting for broadcasts to let go of it
+    int hasSaidBye;              // A bye is in what the reader has read, throttled chat ahead of it is dropped not waited for
+    OutputQueue outputQueue;     // Everything sent to the client goes through here
+    WorkItem inboxTask;          // Pool task that parses and broadcasts the inbox
+    pthread_mutex_t inboxMutex;
+    InboundFrame *inboxHead;     // Chat frames from the reader waiting for the pool, oldest first
+    InboundFrame *inboxTail;
+    InboundFrame *freeFrames;    // Handled frames kept for reuse (each with room for MAX_PROTOL_MESSAGE_SIZE bytes)
+    int isInboxScheduled;        // inboxTask is queued or running, so only one worker ever has this client's frames
+    int slotIndex;               // Index in clientSessionList, picks the worker the inbox is queued on
+    int isSubscribed;            // Receiving broadcasts (after its resume request, or its first frame, or a short wait)
+    unsigned long joinSequence;  // First broadcast sent after the client connected
+    Blob *uploadBlob;            // File the client is uploading, NULL when none (or its put was refused)
+    char uploadPrefix[MAX_PROTOL_MESSAGE_SIZE]; // IP|USER|COUNT| of the put frame, for the announcement
+    size_t uploadChunkRemaining; // Raw bytes of the current chunk still to come (thrown away without an upload)
+    unsigned long captureId;     // Connection id in the traffic capture
+    long long lastReadNs;        // When the last read returned (only kept while the trace sampler is on)
+    MemoryAccount memoryAccount; // What the slot holds (its spare inbox frames outlive the connection)
+    char readBuffer[CLIENT_READ_BUFFER_SIZE]; // Read but not yet handled: a partial frame, or frames left to the reader
+    int bufferedLength;
+    int isDiscarding;            // Skipping the rest of a frame that was too long
+    LowLatencyLink networkLink;  // Lends the connection to a network thread in low-latency mode
+} ClientSession;
+
+// Immutable list of the clients a broadcast goes to. Readers walk it without locks, writers publish a new one.
+typedef struct
+{
+    int memberCount;
+    ClientSession *members[MAX_CLIENTS];
+    RetiredObject retired; // Link for the epoch reclaimer once a newer list replaces it
+} SubscriberSnapshot;
+
+// Server wide counters, updated with atomic adds from every client thread
+typedef struct
+{
+    unsigned long framesThrottled;
+    unsigned long framesDropped;
+    unsigned long framesDelayed;
+    unsigned long clientsDisconnectedForRate;
+    unsigned long clientsDisconnectedForBacklog;
+    unsigned long byesSeenEarly;  // Byes found while chat ahead of them was still to be handled
+} ServerStats;
 
 // Function prototypes
-int initializeListener();
+int initializeListener(const char *address, int isDualStack);
+int initializeListeners(int argc, char *argv[], int *listeningSockets);
+int initializeUnixListener();
 void acceptConnection(int listeningSocket);
-void broadcastChatMessage(char *messageToBroadcast, int senderSocket);
-void processClientMessage(int clientSocket);
-void *clientHandler(void *clientSocketPointer);
+void addClientSession(int clientSocket, int transportKind);
+int parseAndBroadcastProtocolMessage(const char *protocolMessage, int senderSocket);
+void deliverRelayedMessage(const char *protocolMessage);
+int parseServerArguments(int argc, char *argv[], unsigned long *nodeId);
+unsigned long makeNodeId(void);
+unsigned long broadcastChatMessage(char *messageToBroadcast, int senderSocket);
+void processClientMessage(ClientSession *session);
+void noteClientBytes(ClientSession *session, int numberOfBytesRead);
+int handleBufferedFrames(ClientSession *session, int mayWait);
+int isFrameForReader(ClientSession *session, const char *frame);
+int serviceClientOnNetwork(void *sessionPointer);
+int handleClientFrame(ClientSession *session, char *frame);
+int isByeBuffered(const char *data, size_t length);
+void queueInboundFrame(ClientSession *session, const char *frame);
+int startUpload(ClientSession *session, const char *frame, const char *putText);
+int spoolUploadBytes(ClientSession *session, const char *data, size_t length);
+int spoolUploadFromTransport(ClientSession *session);
+void finishUploadChunk(ClientSession *session);
+void sendBlob(ClientSession *session, unsigned long blobId);
+void processInbox(WorkItem *item);
+void subscribeClientSession(ClientSession *session, unsigned long afterSequence);
+void *clientHandler(void *clientSessionPointer);
+void *heartbeatTimerThread(void *unused);
+void refreshClientHeartbeat(ClientSession *session);
+unsigned long sendHeartbeatPing(TimerEntry *entry);
+unsigned long reapDeadPeer(TimerEntry *entry);
+int applyRateLimit(ClientSession *session);
+int sendStatsLine(ClientSession *session, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void sendServerStats(ClientSession *session);
+void sendSearchResults(ClientSession *session, const char *queryText);
+void rejectSession(int clientSocket);
+void publishSubscriberSnapshot(void);
+void removeClientSession(ClientSession *session);
+void enforceMemoryBudget(void);
 
 // Defines
-#define MAX_CLIENTS 10
+#define TIMER_TICK_MS 100                 // Resolution of the heartbeat wheel
+#define HEARTBEAT_IDLE_SECONDS 30         // Silence before the server pings a client
+#define HEARTBEAT_PONG_TIMEOUT_SECONDS 10 // Time a pinged client has to answer before it is reaped
+#define RATE_LIMIT_FRAMES_PER_SECOND 5          // Sustained chat frames per second per client
+#define RATE_LIMIT_BURST 10                     // Frames a client may send back to back before the limit applies
+#define RATE_LIMIT_POLICY RATE_LIMIT_DELAY      // What to do with excess frames (RATE_LIMIT_DROP/DELAY/DISCONNECT)
+#define JOIN_RESUME_WAIT_MS 500                 // How long a new client has to ask for a resume before it is subscribed
+#define INBOX_BATCH_FRAMES 8                    // Frames a worker handles for one client before letting others run
+#define CLIENT_THREAD_STACK_BYTES (256 * 1024)  // Stack of each client's reader thread (charged to its memory account)
+#define SERVER_PORT_SWITCH "-port"               // -portN: client port (SERVER_PORT without it)
+#define SERVER_NODE_SWITCH "-node"               // -nodeN: this node's id among its peers (made up without it)
+#define SERVER_PEER_SWITCH "-peer"               // -peerHOST[:PORT]: another node to relay messages with (repeatable)
+#define SERVER_CAPTURE_SWITCH "-capture"         // -capturePATH: record what clients send to PATH (for chat-replay)
+#define SERVER_TRACE_SWITCH "-trace"             // -traceN: time one chat message in N stage by stage (see message-trace.h)
+#define SERVER_BUSY_POLL_SWITCH "-busypoll"      // -busypollCPUS: low-latency mode on cores like 2,3 or 4-7 (see low-latency.h)
+#define SERVER_SNAPSHOT_SWITCH "-snapshot"       // -snapshotPATH: start from the history in PATH and keep it updated (see state-snapshot.h)
+#define SERVER_MEMORY_SWITCH "-memory"           // -memorySOFT:HARD: memory budget, like 64m:128m (see memory-budget.h)
+#define SERVER_LISTEN_SWITCH "-listen"           // -listenADDRESS[:PORT]: numeric address to take clients on, [::1]:PORT for IPv6 (repeatable)
+#define SERVER_MAX_LISTENERS 8                   // Most -listen switches
+#define SERVER_ANY_ADDRESS "::"                  // Listen address without -listen (dual stack, so IPv4 clients come too)
+#define SERVER_ANY_IPV4_ADDRESS "0.0.0.0"        // Listen address instead when the host has no IPv6
+#define SECONDS_TO_TICKS(seconds) ((unsigned long)(seconds) * 1000 / TIMER_TICK_MS)
 
-#endif // CHAT_SERVER_H
\ No newline at end of file
+#endif // CHAT_SERVER_H
@@ -0,0 +1,47 @@
+#ifndef CONTENT_FILTER_H
+#define CONTENT_FILTER_H
+
+#include "epoch.h"
+#include <signal.h>
+#include <stddef.h>
+
+/*
+ * Word filter on the broadcast path. The pattern list is compiled into one Aho-Corasick automaton, so a message is
+ * checked against every pattern in a single pass over its bytes. The compiled filter is immutable: a reload builds
+ * a new one and swaps it in, readers still using the old one keep it until they leave their epoch.
+ */
+
+// Compiled pattern list. States are numbered from 0 (the root), the transition table has a row of classCount
+// next states per state, with the failure links already folded in so matching never backtracks.
+typedef struct
+{
+    unsigned char byteClass[256];  // Byte to column in the transition table (letters fold to lower case, 0 is any byte no pattern uses)
+    int classCount;
+    int stateCount;
+    int patternCount;
+    unsigned int *transitions;     // stateCount rows of classCount next states
+    unsigned char *matchLength;    // Longest pattern ending in each state (0 if none), the bytes to mask
+    unsigned char *matchAction;    // Strongest action of the patterns ending in each state
+    RetiredObject retired;         // Link for the epoch reclaimer once a reload replaces it
+} ContentFilter;
+
+// Function prototypes
+int contentFilterLoad(const char *path);
+int contentFilterApply(char *text);
+void contentFilterRequestReload(int signalNumber);
+void contentFilterReloadIfRequested(void);
+void contentFilterCounts(int *patternCount, int *stateCount, unsigned long *masked, unsigned long *blocked);
+
+// Defines
+#define CONTENT_FILTER_FILE "chat-filter.txt"  // Pattern list read at start and on SIGHUP: one per line, "block " in front to block instead of mask
+#define CONTENT_FILTER_RELOAD_SIGNAL SIGHUP    // Signal that makes the server read the pattern list again
+#define CONTENT_FILTER_BLOCK_PREFIX "block "   // Pattern line whose matches keep the whole message from being sent
+#define CONTENT_FILTER_MASK_PREFIX "mask "     // Pattern line whose matches are masked (also the default)
+#define CONTENT_FILTER_COMMENT '#'             // Pattern line that is ignored
+#define CONTENT_FILTER_MAX_PATTERN 64          // Longest pattern, longer lines are cut
+#define CONTENT_FILTER_MASK_BYTE '*'           // What masked bytes are replaced with
+#define CONTENT_FILTER_PASS 0                  // contentFilterApply: nothing matched
+#define CONTENT_FILTER_MASK 1                  // contentFilterApply: matches were masked in place
+#define CONTENT_FILTER_BLOCK 2                 // contentFilterApply: the message must not be sent
+
+#endif // CONTENT_FILTER_H
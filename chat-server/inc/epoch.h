@@ -0,0 +1,40 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/*
+ * Epoch based reclamation. Readers bracket their use of shared, immutable data with epochEnter/epochExit and
+ * never lock. Writers swap in a new version and hand the old one to epochRetire, which frees it once every
+ * reader that could still be looking at it has moved on. Retiring never allocates and never waits for readers
+ * (writers retire with locks held that readers may be waiting on), so each retirable object carries its own
+ * RetiredObject link.
+ */
+
+// One per thread that reads, padded to a cache line so readers don't slow each other down
+typedef struct
+{
+    unsigned long localEpoch; // Global epoch seen when the thread last entered
+    int isActive;             // Thread is inside a read section
+    int isClaimed;            // Slot belongs to a thread
+    char padding[48];
+} EpochReaderSlot;
+
+// Something waiting for the readers to move on before it can be freed (embedded in the object)
+typedef struct RetiredObject
+{
+    struct RetiredObject *next;
+    void *object;
+    void (*freeFunction)(void *object);
+    unsigned long retiredEpoch;
+} RetiredObject;
+
+// Function prototypes
+void epochEnter(void);
+void epochExit(void);
+void epochThreadExit(void);
+void epochRetire(RetiredObject *retired, void *object, void (*freeFunction)(void *object));
+void epochSynchronize(void);
+
+// Defines
+#define EPOCH_MAX_THREADS 64 // Threads that can be inside read sections at once
+
+#endif // EPOCH_H
@@ -0,0 +1,77 @@
+#ifndef FEDERATION_H
+#define FEDERATION_H
+
+#include "../../Common/inc/common.h"
+#include <pthread.h>
+
+/*
+ * Server to server relay. Nodes keep persistent TCP links to their peers; a message accepted from a local client is
+ * relayed once over every link, and each node that receives it broadcasts it to its own clients and passes it on
+ * over its other links. Every relayed message carries the node it came from and that node's sequence number for it,
+ * so a message that comes back around a loop is recognised and dropped.
+ */
+
+// Defines needed by the types below
+#define FEDERATION_MAX_PEERS 8         // Links one node keeps (configured and accepted together)
+#define FEDERATION_ADDRESS_SIZE 256    // host:port of a configured peer
+#define FEDERATION_MAX_ORIGINS 64      // Nodes whose recent sequence numbers are remembered for loop suppression
+
+// One link to another node. The link thread dials (or was accepted), reads and delivers; the sender thread writes
+// whatever relays piled up while its last write was in progress, so relays are batched under load without waiting.
+typedef struct
+{
+    int isInUse;                       // Slot holds a link (a configured peer keeps its slot for good)
+    int isOutbound;                    // Configured with -peer, dialled and redialled by us
+    char address[FEDERATION_ADDRESS_SIZE];
+    int socket;                        // -1 while down
+    unsigned long remoteNode;          // Node id from the peer's hello, 0 until then
+    int isConnected;                   // Hellos exchanged, relays flow
+    pthread_mutex_t linkMutex;
+    pthread_cond_t batchReady;         // Signalled when relays are queued or the link goes down
+    char *pendingBatch;                // Relay frames waiting for the sender (appended under linkMutex)
+    size_t pendingLength;
+    char *sendingBatch;                // Frames being written (sender thread only), swapped with pendingBatch
+    pthread_t senderThread;
+} PeerLink;
+
+// Recently seen sequence numbers of one origin node, a sliding window below the highest one
+typedef struct
+{
+    unsigned long node;
+    unsigned long highestSequence;
+    unsigned long long recentMask;     // Bit n set: highestSequence - n has been seen
+} OriginWindow;
+
+// Relay counters (reported by the stats verb)
+typedef struct
+{
+    unsigned long framesRelayed;       // Frames queued to a link (ours and ones passed on)
+    unsigned long framesReceived;      // New messages from other nodes, broadcast here
+    unsigned long duplicatesDropped;   // Messages that came back around a loop, or over a second path
+    unsigned long batchesSent;         // Writes to links (framesRelayed / batchesSent is the batching factor)
+    unsigned long framesDropped;       // Frames a link had no room for (its peer isn't keeping up)
+} FederationStats;
+
+// Function prototypes
+int federationStart(unsigned long nodeId, int serverPort, void (*deliver)(const char *protocolMessage));
+int federationAddPeer(const char *address);
+void federationAcceptPeer(int listeningSocket);
+void federationRelay(unsigned long sequence, const char *protocolMessage);
+unsigned long federationNodeId(void);
+int federationConnectedPeers(void);
+
+// Shared state (read by the stats verb)
+extern FederationStats federationStats;
+
+// Defines
+#define FEDERATION_PORT_OFFSET 1000             // Links go to a node's client port plus this
+#define FEDERATION_HELLO ">>peer<<"             // First frame both ways on a link: >>peer<<NODEID
+#define FEDERATION_RELAY ">>relay<<"            // A relayed message: >>relay<<ORIGINNODE|ORIGINSEQUENCE|IP|USER|COUNT|TEXT
+#define FEDERATION_BATCH_BYTES (256 * 1024)     // Relay bytes a link holds for a slow peer before it drops frames
+#define FEDERATION_READ_BUFFER_SIZE (64 * 1024) // Bytes a link thread reads at once
+#define FEDERATION_FRAME_SIZE (MAX_PROTOL_MESSAGE_SIZE * 2) // Longest relay frame (a client frame plus the header)
+#define FEDERATION_RETRY_MS 1000                // Wait before redialling a configured peer
+#define FEDERATION_HELLO_TIMEOUT_SECONDS 5      // Time a new link has to say hello
+#define FEDERATION_WINDOW_BITS 64               // Sequence numbers remembered below an origin's highest
+
+#endif // FEDERATION_H
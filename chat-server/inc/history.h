@@ -0,0 +1,28 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "output-queue.h"
+#include <pthread.h>
+
+// Defines needed by the types below
+#define HISTORY_CAPACITY 256 // Recent broadcasts kept for clients resuming after a reconnect
+
+// The room's recent broadcasts, in sequence order. Every broadcast is numbered, recorded and queued to its
+// subscribers under historyMutex, so every client sees sequence numbers in increasing order. Numbers only ever go
+// up but can jump (across a restart), so each kept broadcast has its number next to it.
+typedef struct
+{
+    pthread_mutex_t historyMutex;
+    unsigned long nextSequence;                   // Number the next broadcast gets
+    unsigned long recordedCount;                  // Broadcasts recorded so far, the nth lives at n % HISTORY_CAPACITY
+    OutboundMessage *messages[HISTORY_CAPACITY];
+    unsigned long sequences[HISTORY_CAPACITY];    // Number of the broadcast in the same place in messages
+} MessageHistory;
+
+// Function prototypes
+void historyInitialize(MessageHistory *history, unsigned long firstSequence);
+OutboundMessage *historyStamp(MessageHistory *history, const char *text);
+int historyReplay(MessageHistory *history, unsigned long afterSequence, OutputQueue *queue);
+void historyRestore(MessageHistory *history, unsigned long sequence, OutboundMessage *message);
+
+#endif // HISTORY_H
@@ -0,0 +1,65 @@
+#ifndef LOW_LATENCY_H
+#define LOW_LATENCY_H
+
+#include "../../Common/inc/transport.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Low-latency mode (-busypollCPUS): trades CPU for wakeup latency. The first of the listed cores go to network
+ * threads, the rest to the worker pool, so the two never take turns on a core. A network thread spins on poll()
+ * over the sockets it has been given and reads and frames whatever arrives straight into the inboxes, with no
+ * thread to wake on the way. Each client keeps its reader thread, blocked until its network thread hands the
+ * client back for something it must not wait for on everyone's behalf (the rate limit, an upload, a search, the
+ * move to shared memory) or the client goes. Idle workers spin on the pool. Inbox frames are set up and memory is
+ * locked at startup, so the message path neither allocates nor page faults.
+ */
+
+// Defines needed by the types below
+#define LOW_LATENCY_MAX_CPUS 64
+#define LOW_LATENCY_MAX_LINKS 64 // Connections one network thread polls at once
+
+// The cores low-latency threads run on
+typedef struct
+{
+    int cpuCount;                       // 0 when low-latency mode is off
+    int networkThreadCount;             // Network threads, on cpus[0] up to this
+    int cpus[LOW_LATENCY_MAX_CPUS];
+} LowLatencyCores;
+
+// A connection its reader thread has lent to a network thread. The thread that has it is the only one that reads
+// it; the handoff mutex passes it (and everything the reader keeps about it) from one to the other.
+typedef struct
+{
+    int socket;                         // Polled while a network thread has it
+    void *owner;                        // Passed to the service function
+    int networkThread;                  // Which network thread polls it
+    int isHandedBack;                   // Set by the network thread when the reader should take over
+    int handbackResult;                 // What the service function said
+    pthread_mutex_t handoffMutex;
+    pthread_cond_t handoffCondition;
+} LowLatencyLink;
+
+// Function prototypes
+int lowLatencyStart(const char *cpuList);
+int lowLatencyIsActive(void);
+int lowLatencyWorkerCoreCount(void);
+void lowLatencyPinWorker(int workerIndex);
+int lowLatencyStartNetworkThreads(int (*service)(void *owner));
+void lowLatencyLinkInitialize(LowLatencyLink *link, void *owner, int linkIndex);
+int lowLatencyHandToNetwork(LowLatencyLink *link, int socket);
+void lowLatencyPrepareSocket(int socket, int transportKind);
+void lowLatencyBackoff(unsigned int *idleRounds);
+void lowLatencyLockMemory(void);
+
+// Defines
+#define LOW_LATENCY_CORES_PER_NETWORK_THREAD 8 // One network thread for every this many cores (always at least one)
+#define LOW_LATENCY_KEEP 0                     // Service result: leave the connection with the network thread
+#define LOW_LATENCY_HAND_BACK 1                // Service result: its reader has work only it can do
+#define LOW_LATENCY_CLOSED -1                  // Service result: the connection is finished
+#define LOW_LATENCY_SPIN_ROUNDS 4096           // Empty polls spent spinning (pause between them) before yielding the core
+#define LOW_LATENCY_BUSY_POLL_US 50            // SO_BUSY_POLL: how long a read on an empty socket polls the device queue
+#define LOW_LATENCY_INBOX_FRAMES 64            // Inbox frames set up per client slot at startup
+
+#endif // LOW_LATENCY_H
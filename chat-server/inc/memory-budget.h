@@ -0,0 +1,69 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+/*
+ * Memory accounting for the server. Everything a connection makes the server hold (its reader's stack, chat frames
+ * waiting for the pool, output queue entries and compressed blocks, its compressor and upload state) is charged to
+ * the connection's account as it is allocated and credited back as it is freed, and every charge also goes into
+ * the server-wide total. Broadcast frames are shared by every queue and the history, so they are charged once, to
+ * the server alone, as are the search index, the federation links' batches, the capture buffers and the trace
+ * ring. The total is held to two limits: over the soft one the server gives back spare memory and
+ * disconnects the slowest reader, over the hard one it refuses new sessions, chat and uploads as well.
+ */
+
+// Defines needed by the types below
+#define MEMORY_KIND_COUNT 10 // What memory is charged for (MEMORY_STACKS to MEMORY_TRACE)
+
+// Bytes one connection holds, by kind (updated with atomics from its reader, the workers and the writer thread)
+typedef struct
+{
+    long long bytes[MEMORY_KIND_COUNT];
+} MemoryAccount;
+
+// Memory charged across the server, the budget it is held to and what was done to keep to it
+typedef struct
+{
+    long long usedBytes;                     // Everything charged right now
+    long long peakBytes;                     // Most ever charged at once
+    long long kindBytes[MEMORY_KIND_COUNT];  // usedBytes by kind
+    long long softLimitBytes;                // Over this spare memory is given back and slow readers are shed
+    long long hardLimitBytes;                // Over this new work is refused
+    unsigned long long trimmedBytes;         // Spare memory given back over the soft limit
+    unsigned long clientsShed;               // Slow readers disconnected over the soft limit
+    unsigned long refusals;                  // Sessions, chat frames and uploads refused over the hard limit
+} MemoryBudgetState;
+
+// Function prototypes
+int memoryBudgetConfigure(const char *limitsText);
+void memoryCharge(MemoryAccount *account, int kind, long long bytes);
+void memoryRelease(MemoryAccount *account, int kind, long long bytes);
+long long memoryAccountTotal(const MemoryAccount *account);
+int memoryBudgetLevel(void);
+void memoryCountTrimmed(long long bytes);
+void memoryCountShed(void);
+void memoryCountRefused(void);
+
+// Shared state (read by the stats verb)
+extern MemoryBudgetState memoryBudgetState;
+
+// Defines
+#define MEMORY_STACKS 0      // Reader thread stacks
+#define MEMORY_INBOX 1       // Chat frames waiting for the pool, or kept for reuse
+#define MEMORY_OUTPUT 2      // Output queue entries and compressed blocks
+#define MEMORY_COMPRESSION 3 // Compressor windows
+#define MEMORY_UPLOADS 4     // Uploads being put back together
+#define MEMORY_FRAMES 5      // Outgoing frames, shared by the queues and the history (never charged to a connection)
+#define MEMORY_SEARCH 6      // Search index documents, term table and postings, and broadcasts waiting to be indexed
+#define MEMORY_FEDERATION 7  // Peer links' relay batches and read buffers
+#define MEMORY_CAPTURE 8     // Traffic capture double buffer
+#define MEMORY_TRACE 9       // Message trace ring, once sampling is on
+
+#define MEMORY_WITHIN_BUDGET 0 // Under the soft limit
+#define MEMORY_OVER_SOFT 1     // Trim and shed
+#define MEMORY_OVER_HARD 2     // Refuse new work too
+
+#define MEMORY_SOFT_LIMIT_BYTES (64LL * 1024 * 1024)  // Soft limit without -memory
+#define MEMORY_HARD_LIMIT_BYTES (128LL * 1024 * 1024) // Hard limit without -memory
+#define MEMORY_SHED_MIN_BACKLOG_BYTES (16 * 1024)     // A reader is only shed for memory with at least this much queued
+
+#endif // MEMORY_BUDGET_H
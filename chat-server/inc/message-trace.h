@@ -0,0 +1,81 @@
+#ifndef MESSAGE_TRACE_H
+#define MESSAGE_TRACE_H
+
+#include <signal.h>
+#include <stddef.h>
+
+/*
+ * Per-message lifecycle tracing. Static USDT probes mark every stage a chat message goes through (provider
+ * chat_server: accept, frame_received, parsed, broadcast_start, recipient_send, broadcast_done) for perf, bpftrace
+ * or SystemTap to attach to; each is a single nop until something does, and nothing at all without sys/sdt.h.
+ * With -traceN the server also times every Nth chat message stage by stage, keeps the last TRACE_RING_SPANS of
+ * these spans in a ring and writes them to TRACE_DUMP_PATH when it gets TRACE_DUMP_SIGNAL.
+ */
+
+// Where the time went for one sampled chat message (all durations in nanoseconds)
+typedef struct
+{
+    unsigned long sequence;  // Broadcast number, 0 if the content filter blocked it
+    int senderSocket;
+    int recipientCount;
+    long long readNs;        // Reader: from the read returning to the frame being in the inbox (rate limit included)
+    long long inboxNs;       // Waiting in the inbox for a worker
+    long long parseNs;       // Parse, filter and format
+    long long lockWaitNs;    // Waiting for the history lock
+    long long queueNs;       // Numbering it and queueing it to every recipient (under the lock)
+    long long sendNs;        // Flushing the recipients' queues
+    long long totalNs;       // Read to the last flush
+} TraceSpan;
+
+// One place in the ring. stamp is 0 while the span is being written, then its position in the ring plus one.
+typedef struct
+{
+    unsigned long stamp;
+    TraceSpan span;
+} TraceSlot;
+
+// What the sampler has done (reported by the stats verb)
+typedef struct
+{
+    unsigned int sampleEvery;      // One chat message in this many gets a span, 0 when sampling is off
+    unsigned long spansRecorded;
+    long long slowestNs;           // Longest total of any span recorded
+    unsigned long dumps;
+} TraceStats;
+
+// Function prototypes
+void messageTraceStart(unsigned int every);
+int messageTraceIsActive(void);
+int messageTraceShouldSample(void);
+void messageTraceSetCurrent(TraceSpan *span);
+TraceSpan *messageTraceCurrent(void);
+void messageTraceRecord(const TraceSpan *span);
+void messageTraceRequestDump(int signalNumber);
+void messageTraceDumpIfRequested(void);
+
+// Shared state (read by the stats verb)
+extern TraceStats traceStats;
+
+// Defines
+#define TRACE_RING_SPANS 1024                          // Spans kept, the oldest are overwritten (a power of two)
+#define TRACE_DUMP_SIGNAL SIGUSR2                      // Signal that writes the ring out
+#define TRACE_DUMP_PATH "chat-server-trace.txt"        // Where it is written, in the working directory (replaced each time)
+
+// USDT probe points. Arguments are plain integers or pointers, a probe that nothing is attached to costs one nop.
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_HAVE_USDT 1
+#endif
+#endif
+#ifdef TRACE_HAVE_USDT
+#define TRACE_PROBE1(name, first) DTRACE_PROBE1(chat_server, name, first)
+#define TRACE_PROBE2(name, first, second) DTRACE_PROBE2(chat_server, name, first, second)
+#define TRACE_PROBE3(name, first, second, third) DTRACE_PROBE3(chat_server, name, first, second, third)
+#else
+#define TRACE_PROBE1(name, first) do { } while (0)
+#define TRACE_PROBE2(name, first, second) do { } while (0)
+#define TRACE_PROBE3(name, first, second, third) do { } while (0)
+#endif
+
+#endif // MESSAGE_TRACE_H
@@ -0,0 +1,102 @@
+#ifndef OUTPUT_QUEUE_H
+#define OUTPUT_QUEUE_H
+
+#include "../../Common/inc/common.h"
+#include "../../Common/inc/transport.h"
+#include "../../Common/inc/lz.h"
+#include "memory-budget.h"
+#include <pthread.h>
+#include <stddef.h>
+
+// One outgoing frame. A broadcast builds it once and every recipient's queue holds a reference to it.
+typedef struct
+{
+    int referenceCount;
+    int isMapped;        // Lives in a mapped state snapshot rather than on the heap, never freed
+    size_t length;
+    char data[]; // length bytes, ending with PROTOCOL_FRAME_END
+} OutboundMessage;
+
+// Defines needed by the types below
+#define OUTPUT_STREAM_HEADER_SIZE 96 // Longest header a stream puts in front of each chunk
+
+// A file sent in chunks straight from the page cache. Each chunk goes out as a header frame the owner formats
+// followed by the raw bytes, and other frames can go out between chunks.
+typedef struct OutboundStream
+{
+    int fileDescriptor;
+    off_t nextOffset;  // Next byte of the file to send
+    off_t endOffset;   // Where to stop
+    size_t (*formatHeader)(struct OutboundStream *stream, size_t chunkLength, char *header, size_t headerSize);
+    void (*release)(struct OutboundStream *stream); // Called once when the queue is done with the stream
+} OutboundStream;
+
+// A reference to a message, or a stream, waiting in one queue
+typedef struct OutputQueueEntry
+{
+    struct OutputQueueEntry *next;
+    OutboundMessage *message;                     // NULL for a stream
+    OutboundStream *stream;
+    char chunkHeader[OUTPUT_STREAM_HEADER_SIZE];  // Header of the chunk being sent (headOffset counts into it)
+    size_t chunkHeaderLength;                     // 0 between chunks
+    size_t chunkRemaining;                        // File bytes of the chunk still to send
+} OutputQueueEntry;
+
+// Frames waiting to go out to one connection. Whoever appends sends what it can straight away without blocking,
+// anything the peer isn't ready for is left to the writer thread. Control frames (pings, refusals) have a lane of
+// their own that is always drained first, so they only ever wait for the bulk frame already part way out.
+typedef struct OutputQueue
+{
+    pthread_mutex_t queueMutex;       // Initialized once, held while sending so frames never interleave
+    Transport *transport;
+    OutputQueueEntry *head;
+    OutputQueueEntry *tail;
+    size_t headOffset;                // Bytes of the head message already sent
+    size_t queuedBytes;               // Bytes still to send (not counting streams, which are read from their file)
+    int isClosed;                     // Connection is going away, appends are refused
+    int isWaitingForWriter;           // On the writer thread's list
+    struct OutputQueue *nextWaiting;  // Writer thread's list (writerMutex)
+    LzWindow *compressor;             // Set once the peer agreed to compressed batches, NULL otherwise
+    int uncompressedEntries;          // Entries at the head to send as they are (queued before compression was agreed,
+                                      // or a batch that didn't get smaller)
+    char *compressedBlock;            // Header frame and compressed batch being sent, NULL when there is none
+    size_t compressedOffset;          // Next byte of it to send
+    size_t compressedLength;          // Where it ends
+    OutputQueueEntry *controlHead;    // Control lane, sent ahead of everything above (messages only, never compressed)
+    OutputQueueEntry *controlTail;
+    size_t controlOffset;             // Bytes of the control head already sent
+    size_t controlBytes;              // Control bytes still to send (held to OUTPUT_CONTROL_LIMIT_BYTES)
+    MemoryAccount *memoryAccount;     // What the queue allocates is charged here (NULL to charge the server)
+} OutputQueue;
+
+// Function prototypes
+OutboundMessage *outboundMessageCreate(const char *data, size_t length);
+void outboundMessageRelease(OutboundMessage *message);
+void outputQueueInitialize(OutputQueue *queue, MemoryAccount *memoryAccount);
+void outputQueueOpen(OutputQueue *queue, Transport *transport);
+int outputQueueAppend(OutputQueue *queue, OutboundMessage *message);
+int outputQueuePush(OutputQueue *queue, OutboundMessage *message);
+void outputQueueFlush(OutputQueue *queue);
+int outputQueueAppendText(OutputQueue *queue, const char *text);
+int outputQueueAppendControl(OutputQueue *queue, const char *text);
+int outputQueueAppendStream(OutputQueue *queue, OutboundStream *stream);
+int outputQueueEnableCompression(OutputQueue *queue, const char *acceptText);
+void outputQueueCompressionCounts(unsigned long *batches, unsigned long *rawBytes, unsigned long *sentBytes);
+int outputQueueRunWhenIdle(OutputQueue *queue, int (*action)(Transport *transport));
+void outputQueueClose(OutputQueue *queue);
+int outputQueueShed(OutputQueue *queue);
+int outputQueueStartWriter(void);
+int outputQueueTotalFrames(void);
+void outputQueueControlCounts(unsigned long *sent, unsigned long *ahead);
+
+// Defines
+#define OUTPUT_QUEUE_LIMIT_BYTES (256 * 1024) // Backlog at which a client is treated as too slow and disconnected
+#define OUTPUT_WRITER_MAX_WAITING 64          // Queues the writer thread polls at once (the rest wait a round)
+#define OUTPUT_WRITER_RETRY_MS 1              // Writer poll interval while a shared memory ring is full
+#define OUTPUT_STREAM_CHUNK_BYTES PROTOCOL_BLOB_CHUNK_BYTES // File bytes sent before other frames get a turn
+#define OUTPUT_COMPRESS_MIN_BYTES 512         // Queued frames worth compressing together (smaller batches go as they are)
+#define OUTPUT_COMPRESS_MAX_BYTES (64 * 1024) // Most frames compressed into one block
+#define OUTPUT_COMPRESS_HEADER_SIZE 48        // Room kept in front of a block for its header frame
+#define OUTPUT_CONTROL_LIMIT_BYTES (16 * 1024) // Control backlog at which a client is treated as gone (it isn't reading at all)
+
+#endif // OUTPUT_QUEUE_H
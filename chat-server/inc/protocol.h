@@ -0,0 +1,29 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+
+// The fields of one IP|USERNAME|MESSAGECOUNT|TEXT frame from a client
+typedef struct
+{
+    char clientIP[64];
+    char username[64];
+    int messageCount; // 0 for a whole message, 1 or 2 for the halves of a split one, -1 if missing
+    char messageText[256];
+    int isPrintableAscii; // Username and text are plain printable ASCII (a column per byte)
+} ProtocolMessage;
+
+// Function prototypes
+void parseProtocolMessage(const char *protocolMessage, ProtocolMessage *message);
+int formatBroadcastMessage(const ProtocolMessage *message, char *buffer, size_t bufferSize);
+const char *protocolMessageText(const char *protocolMessage);
+int protocolSanitizeText(char *text);
+
+// Defines
+#define PROTOCOL_FIELD_SEPARATOR "|"
+#define PROTOCOL_TEXT_FIELD 3 // Separators in front of the message text
+#define PROTOCOL_PARSE_LIMIT 255 // Bytes of a frame looked at when parsing it
+#define PROTOCOL_USERNAME_COLUMNS 5 // Columns a username is padded to in a broadcast line
+#define PROTOCOL_TEXT_COLUMNS 41 // Columns message text is padded to in a broadcast line
+
+#endif // PROTOCOL_H
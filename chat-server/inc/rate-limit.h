@@ -0,0 +1,23 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+// Token bucket for one connection. Tokens are kept in thousandths so slow rates refill smoothly.
+typedef struct
+{
+    long long milliTokens;        // Tokens currently in the bucket (x1000)
+    long long lastRefillNs;       // Monotonic time the bucket was last topped up
+    unsigned long framesAllowed;   // Frames that got through
+    unsigned long framesThrottled; // Frames that found the bucket empty (any policy)
+} TokenBucket;
+
+// Function prototypes
+void tokenBucketInitialize(TokenBucket *bucket, int burstSize);
+long long tokenBucketTake(TokenBucket *bucket, int framesPerSecond, int burstSize);
+long long tokenBucketWait(TokenBucket *bucket, int framesPerSecond, int burstSize);
+
+// Defines
+#define RATE_LIMIT_DROP 0       // Excess frames are thrown away
+#define RATE_LIMIT_DELAY 1      // The reader waits until a token is available (TCP pushes back on the client)
+#define RATE_LIMIT_DISCONNECT 2 // The client is disconnected
+
+#endif // RATE_LIMIT_H
@@ -0,0 +1,116 @@
+#ifndef SEARCH_INDEX_H
+#define SEARCH_INDEX_H
+
+#include "../../Common/inc/common.h"
+#include <pthread.h>
+#include <sys/types.h>
+
+// Defines needed by the types below
+#define SEARCH_SEGMENT_POSTINGS 128  // Postings per segment, the unit that is decoded (and skipped) at once
+#define SEARCH_TERM_MAX_LENGTH 32    // Longer words are indexed by their first this many bytes
+#define SEARCH_MAX_QUERY_TERMS 8     // Words (and the user) one query can combine
+#define SEARCH_RESULT_TEXT_SIZE 512  // Longest line kept for a match (a broadcast line always fits)
+
+// A run of up to SEARCH_SEGMENT_POSTINGS document numbers, each stored as a varint of the gap from the one before.
+// The first and last numbers are kept in the clear so whole segments can be skipped without decoding them.
+typedef struct
+{
+    unsigned int firstDocument;
+    unsigned int lastDocument;
+    unsigned short postingCount;
+    unsigned short byteLength;
+    unsigned char *bytes; // Trimmed to byteLength once full, the open segment has room for a whole one
+} PostingSegment;
+
+// One indexed word (or @user) and every document it appears in, oldest first
+typedef struct
+{
+    unsigned int documentCount;
+    int segmentCount;
+    int segmentCapacity;
+    PostingSegment *segments; // The last one is still being appended to
+    char term[];
+} TermPostings;
+
+// Where the text of one indexed message is
+typedef struct
+{
+    unsigned long sequence;
+    long long serverMs;       // Never goes down from one document to the next, so a time range is a document range
+    off_t textOffset;         // The line as it was broadcast, in the document file
+    unsigned int textLength;
+} SearchDocument;
+
+// A broadcast waiting to be indexed: its user, the text that is searched and the line a match sends back, one after
+// the other (the first two ending in '\0')
+typedef struct PendingDocument
+{
+    struct PendingDocument *next;
+    unsigned long sequence;
+    long long serverMs;
+    unsigned int textStart;   // Where the text is in data
+    unsigned int lineStart;   // Where the line is in data
+    unsigned int lineLength;
+    char data[];
+} PendingDocument;
+
+// Full text index over every broadcast. Broadcasts are only queued as they happen; the queue is indexed in batches
+// off the broadcast path (on the timer tick, and before a query so it sees everything said before it). Documents are
+// numbered in the order they were indexed, and their text is kept in a file so only the postings and a small record
+// per message stay in memory.
+typedef struct
+{
+    pthread_mutex_t indexMutex;       // The documents and postings, held briefly to add a batch or run a query
+    pthread_mutex_t pendingMutex;     // The queue, held just long enough to link or take it
+    pthread_mutex_t flushMutex;       // One batch indexed at a time, in the order they were queued
+    PendingDocument *pendingHead;
+    PendingDocument *pendingTail;
+    int documentFile;                 // Append-only, unlinked (written by the flush alone)
+    off_t documentFileLength;
+    SearchDocument *documents;        // Document n is the nth message added
+    unsigned int documentCount;
+    unsigned int documentCapacity;
+    TermPostings **terms;             // Open addressing hash table of every term seen
+    unsigned int termCount;
+    unsigned int termCapacity;        // Power of two
+} SearchIndex;
+
+// What a search asks for
+typedef struct
+{
+    char terms[SEARCH_MAX_QUERY_TERMS][SEARCH_TERM_MAX_LENGTH + 2]; // Room for the @ of a user term
+    int termCount;
+    long long afterMs;   // Only messages stamped at or after this (0 for no limit)
+    long long beforeMs;  // Only messages stamped before this (0 for no limit)
+    int limit;           // Most recent matches wanted
+} SearchQuery;
+
+// One match, newest first
+typedef struct
+{
+    unsigned long sequence;
+    long long serverMs;
+    char text[SEARCH_RESULT_TEXT_SIZE];
+} SearchResult;
+
+// Function prototypes
+int searchIndexInitialize(SearchIndex *index);
+void searchIndexAdd(SearchIndex *index, unsigned long sequence, long long serverMs, const char *userName, const char *text, const char *line);
+void searchIndexFlush(SearchIndex *index);
+void searchParseQuery(const char *queryText, SearchQuery *query);
+int searchIndexQuery(SearchIndex *index, const SearchQuery *query, SearchResult *results, int maxResults);
+void searchIndexSize(SearchIndex *index, unsigned int *documentCount, unsigned int *termCount);
+
+// Defines
+#define SEARCH_DOCUMENT_DIRECTORY "/tmp"         // Where the document file lives (unlinked straight away)
+#define SEARCH_INITIAL_TERM_CAPACITY 4096        // Hash table slots to start with
+#define SEARCH_SEGMENT_BYTES (SEARCH_SEGMENT_POSTINGS * 5) // A full segment of 32 bit gaps at worst
+#define SEARCH_DEFAULT_RESULTS 10                // Matches sent when the query doesn't say
+#define SEARCH_MAX_RESULTS 50                    // Most matches one query can ask for
+#define SEARCH_USER_PREFIX "user:"               // Query word limiting matches to one user
+#define SEARCH_AFTER_PREFIX "after:"             // Query word with the earliest server time (ms since the epoch)
+#define SEARCH_BEFORE_PREFIX "before:"           // Query word with the latest server time (ms since the epoch)
+#define SEARCH_LIMIT_PREFIX "limit:"             // Query word with the number of matches wanted
+#define SEARCH_USER_TERM_MARKER '@'              // Users are indexed as @name so they never collide with words
+
+#endif // SEARCH_INDEX_H
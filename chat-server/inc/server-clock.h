@@ -0,0 +1,14 @@
+#ifndef SERVER_CLOCK_H
+#define SERVER_CLOCK_H
+
+#include <time.h>
+
+// Function prototypes
+long long monotonicNanoseconds(void);
+void coarseClockUpdate(void);
+long long coarseClockMilliseconds(void);
+
+// Defines
+#define NANOSECONDS_PER_SECOND 1000000000LL
+
+#endif // SERVER_CLOCK_H
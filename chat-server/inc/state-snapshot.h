@@ -0,0 +1,67 @@
+#ifndef STATE_SNAPSHOT_H
+#define STATE_SNAPSHOT_H
+
+#include "history.h"
+#include <stddef.h>
+
+/*
+ * State snapshots (-snapshotPATH): every SNAPSHOT_INTERVAL_SECONDS, if anything was broadcast since the last one,
+ * the timer thread forks and the child writes the room history out from its copy-on-write view of memory, so the
+ * server only stops broadcasting for as long as the fork takes. A restarted server maps the file and points its
+ * history straight at the frames in it, nothing is parsed or copied, and a resuming client is sent what it missed
+ * from before the restart. The file is flat: a header, a table of sequence numbers and file offsets, then the
+ * frames laid out as OutboundMessage images. A file from another version or build layout is ignored.
+ */
+
+// Defines needed by the types below
+#define SNAPSHOT_MAGIC "CHATSNAP"
+#define SNAPSHOT_MAGIC_LENGTH 8
+#define SNAPSHOT_VERSION 1
+
+// Start of a snapshot file
+typedef struct
+{
+    char magic[SNAPSHOT_MAGIC_LENGTH];
+    unsigned int version;
+    unsigned int headerSize;         // sizeof(SnapshotHeader) and the rest tell another build layout apart
+    unsigned int entrySize;
+    unsigned int messageHeaderSize;  // Bytes of an OutboundMessage in front of its data
+    unsigned int messageCount;       // Entries in the table after the header, oldest first
+    unsigned int unused;
+    unsigned long nextSequence;      // Number the next broadcast would have got
+    long long writtenMs;             // Wall clock when the snapshot was taken
+    unsigned long fileLength;        // The whole file, a shorter one is refused
+} SnapshotHeader;
+
+// One kept broadcast, its frame is an OutboundMessage image at offset
+typedef struct
+{
+    unsigned long sequence;
+    unsigned long offset;            // From the start of the file, a multiple of SNAPSHOT_ALIGNMENT
+} SnapshotEntry;
+
+// What snapshots have done (reported by the stats verb)
+typedef struct
+{
+    int isActive;
+    unsigned int restoredMessages;   // Broadcasts the server started with
+    long long loadMicroseconds;      // Time from opening the file to the history pointing into it
+    unsigned long written;
+    unsigned long failed;            // Children that couldn't write (the last good file is kept)
+    unsigned long lastBytes;         // Size of the last snapshot written
+} SnapshotStats;
+
+// Function prototypes
+int stateSnapshotLoad(MessageHistory *history, const char *path);
+int stateSnapshotStart(MessageHistory *history, const char *path);
+void stateSnapshotWriteIfDue(void);
+
+// Shared state (read by the stats verb)
+extern SnapshotStats snapshotStats;
+
+// Defines
+#define SNAPSHOT_INTERVAL_SECONDS 10   // Time between snapshots (none is taken if nothing was broadcast)
+#define SNAPSHOT_ALIGNMENT 8           // Frames start on this boundary so the mapped images can be used in place
+#define SNAPSHOT_PATH_SIZE 256
+
+#endif // STATE_SNAPSHOT_H
@@ -0,0 +1,40 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <pthread.h>
+
+// Defines
+#define TIMER_WHEEL_LEVELS 3                          // 64 * 64 * 64 ticks of range
+#define TIMER_WHEEL_SLOT_BITS 6                       // 64 slots per level
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS) // Slots per level
+#define TIMER_WHEEL_SLOT_MASK (TIMER_WHEEL_SLOTS - 1)  // Mask to get a slot index from a tick
+
+/*
+ * A timer entry is embedded inside whatever owns it (a client session for example), so arming and
+ * cancelling never allocates. The callback runs on the timer thread with the wheel mutex held, so it must
+ * not block. It returns the number of ticks to re-arm the entry for, or 0 to leave it disarmed.
+ */
+typedef struct TimerEntry
+{
+    struct TimerEntry *next;
+    struct TimerEntry *previous;
+    unsigned long expiryTick;
+    int isArmed;
+    unsigned long (*callback)(struct TimerEntry *entry);
+    void *context;
+} TimerEntry;
+
+typedef struct
+{
+    TimerEntry slotHeads[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; // Sentinel head for each slot list
+    unsigned long currentTick;
+    pthread_mutex_t wheelMutex;
+} TimerWheel;
+
+// Function prototypes
+void timerWheelInitialize(TimerWheel *wheel);
+void timerWheelArm(TimerWheel *wheel, TimerEntry *entry, unsigned long ticks, unsigned long (*callback)(TimerEntry *entry));
+void timerWheelCancel(TimerWheel *wheel, TimerEntry *entry);
+void timerWheelAdvance(TimerWheel *wheel, unsigned long elapsedTicks);
+
+#endif // TIMER_WHEEL_H
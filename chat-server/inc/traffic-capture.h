@@ -0,0 +1,33 @@
+#ifndef TRAFFIC_CAPTURE_H
+#define TRAFFIC_CAPTURE_H
+
+#include "../../Common/inc/capture-file.h"
+
+/*
+ * Capture mode (-capturePATH): everything clients send is recorded with when it was read and which connection it
+ * came on, for chat-replay to play back later. Readers only append to a memory buffer, the timer thread writes it
+ * out, so a slow disk never holds up a client.
+ */
+
+// What has been captured (reported by the stats verb)
+typedef struct
+{
+    unsigned long recordsWritten;  // Records that made it into the file
+    unsigned long bytesWritten;    // File size so far, the magic included
+    unsigned long recordsDropped;  // Records the buffer had no room for (the disk isn't keeping up)
+} CaptureStats;
+
+// Function prototypes
+int trafficCaptureStart(const char *path);
+int trafficCaptureIsActive(void);
+unsigned long trafficCaptureNextConnectionId(void);
+void trafficCaptureRecord(int kind, unsigned long connectionId, const char *payload, size_t length);
+void trafficCaptureFlush(void);
+
+// Shared state (read by the stats verb)
+extern CaptureStats captureStats;
+
+// Defines
+#define CAPTURE_BUFFER_BYTES (1024 * 1024) // Records held between two flushes before new ones are dropped
+
+#endif // TRAFFIC_CAPTURE_H
@@ -0,0 +1,33 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <pthread.h>
+
+// Defines needed by the types below
+#define WORKER_DEQUE_CAPACITY 256 // Items one worker can have queued (a power of two)
+
+// A unit of work, embedded in whatever owns it. run is called on a pool thread.
+typedef struct WorkItem
+{
+    void (*run)(struct WorkItem *item);
+} WorkItem;
+
+// One worker's deque. The owner pushes and pops at the bottom, idle workers steal from the top.
+typedef struct
+{
+    pthread_mutex_t dequeMutex;
+    WorkItem *items[WORKER_DEQUE_CAPACITY];
+    unsigned int top;    // Next item to steal
+    unsigned int bottom; // Next free position
+} WorkDeque;
+
+// Function prototypes
+int workerPoolStart(int workerCount);
+void workerPoolSubmit(WorkItem *item, int preferredWorker);
+int workerPoolSize(void);
+int workerPoolCurrentWorker(void);
+
+// Defines
+#define WORKER_POOL_MAX_WORKERS 16 // Upper bound on pool size, whatever the core count
+
+#endif // WORKER_POOL_H
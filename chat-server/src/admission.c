@@ -0,0 +1,143 @@
+#include "../inc/admission.h"
+#include "../inc/server-clock.h"
+#include <stdio.h>
+#include <unistd.h>
+
+// Shared state, updated with atomics from the client threads and the timer thread
+AdmissionState admissionState;
+
+/*
+ * FUNCTION : admissionBroadcastStarted
+ *
+ * DESCRIPTION : This function counts a chat frame into the broadcast pipeline, called when its reader queues it for the pool
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : void
+ */
+void admissionBroadcastStarted(void)
+{
+    __atomic_add_fetch(&admissionState.pendingBroadcasts, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * FUNCTION : admissionBroadcastFinished
+ *
+ * DESCRIPTION : This function counts a chat frame out of the broadcast pipeline once its broadcast is queued to every
+ * client, and folds its latency (waiting for a worker included) into the smoothed value (an EWMA with weight 1/8, the same smoothing TCP uses for its RTT)
+ *
+ * PARAMETERS : long long startedNs : Monotonic time the frame was queued for the pool.
+ *
+ * RETURNS : void
+ */
+void admissionBroadcastFinished(long long startedNs)
+{
+    long long latencyNs = monotonicNanoseconds() - startedNs;
+    long long smoothed = __atomic_load_n(&admissionState.broadcastLatencyNs, __ATOMIC_RELAXED);
+
+    // Lost updates between racing broadcasts only lose a sample, which is fine for a smoothed value
+    __atomic_store_n(&admissionState.broadcastLatencyNs, smoothed + (latencyNs - smoothed) / 8, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&admissionState.pendingBroadcasts, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * FUNCTION : readResidentBytes
+ *
+ * DESCRIPTION : This function reads how much memory the process has resident
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : long long : Resident bytes, or 0 if /proc couldn't be read.
+ */
+static long long readResidentBytes(void)
+{
+    long long totalPages = 0;
+    long long residentPages = 0;
+
+    FILE *statmFile = fopen("/proc/self/statm", "r");
+    if (statmFile == NULL)
+    {
+        return 0;
+    }
+    if (fscanf(statmFile, "%lld %lld", &totalPages, &residentPages) != 2)
+    {
+        residentPages = 0;
+    }
+    fclose(statmFile);
+    return residentPages * sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * FUNCTION : admissionSample
+ *
+ * DESCRIPTION : This function samples memory and works out the admission level from all three signals.
+ * Whichever signal is worst decides the level. Called periodically from the timer thread.
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : void
+ */
+void admissionSample(void)
+{
+    long long residentBytes = readResidentBytes();
+    int pendingBroadcasts = __atomic_load_n(&admissionState.pendingBroadcasts, __ATOMIC_RELAXED);
+    long long latencyUs = __atomic_load_n(&admissionState.broadcastLatencyNs, __ATOMIC_RELAXED) / 1000;
+    long long residentMb = residentBytes / (1024 * 1024);
+
+    int level = ADMISSION_NORMAL;
+    if (pendingBroadcasts >= ADMISSION_QUEUE_ELEVATED || latencyUs >= ADMISSION_LATENCY_ELEVATED_US ||
+        residentMb >= ADMISSION_MEMORY_ELEVATED_MB)
+    {
+        level = ADMISSION_ELEVATED;
+    }
+    if (pendingBroadcasts >= ADMISSION_QUEUE_OVERLOAD || latencyUs >= ADMISSION_LATENCY_OVERLOAD_US ||
+        residentMb >= ADMISSION_MEMORY_OVERLOAD_MB)
+    {
+        level = ADMISSION_OVERLOAD;
+    }
+
+    __atomic_store_n(&admissionState.residentBytes, residentBytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&admissionState.level, level, __ATOMIC_RELAXED);
+}
+
+/*
+ * FUNCTION : admissionLevel
+ *
+ * DESCRIPTION : This function returns the level worked out by the last sample
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : int : ADMISSION_NORMAL, ADMISSION_ELEVATED or ADMISSION_OVERLOAD.
+ */
+int admissionLevel(void)
+{
+    return __atomic_load_n(&admissionState.level, __ATOMIC_RELAXED);
+}
+
+/*
+ * FUNCTION : admissionCountRejected
+ *
+ * DESCRIPTION : This function counts a session turned away at accept time
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : void
+ */
+void admissionCountRejected(void)
+{
+    __atomic_add_fetch(&admissionState.sessionsRejected, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * FUNCTION : admissionCountShed
+ *
+ * DESCRIPTION : This function counts a frame dropped because of load
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : void
+ */
+void admissionCountShed(void)
+{
+    __atomic_add_fetch(&admissionState.framesShed, 1, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,272 @@
+#define _GNU_SOURCE
+#include "../inc/blob-store.h"
+#include "../inc/protocol.h"
+#include <fcntl.h>
+
+// One download of a blob, queued on a client's output queue as a stream
+typedef struct
+{
+    OutboundStream stream; // First, the queue hands this pointer back
+    Blob *blob;
+    MemoryAccount *memoryAccount; // The downloading client's, charged for the download while it is queued
+} BlobDownload;
+
+/*
+ * FUNCTION : blobStoreInitialize
+ *
+ * DESCRIPTION : This function sets up an empty store
+ *
+ * PARAMETERS : BlobStore *store : The store.
+ *
+ * RETURNS : void
+ */
+void blobStoreInitialize(BlobStore *store)
+{
+    pthread_mutex_init(&store->storeMutex, NULL);
+    store->nextBlobId = 1;
+    for (int i = 0; i < BLOB_STORE_CAPACITY; i++)
+    {
+        store->blobs[i] = NULL;
+    }
+}
+
+/*
+ * FUNCTION : blobCreate
+ *
+ * DESCRIPTION : This function starts a blob for an upload, backed by a temporary file nobody else can open.
+ * The file goes away by itself when the last reference is released.
+ *
+ * PARAMETERS : size_t length : Size the uploader announced.
+ *              const char *name : The file name it gave (anything that can't go in a chat line is replaced).
+ *
+ * RETURNS : Blob * : The blob (the caller holds the only reference), or NULL on error.
+ */
+Blob *blobCreate(size_t length, const char *name)
+{
+    Blob *blob = malloc(sizeof(Blob));
+    if (blob == NULL)
+    {
+        return NULL;
+    }
+
+    blob->fileDescriptor = open(BLOB_SPOOL_DIRECTORY, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (blob->fileDescriptor < 0)
+    {
+        // Filesystems without O_TMPFILE: make a named one and unlink it straight away
+        char spoolPath[] = BLOB_SPOOL_DIRECTORY "/chat-blob-XXXXXX";
+        blob->fileDescriptor = mkstemp(spoolPath);
+        if (blob->fileDescriptor < 0)
+        {
+            free(blob);
+            return NULL;
+        }
+        unlink(spoolPath);
+    }
+
+    blob->referenceCount = 1;
+    blob->blobId = 0;
+    blob->length = length;
+    blob->receivedLength = 0;
+    snprintf(blob->name, sizeof(blob->name), "%s", name);
+    for (char *nameCharacter = blob->name; *nameCharacter != '\0'; nameCharacter++)
+    {
+        if (*nameCharacter == PROTOCOL_FIELD_SEPARATOR[0] || !isprint((unsigned char)*nameCharacter))
+        {
+            *nameCharacter = '_';
+        }
+    }
+    return blob;
+}
+
+/*
+ * FUNCTION : blobSpoolBytes
+ *
+ * DESCRIPTION : This function adds upload bytes that were already read into memory to the end of a blob
+ *
+ * PARAMETERS : Blob *blob : The blob being uploaded.
+ *              const char *data : The bytes.
+ *              size_t length : Number of bytes.
+ *
+ * RETURNS : int : 0 on success, -1 on error.
+ */
+int blobSpoolBytes(Blob *blob, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t writtenBytes = pwrite(blob->fileDescriptor, data, length, blob->receivedLength);
+        if (writtenBytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        data += writtenBytes;
+        length -= writtenBytes;
+        blob->receivedLength += writtenBytes;
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : blobSpoolFromTransport
+ *
+ * DESCRIPTION : This function moves the next upload bytes from the client's connection straight into the blob's
+ * file (spliced for sockets, so they never pass through this process)
+ *
+ * PARAMETERS : Blob *blob : The blob being uploaded.
+ *              Transport *transport : The uploader's connection.
+ *              size_t length : Number of bytes to move.
+ *
+ * RETURNS : int : 0 once they are all there, -1 if the client went away or the file couldn't be written.
+ */
+int blobSpoolFromTransport(Blob *blob, Transport *transport, size_t length)
+{
+    off_t spoolOffset = blob->receivedLength;
+    ssize_t movedBytes = transportReceiveFile(transport, blob->fileDescriptor, &spoolOffset, length);
+    if (movedBytes > 0)
+    {
+        blob->receivedLength += movedBytes;
+    }
+    return movedBytes == (ssize_t)length ? 0 : -1;
+}
+
+/*
+ * FUNCTION : blobStorePublish
+ *
+ * DESCRIPTION : This function gives a finished upload the next id and keeps it in place of the oldest blob
+ *
+ * PARAMETERS : BlobStore *store : The store.
+ *              Blob *blob : The blob, the store takes its own reference.
+ *
+ * RETURNS : unsigned long : The blob's id.
+ */
+unsigned long blobStorePublish(BlobStore *store, Blob *blob)
+{
+    __atomic_add_fetch(&blob->referenceCount, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&store->storeMutex);
+    blob->blobId = store->nextBlobId++;
+    int slot = blob->blobId % BLOB_STORE_CAPACITY;
+    Blob *evictedBlob = store->blobs[slot];
+    store->blobs[slot] = blob;
+    pthread_mutex_unlock(&store->storeMutex);
+
+    // Downloads still in progress hold their own references
+    if (evictedBlob != NULL)
+    {
+        blobRelease(evictedBlob);
+    }
+    return blob->blobId;
+}
+
+/*
+ * FUNCTION : blobStoreFind
+ *
+ * DESCRIPTION : This function looks up a published blob
+ *
+ * PARAMETERS : BlobStore *store : The store.
+ *              unsigned long blobId : The id from the announcement.
+ *
+ * RETURNS : Blob * : The blob with a reference for the caller, or NULL if there is no such blob (any more).
+ */
+Blob *blobStoreFind(BlobStore *store, unsigned long blobId)
+{
+    pthread_mutex_lock(&store->storeMutex);
+    Blob *blob = store->blobs[blobId % BLOB_STORE_CAPACITY];
+    if (blob != NULL && blob->blobId == blobId)
+    {
+        __atomic_add_fetch(&blob->referenceCount, 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        blob = NULL;
+    }
+    pthread_mutex_unlock(&store->storeMutex);
+    return blob;
+}
+
+/*
+ * FUNCTION : blobRelease
+ *
+ * DESCRIPTION : This function drops one reference to a blob and closes its file when it was the last
+ *
+ * PARAMETERS : Blob *blob : The blob.
+ *
+ * RETURNS : void
+ */
+void blobRelease(Blob *blob)
+{
+    if (__atomic_sub_fetch(&blob->referenceCount, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        close(blob->fileDescriptor);
+        free(blob);
+    }
+}
+
+/*
+ * FUNCTION : formatDownloadHeader
+ *
+ * DESCRIPTION : Stream header for a download chunk: >>data<<BLOBID|OFFSET|LENGTH|TOTAL
+ *
+ * PARAMETERS : OutboundStream *stream : The download's stream.
+ *              size_t chunkLength : File bytes that follow the header.
+ *              char *header : Where to put the header.
+ *              size_t headerSize : Size of header.
+ *
+ * RETURNS : size_t : Length of the header, frame end included.
+ */
+static size_t formatDownloadHeader(OutboundStream *stream, size_t chunkLength, char *header, size_t headerSize)
+{
+    Blob *blob = ((BlobDownload *)stream)->blob;
+    return snprintf(header, headerSize, "%s%lu|%lld|%zu|%zu%c", PROTOCOL_DATA, blob->blobId, (long long)stream->nextOffset,
+                    chunkLength, blob->length, PROTOCOL_FRAME_END);
+}
+
+/*
+ * FUNCTION : releaseDownload
+ *
+ * DESCRIPTION : Stream release for a download, lets go of the blob
+ *
+ * PARAMETERS : OutboundStream *stream : The download's stream.
+ *
+ * RETURNS : void
+ */
+static void releaseDownload(OutboundStream *stream)
+{
+    BlobDownload *download = (BlobDownload *)stream;
+    blobRelease(download->blob);
+    memoryRelease(download->memoryAccount, MEMORY_OUTPUT, sizeof(BlobDownload));
+    free(download);
+}
+
+/*
+ * FUNCTION : blobQueueDownload
+ *
+ * DESCRIPTION : This function queues a whole blob to a client. The queue sends it a chunk at a time with sendfile,
+ * and chat lines queued meanwhile go out between chunks.
+ *
+ * PARAMETERS : Blob *blob : The blob, the download takes its own reference.
+ *              OutputQueue *queue : The client's output queue.
+ *
+ * RETURNS : int : 0 if it was queued, -1 otherwise.
+ */
+int blobQueueDownload(Blob *blob, OutputQueue *queue)
+{
+    BlobDownload *download = malloc(sizeof(BlobDownload));
+    if (download == NULL)
+    {
+        return -1;
+    }
+    memoryCharge(queue->memoryAccount, MEMORY_OUTPUT, sizeof(BlobDownload));
+    __atomic_add_fetch(&blob->referenceCount, 1, __ATOMIC_RELAXED);
+    download->blob = blob;
+    download->memoryAccount = queue->memoryAccount;
+    download->stream.fileDescriptor = blob->fileDescriptor;
+    download->stream.nextOffset = 0;
+    download->stream.endOffset = blob->length;
+    download->stream.formatHeader = formatDownloadHeader;
+    download->stream.release = releaseDownload;
+    return outputQueueAppendStream(queue, &download->stream);
+}
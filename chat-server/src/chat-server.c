@@ -1,161 +1,404 @@
 #include "../inc/chat-server.h"
+#include "../../Common/inc/utf8.h"
 
 // Global array for connected client sockets.
 int clientSocketList[MAX_CLIENTS];
 
-// Mutex to protect access to clientSocketList.
+// Mutex to protect access to clientSocketList. Only joins and leaves take it, broadcasts read subscriberSnapshot.
 pthread_mutex_t clientMutex = PTHREAD_MUTEX_INITIALIZER;
 
+// Current list of clients to broadcast to. Swapped by publishSubscriberSnapshot, freed through the epoch reclaimer.
+SubscriberSnapshot *subscriberSnapshot = NULL;
+
+// Per-client state, indexed the same as clientSocketList.
+ClientSession clientSessionList[MAX_CLIENTS];
+
+// One timing wheel drives the idle/heartbeat timers of every client (no timer or thread per client).
+TimerWheel heartbeatWheel;
+
+// Server wide counters (reported by the stats verb)
+ServerStats serverStats;
+
+// Recent broadcasts of the (single) room, numbered for clients resuming after a reconnect
+MessageHistory roomHistory;
+
+// Files shared in the room, announced as chat lines and downloaded by id
+BlobStore roomBlobs;
+
+// Every message broadcast in the room, searchable by word, user and time
+SearchIndex roomIndex;
+
+// Port clients connect to (-portN), and the AF_UNIX socket that goes with it
+int serverPort = SERVER_PORT;
+char unixSocketPath[108] = SERVER_UNIX_SOCKET_PATH;
+
 /*
  * FUNCTION : parseAndBroadcastProtocolMessage
  *
  * DESCRIPTION : This function parses the message from a client, gets the client IP, username, message count, and message text,
- * formats a a return message, and then calls broadcastChatMessage to send the message to all clients
+ * runs the text through the content filter, formats a a return message, and then calls broadcastChatMessage to send
+ * the message to all clients. The message is then added to the search index and, if it came from a local client,
+ * relayed to the other nodes. It runs on the worker pool (or a federation link thread for a relayed message).
  *
  * PARAMETERS : const char *protocolMessage : The raw protocol message string.
- *              int senderSocket : The socket of the sender client.
+ *              int senderSocket : The socket of the sender client, -1 for a message relayed from another node.
  *
- * RETURNS : void
+ * RETURNS : int : 0 if the message was broadcast, -1 if the content filter blocked it.
  */
-void parseAndBroadcastProtocolMessage(const char *protocolMessage, int senderSocket)
+int parseAndBroadcastProtocolMessage(const char *protocolMessage, int senderSocket)
 {
-    char clientIP[64] = "";     // Storage for IP
-    char username[64] = "";     // Storage for username
-    int messageCount = -1;      // To check the message count from client
-    char messageText[256] = ""; // To store the message text from the client
+    TraceSpan *span = messageTraceCurrent();
+    long long parseStartNs = span != NULL ? monotonicNanoseconds() : 0;
 
-    char temporaryMessageSpace[256]; // Temp storage when splitting the message
-    strncpy(temporaryMessageSpace, protocolMessage, sizeof(temporaryMessageSpace) - 1);
-    temporaryMessageSpace[sizeof(temporaryMessageSpace) - 1] = '\0';
+    ProtocolMessage message;
+    parseProtocolMessage(protocolMessage, &message);
+    TRACE_PROBE3(parsed, senderSocket, message.username, message.messageText);
 
-    // Pull out the IP address
-    char *token = strtok(temporaryMessageSpace, "|");
-    if (token != NULL)
+    // Mask (or refuse) filtered words before anyone sees them, or they end up in the history and index
+    if (contentFilterApply(message.messageText) == CONTENT_FILTER_BLOCK)
     {
-        strncpy(clientIP, token, sizeof(clientIP) - 1);
-        // printf("DEBUG : parseAndBroadcastProtocolMessage() - Got the IP: %s\n", clientIP);
+        if (span != NULL)
+        {
+            span->parseNs = monotonicNanoseconds() - parseStartNs;
+        }
+        return -1;
     }
 
-    // Pull the username
-    token = strtok(NULL, "|");
-    if (token != NULL)
+    // Format the final broadcast message.
+    char broadcastMessage[512];
+    formatBroadcastMessage(&message, broadcastMessage, sizeof(broadcastMessage));
+    if (span != NULL)
     {
-        strncpy(username, token, sizeof(username) - 1);
-        // printf("DEBUG : parseAndBroadcastProtocolMessage() - Got the USERNAME: %s\n", username);
+        span->parseNs = monotonicNanoseconds() - parseStartNs;
     }
 
-    // Pull the message COUNT (to check if it is one message up to 40 chars, or parts of an 80 char message)
-    token = strtok(NULL, "|");
-    if (token != NULL)
+    // Broadcast the message to all connected clients
+    unsigned long sequence = broadcastChatMessage(broadcastMessage, senderSocket);
+
+    // Make it searchable (by what was written and who wrote it, a match sends back the whole line)
+    if (sequence != 0)
     {
+        searchIndexAdd(&roomIndex, sequence, coarseClockMilliseconds(), message.username, message.messageText, broadcastMessage);
+    }
 
-        messageCount = atoi(token);
-        // printf("DEBUG : parseAndBroadcastProtocolMessage() - Got the MSG COUNT: %i\n", messageCount);
+    // Other nodes get it as it was filtered here (messages from them are passed on by the federation links)
+    if (sequence != 0 && senderSocket >= 0)
+    {
+        char relayMessage[MAX_PROTOL_MESSAGE_SIZE * 2];
+        snprintf(relayMessage, sizeof(relayMessage), "%s|%s|%d|%s", message.clientIP, message.username, message.messageCount, message.messageText);
+        federationRelay(sequence, relayMessage);
     }
 
-    // Pull the message
-    token = strtok(NULL, "|");
+    // printf("\nDEBUG PARSE COMPLETE: Broadcasting: %s\n", broadcastMessage);
+    // printf("-------Parsing INCOMING message-------\n\n");
+    return 0;
+}
+
+/*
+ * FUNCTION : deliverRelayedMessage
+ *
+ * DESCRIPTION : This function broadcasts a message another node relayed here to the local clients. It goes through
+ * the same parse, filter, format and index steps as a local one.
+ *
+ * PARAMETERS : const char *protocolMessage : The relayed IP|USERNAME|MESSAGECOUNT|TEXT frame.
+ *
+ * RETURNS : void
+ */
+void deliverRelayedMessage(const char *protocolMessage)
+{
+    parseAndBroadcastProtocolMessage(protocolMessage, -1);
+}
 
-    if (token != NULL)
+/*
+ * FUNCTION : parseServerArguments
+ *
+ * DESCRIPTION : This function reads the command line: -portN for the client port, -nodeN for this node's id,
+ * -peerHOST[:PORT] (any number of times) for the nodes to link to, -capturePATH for capture mode (started by main),
+ * -traceN to sample one chat message in N, -busypollCPUS for low-latency mode on those cores, -listenADDRESS (up
+ * to SERVER_MAX_LISTENERS times, opened by main) for the addresses to take clients on and -memorySOFT:HARD for the
+ * memory budget.
+ *
+ * PARAMETERS : int argc : The number of command-line arguments.
+ *              char *argv[] : The command-line arguments.
+ *              unsigned long *nodeId : Set to the -node id, left alone if there is none.
+ *
+ * RETURNS : int : 0 on success, -1 if an argument isn't understood.
+ */
+int parseServerArguments(int argc, char *argv[], unsigned long *nodeId)
+{
+    int listenCount = 0;
+    for (int i = 1; i < argc; i++)
     {
-        strncpy(messageText, token, sizeof(messageText) - 1);
-        // printf("DEBUG : parseAndBroadcastProtocolMessage() - Got the MESSAGE: %s\n", messageText);
-        // printf("Literal Message Size: %li\n", strlen(messageText));
+        if (strncmp(argv[i], SERVER_PORT_SWITCH, strlen(SERVER_PORT_SWITCH)) == 0)
+        {
+            serverPort = atoi(argv[i] + strlen(SERVER_PORT_SWITCH));
+            if (serverPort <= 0 || serverPort + FEDERATION_PORT_OFFSET > 65535)
+            {
+                return -1;
+            }
+        }
+        else if (strncmp(argv[i], SERVER_NODE_SWITCH, strlen(SERVER_NODE_SWITCH)) == 0)
+        {
+            *nodeId = strtoul(argv[i] + strlen(SERVER_NODE_SWITCH), NULL, 10);
+            if (*nodeId == 0)
+            {
+                return -1;
+            }
+        }
+        else if (strncmp(argv[i], SERVER_BUSY_POLL_SWITCH, strlen(SERVER_BUSY_POLL_SWITCH)) == 0)
+        {
+            if (lowLatencyStart(argv[i] + strlen(SERVER_BUSY_POLL_SWITCH)) < 0)
+            {
+                return -1;
+            }
+        }
+        else if (strncmp(argv[i], SERVER_TRACE_SWITCH, strlen(SERVER_TRACE_SWITCH)) == 0)
+        {
+            int sampleEvery = atoi(argv[i] + strlen(SERVER_TRACE_SWITCH));
+            if (sampleEvery <= 0)
+            {
+                return -1;
+            }
+            messageTraceStart((unsigned int)sampleEvery);
+        }
+        else if (strncmp(argv[i], SERVER_MEMORY_SWITCH, strlen(SERVER_MEMORY_SWITCH)) == 0)
+        {
+            if (memoryBudgetConfigure(argv[i] + strlen(SERVER_MEMORY_SWITCH)) < 0)
+            {
+                return -1;
+            }
+        }
+        else if (strncmp(argv[i], SERVER_LISTEN_SWITCH, strlen(SERVER_LISTEN_SWITCH)) == 0)
+        {
+            char host[INET6_ADDRSTRLEN];
+            if (++listenCount > SERVER_MAX_LISTENERS ||
+                transportSplitHostPort(argv[i] + strlen(SERVER_LISTEN_SWITCH), host, sizeof(host), SERVER_PORT) < 0)
+            {
+                return -1;
+            }
+        }
+        else if (strncmp(argv[i], SERVER_PEER_SWITCH, strlen(SERVER_PEER_SWITCH)) != 0 &&
+                 strncmp(argv[i], SERVER_CAPTURE_SWITCH, strlen(SERVER_CAPTURE_SWITCH)) != 0 &&
+                 strncmp(argv[i], SERVER_SNAPSHOT_SWITCH, strlen(SERVER_SNAPSHOT_SWITCH)) != 0)
+        {
+            return -1;
+        }
     }
 
-    // Format the final broadcast message.
-    char broadcastMessage[512];
-    snprintf(broadcastMessage, sizeof(broadcastMessage), "%-*s [%-*s] >> %-*s", 1, clientIP, 5, username, 41, messageText);
-
-    // Broadcast the message to all connected clients
-    broadcastChatMessage(broadcastMessage, senderSocket);
+    // Several servers on one host each need their own AF_UNIX socket
+    if (serverPort != SERVER_PORT)
+    {
+        snprintf(unixSocketPath, sizeof(unixSocketPath), "%s.%d", SERVER_UNIX_SOCKET_PATH, serverPort);
+    }
+    return 0;
+}
 
-    // printf("\nDEBUG PARSE COMPLETE: Broadcasting: %s\n", broadcastMessage);
-    // printf("-------Parsing INCOMING message-------\n\n");
+/*
+ * FUNCTION : makeNodeId
+ *
+ * DESCRIPTION : This function makes up a node id for a server started without -node: random bits with the client
+ * port mixed into the low ones, so nodes on one host differ even if two draws were to collide. Only if the kernel has
+ * no randomness to give does it fall back to the time and pid.
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : unsigned long : The id (never 0).
+ */
+unsigned long makeNodeId(void)
+{
+    unsigned long randomBits;
+    if (getrandom(&randomBits, sizeof(randomBits), GRND_NONBLOCK) != sizeof(randomBits))
+    {
+        randomBits = ((unsigned long)time(NULL) << 20) ^ ((unsigned long)getpid() << 4);
+    }
+    return ((randomBits << 16) ^ (unsigned long)serverPort) | 1;
 }
 
 /*
  * FUNCTION : initializeListener
  *
- * DESCRIPTION : This function creates a listening socket, retrieves the local host details,
- * sets socket options, binds the socket to the server port, and begins listening for incoming connections.
+ * DESCRIPTION : This function creates a listening socket for clients on one address, sets socket options, binds it and
+ * begins listening. The address must be numeric: nothing here asks a resolver, so startup never waits on DNS. An IPv6
+ * address also takes IPv4 clients (as ::ffff:a.b.c.d) when it is dual stack.
  *
- * PARAMETERS : None
+ * PARAMETERS : const char *address : HOST[:PORT], [IPV6]:PORT or :PORT (every address, same as [::]:PORT).
+ *              int isDualStack : 1 to let an IPv6 listener take IPv4 clients too.
  *
- * RETURNS : int : The listening socket descriptor on success, or exits on failure.
+ * RETURNS : int : The listening socket descriptor, or -1 if it couldn't be set up.
  */
-int initializeListener()
+int initializeListener(const char *address, int isDualStack)
 {
-    int listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    char host[INET6_ADDRSTRLEN];
+    int port = transportSplitHostPort(address, host, sizeof(host), serverPort);
+    if (port < 0)
+    {
+        fprintf(stderr, "Listen address %s not understood\n", address);
+        return -1;
+    }
+    char portText[8];
+    snprintf(portText, sizeof(portText), "%d", port);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+    struct addrinfo *bindAddress;
+    int error = getaddrinfo(host[0] != '\0' ? host : SERVER_ANY_ADDRESS, portText, &hints, &bindAddress);
+    if (error != 0)
+    {
+        fprintf(stderr, "Listen address %s: %s (a numeric address is needed)\n", address, gai_strerror(error));
+        return -1;
+    }
+
+    int listenSocket = socket(bindAddress->ai_family, SOCK_STREAM, 0);
     if (listenSocket < 0)
     {
         perror("socket failed");
-        exit(EXIT_FAILURE);
+        freeaddrinfo(bindAddress);
+        return -1;
     }
 
-    char host[256];
-    // char *clientIP;
-    struct hostent *hostDetails;
-    int hostname;
-
-    // Get the literal (local) host name
-    hostname = gethostname(host, sizeof(host));
-    if (hostname < 0)
+    int socketOption = 1;
+    // Set socket options (REUSEADDR so it wont get stuck)
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &socketOption, sizeof(socketOption));
+    if (bindAddress->ai_family == AF_INET6)
     {
-        perror("gethostname failed");
-        exit(EXIT_FAILURE);
+        socketOption = !isDualStack;
+        setsockopt(listenSocket, IPPROTO_IPV6, IPV6_V6ONLY, &socketOption, sizeof(socketOption));
     }
-    // printf("Local host name (from gethostname): %s\n", host);
 
-    // Retrieve host details using the literal host name
-    hostDetails = gethostbyname(host);
-    if (hostDetails == NULL)
+    // Bind to the socket using socketAddress details
+    if (bind(listenSocket, bindAddress->ai_addr, bindAddress->ai_addrlen) < 0 || listen(listenSocket, MAX_CLIENTS) < 0)
     {
-        herror("gethostbyname failed");
-        exit(EXIT_FAILURE);
+        fprintf(stderr, "Listening on %s failed: %s\n", address, strerror(errno));
+        close(listenSocket);
+        freeaddrinfo(bindAddress);
+        return -1;
     }
 
-    // Print the host name debug
-    // printf("LITERAL host name: %s\n", hostDetails->h_name);
-    // clientIP = inet_ntoa(*((struct in_addr *)hostDetails->h_addr_list[0]));
-    // printf("Primary IP: %s\n", clientIP);
+    // Non-blocking so acceptConnection can drain a batch and stop when the backlog is empty
+    fcntl(listenSocket, F_SETFL, fcntl(listenSocket, F_GETFL, 0) | O_NONBLOCK);
 
-    int socketOption = 1;
-    // Set socket options (REUSEADDR so it wont get stuck)
-    if (setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &socketOption, sizeof(socketOption)) < 0)
+    printf("Listening for clients on %s%s%s:%d%s\n", bindAddress->ai_family == AF_INET6 ? "[" : "",
+           host[0] != '\0' ? host : SERVER_ANY_ADDRESS, bindAddress->ai_family == AF_INET6 ? "]" : "", port,
+           bindAddress->ai_family == AF_INET6 && isDualStack ? " (IPv4 too)" : "");
+    freeaddrinfo(bindAddress);
+    return listenSocket;
+}
+
+/*
+ * FUNCTION : initializeListeners
+ *
+ * DESCRIPTION : This function opens a client listener for every -listen switch, or one dual-stack listener on every
+ * address when there are none (IPv4 only if the host has no IPv6). IPv6 listeners stay IPv6 only when an IPv4
+ * listener is asked for too, so the two can share a port.
+ *
+ * PARAMETERS : int argc : The number of command-line arguments.
+ *              char *argv[] : The command-line arguments.
+ *              int *listeningSockets : Room for SERVER_MAX_LISTENERS sockets.
+ *
+ * RETURNS : int : Number of listeners opened, or exits if one can't be.
+ */
+int initializeListeners(int argc, char *argv[], int *listeningSockets)
+{
+    int hasIpv4Listener = 0;
+    for (int i = 1; i < argc; i++)
     {
-        perror("setsockopt failed");
-        exit(EXIT_FAILURE);
+        char host[INET6_ADDRSTRLEN];
+        struct in_addr ipv4Address;
+        if (strncmp(argv[i], SERVER_LISTEN_SWITCH, strlen(SERVER_LISTEN_SWITCH)) == 0 &&
+            transportSplitHostPort(argv[i] + strlen(SERVER_LISTEN_SWITCH), host, sizeof(host), serverPort) >= 0 &&
+            inet_pton(AF_INET, host, &ipv4Address) == 1)
+        {
+            hasIpv4Listener = 1;
+        }
     }
 
-    // Create the socket address details to bind to
-    struct sockaddr_in serverAddress;
-    memset(&serverAddress, 0, sizeof(serverAddress));
-    serverAddress.sin_family = AF_INET;
-    serverAddress.sin_addr.s_addr = INADDR_ANY;
-    serverAddress.sin_port = htons(SERVER_PORT);
+    int listenerCount = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], SERVER_LISTEN_SWITCH, strlen(SERVER_LISTEN_SWITCH)) == 0)
+        {
+            int listenSocket = initializeListener(argv[i] + strlen(SERVER_LISTEN_SWITCH), !hasIpv4Listener);
+            if (listenSocket < 0)
+            {
+                exit(EXIT_FAILURE);
+            }
+            listeningSockets[listenerCount++] = listenSocket;
+        }
+    }
 
-    // Bind to the socket using socketAddress details
-    if (bind(listenSocket, (struct sockaddr *)&serverAddress, sizeof(serverAddress)) < 0)
+    if (listenerCount == 0)
     {
-        perror("socket binding failed");
-        exit(EXIT_FAILURE);
+        char defaultAddress[32];
+        snprintf(defaultAddress, sizeof(defaultAddress), "[%s]:%d", SERVER_ANY_ADDRESS, serverPort);
+        int listenSocket = initializeListener(defaultAddress, 1);
+        if (listenSocket < 0)
+        {
+            snprintf(defaultAddress, sizeof(defaultAddress), "%s:%d", SERVER_ANY_IPV4_ADDRESS, serverPort);
+            listenSocket = initializeListener(defaultAddress, 0);
+        }
+        if (listenSocket < 0)
+        {
+            exit(EXIT_FAILURE);
+        }
+        listeningSockets[listenerCount++] = listenSocket;
     }
+    return listenerCount;
+}
 
-    if (listen(listenSocket, MAX_CLIENTS) < 0)
+/*
+ * FUNCTION : initializeUnixListener
+ *
+ * DESCRIPTION : This function creates the AF_UNIX listening socket that same-host clients (bots, bridges) use
+ * to skip the TCP loopback stack. Failing to create it is not fatal, TCP still works.
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : int : The listening socket descriptor, or -1 if it couldn't be created.
+ */
+int initializeUnixListener()
+{
+    int listenSocket = transportListenUnix(unixSocketPath, MAX_CLIENTS);
+    if (listenSocket < 0)
     {
-        perror("socket listen failed");
-        exit(EXIT_FAILURE);
+        perror("unix socket listen failed");
+        return -1;
     }
 
+    // Non-blocking for the same reason as the TCP listener
+    fcntl(listenSocket, F_SETFL, fcntl(listenSocket, F_GETFL, 0) | O_NONBLOCK);
     return listenSocket;
 }
 
+/*
+ * FUNCTION : rejectSession
+ *
+ * DESCRIPTION : This function turns a new client away with a busy frame telling it when to retry, then closes it.
+ * It is done before a slot or thread is spent on the client.
+ *
+ * PARAMETERS : int clientSocket : The socket of the client being rejected.
+ *
+ * RETURNS : void
+ */
+void rejectSession(int clientSocket)
+{
+    char busyMessage[32];
+    snprintf(busyMessage, sizeof(busyMessage), "%s%d%c", PROTOCOL_BUSY, ADMISSION_RETRY_AFTER_SECONDS, PROTOCOL_FRAME_END);
+
+    // Best effort, the socket is brand new so its send buffer is empty
+    send(clientSocket, busyMessage, strlen(busyMessage), MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(clientSocket);
+    admissionCountRejected();
+}
+
 /*
  * FUNCTION : acceptConnection
  *
- * DESCRIPTION : This function accepts an incoming connection,
- * it adds the new client to the global clientSocketList array, and creates a new thread to handle client messages.
+ * DESCRIPTION : This function accepts a batch of incoming connections (the size depends on the admission level),
+ * it adds each new client to the global clientSocketList array, and creates a new thread to handle client messages.
+ * When the server is overloaded new clients are rejected with a busy frame instead.
  *
  * PARAMETERS : int listenSocket : The listening socket descriptor.
  *
@@ -163,24 +406,67 @@ int initializeListener()
  */
 void acceptConnection(int listenSocket)
 {
-    // Struct for client details
-    struct sockaddr_in clientAddress;
-    socklen_t clientAddressLength = sizeof(clientAddress);
+    int batchSize = ADMISSION_ACCEPT_BATCH;
+    if (admissionLevel() != ADMISSION_NORMAL)
+    {
+        batchSize = ADMISSION_ELEVATED_ACCEPT_BATCH;
+    }
 
-    // Accept the client connection
-    int clientSocket = accept(listenSocket, (struct sockaddr *)&clientAddress, &clientAddressLength);
-    if (clientSocket < 0)
+    for (int accepted = 0; accepted < batchSize; accepted++)
     {
-        perror("accept connection failed");
-        return;
+        // Struct for client details (big enough for TCP or AF_UNIX peers)
+        struct sockaddr_storage clientAddress;
+        socklen_t clientAddressLength = sizeof(clientAddress);
+
+        // Accept the client connection
+        int clientSocket = accept(listenSocket, (struct sockaddr *)&clientAddress, &clientAddressLength);
+        if (clientSocket < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("accept connection failed");
+            }
+            return;
+        }
+        TRACE_PROBE2(accept, clientSocket, clientAddress.ss_family);
+
+        // Established clients come first, under overload new ones are told to come back later
+        if (admissionLevel() == ADMISSION_OVERLOAD)
+        {
+            rejectSession(clientSocket);
+            continue;
+        }
+        // The same once the memory budget is used up, a session costs a stack and buffers before it sends anything
+        if (memoryBudgetLevel() == MEMORY_OVER_HARD)
+        {
+            memoryCountRefused();
+            rejectSession(clientSocket);
+            continue;
+        }
+
+        addClientSession(clientSocket, clientAddress.ss_family == AF_UNIX ? TRANSPORT_UNIX : TRANSPORT_TCP);
     }
+}
 
+/*
+ * FUNCTION : addClientSession
+ *
+ * DESCRIPTION : This function adds a newly accepted client to the global clientSocketList array and
+ * creates a new thread to handle its messages
+ *
+ * PARAMETERS : int clientSocket : The socket of the accepted client.
+ *              int transportKind : TRANSPORT_TCP or TRANSPORT_UNIX depending on which listener it came from.
+ *
+ * RETURNS : void
+ */
+void addClientSession(int clientSocket, int transportKind)
+{
     // Add the new client socket to the list
     // Get the mutex
     pthread_mutex_lock(&clientMutex);
 
-    // Check for if the client was added successfully
-    int wasClientAdded = 0;
+    // Session for the slot the client was added to (NULL if no slot was free)
+    ClientSession *session = NULL;
 
     // Check the list of clients
     for (int i = 0; i < MAX_CLIENTS; i++)
@@ -188,50 +474,76 @@ void acceptConnection(int listenSocket)
         if (clientSocketList[i] == -1)
         {
             clientSocketList[i] = clientSocket;
-            wasClientAdded = 1;
+            session = &clientSessionList[i];
+            session->socket = clientSocket;
+            transportInitialize(&session->transport, clientSocket, transportKind);
+            if (lowLatencyIsActive())
+            {
+                lowLatencyPrepareSocket(clientSocket, transportKind);
+            }
+            tokenBucketInitialize(&session->rateLimit, RATE_LIMIT_BURST);
+            session->framesDropped = 0;
+            session->framesDelayed = 0;
+            session->isLeaving = 0;
+            session->hasSaidBye = 0;
+            session->inboxHead = NULL;
+            session->inboxTail = NULL;
+            session->isInboxScheduled = 0;
+            session->isSubscribed = 0;
+            session->uploadBlob = NULL;
+            session->uploadChunkRemaining = 0;
+            session->captureId = trafficCaptureNextConnectionId();
+            outputQueueOpen(&session->outputQueue, &session->transport);
             break;
         }
     }
     pthread_mutex_unlock(&clientMutex);
 
     // Too many clients exist (max of 10)
-    if (!wasClientAdded)
+    if (session == NULL)
     {
         // printf("DEBUG acceptConnection: Maximum clients reached. Rejecting connection.\n");
-        close(clientSocket);
+        rejectSession(clientSocket);
         return;
     }
 
-    // Create a new thread for the client.
-    pthread_t threadId;
+    // Anything broadcast from here on is replayed to the client when it is subscribed
+    pthread_mutex_lock(&roomHistory.historyMutex);
+    session->joinSequence = roomHistory.nextSequence;
+    pthread_mutex_unlock(&roomHistory.historyMutex);
 
-    // Allocate memory for the socket pointer
-    int *clientSocketPointer = malloc(sizeof(int));
-    if (clientSocketPointer == NULL)
-    {
-        perror("malloc failed");
-        close(clientSocket);
-        return;
-    }
+    // Start the idle timer before the client thread exists so a silent peer is always covered
+    refreshClientHeartbeat(session);
 
-    // Create a pointer for the socket
-    *clientSocketPointer = clientSocket;
+    // Create a new thread for the client, on a stack of a known size so it can be charged to the client
+    pthread_t threadId;
+    pthread_attr_t threadAttributes;
+    pthread_attr_init(&threadAttributes);
+    pthread_attr_setstacksize(&threadAttributes, CLIENT_THREAD_STACK_BYTES);
+    memoryCharge(&session->memoryAccount, MEMORY_STACKS, CLIENT_THREAD_STACK_BYTES);
 
-    // Create the thread, call clientHandler, pass in the socket
-    if (pthread_create(&threadId, NULL, clientHandler, clientSocketPointer) != 0)
+    // Create the thread, call clientHandler, pass in the session
+    int createResult = pthread_create(&threadId, &threadAttributes, clientHandler, session);
+    pthread_attr_destroy(&threadAttributes);
+    if (createResult != 0)
     {
         perror("pthread_create failed");
-        free(clientSocketPointer);
-        close(clientSocket);
+        memoryRelease(&session->memoryAccount, MEMORY_STACKS, CLIENT_THREAD_STACK_BYTES);
+        timerWheelCancel(&heartbeatWheel, &session->idleTimer);
         // get the mutex
         pthread_mutex_lock(&clientMutex);
 
+        // Never published, so no broadcast can be using it
+        outputQueueClose(&session->outputQueue);
+        transportClose(&session->transport);
+
         // Check the list of clients
         for (int i = 0; i < MAX_CLIENTS; i++)
         {
             if (clientSocketList[i] == clientSocket)
             {
                 clientSocketList[i] = -1;
+                clientSessionList[i].socket = -1;
                 break;
             }
         }
@@ -243,159 +555,1677 @@ void acceptConnection(int listenSocket)
     // printf("DEBUG acceptConnection: New connection, socket #%d\n", clientSocket);
 }
 
+/*
+ * FUNCTION : publishSubscriberSnapshot
+ *
+ * DESCRIPTION : This function builds a new immutable subscriber list from clientSocketList and swaps it in.
+ * Broadcasts already walking the old list keep using it, it is freed once they have all finished.
+ * clientMutex must be held.
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : void
+ */
+void publishSubscriberSnapshot(void)
+{
+    SubscriberSnapshot *newSnapshot = malloc(sizeof(SubscriberSnapshot));
+    if (newSnapshot == NULL)
+    {
+        perror("malloc failed");
+        return;
+    }
+
+    newSnapshot->memberCount = 0;
+    for (int i = 0; i < MAX_CLIENTS; i++)
+    {
+        if (clientSocketList[i] != -1 && clientSessionList[i].isSubscribed && !clientSessionList[i].isLeaving)
+        {
+            newSnapshot->members[newSnapshot->memberCount++] = &clientSessionList[i];
+        }
+    }
+
+    SubscriberSnapshot *oldSnapshot = __atomic_exchange_n(&subscriberSnapshot, newSnapshot, __ATOMIC_ACQ_REL);
+    if (oldSnapshot != NULL)
+    {
+        epochRetire(&oldSnapshot->retired, oldSnapshot, free);
+    }
+}
+
 /*
  * FUNCTION : broadcastChatMessage
  *
- * DESCRIPTION : This function broadcasts a message to all connected clients by iterating through the global
- * clientSocketList array and sending the message
+ * DESCRIPTION : This function broadcasts a message to all connected clients. The message is numbered and kept in the
+ * room history, then queued to every client in the current subscriber snapshot (built once, shared by every queue).
+ * Only the numbering and queueing happen under the history lock so every client gets the numbers in order,
+ * the sends happen after it is released.
  *
  * PARAMETERS : char *messageToBroadcast : The message to broadcast.
  *              int senderSocket : The socket descriptor of the sender.
  *
- * RETURNS : void
+ * RETURNS : unsigned long : The message's sequence number, 0 if it couldn't be broadcast.
  */
-void broadcastChatMessage(char *messageToBroadcast, int senderSocket)
+unsigned long broadcastChatMessage(char *messageToBroadcast, int senderSocket)
 {
-    printf("Send messagE: %s", messageToBroadcast);
-    // Get the mutex
-    pthread_mutex_lock(&clientMutex);
+    // Everything in the snapshot stays valid (and its queue open) until epochExit. It is loaded under the history
+    // lock so a client subscribing in between either gets this message replayed or is in the snapshot.
+    TraceSpan *span = messageTraceCurrent();
+    long long lockStartNs = span != NULL ? monotonicNanoseconds() : 0;
+    epochEnter();
+    pthread_mutex_lock(&roomHistory.historyMutex);
+    long long lockedNs = span != NULL ? monotonicNanoseconds() : 0;
+    SubscriberSnapshot *snapshot = __atomic_load_n(&subscriberSnapshot, __ATOMIC_ACQUIRE);
+    OutboundMessage *message = historyStamp(&roomHistory, messageToBroadcast);
+    if (message == NULL)
+    {
+        pthread_mutex_unlock(&roomHistory.historyMutex);
+        epochExit();
+        perror("malloc failed");
+        return 0;
+    }
+    unsigned long sequence = roomHistory.nextSequence - 1;
+    int recipientCount = snapshot != NULL ? snapshot->memberCount : 0;
+    TRACE_PROBE2(broadcast_start, sequence, recipientCount);
 
     // Check the client list
-    for (int i = 0; i < MAX_CLIENTS; i++)
+    for (int i = 0; snapshot != NULL && i < snapshot->memberCount; i++)
     {
-        // If there is a client there
-        if (clientSocketList[i] != -1)
+        // Queue the message for the client
+        if (outputQueuePush(&snapshot->members[i]->outputQueue, message) < 0 && errno == ENOBUFS)
         {
-            // Send the message to the client
-            int sendResult = send(clientSocketList[i], messageToBroadcast, strlen(messageToBroadcast), 0);
-            if (sendResult < 0)
-            {
-                perror("DEBUG broadcastChatMessage: send failed");
-            }
+            __atomic_add_fetch(&serverStats.clientsDisconnectedForBacklog, 1, __ATOMIC_RELAXED);
         }
     }
+    pthread_mutex_unlock(&roomHistory.historyMutex);
+    long long unlockedNs = span != NULL ? monotonicNanoseconds() : 0;
+
+    // Send it
+    for (int i = 0; snapshot != NULL && i < snapshot->memberCount; i++)
+    {
+        TRACE_PROBE2(recipient_send, sequence, snapshot->members[i]->socket);
+        outputQueueFlush(&snapshot->members[i]->outputQueue);
+    }
+    epochExit();
+    TRACE_PROBE2(broadcast_done, sequence, recipientCount);
+
+    if (span != NULL)
+    {
+        span->sequence = sequence;
+        span->recipientCount = recipientCount;
+        span->lockWaitNs = lockedNs - lockStartNs;
+        span->queueNs = unlockedNs - lockedNs;
+        span->sendNs = monotonicNanoseconds() - unlockedNs;
+    }
+
+    outboundMessageRelease(message);
+    return sequence;
+}
+
+/*
+ * FUNCTION : subscribeClientSession
+ *
+ * DESCRIPTION : This function starts sending broadcasts to a client. Everything after the given sequence number that
+ * the history still holds is queued first, and the client joins the snapshot before the history lock is released,
+ * so there is no gap and no repeat between the replay and the live broadcasts.
+ *
+ * PARAMETERS : ClientSession *session : The session to subscribe.
+ *              unsigned long afterSequence : Last broadcast the client already has.
+ *
+ * RETURNS : void
+ */
+void subscribeClientSession(ClientSession *session, unsigned long afterSequence)
+{
+    pthread_mutex_lock(&roomHistory.historyMutex);
+    historyReplay(&roomHistory, afterSequence, &session->outputQueue);
+
+    pthread_mutex_lock(&clientMutex);
+    session->isSubscribed = 1;
+    publishSubscriberSnapshot();
     pthread_mutex_unlock(&clientMutex);
+    pthread_mutex_unlock(&roomHistory.historyMutex);
+
+    outputQueueFlush(&session->outputQueue);
 }
 
 /*
  * FUNCTION : processClientMessage
  *
- * DESCRIPTION : This function keeps reading messages from a client, processes them,
- * and triggers a broadcast or disconnect if necessary
+ * DESCRIPTION : This function keeps reading from a client and splits what arrives into frames.
+ * Control frames are answered here, chat frames are handed to the worker pool (see queueInboundFrame),
+ * so the reader never parses, formats or sends a broadcast itself. In low-latency mode a network thread does the
+ * reading once the client is subscribed, and this thread only sleeps until it is handed something to wait for.
  *
- * PARAMETERS : int clientSocket : The client socket descriptor.
+ * PARAMETERS : ClientSession *session : The session of the client to read from.
  *
  * RETURNS : void
  */
-void processClientMessage(int clientSocket)
+void processClientMessage(ClientSession *session)
 {
-    char incomingMessage[MAX_PROTOL_MESSAGE_SIZE];
+    session->bufferedLength = 0;
+    session->isDiscarding = 0;
+
+    // A reconnecting client asks to resume straight away (after asking for compression, if it does). One that stays
+    // quiet is subscribed from when it joined.
+    long long resumeDeadline = monotonicNanoseconds() + (long long)JOIN_RESUME_WAIT_MS * 1000000;
+    trafficCaptureRecord(CAPTURE_RECORD_OPEN, session->captureId, NULL, 0);
 
     // Keep checking for messages from clients
     while (1)
     {
-        int numberOfBytesRead = read(clientSocket, incomingMessage, MAX_PROTOL_MESSAGE_SIZE - 1);
-        if (numberOfBytesRead > 0)
+        if (!session->isSubscribed)
         {
-            incomingMessage[numberOfBytesRead] = '\0';
-
-            // printf("\n------- GOT MESSAGE FROM CLIENT ------\nprocessClientMessage() Start\n");
-            // Debug print the raw protocol message.
-            // printf("DEBUG: Received message from socket %d (len=%d): \"%s\"\n", clientSocket, numberOfBytesRead, incomingMessage);
-
-            // Extract the protocol fields to get the actual message text.
-            char temporaryMessageSpace[256];
-            strncpy(temporaryMessageSpace, incomingMessage, sizeof(temporaryMessageSpace) - 1);
-            temporaryMessageSpace[sizeof(temporaryMessageSpace) - 1] = '\0';
-
-            // Protocol format: CLIENTIP|USERNAME|MESSAGECOUNT|"Message text"
-            // Get the IP
-            char *ipField = strtok(temporaryMessageSpace, "|");
-            // Get the user name
-            char *usernameField = strtok(NULL, "|");
-            // Get the message count
-            char *msgCountField = strtok(NULL, "|");
-            // Get the message
-            char *messageField = strtok(NULL, "|");
+            long long waitNanoseconds = resumeDeadline - monotonicNanoseconds();
+            struct pollfd firstFramePoll = {session->socket, POLLIN, 0};
+            if (waitNanoseconds <= 0 || poll(&firstFramePoll, 1, (int)(waitNanoseconds / 1000000) + 1) == 0)
+            {
+                subscribeClientSession(session, session->joinSequence - 1);
+            }
+        }
 
-            // If the extracted message text is ">>bye<<", disconnect.
-            if (messageField && strcmp(messageField, ">>bye<<") == 0)
+        // Low-latency mode: a network thread reads the client from here until it comes to something that could wait
+        // (its frames are picked up where it stopped), or the client goes
+        if (lowLatencyIsActive() && session->isSubscribed && session->transport.kind != TRANSPORT_SHARED_MEMORY &&
+            session->uploadChunkRemaining == 0)
+        {
+            int handbackResult = lowLatencyHandToNetwork(&session->networkLink, session->socket);
+            if (handbackResult == LOW_LATENCY_CLOSED)
             {
-                // printf("DEBUG processClientMessage: Client on socket #%d requested disconnect.\n", clientSocket);
                 break;
             }
-            else
+            if (handbackResult == LOW_LATENCY_HAND_BACK)
             {
-                // Parse the full protocol message and broadcast the formatted message.
-                parseAndBroadcastProtocolMessage(incomingMessage, clientSocket);
+                if (handleBufferedFrames(session, 1) < 0)
+                {
+                    break;
+                }
+                continue;
             }
+            // The network thread has all it can poll, read here as usual
         }
-        else if (numberOfBytesRead == 0)
+
+        int numberOfBytesRead = transportReceive(&session->transport, session->readBuffer + session->bufferedLength,
+                                                 sizeof(session->readBuffer) - 1 - session->bufferedLength, 0);
+        if (numberOfBytesRead == 0)
         {
-            // printf("Client on socket #%d disconnected.\n", clientSocket);
+            // printf("Client on socket #%d disconnected.\n", session->socket);
             break;
         }
-        else
+        if (numberOfBytesRead < 0)
         {
             perror("read error");
             break;
         }
+        noteClientBytes(session, numberOfBytesRead);
+        if (handleBufferedFrames(session, 1) < 0)
+        {
+            break;
+        }
     }
+    trafficCaptureRecord(CAPTURE_RECORD_CLOSE, session->captureId, NULL, 0);
     // printf("\n------- END GOT MESSAGE FROM CLIENT ------\nprocessClientMessage() FINISH\n");
 }
 
 /*
- * FUNCTION : clientHandler
+ * FUNCTION : noteClientBytes
  *
- * DESCRIPTION : This function takes a client socket and starts the message processing for it
+ * DESCRIPTION : This function takes in bytes just read into a client's buffer: they prove the client is alive, and
+ * a bye among them is noticed ahead of the frames in front of it
  *
- * PARAMETERS : void *clientSocketPointer : Pointer to the client socket descriptor (cast from int *).
+ * PARAMETERS : ClientSession *session : The session that was read.
+ *              int numberOfBytesRead : How many bytes were added to its buffer.
  *
- * RETURNS : void * : Always returns NULL.
+ * RETURNS : void
  */
-void *clientHandler(void *clientSocketPointer)
+void noteClientBytes(ClientSession *session, int numberOfBytesRead)
 {
-    // Cast the pointer to an int
-    int clientSocket = *(int *)clientSocketPointer;
-    free(clientSocketPointer);
-
-    processClientMessage(clientSocket);
-
-    // Remove the client from the list
-    pthread_mutex_lock(&clientMutex);
-    for (int i = 0; i < MAX_CLIENTS; i++)
+    // Any traffic at all proves the peer is alive, push the idle deadline out
+    refreshClientHeartbeat(session);
+    if (messageTraceIsActive())
     {
-        if (clientSocketList[i] == clientSocket)
-        {
-            clientSocketList[i] = -1;
-            break;
-        }
+        session->lastReadNs = monotonicNanoseconds();
     }
-    pthread_mutex_unlock(&clientMutex);
+    session->bufferedLength += numberOfBytesRead;
 
-    close(clientSocket);
-    return NULL;
+    // Control before bulk: a bye anywhere in what was read means the client is going, so the chat frames ahead
+    // of it must not park this thread in the rate limit (under a flood that could be minutes). Upload bytes at the
+    // front are file contents, not frames.
+    size_t uploadBytesBuffered = session->uploadChunkRemaining < (size_t)session->bufferedLength
+                                     ? session->uploadChunkRemaining
+                                     : (size_t)session->bufferedLength;
+    if (!session->hasSaidBye &&
+        isByeBuffered(session->readBuffer + uploadBytesBuffered, session->bufferedLength - uploadBytesBuffered))
+    {
+        session->hasSaidBye = 1;
+        __atomic_add_fetch(&serverStats.byesSeenEarly, 1, __ATOMIC_RELAXED);
+    }
 }
 
-int main()
+/*
+ * FUNCTION : handleBufferedFrames
+ *
+ * DESCRIPTION : This function hands out every complete frame in a client's buffer, and the raw bytes that follow an
+ * upload chunk frame. A network thread stops at the first thing that could wait (see isFrameForReader) and leaves
+ * it, and everything after it, in the buffer for the client's reader.
+ *
+ * PARAMETERS : ClientSession *session : The session to handle.
+ *              int mayWait : 1 on the client's reader thread, 0 on a network thread.
+ *
+ * RETURNS : int : 0 when the buffer holds at most a partial frame, 1 if the reader has to take over, -1 if the client
+ *                 should be disconnected.
+ */
+int handleBufferedFrames(ClientSession *session, int mayWait)
+{
+    char *frameStart = session->readBuffer;
+    char *bufferEnd = session->readBuffer + session->bufferedLength;
+    char *frameEnd;
+    int result = 0;
+    while (result == 0 && frameStart < bufferEnd)
+    {
+        if (session->uploadChunkRemaining > 0)
+        {
+            if (!mayWait)
+            {
+                result = 1;
+                break;
+            }
+            size_t rawLength = bufferEnd - frameStart;
+            if (rawLength > session->uploadChunkRemaining)
+            {
+                rawLength = session->uploadChunkRemaining;
+            }
+            trafficCaptureRecord(CAPTURE_RECORD_UPLOAD, session->captureId, NULL, rawLength);
+            result = spoolUploadBytes(session, frameStart, rawLength) < 0 ? -1 : 0;
+            frameStart += rawLength;
+            continue;
+        }
+
+        frameEnd = memchr(frameStart, PROTOCOL_FRAME_END, bufferEnd - frameStart);
+        if (frameEnd == NULL)
+        {
+            break;
+        }
+        *frameEnd = '\0';
+        // A frame longer than any client sends is dropped whole
+        if (frameEnd - frameStart >= MAX_PROTOL_MESSAGE_SIZE)
+        {
+            session->isDiscarding = 1;
+        }
+        if (!session->isDiscarding)
+        {
+            if (!mayWait && isFrameForReader(session, frameStart))
+            {
+                *frameEnd = PROTOCOL_FRAME_END;
+                result = 1;
+                break;
+            }
+            trafficCaptureRecord(CAPTURE_RECORD_FRAME, session->captureId, frameStart, frameEnd - frameStart);
+            TRACE_PROBE3(frame_received, session->socket, frameStart, frameEnd - frameStart);
+            result = handleClientFrame(session, frameStart) < 0 ? -1 : 0;
+        }
+        session->isDiscarding = 0;
+        frameStart = frameEnd + 1;
+    }
+    if (result < 0)
+    {
+        return -1;
+    }
+
+    if (result == 0)
+    {
+        // Every frame the scan looked at has been handled, and a real bye would have ended the loop: what it matched
+        // wasn't one (chat text that ends the same way, or a frame too long to take), so rate limiting goes back to normal
+        session->hasSaidBye = 0;
+
+        // The rest of an upload chunk goes from the connection straight into the file
+        if (session->uploadChunkRemaining > 0)
+        {
+            if (!mayWait)
+            {
+                result = 1;
+            }
+            else
+            {
+                trafficCaptureRecord(CAPTURE_RECORD_UPLOAD, session->captureId, NULL, session->uploadChunkRemaining);
+                if (spoolUploadFromTransport(session) < 0)
+                {
+                    return -1;
+                }
+            }
+        }
+    }
+
+    // Keep what is left at the front, or drop a partial frame that is already longer than any real frame
+    session->bufferedLength -= frameStart - session->readBuffer;
+    memmove(session->readBuffer, frameStart, session->bufferedLength);
+    if (result == 0 && session->bufferedLength >= MAX_PROTOL_MESSAGE_SIZE)
+    {
+        session->bufferedLength = 0;
+        session->isDiscarding = 1;
+    }
+    return result;
+}
+
+/*
+ * FUNCTION : isFrameForReader
+ *
+ * DESCRIPTION : This function picks out the frames a network thread leaves to the client's own reader because
+ * handling them could wait on that one client: chat (and puts) with no token in the rate limit bucket, a search
+ * (it reads the document file) and the move to shared memory (the connection leaves the socket).
+ *
+ * PARAMETERS : ClientSession *session : The session the frame came from.
+ *              const char *frame : The frame, without its frame end.
+ *
+ * RETURNS : int : 1 if the reader should handle it, 0 if a network thread can.
+ */
+int isFrameForReader(ClientSession *session, const char *frame)
+{
+    if (strncmp(frame, PROTOCOL_SHM, strlen(PROTOCOL_SHM)) == 0 || strncmp(frame, PROTOCOL_SEARCH, strlen(PROTOCOL_SEARCH)) == 0)
+    {
+        return 1;
+    }
+    return protocolMessageText(frame) != NULL &&
+           tokenBucketWait(&session->rateLimit, RATE_LIMIT_FRAMES_PER_SECOND, RATE_LIMIT_BURST) > 0;
+}
+
+/*
+ * FUNCTION : serviceClientOnNetwork
+ *
+ * DESCRIPTION : This function is what a network thread does with a client's connection when it is ready: one
+ * non-blocking read, then the frames it completes
+ *
+ * PARAMETERS : void *sessionPointer : The client's session (cast from ClientSession *).
+ *
+ * RETURNS : int : LOW_LATENCY_KEEP, LOW_LATENCY_HAND_BACK if the reader has to take over, or LOW_LATENCY_CLOSED
+ *                 when the client closed or should be disconnected.
+ */
+int serviceClientOnNetwork(void *sessionPointer)
+{
+    ClientSession *session = (ClientSession *)sessionPointer;
+    int numberOfBytesRead = transportReceive(&session->transport, session->readBuffer + session->bufferedLength,
+                                             sizeof(session->readBuffer) - 1 - session->bufferedLength, MSG_DONTWAIT);
+    if (numberOfBytesRead == 0)
+    {
+        return LOW_LATENCY_CLOSED;
+    }
+    if (numberOfBytesRead < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        {
+            return LOW_LATENCY_KEEP;
+        }
+        perror("read error");
+        return LOW_LATENCY_CLOSED;
+    }
+    noteClientBytes(session, numberOfBytesRead);
+
+    int result = handleBufferedFrames(session, 0);
+    if (result < 0)
+    {
+        return LOW_LATENCY_CLOSED;
+    }
+    return result > 0 ? LOW_LATENCY_HAND_BACK : LOW_LATENCY_KEEP;
+}
+
+/*
+ * FUNCTION : isByeBuffered
+ *
+ * DESCRIPTION : This function looks through what a reader has buffered for a complete bye frame, ahead of parsing
+ * the frames in front of it. Only the end of each frame is looked at, so it stays cheap on a full buffer. It stops
+ * at an upload chunk header: the raw file bytes after it aren't frames, whatever they contain.
+ *
+ * PARAMETERS : const char *data : The buffered bytes.
+ *              size_t length : How many.
+ *
+ * RETURNS : int : 1 if a frame ends in the bye message text, 0 if not.
+ */
+int isByeBuffered(const char *data, size_t length)
+{
+    const size_t byeLength = strlen("|" PROTOCOL_BYE);
+    const char *frameEnd;
+    while ((frameEnd = memchr(data, PROTOCOL_FRAME_END, length)) != NULL)
+    {
+        // A client on Windows style line endings
+        size_t frameLength = frameEnd - data;
+        if (frameLength > 0 && data[frameLength - 1] == '\r')
+        {
+            frameLength--;
+        }
+        if (frameLength >= byeLength && memcmp(data + frameLength - byeLength, "|" PROTOCOL_BYE, byeLength) == 0)
+        {
+            return 1;
+        }
+        if (frameLength >= strlen(PROTOCOL_CHUNK) && memcmp(data, PROTOCOL_CHUNK, strlen(PROTOCOL_CHUNK)) == 0)
+        {
+            return 0;
+        }
+        length -= frameEnd + 1 - data;
+        data = frameEnd + 1;
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : handleClientFrame
+ *
+ * DESCRIPTION : This function deals with one frame on the reader thread. Control frames (pong, shared memory,
+ * bye, stats) are handled straight away, chat frames are rate limited and queued for the worker pool.
+ *
+ * PARAMETERS : ClientSession *session : The session the frame came from.
+ *              char *frame : The frame, without its frame end.
+ *
+ * RETURNS : int : 0 to keep reading, -1 if the client should be disconnected.
+ */
+int handleClientFrame(ClientSession *session, char *frame)
+{
+    // A client on Windows style line endings
+    size_t frameLength = strlen(frame);
+    if (frameLength > 0 && frame[frameLength - 1] == '\r')
+    {
+        frame[frameLength - 1] = '\0';
+    }
+
+    // A pong only exists to refresh the heartbeat, which reading it already did
+    if (frame[0] == '\0' || strcmp(frame, PROTOCOL_PONG) == 0)
+    {
+        return 0;
+    }
+
+    // A reconnecting client picking up where it left off (only meaningful as its first frame)
+    if (strncmp(frame, PROTOCOL_RESUME, strlen(PROTOCOL_RESUME)) == 0)
+    {
+        if (!session->isSubscribed)
+        {
+            subscribeClientSession(session, strtoul(frame + strlen(PROTOCOL_RESUME), NULL, 10));
+        }
+        return 0;
+    }
+
+    // Compression of what is sent to this client (see outputQueueEnableCompression). Asked for before resuming, so
+    // the replay is compressed too. Same-host transports have nothing to gain and are refused, and so is everyone while
+    // memory is over budget (a compressor window is the biggest thing a connection can ask for).
+    if (strncmp(frame, PROTOCOL_COMPRESS, strlen(PROTOCOL_COMPRESS)) == 0)
+    {
+        if (session->transport.kind == TRANSPORT_TCP && strcmp(frame + strlen(PROTOCOL_COMPRESS), PROTOCOL_COMPRESS_LZ) == 0 &&
+            memoryBudgetLevel() == MEMORY_WITHIN_BUDGET)
+        {
+            outputQueueEnableCompression(&session->outputQueue, PROTOCOL_COMPRESS PROTOCOL_COMPRESS_LZ);
+        }
+        else
+        {
+            outputQueueAppendText(&session->outputQueue, PROTOCOL_COMPRESS PROTOCOL_COMPRESS_NONE);
+        }
+        return 0;
+    }
+
+    // Anything else from a client that hasn't been subscribed yet means it isn't resuming
+    if (!session->isSubscribed)
+    {
+        subscribeClientSession(session, session->joinSequence - 1);
+    }
+
+    // A same-host client asking to move onto shared memory rings. Only done with nothing left in the output queue,
+    // so every frame sent before the switch is already in the socket. Otherwise it is refused (in order, after them).
+    if (strcmp(frame, PROTOCOL_SHM) == 0)
+    {
+        if (!outputQueueRunWhenIdle(&session->outputQueue, transportOfferSharedMemory))
+        {
+            outputQueueAppendText(&session->outputQueue, PROTOCOL_SHM);
+        }
+        return 0;
+    }
+
+    // Upload chunk header, its raw bytes follow (see processClientMessage). A length no client would send means
+    // the stream can't be followed any more.
+    if (strncmp(frame, PROTOCOL_CHUNK, strlen(PROTOCOL_CHUNK)) == 0)
+    {
+        char *lengthEnd;
+        unsigned long chunkLength = strtoul(frame + strlen(PROTOCOL_CHUNK), &lengthEnd, 10);
+        if (lengthEnd == frame + strlen(PROTOCOL_CHUNK) || chunkLength == 0 || chunkLength > PROTOCOL_BLOB_CHUNK_BYTES ||
+            (session->uploadBlob != NULL && chunkLength > session->uploadBlob->length - session->uploadBlob->receivedLength))
+        {
+            return -1;
+        }
+        session->uploadChunkRemaining = chunkLength;
+        return 0;
+    }
+
+    // Search of everything said in the room, the same low priority as stats (and shed over the memory budget too,
+    // its results are gathered in memory)
+    if (strncmp(frame, PROTOCOL_SEARCH, strlen(PROTOCOL_SEARCH)) == 0)
+    {
+        if (admissionLevel() == ADMISSION_OVERLOAD || memoryBudgetLevel() != MEMORY_WITHIN_BUDGET)
+        {
+            admissionCountShed();
+        }
+        else
+        {
+            sendSearchResults(session, frame + strlen(PROTOCOL_SEARCH));
+        }
+        return 0;
+    }
+
+    // Download of a shared file
+    if (strncmp(frame, PROTOCOL_GET, strlen(PROTOCOL_GET)) == 0)
+    {
+        sendBlob(session, strtoul(frame + strlen(PROTOCOL_GET), NULL, 10));
+        return 0;
+    }
+
+    // Protocol format: CLIENTIP|USERNAME|MESSAGECOUNT|"Message text"
+    const char *messageField = protocolMessageText(frame);
+    int isPut = messageField && strncmp(messageField, PROTOCOL_PUT, strlen(PROTOCOL_PUT)) == 0;
+
+    // If the extracted message text is ">>bye<<", disconnect.
+    if (messageField && strcmp(messageField, PROTOCOL_BYE) == 0)
+    {
+        // printf("DEBUG processClientMessage: Client on socket #%d requested disconnect.\n", session->socket);
+        return -1;
+    }
+    else if (messageField && strcmp(messageField, PROTOCOL_STATS) == 0)
+    {
+        // Stats are the lowest priority traffic, the first thing shed under overload
+        if (admissionLevel() == ADMISSION_OVERLOAD)
+        {
+            admissionCountShed();
+        }
+        else
+        {
+            // Only the asking client gets the counters
+            sendServerStats(session);
+        }
+        return 0;
+    }
+
+    // Over the hard memory limit new chat and uploads are refused, before they cost a frame, a broadcast or a file
+    if (memoryBudgetLevel() == MEMORY_OVER_HARD)
+    {
+        memoryCountRefused();
+        if (isPut)
+        {
+            outputQueueAppendControl(&session->outputQueue, PROTOCOL_BLOB_FAIL "memory");
+        }
+        return 0;
+    }
+
+    // Check the client's token bucket before it costs us a broadcast
+    int rateLimitResult = applyRateLimit(session);
+    if (rateLimitResult < 0)
+    {
+        return -1;
+    }
+    if (isPut)
+    {
+        // Its announcement is a broadcast like any other, so the put is what gets charged for it
+        if (rateLimitResult == 0)
+        {
+            outputQueueAppendControl(&session->outputQueue, PROTOCOL_BLOB_FAIL "throttled");
+            return 0;
+        }
+        return startUpload(session, frame, messageField);
+    }
+    if (rateLimitResult > 0)
+    {
+        queueInboundFrame(session, frame);
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : startUpload
+ *
+ * DESCRIPTION : This function starts spooling a file a client is sharing. The chunks that follow go into the blob,
+ * or are thrown away if the put was refused (the client is told why).
+ *
+ * PARAMETERS : ClientSession *session : The session the put came from.
+ *              const char *frame : The whole put frame.
+ *              const char *putText : Its message text: >>put<<TOTALBYTES NAME
+ *
+ * RETURNS : int : 0 to keep reading, -1 if the client should be disconnected.
+ */
+int startUpload(ClientSession *session, const char *frame, const char *putText)
+{
+    if (session->uploadBlob != NULL)
+    {
+        // One at a time, a put in the middle of an upload means the client lost track
+        return -1;
+    }
+
+    char *nameStart;
+    unsigned long totalLength = strtoul(putText + strlen(PROTOCOL_PUT), &nameStart, 10);
+    while (*nameStart == ' ')
+    {
+        nameStart++;
+    }
+    if (totalLength == 0 || totalLength > PROTOCOL_BLOB_MAX_BYTES)
+    {
+        outputQueueAppendControl(&session->outputQueue, PROTOCOL_BLOB_FAIL "size");
+        return 0;
+    }
+
+    session->uploadBlob = blobCreate(totalLength, *nameStart != '\0' ? nameStart : "file");
+    if (session->uploadBlob == NULL)
+    {
+        perror("blobCreate failed");
+        outputQueueAppendControl(&session->outputQueue, PROTOCOL_BLOB_FAIL "storage");
+        return 0;
+    }
+    memoryCharge(&session->memoryAccount, MEMORY_UPLOADS, sizeof(Blob));
+    snprintf(session->uploadPrefix, sizeof(session->uploadPrefix), "%.*s", (int)(putText - frame), frame);
+    return 0;
+}
+
+/*
+ * FUNCTION : spoolUploadBytes
+ *
+ * DESCRIPTION : This function takes upload chunk bytes that arrived in the read buffer along with frames
+ *
+ * PARAMETERS : ClientSession *session : The uploading session.
+ *              const char *data : The bytes (no more than uploadChunkRemaining).
+ *              size_t length : Number of bytes.
+ *
+ * RETURNS : int : 0 to keep reading, -1 if the client should be disconnected.
+ */
+int spoolUploadBytes(ClientSession *session, const char *data, size_t length)
+{
+    if (session->uploadBlob != NULL && blobSpoolBytes(session->uploadBlob, data, length) < 0)
+    {
+        perror("blob spool failed");
+        return -1;
+    }
+    session->uploadChunkRemaining -= length;
+    if (session->uploadChunkRemaining == 0)
+    {
+        finishUploadChunk(session);
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : spoolUploadFromTransport
+ *
+ * DESCRIPTION : This function reads the rest of an upload chunk. For a socket the bytes are spliced from the
+ * connection into the blob's file without passing through the reader's buffer.
+ *
+ * PARAMETERS : ClientSession *session : The uploading session.
+ *
+ * RETURNS : int : 0 to keep reading, -1 if the client went away.
+ */
+int spoolUploadFromTransport(ClientSession *session)
+{
+    if (session->uploadBlob != NULL)
+    {
+        if (blobSpoolFromTransport(session->uploadBlob, &session->transport, session->uploadChunkRemaining) < 0)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        // A refused upload, the bytes only need to be got out of the way
+        char discardBuffer[CLIENT_READ_BUFFER_SIZE];
+        while (session->uploadChunkRemaining > 0)
+        {
+            size_t wantedLength = session->uploadChunkRemaining < sizeof(discardBuffer) ? session->uploadChunkRemaining : sizeof(discardBuffer);
+            ssize_t discardedLength = transportReceive(&session->transport, discardBuffer, wantedLength, 0);
+            if (discardedLength <= 0)
+            {
+                return -1;
+            }
+            session->uploadChunkRemaining -= discardedLength;
+        }
+    }
+    session->uploadChunkRemaining = 0;
+    refreshClientHeartbeat(session);
+    finishUploadChunk(session);
+    return 0;
+}
+
+/*
+ * FUNCTION : finishUploadChunk
+ *
+ * DESCRIPTION : This function is called after each upload chunk. Once the whole file is in, it is published and
+ * announced to the room as a chat line from the uploader, through the pool like any other. The name is cut (on a
+ * character boundary) so the announcement fits in one frame.
+ *
+ * PARAMETERS : ClientSession *session : The uploading session.
+ *
+ * RETURNS : void
+ */
+void finishUploadChunk(ClientSession *session)
+{
+    Blob *blob = session->uploadBlob;
+    if (blob == NULL || blob->receivedLength < blob->length)
+    {
+        return;
+    }
+
+    unsigned long blobId = blobStorePublish(&roomBlobs, blob);
+    char announcement[MAX_PROTOL_MESSAGE_SIZE];
+    char sizeText[32];
+    snprintf(sizeText, sizeof(sizeText), " (%zu bytes)", blob->length);
+    int headLength = snprintf(announcement, sizeof(announcement), "%s[blob %lu] ", session->uploadPrefix, blobId);
+    size_t usedLength = headLength < (int)sizeof(announcement) ? (size_t)headLength : sizeof(announcement) - 1;
+    size_t roomLength = sizeof(announcement) - 1 - usedLength;
+    size_t sizeLength = strlen(sizeText);
+    size_t nameLength = strlen(blob->name);
+    if (nameLength + sizeLength > roomLength)
+    {
+        nameLength = roomLength > sizeLength ? utf8TrimLength(blob->name, roomLength - sizeLength) : 0;
+    }
+    snprintf(announcement + usedLength, sizeof(announcement) - usedLength, "%.*s%s", (int)nameLength, blob->name, sizeText);
+    queueInboundFrame(session, announcement);
+
+    blobRelease(blob);
+    session->uploadBlob = NULL;
+    memoryRelease(&session->memoryAccount, MEMORY_UPLOADS, sizeof(Blob));
+}
+
+/*
+ * FUNCTION : sendBlob
+ *
+ * DESCRIPTION : This function queues a shared file to the client that asked for it. It goes out in chunks with
+ * sendfile, and chat lines keep going out between them.
+ *
+ * PARAMETERS : ClientSession *session : The session that sent the get.
+ *              unsigned long blobId : The id from the announcement.
+ *
+ * RETURNS : void
+ */
+void sendBlob(ClientSession *session, unsigned long blobId)
+{
+    Blob *blob = blobStoreFind(&roomBlobs, blobId);
+    if (blob == NULL)
+    {
+        outputQueueAppendControl(&session->outputQueue, PROTOCOL_BLOB_FAIL "unknown");
+        return;
+    }
+    blobQueueDownload(blob, &session->outputQueue);
+    blobRelease(blob);
+}
+
+/*
+ * FUNCTION : queueInboundFrame
+ *
+ * DESCRIPTION : This function adds a chat frame to the client's inbox and makes sure a pool task is on its way
+ * to it. Only one task per client is ever queued or running, which keeps each sender's messages in order.
+ * Frames are reused once handled, a new one is only allocated when the client has none spare.
+ *
+ * PARAMETERS : ClientSession *session : The session the frame came from.
+ *              const char *frame : The frame, without its frame end.
+ *
+ * RETURNS : void
+ */
+void queueInboundFrame(ClientSession *session, const char *frame)
+{
+    // Callers keep frames under MAX_PROTOL_MESSAGE_SIZE bytes; anything longer is cut to fit the frame buffer
+    size_t frameLength = strlen(frame);
+    if (frameLength > MAX_PROTOL_MESSAGE_SIZE - 1)
+    {
+        frameLength = utf8TrimLength(frame, MAX_PROTOL_MESSAGE_SIZE - 1);
+    }
+    pthread_mutex_lock(&session->inboxMutex);
+    InboundFrame *inboundFrame = session->freeFrames;
+    if (inboundFrame != NULL)
+    {
+        session->freeFrames = inboundFrame->next;
+    }
+    pthread_mutex_unlock(&session->inboxMutex);
+    if (inboundFrame == NULL)
+    {
+        inboundFrame = malloc(sizeof(InboundFrame) + MAX_PROTOL_MESSAGE_SIZE);
+        if (inboundFrame == NULL)
+        {
+            perror("malloc failed");
+            return;
+        }
+        memoryCharge(&session->memoryAccount, MEMORY_INBOX, sizeof(InboundFrame) + MAX_PROTOL_MESSAGE_SIZE);
+    }
+    inboundFrame->next = NULL;
+    inboundFrame->receivedNs = monotonicNanoseconds();
+    memcpy(inboundFrame->text, frame, frameLength);
+    inboundFrame->text[frameLength] = '\0';
+
+    // One in -trace frames is timed the rest of the way
+    inboundFrame->span = NULL;
+    if (messageTraceShouldSample() && (inboundFrame->span = calloc(1, sizeof(TraceSpan))) != NULL)
+    {
+        inboundFrame->span->senderSocket = session->socket;
+        inboundFrame->span->readNs = inboundFrame->receivedNs - session->lastReadNs;
+    }
+
+    // Counts as pending from now until a worker has queued the broadcast
+    admissionBroadcastStarted();
+
+    pthread_mutex_lock(&session->inboxMutex);
+    if (session->inboxTail != NULL)
+    {
+        session->inboxTail->next = inboundFrame;
+    }
+    else
+    {
+        session->inboxHead = inboundFrame;
+    }
+    session->inboxTail = inboundFrame;
+
+    int isSubmitting = !session->isInboxScheduled;
+    session->isInboxScheduled = 1;
+    pthread_mutex_unlock(&session->inboxMutex);
+
+    if (isSubmitting)
+    {
+        workerPoolSubmit(&session->inboxTask, session->slotIndex);
+    }
+}
+
+/*
+ * FUNCTION : processInbox
+ *
+ * DESCRIPTION : Pool task for one client's inbox. Parses, formats and broadcasts up to INBOX_BATCH_FRAMES frames,
+ * then queues itself again if more are waiting so one busy client can't hold a worker.
+ *
+ * PARAMETERS : WorkItem *item : The inboxTask of the client's session.
+ *
+ * RETURNS : void
+ */
+void processInbox(WorkItem *item)
+{
+    ClientSession *session = (ClientSession *)((char *)item - offsetof(ClientSession, inboxTask));
+
+    for (int handled = 0; handled < INBOX_BATCH_FRAMES; handled++)
+    {
+        pthread_mutex_lock(&session->inboxMutex);
+        InboundFrame *inboundFrame = session->inboxHead;
+        if (inboundFrame == NULL)
+        {
+            // Done, the reader submits the task again for the next frame
+            session->isInboxScheduled = 0;
+            pthread_mutex_unlock(&session->inboxMutex);
+            return;
+        }
+        session->inboxHead = inboundFrame->next;
+        if (session->inboxHead == NULL)
+        {
+            session->inboxTail = NULL;
+        }
+        pthread_mutex_unlock(&session->inboxMutex);
+
+        // A sampled frame's span follows it through the broadcast
+        TraceSpan *span = inboundFrame->span;
+        if (span != NULL)
+        {
+            span->inboxNs = monotonicNanoseconds() - inboundFrame->receivedNs;
+        }
+        messageTraceSetCurrent(span);
+
+        // Parse the full protocol message and broadcast the formatted message, the sender hears if it was blocked
+        if (parseAndBroadcastProtocolMessage(inboundFrame->text, session->socket) < 0)
+        {
+            outputQueueAppendControl(&session->outputQueue, PROTOCOL_BLOCKED);
+        }
+        admissionBroadcastFinished(inboundFrame->receivedNs);
+
+        messageTraceSetCurrent(NULL);
+        if (span != NULL)
+        {
+            span->totalNs = monotonicNanoseconds() - (inboundFrame->receivedNs - span->readNs);
+            messageTraceRecord(span);
+            free(span);
+        }
+        pthread_mutex_lock(&session->inboxMutex);
+        inboundFrame->next = session->freeFrames;
+        session->freeFrames = inboundFrame;
+        pthread_mutex_unlock(&session->inboxMutex);
+    }
+
+    // Still scheduled, so nobody else picks this client up in the meantime
+    workerPoolSubmit(item, session->slotIndex);
+}
+
+/*
+ * FUNCTION : applyRateLimit
+ *
+ * DESCRIPTION : This function charges one chat frame to the client's token bucket and applies RATE_LIMIT_POLICY
+ * when the bucket is empty. A noisy client only ever slows itself down, the broadcast cost is never paid for
+ * frames over the limit.
+ *
+ * PARAMETERS : ClientSession *session : The session the frame came from.
+ *
+ * RETURNS : int : 1 if the frame should be broadcast, 0 if it was dropped, -1 if the client should be disconnected.
+ */
+int applyRateLimit(ClientSession *session)
+{
+    long long waitNs = tokenBucketTake(&session->rateLimit, RATE_LIMIT_FRAMES_PER_SECOND, RATE_LIMIT_BURST);
+    if (waitNs == 0)
+    {
+        return 1;
+    }
+    __atomic_add_fetch(&serverStats.framesThrottled, 1, __ATOMIC_RELAXED);
+
+    // Under overload a throttled frame is shed rather than parking a thread to wait for it
+    if (RATE_LIMIT_POLICY == RATE_LIMIT_DELAY && admissionLevel() == ADMISSION_OVERLOAD)
+    {
+        session->framesDropped++;
+        __atomic_add_fetch(&serverStats.framesDropped, 1, __ATOMIC_RELAXED);
+        admissionCountShed();
+        return 0;
+    }
+
+    if (RATE_LIMIT_POLICY == RATE_LIMIT_DROP)
+    {
+        session->framesDropped++;
+        __atomic_add_fetch(&serverStats.framesDropped, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    else if (RATE_LIMIT_POLICY == RATE_LIMIT_DISCONNECT)
+    {
+        __atomic_add_fetch(&serverStats.clientsDisconnectedForRate, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    // A client that has already said bye gets to it without waiting, what it is over the limit by is dropped
+    if (session->hasSaidBye)
+    {
+        session->framesDropped++;
+        __atomic_add_fetch(&serverStats.framesDropped, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    // RATE_LIMIT_DELAY: sleep this client's thread until the token has dripped in. While it sleeps nothing is read,
+    // so the client's own socket buffers fill up and TCP slows the sender down. The wait is ours, not the client
+    // going quiet, so it doesn't count against its heartbeat.
+    session->framesDelayed++;
+    __atomic_add_fetch(&serverStats.framesDelayed, 1, __ATOMIC_RELAXED);
+    while (waitNs > 0)
+    {
+        struct timespec waitTime = {waitNs / NANOSECONDS_PER_SECOND, waitNs % NANOSECONDS_PER_SECOND};
+        nanosleep(&waitTime, NULL);
+        waitNs = tokenBucketTake(&session->rateLimit, RATE_LIMIT_FRAMES_PER_SECOND, RATE_LIMIT_BURST);
+    }
+    refreshClientHeartbeat(session);
+    return 1;
+}
+
+/*
+ * FUNCTION : sendStatsLine
+ *
+ * DESCRIPTION : This function formats one STATS line and queues it to the client. A line too long for the buffer
+ * is reported on stderr rather than losing its last fields without a word (it is still sent, cut short).
+ *
+ * PARAMETERS : ClientSession *session : The session that sent the stats verb.
+ *              const char *format : printf format of the line.
+ *              ... : Its values.
+ *
+ * RETURNS : int : 0 if the line was queued, -1 if it couldn't be.
+ */
+int sendStatsLine(ClientSession *session, const char *format, ...)
+{
+    char statsMessage[MAX_PROTOL_MESSAGE_SIZE * 2];
+    va_list values;
+    va_start(values, format);
+    int statsLength = vsnprintf(statsMessage, sizeof(statsMessage), format, values);
+    va_end(values);
+    if (statsLength >= (int)sizeof(statsMessage))
+    {
+        fprintf(stderr, "sendStatsLine: %d byte line cut to %zu: %s\n", statsLength, sizeof(statsMessage) - 1, statsMessage);
+    }
+
+    if (outputQueueAppendText(&session->outputQueue, statsMessage) < 0)
+    {
+        perror("DEBUG sendServerStats: send failed");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : sendServerStats
+ *
+ * DESCRIPTION : This function sends the server's counters and the client's own counters back to the client that asked
+ *
+ * PARAMETERS : ClientSession *session : The session that sent the stats verb.
+ *
+ * RETURNS : void
+ */
+void sendServerStats(ClientSession *session)
+{
+    if (sendStatsLine(session, "STATS me ok=%lu thr=%lu drop=%lu delay=%lu | all thr=%lu drop=%lu delay=%lu kick=%lu",
+                      session->rateLimit.framesAllowed, session->rateLimit.framesThrottled, session->framesDropped, session->framesDelayed,
+                      __atomic_load_n(&serverStats.framesThrottled, __ATOMIC_RELAXED),
+                      __atomic_load_n(&serverStats.framesDropped, __ATOMIC_RELAXED),
+                      __atomic_load_n(&serverStats.framesDelayed, __ATOMIC_RELAXED),
+                      __atomic_load_n(&serverStats.clientsDisconnectedForRate, __ATOMIC_RELAXED)) < 0)
+    {
+        return;
+    }
+
+    // Second line: load as seen by the admission controller
+    if (sendStatsLine(session, "STATS load lvl=%d queue=%d out=%d lat=%lldus rss=%lldMB rejected=%lu shed=%lu slow=%lu",
+                      admissionLevel(),
+                      __atomic_load_n(&admissionState.pendingBroadcasts, __ATOMIC_RELAXED),
+                      outputQueueTotalFrames(),
+                      __atomic_load_n(&admissionState.broadcastLatencyNs, __ATOMIC_RELAXED) / 1000,
+                      __atomic_load_n(&admissionState.residentBytes, __ATOMIC_RELAXED) / (1024 * 1024),
+                      __atomic_load_n(&admissionState.sessionsRejected, __ATOMIC_RELAXED),
+                      __atomic_load_n(&admissionState.framesShed, __ATOMIC_RELAXED),
+                      __atomic_load_n(&serverStats.clientsDisconnectedForBacklog, __ATOMIC_RELAXED)) < 0)
+    {
+        return;
+    }
+
+    // Third line: what the search index holds
+    unsigned int documentCount;
+    unsigned int termCount;
+    searchIndexSize(&roomIndex, &documentCount, &termCount);
+    if (sendStatsLine(session, "STATS search docs=%u terms=%u", documentCount, termCount) < 0)
+    {
+        return;
+    }
+
+    // Fourth line: the content filter
+    int patternCount;
+    int stateCount;
+    unsigned long messagesMasked;
+    unsigned long messagesBlocked;
+    contentFilterCounts(&patternCount, &stateCount, &messagesMasked, &messagesBlocked);
+    if (sendStatsLine(session, "STATS filter patterns=%d states=%d masked=%lu blocked=%lu",
+                      patternCount, stateCount, messagesMasked, messagesBlocked) < 0)
+    {
+        return;
+    }
+
+    // Fifth line: links to other nodes
+    if (sendStatsLine(session, "STATS federation node=%lu peers=%d relayed=%lu received=%lu dup=%lu batches=%lu dropped=%lu",
+                      federationNodeId(), federationConnectedPeers(),
+                      __atomic_load_n(&federationStats.framesRelayed, __ATOMIC_RELAXED),
+                      __atomic_load_n(&federationStats.framesReceived, __ATOMIC_RELAXED),
+                      __atomic_load_n(&federationStats.duplicatesDropped, __ATOMIC_RELAXED),
+                      __atomic_load_n(&federationStats.batchesSent, __ATOMIC_RELAXED),
+                      __atomic_load_n(&federationStats.framesDropped, __ATOMIC_RELAXED)) < 0)
+    {
+        return;
+    }
+
+    // Sixth line: compressed batches, and the bytes they saved
+    unsigned long compressedBatches;
+    unsigned long compressedRawBytes;
+    unsigned long compressedSentBytes;
+    outputQueueCompressionCounts(&compressedBatches, &compressedRawBytes, &compressedSentBytes);
+    if (sendStatsLine(session, "STATS compress batches=%lu raw=%lu sent=%lu",
+                      compressedBatches, compressedRawBytes, compressedSentBytes) < 0)
+    {
+        return;
+    }
+
+    // Seventh line: capture mode
+    if (sendStatsLine(session, "STATS capture on=%d records=%lu bytes=%lu dropped=%lu", trafficCaptureIsActive(),
+                      __atomic_load_n(&captureStats.recordsWritten, __ATOMIC_RELAXED),
+                      __atomic_load_n(&captureStats.bytesWritten, __ATOMIC_RELAXED),
+                      __atomic_load_n(&captureStats.recordsDropped, __ATOMIC_RELAXED)) < 0)
+    {
+        return;
+    }
+
+    // Eighth line: the message trace sampler
+    if (sendStatsLine(session, "STATS trace every=%u spans=%lu slowest=%lldus dumps=%lu",
+                      __atomic_load_n(&traceStats.sampleEvery, __ATOMIC_RELAXED),
+                      __atomic_load_n(&traceStats.spansRecorded, __ATOMIC_RELAXED),
+                      __atomic_load_n(&traceStats.slowestNs, __ATOMIC_RELAXED) / 1000,
+                      __atomic_load_n(&traceStats.dumps, __ATOMIC_RELAXED)) < 0)
+    {
+        return;
+    }
+
+    // Ninth line: the control lane, and byes that got ahead of the chat in front of them
+    unsigned long controlSent;
+    unsigned long controlAhead;
+    outputQueueControlCounts(&controlSent, &controlAhead);
+    if (sendStatsLine(session, "STATS lanes control=%lu ahead=%lu byes=%lu", controlSent, controlAhead,
+                      __atomic_load_n(&serverStats.byesSeenEarly, __ATOMIC_RELAXED)) < 0)
+    {
+        return;
+    }
+
+    // Tenth line: state snapshots
+    if (sendStatsLine(session, "STATS snapshot on=%d restored=%u load=%lldus written=%lu failed=%lu bytes=%lu",
+                      snapshotStats.isActive, snapshotStats.restoredMessages, snapshotStats.loadMicroseconds,
+                      __atomic_load_n(&snapshotStats.written, __ATOMIC_RELAXED), __atomic_load_n(&snapshotStats.failed, __ATOMIC_RELAXED),
+                      __atomic_load_n(&snapshotStats.lastBytes, __ATOMIC_RELAXED)) < 0)
+    {
+        return;
+    }
+
+    // Eleventh line: the memory budget, what this client holds and what was done to keep to the budget
+    if (sendStatsLine(session, "STATS memory lvl=%d used=%lldKB peak=%lldKB soft=%lldKB hard=%lldKB me=%lldKB trimmed=%lluKB shed=%lu refused=%lu",
+                               memoryBudgetLevel(), __atomic_load_n(&memoryBudgetState.usedBytes, __ATOMIC_RELAXED) / 1024,
+                               __atomic_load_n(&memoryBudgetState.peakBytes, __ATOMIC_RELAXED) / 1024, memoryBudgetState.softLimitBytes / 1024,
+                               memoryBudgetState.hardLimitBytes / 1024, memoryAccountTotal(&session->memoryAccount) / 1024,
+                               __atomic_load_n(&memoryBudgetState.trimmedBytes, __ATOMIC_RELAXED) / 1024,
+                               __atomic_load_n(&memoryBudgetState.clientsShed, __ATOMIC_RELAXED),
+                               __atomic_load_n(&memoryBudgetState.refusals, __ATOMIC_RELAXED)) < 0)
+    {
+        return;
+    }
+
+    // Twelfth line: what the memory in use is made of
+    sendStatsLine(session, "STATS memory-kinds stacks=%lldKB inbox=%lldKB out=%lldKB lz=%lldKB up=%lldKB frames=%lldKB search=%lldKB fed=%lldKB cap=%lldKB trace=%lldKB",
+                           __atomic_load_n(&memoryBudgetState.kindBytes[MEMORY_STACKS], __ATOMIC_RELAXED) / 1024,
+                           __atomic_load_n(&memoryBudgetState.kindBytes[MEMORY_INBOX], __ATOMIC_RELAXED) / 1024,
+                           __atomic_load_n(&memoryBudgetState.kindBytes[MEMORY_OUTPUT], __ATOMIC_RELAXED) / 1024,
+                           __atomic_load_n(&memoryBudgetState.kindBytes[MEMORY_COMPRESSION], __ATOMIC_RELAXED) / 1024,
+                           __atomic_load_n(&memoryBudgetState.kindBytes[MEMORY_UPLOADS], __ATOMIC_RELAXED) / 1024,
+                           __atomic_load_n(&memoryBudgetState.kindBytes[MEMORY_FRAMES], __ATOMIC_RELAXED) / 1024,
+                           __atomic_load_n(&memoryBudgetState.kindBytes[MEMORY_SEARCH], __ATOMIC_RELAXED) / 1024,
+                           __atomic_load_n(&memoryBudgetState.kindBytes[MEMORY_FEDERATION], __ATOMIC_RELAXED) / 1024,
+                           __atomic_load_n(&memoryBudgetState.kindBytes[MEMORY_CAPTURE], __ATOMIC_RELAXED) / 1024,
+                           __atomic_load_n(&memoryBudgetState.kindBytes[MEMORY_TRACE], __ATOMIC_RELAXED) / 1024);
+}
+
+/*
+ * FUNCTION : sendSearchResults
+ *
+ * DESCRIPTION : This function answers a search with the most recent matching lines, newest first, then a frame
+ * with the number of matches and how long the search took
+ *
+ * PARAMETERS : ClientSession *session : The session that searched.
+ *              const char *queryText : The query (see searchParseQuery).
+ *
+ * RETURNS : void
+ */
+void sendSearchResults(ClientSession *session, const char *queryText)
+{
+    SearchQuery query;
+    searchParseQuery(queryText, &query);
+
+    SearchResult *results = malloc(SEARCH_MAX_RESULTS * sizeof(SearchResult));
+    if (results == NULL)
+    {
+        perror("malloc failed");
+        return;
+    }
+    long long startNs = monotonicNanoseconds();
+    int resultCount = searchIndexQuery(&roomIndex, &query, results, SEARCH_MAX_RESULTS);
+    long long searchUs = (monotonicNanoseconds() - startNs) / 1000;
+
+    char resultFrame[SEARCH_RESULT_TEXT_SIZE + MAX_PROTOL_MESSAGE_SIZE];
+    for (int i = 0; i < resultCount; i++)
+    {
+        snprintf(resultFrame, sizeof(resultFrame), "%s%lu|%lld|%s", PROTOCOL_SEARCH_HIT, results[i].sequence, results[i].serverMs, results[i].text);
+        outputQueueAppendText(&session->outputQueue, resultFrame);
+    }
+    snprintf(resultFrame, sizeof(resultFrame), "%s%d|%lld", PROTOCOL_SEARCH_END, resultCount, searchUs);
+    outputQueueAppendText(&session->outputQueue, resultFrame);
+    free(results);
+}
+
+/*
+ * FUNCTION : clientHandler
+ *
+ * DESCRIPTION : This function takes a client session and starts the message processing for it
+ *
+ * PARAMETERS : void *clientSessionPointer : Pointer to the client's session (cast from ClientSession *).
+ *
+ * RETURNS : void * : Always returns NULL.
+ */
+void *clientHandler(void *clientSessionPointer)
+{
+    // Cast the pointer to the session
+    ClientSession *session = (ClientSession *)clientSessionPointer;
+    processClientMessage(session);
+
+    // Stop the heartbeat first, once this returns the timer thread can't touch the socket anymore
+    timerWheelCancel(&heartbeatWheel, &session->idleTimer);
+
+    removeClientSession(session);
+    epochThreadExit();
+    memoryRelease(&session->memoryAccount, MEMORY_STACKS, CLIENT_THREAD_STACK_BYTES);
+    return NULL;
+}
+
+/*
+ * FUNCTION : removeClientSession
+ *
+ * DESCRIPTION : This function takes a client out of the subscriber snapshot, lets the pool finish the frames it
+ * already sent, waits for any broadcast that might still be queueing to it, then closes it and frees its slot
+ *
+ * PARAMETERS : ClientSession *session : The session to remove.
+ *
+ * RETURNS : void
+ */
+void removeClientSession(ClientSession *session)
+{
+    int clientSocket = session->socket;
+
+    // Stop new broadcasts from seeing the client
+    pthread_mutex_lock(&clientMutex);
+    session->isLeaving = 1;
+    publishSubscriberSnapshot();
+    pthread_mutex_unlock(&clientMutex);
+
+    // The reader has stopped, so the inbox only shrinks. Its last frames still go out to everyone else.
+    while (1)
+    {
+        pthread_mutex_lock(&session->inboxMutex);
+        int isScheduled = session->isInboxScheduled;
+        pthread_mutex_unlock(&session->inboxMutex);
+        if (!isScheduled)
+        {
+            break;
+        }
+        struct timespec inboxWait = {0, 1000000L};
+        nanosleep(&inboxWait, NULL);
+    }
+
+    // Broadcasts that loaded an older snapshot may still be queueing to it
+    epochSynchronize();
+    outputQueueClose(&session->outputQueue);
+
+    // An upload cut off part way is never published
+    if (session->uploadBlob != NULL)
+    {
+        blobRelease(session->uploadBlob);
+        session->uploadBlob = NULL;
+        memoryRelease(&session->memoryAccount, MEMORY_UPLOADS, sizeof(Blob));
+    }
+    session->uploadChunkRemaining = 0;
+
+    // Remove the client from the list
+    pthread_mutex_lock(&clientMutex);
+    for (int i = 0; i < MAX_CLIENTS; i++)
+    {
+        if (clientSocketList[i] == clientSocket)
+        {
+            clientSocketList[i] = -1;
+            break;
+        }
+    }
+    // Close while still holding the lock, the slot (and its transport) can be reused as soon as it is released
+    transportClose(&session->transport);
+    session->socket = -1;
+    pthread_mutex_unlock(&clientMutex);
+}
+
+/*
+ * FUNCTION : refreshClientHeartbeat
+ *
+ * DESCRIPTION : This function (re)starts a client's idle timer, called whenever anything arrives from the client.
+ * Moving an entry on the wheel is O(1), so doing this on every read is cheap.
+ *
+ * PARAMETERS : ClientSession *session : The session that just showed activity.
+ *
+ * RETURNS : void
+ */
+void refreshClientHeartbeat(ClientSession *session)
+{
+    timerWheelArm(&heartbeatWheel, &session->idleTimer, SECONDS_TO_TICKS(HEARTBEAT_IDLE_SECONDS), sendHeartbeatPing);
+}
+
+/*
+ * FUNCTION : sendHeartbeatPing
+ *
+ * DESCRIPTION : Timer callback for a client that has been idle for HEARTBEAT_IDLE_SECONDS.
+ * Sends a ping and gives the client HEARTBEAT_PONG_TIMEOUT_SECONDS to answer before it gets reaped.
+ * Runs on the timer thread with the wheel locked, the output queue never blocks on the peer.
+ *
+ * PARAMETERS : TimerEntry *entry : The idle timer of the client.
+ *
+ * RETURNS : unsigned long : Ticks to re-arm the timer for.
+ */
+unsigned long sendHeartbeatPing(TimerEntry *entry)
+{
+    ClientSession *session = (ClientSession *)entry->context;
+
+    // If the ping can't even be queued, the reaper will deal with the client
+    outputQueueAppendControl(&session->outputQueue, PROTOCOL_PING);
+
+    entry->callback = reapDeadPeer;
+    return SECONDS_TO_TICKS(HEARTBEAT_PONG_TIMEOUT_SECONDS);
+}
+
+/*
+ * FUNCTION : reapDeadPeer
+ *
+ * DESCRIPTION : Timer callback for a client that never answered its ping.
+ * Shutting the socket down wakes the client thread out of read(), which then frees the slot and closes the socket
+ * the same way as a normal disconnect.
+ *
+ * PARAMETERS : TimerEntry *entry : The idle timer of the client.
+ *
+ * RETURNS : unsigned long : Always 0 (the timer is not re-armed).
+ */
+unsigned long reapDeadPeer(TimerEntry *entry)
+{
+    ClientSession *session = (ClientSession *)entry->context;
+
+    // printf("DEBUG reapDeadPeer: Client on socket #%d missed its heartbeat.\n", session->socket);
+    transportShutdown(&session->transport);
+    return 0;
+}
+
+/*
+ * FUNCTION : enforceMemoryBudget
+ *
+ * DESCRIPTION : This function gets memory back while the server is over its soft limit. Spare inbox frames (kept
+ * only to save a malloc) are freed first, except the ones low-latency mode set up at startup so its message path
+ * never allocates. If that isn't enough the client with the biggest output backlog is
+ * disconnected, as long as it has a backlog worth the name: a burst of slow readers is what runs a chat server out
+ * of memory, and every broadcast they haven't taken is held for them. One client per call, called on every timer
+ * tick, so shedding stops as soon as the server is back under the limit.
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : void
+ */
+void enforceMemoryBudget(void)
+{
+    if (memoryBudgetLevel() == MEMORY_WITHIN_BUDGET)
+    {
+        return;
+    }
+
+    long long trimmedBytes = 0;
+    int keptFrameCount = lowLatencyIsActive() ? LOW_LATENCY_INBOX_FRAMES : 0;
+    for (int i = 0; i < MAX_CLIENTS; i++)
+    {
+        ClientSession *session = &clientSessionList[i];
+        pthread_mutex_lock(&session->inboxMutex);
+        InboundFrame **spareLink = &session->freeFrames;
+        for (int kept = 0; kept < keptFrameCount && *spareLink != NULL; kept++)
+        {
+            spareLink = &(*spareLink)->next;
+        }
+        InboundFrame *spareFrames = *spareLink;
+        *spareLink = NULL;
+        pthread_mutex_unlock(&session->inboxMutex);
+        while (spareFrames != NULL)
+        {
+            InboundFrame *nextFrame = spareFrames->next;
+            free(spareFrames);
+            memoryRelease(&session->memoryAccount, MEMORY_INBOX, sizeof(InboundFrame) + MAX_PROTOL_MESSAGE_SIZE);
+            trimmedBytes += sizeof(InboundFrame) + MAX_PROTOL_MESSAGE_SIZE;
+            spareFrames = nextFrame;
+        }
+    }
+    if (trimmedBytes > 0)
+    {
+        memoryCountTrimmed(trimmedBytes);
+    }
+    if (memoryBudgetLevel() == MEMORY_WITHIN_BUDGET)
+    {
+        return;
+    }
+
+    // The backlogs are read without their locks, an estimate is good enough to pick one
+    pthread_mutex_lock(&clientMutex);
+    ClientSession *slowestSession = NULL;
+    size_t slowestBacklog = MEMORY_SHED_MIN_BACKLOG_BYTES - 1;
+    for (int i = 0; i < MAX_CLIENTS; i++)
+    {
+        size_t backlog = __atomic_load_n(&clientSessionList[i].outputQueue.queuedBytes, __ATOMIC_RELAXED);
+        if (clientSocketList[i] != -1 && !clientSessionList[i].isLeaving && backlog > slowestBacklog)
+        {
+            slowestSession = &clientSessionList[i];
+            slowestBacklog = backlog;
+        }
+    }
+    if (slowestSession != NULL && outputQueueShed(&slowestSession->outputQueue) == 0)
+    {
+        memoryCountShed();
+    }
+    pthread_mutex_unlock(&clientMutex);
+}
+
+/*
+ * FUNCTION : heartbeatTimerThread
+ *
+ * DESCRIPTION : This function is the single thread that turns the heartbeat wheel and samples server load.
+ * It works out how many ticks really passed from the monotonic clock so a late wakeup doesn't drift the timers.
+ *
+ * PARAMETERS : void *unused : Not used.
+ *
+ * RETURNS : void * : Never returns.
+ */
+void *heartbeatTimerThread(void *unused)
+{
+    struct timespec startTime;
+    struct timespec currentTime;
+    struct timespec tickLength = {0, TIMER_TICK_MS * 1000000L};
+    unsigned long ticksDone = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    while (1)
+    {
+        nanosleep(&tickLength, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &currentTime);
+
+        long long elapsedMs = (currentTime.tv_sec - startTime.tv_sec) * 1000LL + (currentTime.tv_nsec - startTime.tv_nsec) / 1000000;
+        unsigned long ticksDue = (unsigned long)(elapsedMs / TIMER_TICK_MS);
+        if (ticksDue > ticksDone)
+        {
+            timerWheelAdvance(&heartbeatWheel, ticksDue - ticksDone);
+            ticksDone = ticksDue;
+
+            // Message timestamps come from here rather than a clock read per message
+            coarseClockUpdate();
+
+            // Piggyback the admission controller's sampling on the same tick
+            admissionSample();
+
+            // And getting memory back when it is over budget
+            enforceMemoryBudget();
+
+            // A new pattern list is compiled here, off the broadcast path
+            contentFilterReloadIfRequested();
+
+            // Captured traffic goes to disk from here, never from a client's reader
+            trafficCaptureFlush();
+
+            // And broadcasts are indexed in batches, never on the broadcast path
+            searchIndexFlush(&roomIndex);
+
+            // Sampled spans too, when asked for
+            messageTraceDumpIfRequested();
+
+            // And the history snapshot, written by a child so nothing here waits on the disk
+            stateSnapshotWriteIfDue();
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
 {
-    int listeningSocket = initializeListener();
+    unsigned long nodeId = 0;
+    if (parseServerArguments(argc, argv, &nodeId) < 0)
+    {
+        printf("Usage: chat-server [%sPORT] [%sID] [%sPATH] [%sPATH] [%sN] [%sCPUS] [%sSOFT:HARD] [%sADDRESS[:PORT]]... "
+               "[%sHOST[:PORT]]...\n", SERVER_PORT_SWITCH, SERVER_NODE_SWITCH, SERVER_CAPTURE_SWITCH, SERVER_SNAPSHOT_SWITCH,
+               SERVER_TRACE_SWITCH, SERVER_BUSY_POLL_SWITCH, SERVER_MEMORY_SWITCH, SERVER_LISTEN_SWITCH, SERVER_PEER_SWITCH);
+        exit(EXIT_FAILURE);
+    }
+
+    // This node's id, made up once the port is known when -node didn't give one
+    if (nodeId == 0)
+    {
+        nodeId = makeNodeId();
+    }
+
+    int listeningSockets[SERVER_MAX_LISTENERS];
+    int clientListenerCount = initializeListeners(argc, argv, listeningSockets);
+    int unixListeningSocket = initializeUnixListener();
+
+    // A peer that vanished should give us EPIPE on send, not kill the whole server
+    signal(SIGPIPE, SIG_IGN);
 
     // Initialize the global clientSocketList array to store client information
     for (int i = 0; i < MAX_CLIENTS; i++)
     {
         // Set all entries to -1 (for checking later, if -1, that means no client exists at this index!)
         clientSocketList[i] = -1;
+        clientSessionList[i].socket = -1;
+        clientSessionList[i].idleTimer.context = &clientSessionList[i];
+        clientSessionList[i].idleTimer.isArmed = 0;
+        clientSessionList[i].isLeaving = 0;
+        clientSessionList[i].hasSaidBye = 0;
+        clientSessionList[i].isSubscribed = 0;
+        clientSessionList[i].uploadBlob = NULL;
+        clientSessionList[i].uploadChunkRemaining = 0;
+        clientSessionList[i].slotIndex = i;
+        clientSessionList[i].inboxTask.run = processInbox;
+        clientSessionList[i].freeFrames = NULL;
+        lowLatencyLinkInitialize(&clientSessionList[i].networkLink, &clientSessionList[i], i);
+        for (int j = 0; lowLatencyIsActive() && j < LOW_LATENCY_INBOX_FRAMES; j++)
+        {
+            // Low-latency mode sets up the inbox frames now rather than on the first messages
+            InboundFrame *spareFrame = malloc(sizeof(InboundFrame) + MAX_PROTOL_MESSAGE_SIZE);
+            if (spareFrame == NULL)
+            {
+                break;
+            }
+            memoryCharge(&clientSessionList[i].memoryAccount, MEMORY_INBOX, sizeof(InboundFrame) + MAX_PROTOL_MESSAGE_SIZE);
+            spareFrame->next = clientSessionList[i].freeFrames;
+            clientSessionList[i].freeFrames = spareFrame;
+        }
+        pthread_mutex_init(&clientSessionList[i].inboxMutex, NULL);
+        outputQueueInitialize(&clientSessionList[i].outputQueue, &clientSessionList[i].memoryAccount);
+    }
+    publishSubscriberSnapshot();
+
+    // Broadcasts are numbered from the start time (in microseconds), so numbers keep going up across restarts
+    // and a resume point from before a restart is never ahead of the new server
+    coarseClockUpdate();
+    historyInitialize(&roomHistory, (unsigned long)coarseClockMilliseconds() * 1000);
+    blobStoreInitialize(&roomBlobs);
+
+    // Recent history from before a restart, mapped rather than replayed, and snapshots of it from here on
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], SERVER_SNAPSHOT_SWITCH, strlen(SERVER_SNAPSHOT_SWITCH)) == 0)
+        {
+            stateSnapshotLoad(&roomHistory, argv[i] + strlen(SERVER_SNAPSHOT_SWITCH));
+            if (stateSnapshotStart(&roomHistory, argv[i] + strlen(SERVER_SNAPSHOT_SWITCH)) < 0)
+            {
+                printf("Snapshot path too long: %s\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    // Filtered words (kill -HUP to read the list again without stopping traffic)
+    if (contentFilterLoad(CONTENT_FILTER_FILE) < 0)
+    {
+        perror("content filter failed");
+        exit(EXIT_FAILURE);
+    }
+    signal(CONTENT_FILTER_RELOAD_SIGNAL, contentFilterRequestReload);
+
+    // Sampled message spans (kill -USR2 writes them to TRACE_DUMP_PATH)
+    signal(TRACE_DUMP_SIGNAL, messageTraceRequestDump);
+
+    // Capture mode, for replaying this traffic later with chat-replay
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], SERVER_CAPTURE_SWITCH, strlen(SERVER_CAPTURE_SWITCH)) == 0 &&
+            trafficCaptureStart(argv[i] + strlen(SERVER_CAPTURE_SWITCH)) < 0)
+        {
+            perror("capture failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (searchIndexInitialize(&roomIndex) < 0)
+    {
+        perror("search index failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Parse/format/broadcast run on a pool sized to the machine, sends the clients aren't ready for on the writer
+    // (in low-latency mode, one worker per core the network threads left)
+    int workerCount = lowLatencyWorkerCoreCount() > 0 ? lowLatencyWorkerCoreCount() : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (workerPoolStart(workerCount) < 0 || outputQueueStartWriter() < 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    if (lowLatencyIsActive() && lowLatencyStartNetworkThreads(serviceClientOnNetwork) < 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // Start the thread that drives every client's heartbeat
+    timerWheelInitialize(&heartbeatWheel);
+    pthread_t timerThreadId;
+    if (pthread_create(&timerThreadId, NULL, heartbeatTimerThread, NULL) != 0)
+    {
+        perror("pthread_create failed");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(timerThreadId);
+
+    // Link up with the other nodes, and let them link to us
+    int federationListeningSocket = federationStart(nodeId, serverPort, deliverRelayedMessage);
+    if (federationListeningSocket < 0)
+    {
+        perror("federation listen failed");
+        exit(EXIT_FAILURE);
     }
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], SERVER_PEER_SWITCH, strlen(SERVER_PEER_SWITCH)) == 0 &&
+            federationAddPeer(argv[i] + strlen(SERVER_PEER_SWITCH)) < 0)
+        {
+            printf("Too many peers, %s ignored\n", argv[i]);
+        }
+    }
+    printf("Node %lu taking peers on port %d\n", nodeId, serverPort + FEDERATION_PORT_OFFSET);
 
-    // printf("Server listening on port %d\n", SERVER_PORT);
+    // Everything is set up, low-latency mode keeps it in memory from here on
+    lowLatencyLockMemory();
 
     // Start accepting connections
+    struct pollfd listenPolls[SERVER_MAX_LISTENERS + 2];
+    int listenerCount = 0;
+    for (int i = 0; i < clientListenerCount; i++)
+    {
+        listenPolls[listenerCount++] = (struct pollfd){listeningSockets[i], POLLIN, 0};
+    }
+    if (unixListeningSocket >= 0)
+    {
+        listenPolls[listenerCount++] = (struct pollfd){unixListeningSocket, POLLIN, 0};
+    }
+    int federationPollIndex = listenerCount;
+    listenPolls[listenerCount++] = (struct pollfd){federationListeningSocket, POLLIN, 0};
     while (1)
     {
-        acceptConnection(listeningSocket);
+        if (poll(listenPolls, listenerCount, -1) < 0 && errno != EINTR)
+        {
+            perror("poll failed");
+            break;
+        }
+        for (int i = 0; i < listenerCount; i++)
+        {
+            if ((listenPolls[i].revents & POLLIN) && i == federationPollIndex)
+            {
+                federationAcceptPeer(listenPolls[i].fd);
+            }
+            else if (listenPolls[i].revents & POLLIN)
+            {
+                acceptConnection(listenPolls[i].fd);
+            }
+        }
+
+        // Under load leave the rest of the backlog in the kernel for a moment so established clients get the CPU
+        if (admissionLevel() != ADMISSION_NORMAL)
+        {
+            struct timespec acceptPause = {0, ADMISSION_ELEVATED_PAUSE_MS * 1000000L};
+            nanosleep(&acceptPause, NULL);
+        }
     }
 
-    close(listeningSocket);
+    for (int i = 0; i < clientListenerCount; i++)
+    {
+        close(listeningSockets[i]);
+    }
+    if (unixListeningSocket >= 0)
+    {
+        close(unixListeningSocket);
+        unlink(unixSocketPath);
+    }
     return 0;
 }
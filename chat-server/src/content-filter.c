@@ -0,0 +1,406 @@
+#include "../inc/content-filter.h"
+#include "../inc/epoch.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// One line of the pattern file, folded to lower case
+typedef struct
+{
+    unsigned char bytes[CONTENT_FILTER_MAX_PATTERN];
+    int length;
+    int action; // CONTENT_FILTER_MASK or CONTENT_FILTER_BLOCK
+} FilterPattern;
+
+// Filter every broadcast goes through, NULL when there are no patterns. Swapped by contentFilterLoad.
+static ContentFilter *activeFilter = NULL;
+
+// Set from the signal handler, the reload itself happens on the timer thread
+static volatile sig_atomic_t isReloadRequested = 0;
+
+// Messages changed or stopped since the server started (across reloads)
+static unsigned long messagesMasked = 0;
+static unsigned long messagesBlocked = 0;
+
+/*
+ * FUNCTION : freeContentFilter
+ *
+ * DESCRIPTION : This function frees a compiled filter (handed to the epoch reclaimer when a new one is swapped in)
+ *
+ * PARAMETERS : void *filterPointer : The ContentFilter.
+ *
+ * RETURNS : void
+ */
+static void freeContentFilter(void *filterPointer)
+{
+    ContentFilter *filter = (ContentFilter *)filterPointer;
+    free(filter->transitions);
+    free(filter->matchLength);
+    free(filter->matchAction);
+    free(filter);
+}
+
+/*
+ * FUNCTION : readPatterns
+ *
+ * DESCRIPTION : This function reads the pattern file. Blank lines and comments are skipped, a "block " or "mask "
+ * in front picks the action (mask when there is neither).
+ *
+ * PARAMETERS : FILE *patternFile : The open pattern file.
+ *              FilterPattern **patterns : Set to the patterns read (free with free), NULL if there are none.
+ *
+ * RETURNS : int : The number of patterns read, -1 if memory ran out.
+ */
+static int readPatterns(FILE *patternFile, FilterPattern **patterns)
+{
+    int patternCount = 0;
+    int patternCapacity = 0;
+    char line[CONTENT_FILTER_MAX_PATTERN * 2];
+
+    *patterns = NULL;
+    while (fgets(line, sizeof(line), patternFile) != NULL)
+    {
+        // Lines too long for the buffer are cut (the rest of the line is skipped)
+        if (strchr(line, '\n') == NULL && !feof(patternFile))
+        {
+            int nextByte;
+            while ((nextByte = fgetc(patternFile)) != EOF && nextByte != '\n')
+            {
+            }
+        }
+        line[strcspn(line, "\r\n")] = '\0';
+
+        const char *patternText = line;
+        int action = CONTENT_FILTER_MASK;
+        if (strncmp(patternText, CONTENT_FILTER_BLOCK_PREFIX, strlen(CONTENT_FILTER_BLOCK_PREFIX)) == 0)
+        {
+            patternText += strlen(CONTENT_FILTER_BLOCK_PREFIX);
+            action = CONTENT_FILTER_BLOCK;
+        }
+        else if (strncmp(patternText, CONTENT_FILTER_MASK_PREFIX, strlen(CONTENT_FILTER_MASK_PREFIX)) == 0)
+        {
+            patternText += strlen(CONTENT_FILTER_MASK_PREFIX);
+        }
+        if (*patternText == '\0' || line[0] == CONTENT_FILTER_COMMENT)
+        {
+            continue;
+        }
+
+        if (patternCount == patternCapacity)
+        {
+            int newCapacity = patternCapacity == 0 ? 64 : patternCapacity * 2;
+            FilterPattern *newPatterns = realloc(*patterns, newCapacity * sizeof(FilterPattern));
+            if (newPatterns == NULL)
+            {
+                free(*patterns);
+                *patterns = NULL;
+                return -1;
+            }
+            *patterns = newPatterns;
+            patternCapacity = newCapacity;
+        }
+
+        FilterPattern *pattern = &(*patterns)[patternCount++];
+        pattern->length = 0;
+        pattern->action = action;
+        for (; *patternText != '\0' && pattern->length < CONTENT_FILTER_MAX_PATTERN; patternText++)
+        {
+            pattern->bytes[pattern->length++] = (unsigned char)tolower((unsigned char)*patternText);
+        }
+    }
+    return patternCount;
+}
+
+/*
+ * FUNCTION : compileFilter
+ *
+ * DESCRIPTION : This function builds the automaton for a set of patterns. Only bytes that appear in a pattern get a
+ * column of their own, so the rows stay a few dozen entries wide and the whole table usually fits in cache. The
+ * trie is built first, then a breadth first pass works out each state's failure link and fills in every missing
+ * transition from it, leaving a plain table lookup per byte.
+ *
+ * PARAMETERS : const FilterPattern *patterns : The patterns.
+ *              int patternCount : How many there are (at least one).
+ *
+ * RETURNS : ContentFilter * : The compiled filter, NULL if memory ran out.
+ */
+static ContentFilter *compileFilter(const FilterPattern *patterns, int patternCount)
+{
+    ContentFilter *filter = calloc(1, sizeof(ContentFilter));
+    if (filter == NULL)
+    {
+        return NULL;
+    }
+    filter->patternCount = patternCount;
+
+    // Columns: one per (lower case) byte the patterns use, upper case letters share the lower case column
+    filter->classCount = 1;
+    int stateCapacity = 1;
+    for (int i = 0; i < patternCount; i++)
+    {
+        for (int j = 0; j < patterns[i].length; j++)
+        {
+            if (filter->byteClass[patterns[i].bytes[j]] == 0)
+            {
+                filter->byteClass[patterns[i].bytes[j]] = (unsigned char)filter->classCount++;
+            }
+        }
+        stateCapacity += patterns[i].length;
+    }
+    for (int letter = 'A'; letter <= 'Z'; letter++)
+    {
+        filter->byteClass[letter] = filter->byteClass[tolower(letter)];
+    }
+
+    // Every pattern byte can add at most one state
+    int classCount = filter->classCount;
+    filter->transitions = calloc((size_t)stateCapacity * classCount, sizeof(unsigned int));
+    filter->matchLength = calloc(stateCapacity, 1);
+    filter->matchAction = calloc(stateCapacity, 1);
+    int *failureLinks = malloc(stateCapacity * sizeof(int));
+    int *stateQueue = malloc(stateCapacity * sizeof(int));
+    if (filter->transitions == NULL || filter->matchLength == NULL || filter->matchAction == NULL || failureLinks == NULL || stateQueue == NULL)
+    {
+        free(failureLinks);
+        free(stateQueue);
+        freeContentFilter(filter);
+        return NULL;
+    }
+
+    // The trie. While it is built, 0 means no edge (nothing ever goes back to the root).
+    filter->stateCount = 1;
+    for (int i = 0; i < patternCount; i++)
+    {
+        unsigned int state = 0;
+        for (int j = 0; j < patterns[i].length; j++)
+        {
+            unsigned int *edge = &filter->transitions[(size_t)state * classCount + filter->byteClass[patterns[i].bytes[j]]];
+            if (*edge == 0)
+            {
+                *edge = (unsigned int)filter->stateCount++;
+            }
+            state = *edge;
+        }
+        filter->matchLength[state] = (unsigned char)patterns[i].length;
+        if (patterns[i].action > filter->matchAction[state])
+        {
+            filter->matchAction[state] = (unsigned char)patterns[i].action;
+        }
+    }
+
+    // Breadth first, so a state's failure link (always shallower) is finished before the state itself
+    int queueHead = 0;
+    int queueTail = 0;
+    failureLinks[0] = 0;
+    stateQueue[queueTail++] = 0;
+    while (queueHead < queueTail)
+    {
+        int state = stateQueue[queueHead++];
+        unsigned int *row = &filter->transitions[(size_t)state * classCount];
+        const unsigned int *failureRow = &filter->transitions[(size_t)failureLinks[state] * classCount];
+        for (int column = 0; column < classCount; column++)
+        {
+            if (row[column] == 0)
+            {
+                // No edge: go where the longest suffix that has one goes (the root loops back to itself)
+                row[column] = state == 0 ? 0 : failureRow[column];
+                continue;
+            }
+
+            int child = (int)row[column];
+            failureLinks[child] = state == 0 ? 0 : (int)failureRow[column];
+
+            // A state also ends every pattern that ends at its failure link, keep the longest and strongest
+            if (filter->matchLength[failureLinks[child]] > filter->matchLength[child])
+            {
+                filter->matchLength[child] = filter->matchLength[failureLinks[child]];
+            }
+            if (filter->matchAction[failureLinks[child]] > filter->matchAction[child])
+            {
+                filter->matchAction[child] = filter->matchAction[failureLinks[child]];
+            }
+            stateQueue[queueTail++] = child;
+        }
+    }
+    free(failureLinks);
+    free(stateQueue);
+
+    // Patterns that share prefixes leave spare rows at the end
+    unsigned int *trimmed = realloc(filter->transitions, (size_t)filter->stateCount * classCount * sizeof(unsigned int));
+    if (trimmed != NULL)
+    {
+        filter->transitions = trimmed;
+    }
+    return filter;
+}
+
+/*
+ * FUNCTION : contentFilterLoad
+ *
+ * DESCRIPTION : This function reads and compiles the pattern file and swaps it in for every message that follows.
+ * Messages being filtered keep the old filter until they are done. A missing file means no filtering.
+ *
+ * PARAMETERS : const char *path : The pattern file.
+ *
+ * RETURNS : int : The number of patterns now in use, -1 if the file couldn't be read or compiled (errno set,
+ *                 the old filter stays).
+ */
+int contentFilterLoad(const char *path)
+{
+    ContentFilter *newFilter = NULL;
+    int patternCount = 0;
+
+    FILE *patternFile = fopen(path, "r");
+    if (patternFile == NULL && errno != ENOENT)
+    {
+        return -1;
+    }
+    if (patternFile != NULL)
+    {
+        FilterPattern *patterns;
+        patternCount = readPatterns(patternFile, &patterns);
+        int isReadFailed = patternCount < 0 || ferror(patternFile);
+        fclose(patternFile);
+        if (isReadFailed)
+        {
+            free(patterns);
+            return -1;
+        }
+        if (patternCount > 0)
+        {
+            newFilter = compileFilter(patterns, patternCount);
+            free(patterns);
+            if (newFilter == NULL)
+            {
+                return -1;
+            }
+        }
+    }
+
+    ContentFilter *oldFilter = __atomic_exchange_n(&activeFilter, newFilter, __ATOMIC_ACQ_REL);
+    if (oldFilter != NULL)
+    {
+        epochRetire(&oldFilter->retired, oldFilter, freeContentFilter);
+    }
+    return patternCount;
+}
+
+/*
+ * FUNCTION : contentFilterApply
+ *
+ * DESCRIPTION : This function runs a message through the filter, one table lookup per byte. Bytes matched by a
+ * mask pattern are overwritten with CONTENT_FILTER_MASK_BYTE as soon as the match ends, a block pattern stops
+ * the scan straight away.
+ *
+ * PARAMETERS : char *text : The message text (masked in place).
+ *
+ * RETURNS : int : CONTENT_FILTER_PASS, CONTENT_FILTER_MASK or CONTENT_FILTER_BLOCK.
+ */
+int contentFilterApply(char *text)
+{
+    int result = CONTENT_FILTER_PASS;
+
+    epochEnter();
+    const ContentFilter *filter = __atomic_load_n(&activeFilter, __ATOMIC_ACQUIRE);
+    if (filter != NULL)
+    {
+        const unsigned int *transitions = filter->transitions;
+        const unsigned char *byteClass = filter->byteClass;
+        int classCount = filter->classCount;
+        unsigned int state = 0;
+        for (unsigned char *textByte = (unsigned char *)text; *textByte != '\0'; textByte++)
+        {
+            state = transitions[(size_t)state * classCount + byteClass[*textByte]];
+            if (filter->matchLength[state] == 0)
+            {
+                continue;
+            }
+            if (filter->matchAction[state] == CONTENT_FILTER_BLOCK)
+            {
+                result = CONTENT_FILTER_BLOCK;
+                break;
+            }
+            memset(textByte + 1 - filter->matchLength[state], CONTENT_FILTER_MASK_BYTE, filter->matchLength[state]);
+            result = CONTENT_FILTER_MASK;
+        }
+    }
+    epochExit();
+
+    if (result == CONTENT_FILTER_MASK)
+    {
+        __atomic_add_fetch(&messagesMasked, 1, __ATOMIC_RELAXED);
+    }
+    else if (result == CONTENT_FILTER_BLOCK)
+    {
+        __atomic_add_fetch(&messagesBlocked, 1, __ATOMIC_RELAXED);
+    }
+    return result;
+}
+
+/*
+ * FUNCTION : contentFilterRequestReload
+ *
+ * DESCRIPTION : Signal handler for CONTENT_FILTER_RELOAD_SIGNAL. Only notes the request, compiling isn't safe in
+ * a signal handler.
+ *
+ * PARAMETERS : int signalNumber : Not used.
+ *
+ * RETURNS : void
+ */
+void contentFilterRequestReload(int signalNumber)
+{
+    isReloadRequested = 1;
+}
+
+/*
+ * FUNCTION : contentFilterReloadIfRequested
+ *
+ * DESCRIPTION : This function reloads CONTENT_FILTER_FILE if the reload signal came in since the last call.
+ * Traffic keeps flowing through the old filter while the new one compiles.
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : void
+ */
+void contentFilterReloadIfRequested(void)
+{
+    if (!isReloadRequested)
+    {
+        return;
+    }
+    isReloadRequested = 0;
+
+    int patternCount = contentFilterLoad(CONTENT_FILTER_FILE);
+    if (patternCount < 0)
+    {
+        perror("content filter reload failed");
+        return;
+    }
+    printf("Content filter reloaded: %d patterns\n", patternCount);
+}
+
+/*
+ * FUNCTION : contentFilterCounts
+ *
+ * DESCRIPTION : This function reports the size of the current filter and what it has done so far (for stats)
+ *
+ * PARAMETERS : int *patternCount : Set to the patterns in the current filter.
+ *              int *stateCount : Set to its automaton states.
+ *              unsigned long *masked : Set to the messages masked since the server started.
+ *              unsigned long *blocked : Set to the messages blocked since the server started.
+ *
+ * RETURNS : void
+ */
+void contentFilterCounts(int *patternCount, int *stateCount, unsigned long *masked, unsigned long *blocked)
+{
+    epochEnter();
+    const ContentFilter *filter = __atomic_load_n(&activeFilter, __ATOMIC_ACQUIRE);
+    *patternCount = filter != NULL ? filter->patternCount : 0;
+    *stateCount = filter != NULL ? filter->stateCount : 0;
+    epochExit();
+
+    *masked = __atomic_load_n(&messagesMasked, __ATOMIC_RELAXED);
+    *blocked = __atomic_load_n(&messagesBlocked, __ATOMIC_RELAXED);
+}
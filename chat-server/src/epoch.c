@@ -0,0 +1,191 @@
+#include "../inc/epoch.h"
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+// The global epoch only moves forward
+static unsigned long globalEpoch = 1;
+
+// Reader slots, claimed by a thread the first time it enters
+static EpochReaderSlot readerSlots[EPOCH_MAX_THREADS];
+
+// This thread's slot (-1 until it first enters)
+static __thread int threadSlotIndex = -1;
+
+// Objects waiting to be freed, only touched with retireMutex held
+static RetiredObject *retiredList = NULL;
+static pthread_mutex_t retireMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * FUNCTION : claimReaderSlot
+ *
+ * DESCRIPTION : This function gives the calling thread a reader slot of its own.
+ * If every slot is taken it waits for one to be released.
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : int : Index of the claimed slot.
+ */
+static int claimReaderSlot(void)
+{
+    while (1)
+    {
+        for (int i = 0; i < EPOCH_MAX_THREADS; i++)
+        {
+            int expected = 0;
+            if (__atomic_compare_exchange_n(&readerSlots[i].isClaimed, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            {
+                return i;
+            }
+        }
+        sched_yield();
+    }
+}
+
+/*
+ * FUNCTION : epochEnter
+ *
+ * DESCRIPTION : This function starts a read section. Anything loaded from a shared pointer after this call
+ * stays valid until epochExit.
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : void
+ */
+void epochEnter(void)
+{
+    if (threadSlotIndex < 0)
+    {
+        threadSlotIndex = claimReaderSlot();
+    }
+    EpochReaderSlot *slot = &readerSlots[threadSlotIndex];
+
+    __atomic_store_n(&slot->localEpoch, __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->isActive, 1, __ATOMIC_RELAXED);
+
+    // The announcement must be visible before we load any shared pointer
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*
+ * FUNCTION : epochExit
+ *
+ * DESCRIPTION : This function ends a read section
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : void
+ */
+void epochExit(void)
+{
+    __atomic_store_n(&readerSlots[threadSlotIndex].isActive, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * FUNCTION : epochThreadExit
+ *
+ * DESCRIPTION : This function gives the calling thread's slot back. Call it before a reading thread exits.
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : void
+ */
+void epochThreadExit(void)
+{
+    if (threadSlotIndex >= 0)
+    {
+        __atomic_store_n(&readerSlots[threadSlotIndex].isClaimed, 0, __ATOMIC_RELEASE);
+        threadSlotIndex = -1;
+    }
+}
+
+/*
+ * FUNCTION : tryAdvanceEpoch
+ *
+ * DESCRIPTION : This function moves the global epoch on if every active reader has already seen the current one
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : unsigned long : The global epoch after the attempt.
+ */
+static unsigned long tryAdvanceEpoch(void)
+{
+    unsigned long currentEpoch = __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (int i = 0; i < EPOCH_MAX_THREADS; i++)
+    {
+        if (__atomic_load_n(&readerSlots[i].isActive, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&readerSlots[i].localEpoch, __ATOMIC_ACQUIRE) != currentEpoch)
+        {
+            return currentEpoch;
+        }
+    }
+
+    // Only one advance per epoch wins, losing the race is fine
+    __atomic_compare_exchange_n(&globalEpoch, &currentEpoch, currentEpoch + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    return __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * FUNCTION : epochRetire
+ *
+ * DESCRIPTION : This function hands an object that has been unpublished to the reclaimer, then frees whatever is
+ * old enough. An object retired in epoch E can be freed once the global epoch reaches E + 2, because by then
+ * every reader has entered after it was unpublished. It never allocates or waits for readers, so it is safe to call
+ * with locks held that a reader may be waiting on.
+ *
+ * PARAMETERS : RetiredObject *retired : The object's own link (freed with it).
+ *              void *object : The object to free later.
+ *              void (*freeFunction)(void *object) : How to free it.
+ *
+ * RETURNS : void
+ */
+void epochRetire(RetiredObject *retired, void *object, void (*freeFunction)(void *object))
+{
+    pthread_mutex_lock(&retireMutex);
+    retired->object = object;
+    retired->freeFunction = freeFunction;
+    retired->retiredEpoch = __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE);
+    retired->next = retiredList;
+    retiredList = retired;
+
+    unsigned long currentEpoch = tryAdvanceEpoch();
+
+    // Free everything at least two epochs old
+    RetiredObject **link = &retiredList;
+    while (*link != NULL)
+    {
+        RetiredObject *candidate = *link;
+        if (candidate->retiredEpoch + 2 <= currentEpoch)
+        {
+            // The link lives in the object, so it is unlinked before the object goes
+            *link = candidate->next;
+            candidate->freeFunction(candidate->object);
+        }
+        else
+        {
+            link = &candidate->next;
+        }
+    }
+    pthread_mutex_unlock(&retireMutex);
+}
+
+/*
+ * FUNCTION : epochSynchronize
+ *
+ * DESCRIPTION : This function waits until every read section that was running when it was called has finished.
+ * Must not be called from inside a read section.
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : void
+ */
+void epochSynchronize(void)
+{
+    unsigned long startEpoch = __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE);
+    while (tryAdvanceEpoch() < startEpoch + 2)
+    {
+        usleep(100);
+    }
+}
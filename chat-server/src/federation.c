@@ -0,0 +1,702 @@
+#include "../inc/federation.h"
+#include "../inc/memory-budget.h"
+#include "../../Common/inc/transport.h"
+#include <fcntl.h>
+#include <netinet/tcp.h>
+
+// Relay counters
+FederationStats federationStats;
+
+// This node's id, stamped on every message it relays
+static unsigned long localNode = 0;
+
+// Broadcasts a message relayed from another node to the local clients
+static void (*deliverRelayed)(const char *protocolMessage) = NULL;
+
+// Every link, configured or accepted. Slots are only claimed and released under federationMutex.
+static PeerLink peerLinks[FEDERATION_MAX_PEERS];
+static pthread_mutex_t federationMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Loop suppression: recent sequence numbers of every node heard from
+static OriginWindow originWindows[FEDERATION_MAX_ORIGINS];
+static int nextOriginSlot = 0; // Reused oldest first once every slot is taken
+static pthread_mutex_t originMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * FUNCTION : isAlreadySeen
+ *
+ * DESCRIPTION : This function checks a relayed message against its origin's window of recent sequence numbers and
+ * records it. Messages can arrive out of order over different paths, so anything within FEDERATION_WINDOW_BITS of
+ * the highest number is tracked one by one; anything older than that is taken to be a duplicate.
+ *
+ * PARAMETERS : unsigned long node : The node the message was first accepted on.
+ *              unsigned long sequence : That node's sequence number for it.
+ *
+ * RETURNS : int : 1 if the message was seen before, 0 if it is new.
+ */
+static int isAlreadySeen(unsigned long node, unsigned long sequence)
+{
+    int isSeen = 0;
+
+    pthread_mutex_lock(&originMutex);
+    OriginWindow *window = NULL;
+    for (int i = 0; i < FEDERATION_MAX_ORIGINS && window == NULL; i++)
+    {
+        if (originWindows[i].node == node)
+        {
+            window = &originWindows[i];
+        }
+    }
+    if (window == NULL)
+    {
+        window = &originWindows[nextOriginSlot];
+        nextOriginSlot = (nextOriginSlot + 1) % FEDERATION_MAX_ORIGINS;
+        window->node = node;
+        window->highestSequence = sequence;
+        window->recentMask = 1;
+    }
+    else if (sequence > window->highestSequence)
+    {
+        unsigned long shift = sequence - window->highestSequence;
+        window->recentMask = shift >= FEDERATION_WINDOW_BITS ? 1 : (window->recentMask << shift) | 1;
+        window->highestSequence = sequence;
+    }
+    else if (window->highestSequence - sequence >= FEDERATION_WINDOW_BITS)
+    {
+        isSeen = 1;
+    }
+    else
+    {
+        unsigned long long bit = 1ULL << (window->highestSequence - sequence);
+        isSeen = (window->recentMask & bit) != 0;
+        window->recentMask |= bit;
+    }
+    pthread_mutex_unlock(&originMutex);
+    return isSeen;
+}
+
+/*
+ * FUNCTION : queueRelayFrame
+ *
+ * DESCRIPTION : This function queues a relay frame on every connected link but the one it came from. It only copies
+ * the frame into each link's pending batch; the link's sender thread writes it.
+ *
+ * PARAMETERS : const char *frame : The relay frame, frame end included.
+ *              size_t frameLength : Its length.
+ *              const PeerLink *sourceLink : The link it arrived on, NULL for a message accepted here.
+ *
+ * RETURNS : void
+ */
+static void queueRelayFrame(const char *frame, size_t frameLength, const PeerLink *sourceLink)
+{
+    for (int i = 0; i < FEDERATION_MAX_PEERS; i++)
+    {
+        PeerLink *link = &peerLinks[i];
+        if (link == sourceLink || !__atomic_load_n(&link->isConnected, __ATOMIC_RELAXED))
+        {
+            continue;
+        }
+
+        pthread_mutex_lock(&link->linkMutex);
+        if (!link->isConnected)
+        {
+            pthread_mutex_unlock(&link->linkMutex);
+            continue;
+        }
+        if (link->pendingLength + frameLength > FEDERATION_BATCH_BYTES)
+        {
+            pthread_mutex_unlock(&link->linkMutex);
+            __atomic_add_fetch(&federationStats.framesDropped, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        memcpy(link->pendingBatch + link->pendingLength, frame, frameLength);
+        link->pendingLength += frameLength;
+        pthread_cond_signal(&link->batchReady);
+        pthread_mutex_unlock(&link->linkMutex);
+        __atomic_add_fetch(&federationStats.framesRelayed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * FUNCTION : sendAll
+ *
+ * DESCRIPTION : This function writes a whole buffer to a link socket
+ *
+ * PARAMETERS : int socket : The link socket.
+ *              const char *data : The bytes.
+ *              size_t length : How many.
+ *
+ * RETURNS : int : 0 on success, -1 if the link failed.
+ */
+static int sendAll(int socket, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t sent = send(socket, data, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return -1;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : sendHello
+ *
+ * DESCRIPTION : This function tells the other end of a link which node this is
+ *
+ * PARAMETERS : int socket : The link socket.
+ *
+ * RETURNS : int : 0 on success, -1 if the link failed.
+ */
+static int sendHello(int socket)
+{
+    char hello[64];
+    int helloLength = snprintf(hello, sizeof(hello), "%s%lu%c", FEDERATION_HELLO, localNode, PROTOCOL_FRAME_END);
+    return sendAll(socket, hello, helloLength);
+}
+
+/*
+ * FUNCTION : peerSenderThread
+ *
+ * DESCRIPTION : This function is a link's sender thread. It takes every relay frame queued since its last write and
+ * writes them with one send, so at low rates each message goes out straight away and under load one write carries
+ * many messages. A failed write shuts the socket down, which ends the link thread's read.
+ *
+ * PARAMETERS : void *linkPointer : The PeerLink.
+ *
+ * RETURNS : void * : Always NULL.
+ */
+static void *peerSenderThread(void *linkPointer)
+{
+    PeerLink *link = (PeerLink *)linkPointer;
+
+    pthread_mutex_lock(&link->linkMutex);
+    while (1)
+    {
+        while (link->isConnected && link->pendingLength == 0)
+        {
+            pthread_cond_wait(&link->batchReady, &link->linkMutex);
+        }
+        if (!link->isConnected)
+        {
+            break;
+        }
+
+        // Swap buffers so workers keep queueing while this batch is written
+        char *batch = link->pendingBatch;
+        size_t batchLength = link->pendingLength;
+        link->pendingBatch = link->sendingBatch;
+        link->sendingBatch = batch;
+        link->pendingLength = 0;
+        pthread_mutex_unlock(&link->linkMutex);
+
+        int sendResult = sendAll(link->socket, batch, batchLength);
+        __atomic_add_fetch(&federationStats.batchesSent, 1, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&link->linkMutex);
+        if (sendResult < 0)
+        {
+            shutdown(link->socket, SHUT_RDWR);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&link->linkMutex);
+    return NULL;
+}
+
+/*
+ * FUNCTION : handleHello
+ *
+ * DESCRIPTION : This function completes a link when the peer's hello arrives. An accepted link answers with its own
+ * hello, then the sender thread is started and relays start flowing.
+ *
+ * PARAMETERS : PeerLink *link : The link.
+ *              const char *helloText : The node id after FEDERATION_HELLO.
+ *
+ * RETURNS : int : 0 on success, -1 if the link should be dropped.
+ */
+static int handleHello(PeerLink *link, const char *helloText)
+{
+    unsigned long remoteNode = strtoul(helloText, NULL, 10);
+    if (remoteNode == 0)
+    {
+        return -1;
+    }
+    if (remoteNode == localNode)
+    {
+        // A peer list that points back at this node, or another node with the same id: linking would have each drop
+        // the other's relays as its own
+        printf("Federation: refused a link to node %lu, it has this node's id (%s)\n", remoteNode,
+               link->isOutbound ? link->address : "accepted");
+        return -1;
+    }
+    if (!link->isOutbound && sendHello(link->socket) < 0)
+    {
+        return -1;
+    }
+
+    // Relays are small and already batched, don't let Nagle hold them back. Reads can block for good from here.
+    int socketOption = 1;
+    setsockopt(link->socket, IPPROTO_TCP, TCP_NODELAY, &socketOption, sizeof(socketOption));
+    setsockopt(link->socket, SOL_SOCKET, SO_KEEPALIVE, &socketOption, sizeof(socketOption));
+    struct timeval noTimeout = {0, 0};
+    setsockopt(link->socket, SOL_SOCKET, SO_RCVTIMEO, &noTimeout, sizeof(noTimeout));
+
+    pthread_mutex_lock(&link->linkMutex);
+    link->remoteNode = remoteNode;
+    link->pendingLength = 0;
+    __atomic_store_n(&link->isConnected, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&link->linkMutex);
+    if (pthread_create(&link->senderThread, NULL, peerSenderThread, link) != 0)
+    {
+        pthread_mutex_lock(&link->linkMutex);
+        __atomic_store_n(&link->isConnected, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&link->linkMutex);
+        return -1;
+    }
+    printf("Federation: linked to node %lu (%s)\n", remoteNode, link->isOutbound ? link->address : "accepted");
+    return 0;
+}
+
+/*
+ * FUNCTION : handleRelay
+ *
+ * DESCRIPTION : This function takes a relayed message from a link. One that has been seen before is dropped, a new
+ * one is broadcast to the local clients and passed on over every other link.
+ *
+ * PARAMETERS : PeerLink *link : The link it arrived on.
+ *              char *frame : The whole relay frame (frame end replaced by the terminator).
+ *              size_t frameLength : Its length.
+ *
+ * RETURNS : int : 0 on success, -1 if the frame is malformed and the link should be dropped.
+ */
+static int handleRelay(PeerLink *link, char *frame, size_t frameLength)
+{
+    char *field = frame + strlen(FEDERATION_RELAY);
+    unsigned long originNode = strtoul(field, &field, 10);
+    if (*field != '|')
+    {
+        return -1;
+    }
+    unsigned long originSequence = strtoul(field + 1, &field, 10);
+    if (*field != '|')
+    {
+        return -1;
+    }
+
+    if (originNode == localNode || isAlreadySeen(originNode, originSequence))
+    {
+        __atomic_add_fetch(&federationStats.duplicatesDropped, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    __atomic_add_fetch(&federationStats.framesReceived, 1, __ATOMIC_RELAXED);
+
+    // Pass it on first (as it arrived) so the next hop isn't waiting on our broadcast
+    frame[frameLength] = PROTOCOL_FRAME_END;
+    queueRelayFrame(frame, frameLength + 1, link);
+    frame[frameLength] = '\0';
+
+    deliverRelayed(field + 1);
+    return 0;
+}
+
+/*
+ * FUNCTION : runPeerLink
+ *
+ * DESCRIPTION : This function reads a link until it drops: the hello first, then relay frames. When it drops the
+ * sender thread is stopped, anything still queued is thrown away and the socket is closed.
+ *
+ * PARAMETERS : PeerLink *link : The link, its socket connected (and our hello sent if we dialled).
+ *
+ * RETURNS : void
+ */
+static void runPeerLink(PeerLink *link)
+{
+    char *readBuffer = malloc(FEDERATION_READ_BUFFER_SIZE);
+    size_t bufferedLength = 0;
+
+    // Until the hello arrives a silent connection only gets so long
+    struct timeval helloTimeout = {FEDERATION_HELLO_TIMEOUT_SECONDS, 0};
+    setsockopt(link->socket, SOL_SOCKET, SO_RCVTIMEO, &helloTimeout, sizeof(helloTimeout));
+
+    int isDropping = readBuffer == NULL;
+    if (readBuffer != NULL)
+    {
+        memoryCharge(NULL, MEMORY_FEDERATION, FEDERATION_READ_BUFFER_SIZE);
+    }
+    while (!isDropping)
+    {
+        ssize_t numberOfBytesRead = recv(link->socket, readBuffer + bufferedLength, FEDERATION_READ_BUFFER_SIZE - 1 - bufferedLength, 0);
+        if (numberOfBytesRead < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (numberOfBytesRead <= 0)
+        {
+            break;
+        }
+        bufferedLength += numberOfBytesRead;
+
+        // Every complete frame in the buffer
+        char *frameStart = readBuffer;
+        char *bufferEnd = readBuffer + bufferedLength;
+        char *frameEnd;
+        while (!isDropping && (frameEnd = memchr(frameStart, PROTOCOL_FRAME_END, bufferEnd - frameStart)) != NULL)
+        {
+            *frameEnd = '\0';
+            if (link->remoteNode == 0)
+            {
+                isDropping = strncmp(frameStart, FEDERATION_HELLO, strlen(FEDERATION_HELLO)) != 0 ||
+                             handleHello(link, frameStart + strlen(FEDERATION_HELLO)) < 0;
+            }
+            else if (strncmp(frameStart, FEDERATION_RELAY, strlen(FEDERATION_RELAY)) == 0)
+            {
+                isDropping = handleRelay(link, frameStart, frameEnd - frameStart) < 0;
+            }
+            frameStart = frameEnd + 1;
+        }
+
+        // Keep the partial frame at the front. One that already can't be a real frame means the peer lost track.
+        bufferedLength = bufferEnd - frameStart;
+        memmove(readBuffer, frameStart, bufferedLength);
+        if (bufferedLength >= FEDERATION_FRAME_SIZE)
+        {
+            isDropping = 1;
+        }
+    }
+    if (readBuffer != NULL)
+    {
+        free(readBuffer);
+        memoryRelease(NULL, MEMORY_FEDERATION, FEDERATION_READ_BUFFER_SIZE);
+    }
+
+    // Stop the sender (a write in progress fails on the shut down socket)
+    pthread_mutex_lock(&link->linkMutex);
+    int hadSender = link->isConnected;
+    __atomic_store_n(&link->isConnected, 0, __ATOMIC_RELAXED);
+    link->pendingLength = 0;
+    pthread_cond_signal(&link->batchReady);
+    pthread_mutex_unlock(&link->linkMutex);
+    shutdown(link->socket, SHUT_RDWR);
+    if (hadSender)
+    {
+        pthread_join(link->senderThread, NULL);
+        printf("Federation: lost node %lu\n", link->remoteNode);
+    }
+    close(link->socket);
+    link->socket = -1;
+    link->remoteNode = 0;
+}
+
+/*
+ * FUNCTION : dialPeer
+ *
+ * DESCRIPTION : This function connects to a configured peer's federation port and sends our hello
+ *
+ * PARAMETERS : const char *address : host:port of the peer's client listener.
+ *
+ * RETURNS : int : The connected socket, or -1 on error.
+ */
+static int dialPeer(const char *address)
+{
+    char host[FEDERATION_ADDRESS_SIZE];
+    int clientPort = transportSplitHostPort(address, host, sizeof(host), SERVER_PORT);
+    if (clientPort < 0 || host[0] == '\0')
+    {
+        return -1;
+    }
+    char service[16];
+    snprintf(service, sizeof(service), "%d", clientPort + FEDERATION_PORT_OFFSET);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *addresses;
+    if (getaddrinfo(host, service, &hints, &addresses) != 0)
+    {
+        return -1;
+    }
+
+    int linkSocket = -1;
+    for (struct addrinfo *candidate = addresses; candidate != NULL && linkSocket < 0; candidate = candidate->ai_next)
+    {
+        linkSocket = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (linkSocket >= 0 && connect(linkSocket, candidate->ai_addr, candidate->ai_addrlen) < 0)
+        {
+            close(linkSocket);
+            linkSocket = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    if (linkSocket >= 0 && sendHello(linkSocket) < 0)
+    {
+        close(linkSocket);
+        linkSocket = -1;
+    }
+    return linkSocket;
+}
+
+/*
+ * FUNCTION : peerLinkThread
+ *
+ * DESCRIPTION : This function runs one link for as long as it exists. A configured peer is dialled, and redialled
+ * every FEDERATION_RETRY_MS after it drops; an accepted link ends (and frees its slot) when it drops.
+ *
+ * PARAMETERS : void *linkPointer : The PeerLink.
+ *
+ * RETURNS : void * : Always NULL.
+ */
+static void *peerLinkThread(void *linkPointer)
+{
+    PeerLink *link = (PeerLink *)linkPointer;
+    struct timespec retryDelay = {FEDERATION_RETRY_MS / 1000, (FEDERATION_RETRY_MS % 1000) * 1000000L};
+
+    while (1)
+    {
+        if (link->isOutbound)
+        {
+            link->socket = dialPeer(link->address);
+        }
+        if (link->socket >= 0)
+        {
+            runPeerLink(link);
+        }
+        if (!link->isOutbound)
+        {
+            break;
+        }
+        nanosleep(&retryDelay, NULL);
+    }
+
+    pthread_mutex_lock(&federationMutex);
+    link->isInUse = 0;
+    pthread_mutex_unlock(&federationMutex);
+    return NULL;
+}
+
+/*
+ * FUNCTION : startPeerLink
+ *
+ * DESCRIPTION : This function claims a free link slot and starts its thread
+ *
+ * PARAMETERS : const char *address : host:port to dial, or NULL for an accepted link.
+ *              int linkSocket : The accepted socket (-1 when dialling).
+ *
+ * RETURNS : int : 0 on success, -1 if every slot is taken or the thread couldn't start.
+ */
+static int startPeerLink(const char *address, int linkSocket)
+{
+    PeerLink *link = NULL;
+    pthread_mutex_lock(&federationMutex);
+    for (int i = 0; i < FEDERATION_MAX_PEERS && link == NULL; i++)
+    {
+        if (!peerLinks[i].isInUse)
+        {
+            link = &peerLinks[i];
+            link->isInUse = 1;
+        }
+    }
+    pthread_mutex_unlock(&federationMutex);
+    if (link == NULL)
+    {
+        return -1;
+    }
+
+    link->isOutbound = address != NULL;
+    snprintf(link->address, sizeof(link->address), "%s", address != NULL ? address : "");
+    link->socket = linkSocket;
+    link->remoteNode = 0;
+
+    pthread_t linkThreadId;
+    if (pthread_create(&linkThreadId, NULL, peerLinkThread, link) != 0)
+    {
+        pthread_mutex_lock(&federationMutex);
+        link->isInUse = 0;
+        pthread_mutex_unlock(&federationMutex);
+        return -1;
+    }
+    pthread_detach(linkThreadId);
+    return 0;
+}
+
+/*
+ * FUNCTION : federationStart
+ *
+ * DESCRIPTION : This function sets up the relay and opens the federation listener that other nodes link to
+ * (the client port plus FEDERATION_PORT_OFFSET).
+ *
+ * PARAMETERS : unsigned long nodeId : This node's id (must differ from every other node's).
+ *              int serverPort : The client port.
+ *              void (*deliver)(const char *protocolMessage) : Broadcasts an IP|USER|COUNT|TEXT frame relayed from
+ *                                                             another node to the local clients.
+ *
+ * RETURNS : int : The non-blocking listening socket, or -1 on error.
+ */
+int federationStart(unsigned long nodeId, int serverPort, void (*deliver)(const char *protocolMessage))
+{
+    localNode = nodeId;
+    deliverRelayed = deliver;
+    for (int i = 0; i < FEDERATION_MAX_PEERS; i++)
+    {
+        peerLinks[i].isInUse = 0;
+        peerLinks[i].socket = -1;
+        peerLinks[i].isConnected = 0;
+        pthread_mutex_init(&peerLinks[i].linkMutex, NULL);
+        pthread_cond_init(&peerLinks[i].batchReady, NULL);
+        peerLinks[i].pendingBatch = malloc(FEDERATION_BATCH_BYTES);
+        peerLinks[i].sendingBatch = malloc(FEDERATION_BATCH_BYTES);
+        if (peerLinks[i].pendingBatch == NULL || peerLinks[i].sendingBatch == NULL)
+        {
+            return -1;
+        }
+        memoryCharge(NULL, MEMORY_FEDERATION, 2 * FEDERATION_BATCH_BYTES);
+    }
+
+    // Dual stack so peers can link over IPv4 or IPv6, plain IPv4 if the host has no IPv6
+    struct sockaddr_storage federationAddress;
+    socklen_t federationAddressLength;
+    memset(&federationAddress, 0, sizeof(federationAddress));
+    int listenSocket = socket(AF_INET6, SOCK_STREAM, 0);
+    if (listenSocket >= 0)
+    {
+        struct sockaddr_in6 *ipv6Address = (struct sockaddr_in6 *)&federationAddress;
+        ipv6Address->sin6_family = AF_INET6;
+        ipv6Address->sin6_addr = in6addr_any;
+        ipv6Address->sin6_port = htons(serverPort + FEDERATION_PORT_OFFSET);
+        federationAddressLength = sizeof(*ipv6Address);
+        int isIpv6Only = 0;
+        setsockopt(listenSocket, IPPROTO_IPV6, IPV6_V6ONLY, &isIpv6Only, sizeof(isIpv6Only));
+    }
+    else
+    {
+        listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+        if (listenSocket < 0)
+        {
+            return -1;
+        }
+        struct sockaddr_in *ipv4Address = (struct sockaddr_in *)&federationAddress;
+        ipv4Address->sin_family = AF_INET;
+        ipv4Address->sin_addr.s_addr = INADDR_ANY;
+        ipv4Address->sin_port = htons(serverPort + FEDERATION_PORT_OFFSET);
+        federationAddressLength = sizeof(*ipv4Address);
+    }
+    int socketOption = 1;
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &socketOption, sizeof(socketOption));
+
+    if (bind(listenSocket, (struct sockaddr *)&federationAddress, federationAddressLength) < 0 ||
+        listen(listenSocket, FEDERATION_MAX_PEERS) < 0)
+    {
+        close(listenSocket);
+        return -1;
+    }
+    fcntl(listenSocket, F_SETFL, fcntl(listenSocket, F_GETFL, 0) | O_NONBLOCK);
+    return listenSocket;
+}
+
+/*
+ * FUNCTION : federationAddPeer
+ *
+ * DESCRIPTION : This function links to another node and keeps the link up for as long as the server runs
+ *
+ * PARAMETERS : const char *address : host:port of the peer's client listener ([v6]:port for IPv6, host alone means
+ *              SERVER_PORT).
+ *
+ * RETURNS : int : 0 on success, -1 if there is no room for another link.
+ */
+int federationAddPeer(const char *address)
+{
+    return startPeerLink(address, -1);
+}
+
+/*
+ * FUNCTION : federationAcceptPeer
+ *
+ * DESCRIPTION : This function accepts every link waiting on the federation listener. The hello is read on the
+ * link's own thread so a slow peer can't hold up the accept loop.
+ *
+ * PARAMETERS : int listeningSocket : The socket federationStart returned.
+ *
+ * RETURNS : void
+ */
+void federationAcceptPeer(int listeningSocket)
+{
+    int linkSocket;
+    while ((linkSocket = accept(listeningSocket, NULL, NULL)) >= 0)
+    {
+        // The listener is non-blocking, the link is not
+        fcntl(linkSocket, F_SETFL, fcntl(linkSocket, F_GETFL, 0) & ~O_NONBLOCK);
+        if (startPeerLink(NULL, linkSocket) < 0)
+        {
+            close(linkSocket);
+        }
+    }
+}
+
+/*
+ * FUNCTION : federationRelay
+ *
+ * DESCRIPTION : This function relays a message accepted from a local client to every linked node
+ *
+ * PARAMETERS : unsigned long sequence : The message's sequence number here.
+ *              const char *protocolMessage : The message as IP|USER|COUNT|TEXT (after the content filter).
+ *
+ * RETURNS : void
+ */
+void federationRelay(unsigned long sequence, const char *protocolMessage)
+{
+    if (federationConnectedPeers() == 0)
+    {
+        return;
+    }
+
+    char frame[FEDERATION_FRAME_SIZE];
+    int frameLength = snprintf(frame, sizeof(frame), "%s%lu|%lu|%s%c", FEDERATION_RELAY, localNode, sequence, protocolMessage, PROTOCOL_FRAME_END);
+    if (frameLength >= (int)sizeof(frame))
+    {
+        // Can't happen for a frame a client could send, but never relay a cut one
+        return;
+    }
+    queueRelayFrame(frame, frameLength, NULL);
+}
+
+/*
+ * FUNCTION : federationNodeId
+ *
+ * DESCRIPTION : This function returns this node's id
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : unsigned long : The node id.
+ */
+unsigned long federationNodeId(void)
+{
+    return localNode;
+}
+
+/*
+ * FUNCTION : federationConnectedPeers
+ *
+ * DESCRIPTION : This function counts the links that are up
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : int : Links with relays flowing.
+ */
+int federationConnectedPeers(void)
+{
+    int connectedPeers = 0;
+    for (int i = 0; i < FEDERATION_MAX_PEERS; i++)
+    {
+        connectedPeers += __atomic_load_n(&peerLinks[i].isConnected, __ATOMIC_RELAXED);
+    }
+    return connectedPeers;
+}
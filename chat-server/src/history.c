@@ -0,0 +1,135 @@
+#include "../inc/history.h"
+#include "../inc/server-clock.h"
+
+/*
+ * FUNCTION : historyInitialize
+ *
+ * DESCRIPTION : This function sets up an empty history
+ *
+ * PARAMETERS : MessageHistory *history : The history.
+ *              unsigned long firstSequence : Number of the first broadcast.
+ *
+ * RETURNS : void
+ */
+void historyInitialize(MessageHistory *history, unsigned long firstSequence)
+{
+    pthread_mutex_init(&history->historyMutex, NULL);
+    history->nextSequence = firstSequence;
+    history->recordedCount = 0;
+    for (int i = 0; i < HISTORY_CAPACITY; i++)
+    {
+        history->messages[i] = NULL;
+        history->sequences[i] = 0;
+    }
+}
+
+/*
+ * FUNCTION : recordMessage
+ *
+ * DESCRIPTION : This function keeps a broadcast in place of the oldest one. historyMutex must be held (or the
+ * history not yet shared).
+ *
+ * PARAMETERS : MessageHistory *history : The history.
+ *              unsigned long sequence : The broadcast's number, higher than any kept.
+ *              OutboundMessage *message : The frame, the history takes its own reference.
+ *
+ * RETURNS : void
+ */
+static void recordMessage(MessageHistory *history, unsigned long sequence, OutboundMessage *message)
+{
+    int slot = history->recordedCount % HISTORY_CAPACITY;
+    if (history->messages[slot] != NULL)
+    {
+        outboundMessageRelease(history->messages[slot]);
+    }
+    __atomic_add_fetch(&message->referenceCount, 1, __ATOMIC_RELAXED);
+    history->messages[slot] = message;
+    history->sequences[slot] = sequence;
+    history->recordedCount++;
+}
+
+/*
+ * FUNCTION : historyStamp
+ *
+ * DESCRIPTION : This function gives a broadcast the next sequence number and the server's (coarse) time, and keeps it
+ * in place of the oldest one. historyMutex must be held until the message has been queued to every subscriber.
+ *
+ * PARAMETERS : MessageHistory *history : The history.
+ *              const char *text : The formatted chat line.
+ *
+ * RETURNS : OutboundMessage * : The frame to queue (the caller holds one reference), or NULL if it couldn't be allocated.
+ */
+OutboundMessage *historyStamp(MessageHistory *history, const char *text)
+{
+    char frame[MAX_PROTOL_MESSAGE_SIZE * 4];
+    int frameLength = snprintf(frame, sizeof(frame), "%s%lu|%lld|%s", PROTOCOL_MESSAGE, history->nextSequence, coarseClockMilliseconds(), text);
+    if (frameLength >= (int)sizeof(frame))
+    {
+        frameLength = sizeof(frame) - 1;
+    }
+
+    OutboundMessage *message = outboundMessageCreate(frame, frameLength);
+    if (message == NULL)
+    {
+        return NULL;
+    }
+
+    recordMessage(history, history->nextSequence, message);
+    history->nextSequence++;
+    return message;
+}
+
+/*
+ * FUNCTION : historyReplay
+ *
+ * DESCRIPTION : This function queues every broadcast after a sequence number that is still kept, without sending.
+ * historyMutex must be held, so nothing newer can be queued to the client in between.
+ *
+ * PARAMETERS : MessageHistory *history : The history.
+ *              unsigned long afterSequence : Last sequence number the client saw.
+ *              OutputQueue *queue : The client's queue.
+ *
+ * RETURNS : int : Number of broadcasts queued.
+ */
+int historyReplay(MessageHistory *history, unsigned long afterSequence, OutputQueue *queue)
+{
+    int replayed = 0;
+
+    // Older than the ring reaches is gone, the client sees the jump in numbers. Walk back to the first one it missed.
+    unsigned long oldestKept = history->recordedCount > HISTORY_CAPACITY ? history->recordedCount - HISTORY_CAPACITY : 0;
+    unsigned long position = history->recordedCount;
+    while (position > oldestKept && history->sequences[(position - 1) % HISTORY_CAPACITY] > afterSequence)
+    {
+        position--;
+    }
+    for (; position < history->recordedCount; position++)
+    {
+        if (outputQueuePush(queue, history->messages[position % HISTORY_CAPACITY]) < 0)
+        {
+            break;
+        }
+        replayed++;
+    }
+    return replayed;
+}
+
+/*
+ * FUNCTION : historyRestore
+ *
+ * DESCRIPTION : This function puts back a broadcast from before a restart, oldest first, before any client can
+ * see the history. Numbering carries on above it even if the clock went back.
+ *
+ * PARAMETERS : MessageHistory *history : The history.
+ *              unsigned long sequence : The broadcast's number, higher than any restored before it.
+ *              OutboundMessage *message : The frame, the history takes its own reference.
+ *
+ * RETURNS : void
+ */
+void historyRestore(MessageHistory *history, unsigned long sequence, OutboundMessage *message)
+{
+    recordMessage(history, sequence, message);
+    if (history->nextSequence <= sequence)
+    {
+        history->nextSequence = sequence + 1;
+    }
+}
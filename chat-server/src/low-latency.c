@@ -0,0 +1,412 @@
+#define _GNU_SOURCE
+#include "../inc/low-latency.h"
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+// Connections lent to one network thread that it hasn't picked up yet
+typedef struct
+{
+    pthread_mutex_t arrivalMutex;
+    pthread_cond_t arrivalCondition;            // Signalled for a network thread that has nothing to poll
+    LowLatencyLink *arrivals[LOW_LATENCY_MAX_LINKS];
+    int arrivalCount;                           // Also read without the lock while the thread spins
+    int lentCount;                              // Connections the thread has or is about to have
+} NetworkArrivals;
+
+// Set once at startup, before any thread that reads it exists
+static LowLatencyCores lowLatencyCores;
+static NetworkArrivals networkArrivals[LOW_LATENCY_MAX_CPUS];
+static int (*serviceConnection)(void *owner) = NULL;
+
+/*
+ * FUNCTION : lowLatencyStart
+ *
+ * DESCRIPTION : This function turns low-latency mode on for a list of cores, given as numbers and ranges
+ * ("2,3" or "4-7"). Every core must be one the server is allowed to run on. The first cores of the list go to the
+ * network threads (one per LOW_LATENCY_CORES_PER_NETWORK_THREAD, at least one), the rest to the workers.
+ *
+ * PARAMETERS : const char *cpuList : The cores.
+ *
+ * RETURNS : int : Number of cores, or -1 if the list isn't understood or names a core that can't be used.
+ */
+int lowLatencyStart(const char *cpuList)
+{
+    cpu_set_t allowedCpus;
+    if (sched_getaffinity(0, sizeof(allowedCpus), &allowedCpus) < 0)
+    {
+        return -1;
+    }
+
+    int cpuCount = 0;
+    const char *cursor = cpuList;
+    while (*cursor != '\0')
+    {
+        char *numberEnd;
+        long firstCpu = strtol(cursor, &numberEnd, 10);
+        long lastCpu = firstCpu;
+        if (numberEnd == cursor)
+        {
+            return -1;
+        }
+        if (*numberEnd == '-')
+        {
+            cursor = numberEnd + 1;
+            lastCpu = strtol(cursor, &numberEnd, 10);
+            if (numberEnd == cursor)
+            {
+                return -1;
+            }
+        }
+        for (long cpu = firstCpu; cpu <= lastCpu; cpu++)
+        {
+            if (cpu < 0 || cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowedCpus) || cpuCount == LOW_LATENCY_MAX_CPUS)
+            {
+                return -1;
+            }
+            lowLatencyCores.cpus[cpuCount++] = (int)cpu;
+        }
+        cursor = *numberEnd == ',' ? numberEnd + 1 : numberEnd;
+        if (*numberEnd != ',' && *numberEnd != '\0')
+        {
+            return -1;
+        }
+    }
+    lowLatencyCores.cpuCount = cpuCount;
+    lowLatencyCores.networkThreadCount = cpuCount / LOW_LATENCY_CORES_PER_NETWORK_THREAD;
+    if (lowLatencyCores.networkThreadCount == 0)
+    {
+        lowLatencyCores.networkThreadCount = 1;
+    }
+    return cpuCount > 0 ? cpuCount : -1;
+}
+
+/*
+ * FUNCTION : lowLatencyIsActive
+ *
+ * DESCRIPTION : This function says whether the server runs in low-latency mode
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : int : 1 if it does, 0 if not.
+ */
+int lowLatencyIsActive(void)
+{
+    return lowLatencyCores.cpuCount > 0;
+}
+
+/*
+ * FUNCTION : lowLatencyWorkerCoreCount
+ *
+ * DESCRIPTION : This function returns how many cores low-latency mode left for the worker pool after the network
+ * threads took theirs (the pool gets one spinning worker each)
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : int : The number of cores, 0 when the mode is off or the network threads took them all.
+ */
+int lowLatencyWorkerCoreCount(void)
+{
+    return lowLatencyCores.cpuCount - lowLatencyCores.networkThreadCount;
+}
+
+/*
+ * FUNCTION : pinThread
+ *
+ * DESCRIPTION : This function pins the calling thread to one core
+ *
+ * PARAMETERS : int cpu : The core.
+ *
+ * RETURNS : void
+ */
+static void pinThread(int cpu)
+{
+    cpu_set_t threadCpus;
+    CPU_ZERO(&threadCpus);
+    CPU_SET(cpu, &threadCpus);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(threadCpus), &threadCpus);
+    if (error != 0)
+    {
+        errno = error;
+        perror("pinning thread failed");
+    }
+}
+
+/*
+ * FUNCTION : lowLatencyPinWorker
+ *
+ * DESCRIPTION : This function pins the calling worker to one of the worker cores, spread by index. Network thread
+ * cores are never used.
+ *
+ * PARAMETERS : int workerIndex : The worker's index.
+ *
+ * RETURNS : void
+ */
+void lowLatencyPinWorker(int workerIndex)
+{
+    int workerCoreCount = lowLatencyWorkerCoreCount();
+    if (workerCoreCount > 0)
+    {
+        pinThread(lowLatencyCores.cpus[lowLatencyCores.networkThreadCount + workerIndex % workerCoreCount]);
+    }
+}
+
+/*
+ * FUNCTION : handBack
+ *
+ * DESCRIPTION : This function gives a connection back to its reader thread. The network thread must have stopped
+ * polling it, the reader may reuse or close it as soon as it wakes.
+ *
+ * PARAMETERS : NetworkArrivals *arrivals : The network thread's arrivals (for its count of connections).
+ *              LowLatencyLink *link : The connection.
+ *              int result : LOW_LATENCY_HAND_BACK or LOW_LATENCY_CLOSED.
+ *
+ * RETURNS : void
+ */
+static void handBack(NetworkArrivals *arrivals, LowLatencyLink *link, int result)
+{
+    pthread_mutex_lock(&arrivals->arrivalMutex);
+    arrivals->lentCount--;
+    pthread_mutex_unlock(&arrivals->arrivalMutex);
+
+    pthread_mutex_lock(&link->handoffMutex);
+    link->handbackResult = result;
+    link->isHandedBack = 1;
+    pthread_cond_signal(&link->handoffCondition);
+    pthread_mutex_unlock(&link->handoffMutex);
+}
+
+/*
+ * FUNCTION : networkThread
+ *
+ * DESCRIPTION : This function is the loop each network thread runs on its own core: pick up connections readers
+ * have lent, poll them all without sleeping, and have the service function read and frame any that are ready.
+ * With no connections at all it sleeps until one is lent.
+ *
+ * PARAMETERS : void *threadIndexPointer : The thread's index (cast from intptr_t).
+ *
+ * RETURNS : void * : Never returns.
+ */
+static void *networkThread(void *threadIndexPointer)
+{
+    int threadIndex = (int)(long)threadIndexPointer;
+    NetworkArrivals *arrivals = &networkArrivals[threadIndex];
+    LowLatencyLink *links[LOW_LATENCY_MAX_LINKS];
+    struct pollfd linkPolls[LOW_LATENCY_MAX_LINKS];
+    int linkCount = 0;
+    unsigned int idleRounds = 0;
+    pinThread(lowLatencyCores.cpus[threadIndex]);
+
+    while (1)
+    {
+        if (linkCount == 0 || __atomic_load_n(&arrivals->arrivalCount, __ATOMIC_ACQUIRE) > 0)
+        {
+            pthread_mutex_lock(&arrivals->arrivalMutex);
+            while (linkCount == 0 && arrivals->arrivalCount == 0)
+            {
+                pthread_cond_wait(&arrivals->arrivalCondition, &arrivals->arrivalMutex);
+            }
+            for (int i = 0; i < arrivals->arrivalCount; i++)
+            {
+                links[linkCount] = arrivals->arrivals[i];
+                linkPolls[linkCount].fd = arrivals->arrivals[i]->socket;
+                linkPolls[linkCount].events = POLLIN;
+                linkCount++;
+            }
+            __atomic_store_n(&arrivals->arrivalCount, 0, __ATOMIC_RELEASE);
+            pthread_mutex_unlock(&arrivals->arrivalMutex);
+        }
+
+        if (poll(linkPolls, linkCount, 0) <= 0)
+        {
+            lowLatencyBackoff(&idleRounds);
+            continue;
+        }
+        idleRounds = 0;
+
+        // Backwards, so a connection given back is replaced by one already looked at
+        for (int i = linkCount - 1; i >= 0; i--)
+        {
+            if (linkPolls[i].revents == 0)
+            {
+                continue;
+            }
+            LowLatencyLink *link = links[i];
+            int result = serviceConnection(link->owner);
+            if (result == LOW_LATENCY_KEEP)
+            {
+                continue;
+            }
+            linkCount--;
+            links[i] = links[linkCount];
+            linkPolls[i] = linkPolls[linkCount];
+            handBack(arrivals, link, result);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * FUNCTION : lowLatencyStartNetworkThreads
+ *
+ * DESCRIPTION : This function starts the network threads, one on each of the first cores of the list
+ *
+ * PARAMETERS : int (*service)(void *owner) : Called on a network thread when a connection is ready to read, with
+ *              its owner. Returns LOW_LATENCY_KEEP, LOW_LATENCY_HAND_BACK or LOW_LATENCY_CLOSED.
+ *
+ * RETURNS : int : 0 on success, -1 if a thread couldn't be started.
+ */
+int lowLatencyStartNetworkThreads(int (*service)(void *owner))
+{
+    serviceConnection = service;
+    for (int i = 0; i < lowLatencyCores.networkThreadCount; i++)
+    {
+        pthread_mutex_init(&networkArrivals[i].arrivalMutex, NULL);
+        pthread_cond_init(&networkArrivals[i].arrivalCondition, NULL);
+        networkArrivals[i].arrivalCount = 0;
+        networkArrivals[i].lentCount = 0;
+
+        pthread_t threadId;
+        if (pthread_create(&threadId, NULL, networkThread, (void *)(long)i) != 0)
+        {
+            perror("pthread_create failed");
+            return -1;
+        }
+        pthread_detach(threadId);
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : lowLatencyLinkInitialize
+ *
+ * DESCRIPTION : This function sets up the link a client slot lends its connections through
+ *
+ * PARAMETERS : LowLatencyLink *link : The link.
+ *              void *owner : What the service function is given for it.
+ *              int linkIndex : Picks the network thread (slots are spread over them).
+ *
+ * RETURNS : void
+ */
+void lowLatencyLinkInitialize(LowLatencyLink *link, void *owner, int linkIndex)
+{
+    link->socket = -1;
+    link->owner = owner;
+    link->networkThread = lowLatencyCores.networkThreadCount > 0 ? linkIndex % lowLatencyCores.networkThreadCount : 0;
+    link->isHandedBack = 0;
+    link->handbackResult = LOW_LATENCY_KEEP;
+    pthread_mutex_init(&link->handoffMutex, NULL);
+    pthread_cond_init(&link->handoffCondition, NULL);
+}
+
+/*
+ * FUNCTION : lowLatencyHandToNetwork
+ *
+ * DESCRIPTION : This function lends a connection to its network thread and blocks the calling reader until it is
+ * given back. Until then only the network thread touches the connection.
+ *
+ * PARAMETERS : LowLatencyLink *link : The connection's link.
+ *              int socket : Its socket.
+ *
+ * RETURNS : int : LOW_LATENCY_HAND_BACK or LOW_LATENCY_CLOSED from the service function, or LOW_LATENCY_KEEP if the
+ *                 network thread already has all it can poll (the reader reads the connection itself).
+ */
+int lowLatencyHandToNetwork(LowLatencyLink *link, int socket)
+{
+    NetworkArrivals *arrivals = &networkArrivals[link->networkThread];
+    link->socket = socket;
+    link->isHandedBack = 0;
+
+    pthread_mutex_lock(&arrivals->arrivalMutex);
+    if (arrivals->lentCount == LOW_LATENCY_MAX_LINKS)
+    {
+        pthread_mutex_unlock(&arrivals->arrivalMutex);
+        return LOW_LATENCY_KEEP;
+    }
+    arrivals->lentCount++;
+    arrivals->arrivals[arrivals->arrivalCount] = link;
+    __atomic_store_n(&arrivals->arrivalCount, arrivals->arrivalCount + 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&arrivals->arrivalCondition);
+    pthread_mutex_unlock(&arrivals->arrivalMutex);
+
+    pthread_mutex_lock(&link->handoffMutex);
+    while (!link->isHandedBack)
+    {
+        pthread_cond_wait(&link->handoffCondition, &link->handoffMutex);
+    }
+    int result = link->handbackResult;
+    pthread_mutex_unlock(&link->handoffMutex);
+    return result;
+}
+
+/*
+ * FUNCTION : lowLatencyPrepareSocket
+ *
+ * DESCRIPTION : This function sets a client socket up for low latency: Nagle off on TCP, so a small frame is
+ * never held back for an ACK, and busy polling on reads. Raising SO_BUSY_POLL past the system default needs
+ * CAP_NET_ADMIN, without it the socket just polls for the default time (often none).
+ *
+ * PARAMETERS : int socket : The client socket.
+ *              int transportKind : TRANSPORT_TCP or TRANSPORT_UNIX.
+ *
+ * RETURNS : void
+ */
+void lowLatencyPrepareSocket(int socket, int transportKind)
+{
+    int socketOption = 1;
+    if (transportKind == TRANSPORT_TCP)
+    {
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &socketOption, sizeof(socketOption));
+    }
+#ifdef SO_BUSY_POLL
+    socketOption = LOW_LATENCY_BUSY_POLL_US;
+    setsockopt(socket, SOL_SOCKET, SO_BUSY_POLL, &socketOption, sizeof(socketOption));
+#endif
+}
+
+/*
+ * FUNCTION : lowLatencyBackoff
+ *
+ * DESCRIPTION : This function waits a little after a thread found nothing to do. The first LOW_LATENCY_SPIN_ROUNDS
+ * calls only tell the core it is spinning, later ones give the core to anything else that wants it.
+ *
+ * PARAMETERS : unsigned int *idleRounds : Empty rounds so far, counted up (the caller zeroes it on work).
+ *
+ * RETURNS : void
+ */
+void lowLatencyBackoff(unsigned int *idleRounds)
+{
+    if ((*idleRounds)++ < LOW_LATENCY_SPIN_ROUNDS)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+        return;
+    }
+    sched_yield();
+}
+
+/*
+ * FUNCTION : lowLatencyLockMemory
+ *
+ * DESCRIPTION : This function locks everything the server has mapped so far into memory, once startup has set it
+ * all up, so the message path never waits on a page fault. Memory mapped later isn't locked, a cap on locked
+ * memory would otherwise make those mappings fail.
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : void
+ */
+void lowLatencyLockMemory(void)
+{
+    if (lowLatencyCores.cpuCount > 0 && mlockall(MCL_CURRENT) < 0)
+    {
+        perror("locking memory failed");
+    }
+}
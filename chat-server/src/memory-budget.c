@@ -0,0 +1,196 @@
+#include "../inc/memory-budget.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Shared state, updated with atomics from every thread that allocates on behalf of a connection
+MemoryBudgetState memoryBudgetState = {0, 0, {0}, MEMORY_SOFT_LIMIT_BYTES, MEMORY_HARD_LIMIT_BYTES, 0, 0, 0};
+
+/*
+ * FUNCTION : parseByteCount
+ *
+ * DESCRIPTION : This function reads a size like 512k, 64m or 1g (plain bytes without a suffix)
+ *
+ * PARAMETERS : const char *text : The size.
+ *              char **end : Set to the first character after it.
+ *
+ * RETURNS : long long : Bytes, 0 if there is no number.
+ */
+static long long parseByteCount(const char *text, char **end)
+{
+    long long count = strtoll(text, end, 10);
+    if (*end == text || count <= 0)
+    {
+        return 0;
+    }
+    // Each suffix is another factor of 1024
+    static const char suffixes[] = "kmg";
+    const char *suffix = strchr(suffixes, tolower((unsigned char)**end));
+    if (**end != '\0' && suffix != NULL)
+    {
+        count <<= 10 * (suffix - suffixes + 1);
+        (*end)++;
+    }
+    return count;
+}
+
+/*
+ * FUNCTION : memoryBudgetConfigure
+ *
+ * DESCRIPTION : This function sets the limits from the -memory switch: SOFT:HARD, each in bytes or with a k, m or
+ * g suffix (-memory64m:128m)
+ *
+ * PARAMETERS : const char *limitsText : What follows the switch.
+ *
+ * RETURNS : int : 0 on success, -1 if the limits aren't understood or the soft one is over the hard one.
+ */
+int memoryBudgetConfigure(const char *limitsText)
+{
+    char *end;
+    long long softLimitBytes = parseByteCount(limitsText, &end);
+    if (softLimitBytes == 0 || *end != ':')
+    {
+        return -1;
+    }
+    long long hardLimitBytes = parseByteCount(end + 1, &end);
+    if (hardLimitBytes == 0 || *end != '\0' || softLimitBytes > hardLimitBytes)
+    {
+        return -1;
+    }
+    memoryBudgetState.softLimitBytes = softLimitBytes;
+    memoryBudgetState.hardLimitBytes = hardLimitBytes;
+    return 0;
+}
+
+/*
+ * FUNCTION : memoryCharge
+ *
+ * DESCRIPTION : This function charges memory that has just been allocated, whatever the budget says (it is
+ * already in use, refusing would only lose track of it)
+ *
+ * PARAMETERS : MemoryAccount *account : The connection it is for, NULL for memory the server holds for everyone.
+ *              int kind : MEMORY_STACKS to MEMORY_TRACE.
+ *              long long bytes : Bytes allocated.
+ *
+ * RETURNS : void
+ */
+void memoryCharge(MemoryAccount *account, int kind, long long bytes)
+{
+    if (account != NULL)
+    {
+        __atomic_add_fetch(&account->bytes[kind], bytes, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&memoryBudgetState.kindBytes[kind], bytes, __ATOMIC_RELAXED);
+    long long usedBytes = __atomic_add_fetch(&memoryBudgetState.usedBytes, bytes, __ATOMIC_RELAXED);
+
+    long long peakBytes = __atomic_load_n(&memoryBudgetState.peakBytes, __ATOMIC_RELAXED);
+    while (usedBytes > peakBytes &&
+           !__atomic_compare_exchange_n(&memoryBudgetState.peakBytes, &peakBytes, usedBytes, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+/*
+ * FUNCTION : memoryRelease
+ *
+ * DESCRIPTION : This function credits back memory that has been freed
+ *
+ * PARAMETERS : MemoryAccount *account : The connection it was charged to, NULL if it was charged to the server.
+ *              int kind : What it was charged as.
+ *              long long bytes : Bytes freed.
+ *
+ * RETURNS : void
+ */
+void memoryRelease(MemoryAccount *account, int kind, long long bytes)
+{
+    if (account != NULL)
+    {
+        __atomic_sub_fetch(&account->bytes[kind], bytes, __ATOMIC_RELAXED);
+    }
+    __atomic_sub_fetch(&memoryBudgetState.kindBytes[kind], bytes, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&memoryBudgetState.usedBytes, bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * FUNCTION : memoryAccountTotal
+ *
+ * DESCRIPTION : This function adds up what a connection holds
+ *
+ * PARAMETERS : const MemoryAccount *account : The connection's account.
+ *
+ * RETURNS : long long : Bytes, every kind together.
+ */
+long long memoryAccountTotal(const MemoryAccount *account)
+{
+    long long totalBytes = 0;
+    for (int kind = 0; kind < MEMORY_KIND_COUNT; kind++)
+    {
+        totalBytes += __atomic_load_n(&account->bytes[kind], __ATOMIC_RELAXED);
+    }
+    return totalBytes;
+}
+
+/*
+ * FUNCTION : memoryBudgetLevel
+ *
+ * DESCRIPTION : This function compares what is charged right now with the limits
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : int : MEMORY_WITHIN_BUDGET, MEMORY_OVER_SOFT or MEMORY_OVER_HARD.
+ */
+int memoryBudgetLevel(void)
+{
+    long long usedBytes = __atomic_load_n(&memoryBudgetState.usedBytes, __ATOMIC_RELAXED);
+    if (usedBytes >= memoryBudgetState.hardLimitBytes)
+    {
+        return MEMORY_OVER_HARD;
+    }
+    if (usedBytes >= memoryBudgetState.softLimitBytes)
+    {
+        return MEMORY_OVER_SOFT;
+    }
+    return MEMORY_WITHIN_BUDGET;
+}
+
+/*
+ * FUNCTION : memoryCountTrimmed
+ *
+ * DESCRIPTION : This function counts spare memory given back because of the soft limit
+ *
+ * PARAMETERS : long long bytes : Bytes freed.
+ *
+ * RETURNS : void
+ */
+void memoryCountTrimmed(long long bytes)
+{
+    __atomic_add_fetch(&memoryBudgetState.trimmedBytes, bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * FUNCTION : memoryCountShed
+ *
+ * DESCRIPTION : This function counts a slow reader disconnected because of the soft limit
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : void
+ */
+void memoryCountShed(void)
+{
+    __atomic_add_fetch(&memoryBudgetState.clientsShed, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * FUNCTION : memoryCountRefused
+ *
+ * DESCRIPTION : This function counts new work refused because of the hard limit
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : void
+ */
+void memoryCountRefused(void)
+{
+    __atomic_add_fetch(&memoryBudgetState.refusals, 1, __ATOMIC_RELAXED);
+}
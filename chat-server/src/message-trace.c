@@ -0,0 +1,197 @@
+#include "../inc/message-trace.h"
+#include "../inc/memory-budget.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Shared state, updated with atomic operations by the workers
+TraceStats traceStats;
+
+static unsigned long sampleCounter = 0;     // Chat frames seen while sampling
+static TraceSlot traceRing[TRACE_RING_SPANS];
+static unsigned long traceRingNext = 0;     // Position of the next span written (slot is this modulo the ring size)
+static volatile sig_atomic_t isDumpRequested = 0;
+
+// Span of the message the calling worker is broadcasting, NULL if it isn't sampled
+static __thread TraceSpan *currentSpan = NULL;
+
+/*
+ * FUNCTION : messageTraceStart
+ *
+ * DESCRIPTION : This function turns the sampler on
+ *
+ * PARAMETERS : unsigned int every : Sample one chat message in this many (0 leaves it off).
+ *
+ * RETURNS : void
+ */
+void messageTraceStart(unsigned int every)
+{
+    // The ring is only touched, and so only takes memory, once sampling is on
+    if (every > 0 && __atomic_load_n(&traceStats.sampleEvery, __ATOMIC_RELAXED) == 0)
+    {
+        memoryCharge(NULL, MEMORY_TRACE, sizeof(traceRing));
+    }
+    __atomic_store_n(&traceStats.sampleEvery, every, __ATOMIC_RELAXED);
+}
+
+/*
+ * FUNCTION : messageTraceIsActive
+ *
+ * DESCRIPTION : This function says whether the sampler is on, so callers can skip reading the clock when it isn't
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : int : 1 if it is, 0 if not.
+ */
+int messageTraceIsActive(void)
+{
+    return __atomic_load_n(&traceStats.sampleEvery, __ATOMIC_RELAXED) != 0;
+}
+
+/*
+ * FUNCTION : messageTraceShouldSample
+ *
+ * DESCRIPTION : This function decides whether a chat frame gets a span. With the sampler off it is one load.
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : int : 1 to trace this one, 0 if not.
+ */
+int messageTraceShouldSample(void)
+{
+    unsigned int every = __atomic_load_n(&traceStats.sampleEvery, __ATOMIC_RELAXED);
+    if (every == 0)
+    {
+        return 0;
+    }
+    return __atomic_fetch_add(&sampleCounter, 1, __ATOMIC_RELAXED) % every == 0;
+}
+
+/*
+ * FUNCTION : messageTraceSetCurrent
+ *
+ * DESCRIPTION : This function tells the broadcast path which span the calling thread's message belongs to
+ *
+ * PARAMETERS : TraceSpan *span : The span, NULL once the message is done (or for one that isn't sampled).
+ *
+ * RETURNS : void
+ */
+void messageTraceSetCurrent(TraceSpan *span)
+{
+    currentSpan = span;
+}
+
+/*
+ * FUNCTION : messageTraceCurrent
+ *
+ * DESCRIPTION : This function gets the span the calling thread's message belongs to
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : TraceSpan * : The span, or NULL if the message isn't sampled.
+ */
+TraceSpan *messageTraceCurrent(void)
+{
+    return currentSpan;
+}
+
+/*
+ * FUNCTION : messageTraceRecord
+ *
+ * DESCRIPTION : This function copies a finished span into the ring, over the oldest one. The slot's stamp is
+ * cleared first and set last, so a dump running at the same time can tell it caught the copy half done.
+ *
+ * PARAMETERS : const TraceSpan *span : The span.
+ *
+ * RETURNS : void
+ */
+void messageTraceRecord(const TraceSpan *span)
+{
+    unsigned long position = __atomic_fetch_add(&traceRingNext, 1, __ATOMIC_RELAXED);
+    TraceSlot *slot = &traceRing[position & (TRACE_RING_SPANS - 1)];
+
+    __atomic_store_n(&slot->stamp, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->span = *span;
+    __atomic_store_n(&slot->stamp, position + 1, __ATOMIC_RELEASE);
+
+    __atomic_add_fetch(&traceStats.spansRecorded, 1, __ATOMIC_RELAXED);
+    long long slowestNs = __atomic_load_n(&traceStats.slowestNs, __ATOMIC_RELAXED);
+    while (span->totalNs > slowestNs &&
+           !__atomic_compare_exchange_n(&traceStats.slowestNs, &slowestNs, span->totalNs, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+/*
+ * FUNCTION : messageTraceRequestDump
+ *
+ * DESCRIPTION : Signal handler for TRACE_DUMP_SIGNAL. Only notes the request, writing a file isn't safe in a signal
+ * handler.
+ *
+ * PARAMETERS : int signalNumber : Not used.
+ *
+ * RETURNS : void
+ */
+void messageTraceRequestDump(int signalNumber)
+{
+    isDumpRequested = 1;
+}
+
+/*
+ * FUNCTION : messageTraceDumpIfRequested
+ *
+ * DESCRIPTION : This function writes the spans in the ring to TRACE_DUMP_PATH, oldest first and in microseconds,
+ * if the dump signal came in since the last call. Spans being written while it runs are left out.
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : void
+ */
+void messageTraceDumpIfRequested(void)
+{
+    if (!isDumpRequested)
+    {
+        return;
+    }
+    isDumpRequested = 0;
+
+    // Never through a symlink someone else left at the path, and readable only by the server's user
+    int file = open(TRACE_DUMP_PATH, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+    FILE *dump = file >= 0 ? fdopen(file, "w") : NULL;
+    if (dump == NULL)
+    {
+        perror("trace dump failed");
+        if (file >= 0)
+        {
+            close(file);
+        }
+        return;
+    }
+    fprintf(dump, "# 1 in %u messages: sequence sender recipients read inbox parse lockwait queue send total (us)\n",
+            __atomic_load_n(&traceStats.sampleEvery, __ATOMIC_RELAXED));
+
+    unsigned long endPosition = __atomic_load_n(&traceRingNext, __ATOMIC_RELAXED);
+    unsigned long position = endPosition > TRACE_RING_SPANS ? endPosition - TRACE_RING_SPANS : 0;
+    int spanCount = 0;
+    for (; position < endPosition; position++)
+    {
+        TraceSlot *slot = &traceRing[position & (TRACE_RING_SPANS - 1)];
+        unsigned long stamp = __atomic_load_n(&slot->stamp, __ATOMIC_ACQUIRE);
+        TraceSpan span = slot->span;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (stamp != position + 1 || __atomic_load_n(&slot->stamp, __ATOMIC_RELAXED) != stamp)
+        {
+            continue;
+        }
+        fprintf(dump, "%lu %d %d %lld %lld %lld %lld %lld %lld %lld\n", span.sequence, span.senderSocket, span.recipientCount,
+                span.readNs / 1000, span.inboxNs / 1000, span.parseNs / 1000, span.lockWaitNs / 1000, span.queueNs / 1000,
+                span.sendNs / 1000, span.totalNs / 1000);
+        spanCount++;
+    }
+    fclose(dump);
+
+    __atomic_add_fetch(&traceStats.dumps, 1, __ATOMIC_RELAXED);
+    printf("Trace dumped: %d spans to %s\n", spanCount, TRACE_DUMP_PATH);
+}
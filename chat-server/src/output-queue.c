@@ -0,0 +1,1137 @@
+#include "../inc/output-queue.h"
+#include <poll.h>
+#include <sys/eventfd.h>
+
+// Queues whose peer wasn't ready, the writer thread sends the rest when it is
+static pthread_mutex_t writerMutex = PTHREAD_MUTEX_INITIALIZER;
+static OutputQueue *waitingQueues = NULL;
+static int writerDoorbell = -1;
+
+// Frames waiting in every queue (stats)
+static int totalQueuedFrames = 0;
+
+// Compressed batches sent across every queue, and their bytes before and after (stats)
+static unsigned long compressedBatches = 0;
+static unsigned long compressedRawBytes = 0;
+static unsigned long compressedSentBytes = 0;
+
+// Control frames sent, and how many of them went out ahead of bulk frames already queued (stats)
+static unsigned long controlFramesSent = 0;
+static unsigned long controlFramesAhead = 0;
+
+/*
+ * FUNCTION : outboundMessageCreate
+ *
+ * DESCRIPTION : This function builds a frame to send, adding the frame end. The caller holds the first reference.
+ *
+ * PARAMETERS : const char *data : The frame contents.
+ *              size_t length : Number of bytes in data.
+ *
+ * RETURNS : OutboundMessage * : The message, or NULL if it couldn't be allocated.
+ */
+OutboundMessage *outboundMessageCreate(const char *data, size_t length)
+{
+    OutboundMessage *message = malloc(sizeof(OutboundMessage) + length + 1);
+    if (message == NULL)
+    {
+        return NULL;
+    }
+    memoryCharge(NULL, MEMORY_FRAMES, sizeof(OutboundMessage) + length + 1);
+    message->referenceCount = 1;
+    message->isMapped = 0;
+    message->length = length + 1;
+    memcpy(message->data, data, length);
+    message->data[length] = PROTOCOL_FRAME_END;
+    return message;
+}
+
+/*
+ * FUNCTION : outboundMessageRelease
+ *
+ * DESCRIPTION : This function drops one reference to a message and frees it when it was the last (unless it is
+ * part of a mapped snapshot, which stays mapped)
+ *
+ * PARAMETERS : OutboundMessage *message : The message.
+ *
+ * RETURNS : void
+ */
+void outboundMessageRelease(OutboundMessage *message)
+{
+    if (__atomic_sub_fetch(&message->referenceCount, 1, __ATOMIC_ACQ_REL) == 0 && !message->isMapped)
+    {
+        memoryRelease(NULL, MEMORY_FRAMES, sizeof(OutboundMessage) + message->length);
+        free(message);
+    }
+}
+
+/*
+ * FUNCTION : registerWithWriter
+ *
+ * DESCRIPTION : This function hands a queue the peer isn't ready for to the writer thread. queueMutex must be held.
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *
+ * RETURNS : void
+ */
+static void registerWithWriter(OutputQueue *queue)
+{
+    if (queue->isWaitingForWriter)
+    {
+        return;
+    }
+    queue->isWaitingForWriter = 1;
+
+    pthread_mutex_lock(&writerMutex);
+    queue->nextWaiting = waitingQueues;
+    waitingQueues = queue;
+    pthread_mutex_unlock(&writerMutex);
+
+    // Wake the writer so it adds the queue to what it polls
+    eventfd_write(writerDoorbell, 1);
+}
+
+/*
+ * FUNCTION : unregisterFromWriter
+ *
+ * DESCRIPTION : This function takes a queue off the writer thread's list. queueMutex must be held.
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *
+ * RETURNS : void
+ */
+static void unregisterFromWriter(OutputQueue *queue)
+{
+    if (!queue->isWaitingForWriter)
+    {
+        return;
+    }
+    queue->isWaitingForWriter = 0;
+
+    pthread_mutex_lock(&writerMutex);
+    for (OutputQueue **link = &waitingQueues; *link != NULL; link = &(*link)->nextWaiting)
+    {
+        if (*link == queue)
+        {
+            *link = queue->nextWaiting;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&writerMutex);
+}
+
+/*
+ * FUNCTION : popHead
+ *
+ * DESCRIPTION : This function removes the first entry of a queue and drops its message reference (or releases its
+ * stream). queueMutex must be held.
+ *
+ * PARAMETERS : OutputQueue *queue : The queue (must not be empty).
+ *
+ * RETURNS : void
+ */
+static void popHead(OutputQueue *queue)
+{
+    OutputQueueEntry *entry = queue->head;
+    queue->head = entry->next;
+    if (queue->head == NULL)
+    {
+        queue->tail = NULL;
+    }
+    if (entry->message != NULL)
+    {
+        queue->queuedBytes -= entry->message->length - queue->headOffset;
+        outboundMessageRelease(entry->message);
+    }
+    else
+    {
+        entry->stream->release(entry->stream);
+    }
+    queue->headOffset = 0;
+    free(entry);
+    memoryRelease(queue->memoryAccount, MEMORY_OUTPUT, sizeof(OutputQueueEntry));
+    __atomic_sub_fetch(&totalQueuedFrames, 1, __ATOMIC_RELAXED);
+    if (queue->uncompressedEntries > 0)
+    {
+        queue->uncompressedEntries--;
+    }
+}
+
+/*
+ * FUNCTION : popControlHead
+ *
+ * DESCRIPTION : This function removes the first entry of a queue's control lane and drops its message reference.
+ * queueMutex must be held.
+ *
+ * PARAMETERS : OutputQueue *queue : The queue (its control lane must not be empty).
+ *
+ * RETURNS : void
+ */
+static void popControlHead(OutputQueue *queue)
+{
+    OutputQueueEntry *entry = queue->controlHead;
+    queue->controlHead = entry->next;
+    if (queue->controlHead == NULL)
+    {
+        queue->controlTail = NULL;
+    }
+    queue->controlBytes -= entry->message->length - queue->controlOffset;
+    queue->controlOffset = 0;
+    outboundMessageRelease(entry->message);
+    free(entry);
+    memoryRelease(queue->memoryAccount, MEMORY_OUTPUT, sizeof(OutputQueueEntry));
+    __atomic_sub_fetch(&totalQueuedFrames, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * FUNCTION : isBulkFrameStarted
+ *
+ * DESCRIPTION : This function says whether part of a bulk frame has gone out, so nothing else may be sent until the
+ * rest of it has (a compressed block counts from when it is made, a stream chunk from its header to its last byte).
+ * queueMutex must be held.
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *
+ * RETURNS : int : 1 if a frame is part way out, 0 if the queue is between frames.
+ */
+static int isBulkFrameStarted(OutputQueue *queue)
+{
+    if (queue->compressedBlock != NULL || queue->headOffset > 0)
+    {
+        return 1;
+    }
+    return queue->head != NULL && queue->head->message == NULL && queue->head->chunkHeaderLength != 0;
+}
+
+/*
+ * FUNCTION : sendControl
+ *
+ * DESCRIPTION : This function sends what it can of the control lane. queueMutex must be held and the bulk lane must
+ * be between frames.
+ *
+ * PARAMETERS : OutputQueue *queue : The queue, with something in its control lane.
+ *
+ * RETURNS : ssize_t : Bytes sent, or -1 on error (errno set).
+ */
+static ssize_t sendControl(OutputQueue *queue)
+{
+    OutboundMessage *message = queue->controlHead->message;
+    ssize_t sentBytes = transportSend(queue->transport, message->data + queue->controlOffset,
+                                      message->length - queue->controlOffset, MSG_DONTWAIT);
+    if (sentBytes <= 0)
+    {
+        return sentBytes;
+    }
+
+    queue->controlOffset += sentBytes;
+    if (queue->controlOffset == message->length)
+    {
+        __atomic_add_fetch(&controlFramesSent, 1, __ATOMIC_RELAXED);
+        if (queue->head != NULL)
+        {
+            __atomic_add_fetch(&controlFramesAhead, 1, __ATOMIC_RELAXED);
+        }
+        // popControlHead subtracts what is left of the head, which is nothing now
+        popControlHead(queue);
+    }
+    else
+    {
+        queue->controlBytes -= sentBytes;
+    }
+    return sentBytes;
+}
+
+/*
+ * FUNCTION : freeCompressedBlock
+ *
+ * DESCRIPTION : This function frees the compressed block a queue was sending, if it has one. queueMutex must be held.
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *
+ * RETURNS : void
+ */
+static void freeCompressedBlock(OutputQueue *queue)
+{
+    if (queue->compressedBlock != NULL)
+    {
+        free(queue->compressedBlock);
+        queue->compressedBlock = NULL;
+        memoryRelease(queue->memoryAccount, MEMORY_OUTPUT, queue->compressedLength);
+    }
+}
+
+/*
+ * FUNCTION : discardQueued
+ *
+ * DESCRIPTION : This function throws away everything a queue still has to send. queueMutex must be held.
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *
+ * RETURNS : void
+ */
+static void discardQueued(OutputQueue *queue)
+{
+    while (queue->head != NULL)
+    {
+        popHead(queue);
+    }
+    freeCompressedBlock(queue);
+    queue->queuedBytes = 0;
+
+    while (queue->controlHead != NULL)
+    {
+        popControlHead(queue);
+    }
+    queue->controlBytes = 0;
+}
+
+/*
+ * FUNCTION : shutDownQueue
+ *
+ * DESCRIPTION : This function gives up on a client that isn't keeping up: the queue is closed and emptied and the
+ * transport shut down, so its reader wakes up with an error and removes it. queueMutex must be held.
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *
+ * RETURNS : void
+ */
+static void shutDownQueue(OutputQueue *queue)
+{
+    queue->isClosed = 1;
+    discardQueued(queue);
+    unregisterFromWriter(queue);
+    transportShutdown(queue->transport);
+}
+
+/*
+ * FUNCTION : compressBatch
+ *
+ * DESCRIPTION : This function compresses the frames at the head of a queue into one block, if there are enough of
+ * them to be worth it, and puts it in front of the queue as a header frame followed by the compressed bytes.
+ * Only whole frames are taken (nothing of the head sent yet) and a stream ends the batch. A batch that doesn't get
+ * smaller is sent as it is. queueMutex must be held.
+ *
+ * PARAMETERS : OutputQueue *queue : The queue, its peer has agreed to compression.
+ *
+ * RETURNS : int : 1 if a block was made, 0 if the head should be sent as it is.
+ */
+static int compressBatch(OutputQueue *queue)
+{
+    size_t batchLength = 0;
+    int batchEntries = 0;
+    for (OutputQueueEntry *entry = queue->head; entry != NULL && entry->message != NULL; entry = entry->next)
+    {
+        if (batchLength + entry->message->length > OUTPUT_COMPRESS_MAX_BYTES)
+        {
+            break;
+        }
+        batchLength += entry->message->length;
+        batchEntries++;
+    }
+    if (batchLength < OUTPUT_COMPRESS_MIN_BYTES)
+    {
+        // A lone line or two, not worth the CPU
+        return 0;
+    }
+
+    char *batch = malloc(batchLength);
+    char *block = malloc(OUTPUT_COMPRESS_HEADER_SIZE + batchLength);
+    size_t compressedLength = 0;
+    if (batch != NULL && block != NULL)
+    {
+        size_t gatheredLength = 0;
+        OutputQueueEntry *entry = queue->head;
+        for (int i = 0; i < batchEntries; i++, entry = entry->next)
+        {
+            memcpy(batch + gatheredLength, entry->message->data, entry->message->length);
+            gatheredLength += entry->message->length;
+        }
+        // Only worth it if the header is paid for
+        compressedLength = lzCompress(queue->compressor, batch, batchLength, block + OUTPUT_COMPRESS_HEADER_SIZE,
+                                      batchLength - OUTPUT_COMPRESS_HEADER_SIZE);
+    }
+    free(batch);
+
+    // Only what the block needs stays allocated while it waits for the peer
+    char *shrunkBlock = compressedLength != 0 ? realloc(block, OUTPUT_COMPRESS_HEADER_SIZE + compressedLength) : NULL;
+    if (shrunkBlock == NULL)
+    {
+        free(block);
+        queue->uncompressedEntries = batchEntries;
+        return 0;
+    }
+    block = shrunkBlock;
+    memoryCharge(queue->memoryAccount, MEMORY_OUTPUT, OUTPUT_COMPRESS_HEADER_SIZE + compressedLength);
+
+    // The header frame goes right in front of the compressed bytes
+    char header[OUTPUT_COMPRESS_HEADER_SIZE];
+    int headerLength = snprintf(header, sizeof(header), "%s%zu|%zu%c", PROTOCOL_COMPRESSED, batchLength, compressedLength, PROTOCOL_FRAME_END);
+    memcpy(block + OUTPUT_COMPRESS_HEADER_SIZE - headerLength, header, headerLength);
+    queue->compressedBlock = block;
+    queue->compressedOffset = OUTPUT_COMPRESS_HEADER_SIZE - headerLength;
+    queue->compressedLength = OUTPUT_COMPRESS_HEADER_SIZE + compressedLength;
+
+    for (int i = 0; i < batchEntries; i++)
+    {
+        popHead(queue);
+    }
+    queue->queuedBytes += headerLength + compressedLength;
+
+    __atomic_add_fetch(&compressedBatches, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&compressedRawBytes, batchLength, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&compressedSentBytes, headerLength + compressedLength, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/*
+ * FUNCTION : appendEntry
+ *
+ * DESCRIPTION : This function links a new entry onto the end of a queue. queueMutex must be held.
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *              OutputQueueEntry *entry : The entry.
+ *
+ * RETURNS : void
+ */
+static void appendEntry(OutputQueue *queue, OutputQueueEntry *entry)
+{
+    entry->next = NULL;
+    if (queue->tail != NULL)
+    {
+        queue->tail->next = entry;
+    }
+    else
+    {
+        queue->head = entry;
+    }
+    queue->tail = entry;
+}
+
+/*
+ * FUNCTION : sendStreamChunk
+ *
+ * DESCRIPTION : This function sends what it can of the current chunk of the stream at the head of a queue: its
+ * header frame first, then the file bytes with transportSendFile. queueMutex must be held.
+ *
+ * PARAMETERS : OutputQueue *queue : The queue, with a stream at its head.
+ *
+ * RETURNS : ssize_t : Bytes sent (0 when the stream is finished and was popped), or -1 on error (errno set).
+ */
+static ssize_t sendStreamChunk(OutputQueue *queue)
+{
+    OutputQueueEntry *entry = queue->head;
+    OutboundStream *stream = entry->stream;
+
+    if (entry->chunkHeaderLength == 0)
+    {
+        off_t streamRemaining = stream->endOffset - stream->nextOffset;
+        if (streamRemaining <= 0)
+        {
+            popHead(queue);
+            return 0;
+        }
+        entry->chunkRemaining = streamRemaining < OUTPUT_STREAM_CHUNK_BYTES ? streamRemaining : OUTPUT_STREAM_CHUNK_BYTES;
+        entry->chunkHeaderLength = stream->formatHeader(stream, entry->chunkRemaining, entry->chunkHeader, sizeof(entry->chunkHeader));
+        queue->headOffset = 0;
+    }
+
+    ssize_t sentBytes;
+    if (queue->headOffset < entry->chunkHeaderLength)
+    {
+        sentBytes = transportSend(queue->transport, entry->chunkHeader + queue->headOffset,
+                                  entry->chunkHeaderLength - queue->headOffset, MSG_DONTWAIT);
+        if (sentBytes > 0)
+        {
+            queue->headOffset += sentBytes;
+        }
+        return sentBytes;
+    }
+
+    sentBytes = transportSendFile(queue->transport, stream->fileDescriptor, &stream->nextOffset, entry->chunkRemaining, MSG_DONTWAIT);
+    if (sentBytes == 0)
+    {
+        // The file is shorter than it said, the peer is left part way through a chunk
+        errno = EIO;
+        return -1;
+    }
+    if (sentBytes < 0)
+    {
+        return sentBytes;
+    }
+
+    entry->chunkRemaining -= sentBytes;
+    if (entry->chunkRemaining == 0)
+    {
+        entry->chunkHeaderLength = 0;
+        queue->headOffset = 0;
+        if (stream->nextOffset >= stream->endOffset)
+        {
+            popHead(queue);
+        }
+        else if (entry->next != NULL)
+        {
+            // Let whatever was queued behind it go before the next chunk
+            queue->head = entry->next;
+            appendEntry(queue, entry);
+        }
+    }
+    return sentBytes;
+}
+
+/*
+ * FUNCTION : flushQueue
+ *
+ * DESCRIPTION : This function sends as much of a queue as the peer takes without blocking. Whatever is left is
+ * handed to the writer thread. The control lane goes first whenever the bulk lane is between frames. For a peer
+ * that agreed to compression, frames that piled up (a replay, or a peer that fell behind) go out as compressed
+ * blocks. queueMutex must be held.
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *
+ * RETURNS : void
+ */
+static void flushQueue(OutputQueue *queue)
+{
+    while (queue->head != NULL || queue->compressedBlock != NULL || queue->controlHead != NULL)
+    {
+        ssize_t sentBytes;
+        if (queue->controlHead != NULL && (queue->controlOffset > 0 || !isBulkFrameStarted(queue)))
+        {
+            sentBytes = sendControl(queue);
+            if (sentBytes > 0)
+            {
+                continue;
+            }
+            if (sentBytes == 0)
+            {
+                errno = EPIPE;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                registerWithWriter(queue);
+                return;
+            }
+            discardQueued(queue);
+            transportShutdown(queue->transport);
+            break;
+        }
+
+        if (queue->compressedBlock == NULL && queue->compressor != NULL && queue->uncompressedEntries == 0 &&
+            queue->headOffset == 0 && queue->head->message != NULL)
+        {
+            compressBatch(queue);
+        }
+
+        OutboundMessage *message = queue->compressedBlock == NULL ? queue->head->message : NULL;
+        if (queue->compressedBlock != NULL)
+        {
+            sentBytes = transportSend(queue->transport, queue->compressedBlock + queue->compressedOffset,
+                                      queue->compressedLength - queue->compressedOffset, MSG_DONTWAIT);
+        }
+        else if (message == NULL)
+        {
+            sentBytes = sendStreamChunk(queue);
+            if (sentBytes >= 0)
+            {
+                continue;
+            }
+        }
+        else
+        {
+            sentBytes = transportSend(queue->transport, message->data + queue->headOffset, message->length - queue->headOffset, MSG_DONTWAIT);
+        }
+        if (sentBytes < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                registerWithWriter(queue);
+                return;
+            }
+
+            // The peer is gone (or was left part way through a stream chunk), nothing queued can be delivered.
+            // Its reader notices and removes the client.
+            discardQueued(queue);
+            transportShutdown(queue->transport);
+            break;
+        }
+
+        queue->queuedBytes -= sentBytes;
+        if (queue->compressedBlock != NULL)
+        {
+            queue->compressedOffset += sentBytes;
+            if (queue->compressedOffset == queue->compressedLength)
+            {
+                freeCompressedBlock(queue);
+            }
+            continue;
+        }
+        queue->headOffset += sentBytes;
+        if (queue->headOffset == message->length)
+        {
+            // popHead subtracts what is left of the head, which is nothing now
+            popHead(queue);
+        }
+    }
+    unregisterFromWriter(queue);
+}
+
+/*
+ * FUNCTION : outputQueueInitialize
+ *
+ * DESCRIPTION : This function sets up a queue once at startup, it starts closed until outputQueueOpen
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *              MemoryAccount *memoryAccount : Charged for what the queue allocates (NULL to charge the server).
+ *
+ * RETURNS : void
+ */
+void outputQueueInitialize(OutputQueue *queue, MemoryAccount *memoryAccount)
+{
+    pthread_mutex_init(&queue->queueMutex, NULL);
+    queue->transport = NULL;
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->headOffset = 0;
+    queue->queuedBytes = 0;
+    queue->isClosed = 1;
+    queue->isWaitingForWriter = 0;
+    queue->nextWaiting = NULL;
+    queue->compressor = NULL;
+    queue->uncompressedEntries = 0;
+    queue->compressedBlock = NULL;
+    queue->controlHead = NULL;
+    queue->controlTail = NULL;
+    queue->controlOffset = 0;
+    queue->controlBytes = 0;
+    queue->memoryAccount = memoryAccount;
+}
+
+/*
+ * FUNCTION : outputQueueOpen
+ *
+ * DESCRIPTION : This function starts accepting frames for a new connection
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *              Transport *transport : Where the frames go.
+ *
+ * RETURNS : void
+ */
+void outputQueueOpen(OutputQueue *queue, Transport *transport)
+{
+    pthread_mutex_lock(&queue->queueMutex);
+    queue->transport = transport;
+    queue->isClosed = 0;
+    queue->uncompressedEntries = 0;
+    pthread_mutex_unlock(&queue->queueMutex);
+}
+
+/*
+ * FUNCTION : queueMessage
+ *
+ * DESCRIPTION : This function adds a message to the end of a queue without sending anything. queueMutex must be held.
+ * A client whose backlog passes OUTPUT_QUEUE_LIMIT_BYTES is shut down rather than letting it hold memory.
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *              OutboundMessage *message : The message, the queue takes its own reference.
+ *
+ * RETURNS : int : 0 if the message was queued, -1 if the queue is closed or the client was too slow (errno ENOBUFS).
+ */
+static int queueMessage(OutputQueue *queue, OutboundMessage *message)
+{
+    if (queue->isClosed)
+    {
+        errno = EPIPE;
+        return -1;
+    }
+
+    if (queue->queuedBytes + message->length > OUTPUT_QUEUE_LIMIT_BYTES)
+    {
+        // Its reader wakes up with an error and removes it the usual way
+        shutDownQueue(queue);
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    OutputQueueEntry *entry = malloc(sizeof(OutputQueueEntry));
+    if (entry == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    memoryCharge(queue->memoryAccount, MEMORY_OUTPUT, sizeof(OutputQueueEntry));
+    __atomic_add_fetch(&message->referenceCount, 1, __ATOMIC_RELAXED);
+    entry->message = message;
+    entry->stream = NULL;
+    appendEntry(queue, entry);
+    queue->queuedBytes += message->length;
+    __atomic_add_fetch(&totalQueuedFrames, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/*
+ * FUNCTION : outputQueueAppend
+ *
+ * DESCRIPTION : This function queues a message for a connection and sends what it can straight away
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *              OutboundMessage *message : The message, the queue takes its own reference.
+ *
+ * RETURNS : int : 0 if the message was queued, -1 if the queue is closed or the client was too slow (errno ENOBUFS).
+ */
+int outputQueueAppend(OutputQueue *queue, OutboundMessage *message)
+{
+    pthread_mutex_lock(&queue->queueMutex);
+    int appendResult = queueMessage(queue, message);
+
+    // A queue already with the writer is waiting for the peer, trying again now would only fail
+    if (appendResult == 0 && !queue->isWaitingForWriter)
+    {
+        flushQueue(queue);
+    }
+    pthread_mutex_unlock(&queue->queueMutex);
+    return appendResult;
+}
+
+/*
+ * FUNCTION : outputQueuePush
+ *
+ * DESCRIPTION : This function queues a message without sending it, for callers that must queue to many clients
+ * under their own lock and send afterwards (see outputQueueFlush)
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *              OutboundMessage *message : The message, the queue takes its own reference.
+ *
+ * RETURNS : int : 0 if the message was queued, -1 if the queue is closed or the client was too slow (errno ENOBUFS).
+ */
+int outputQueuePush(OutputQueue *queue, OutboundMessage *message)
+{
+    pthread_mutex_lock(&queue->queueMutex);
+    int pushResult = queueMessage(queue, message);
+    pthread_mutex_unlock(&queue->queueMutex);
+    return pushResult;
+}
+
+/*
+ * FUNCTION : outputQueueFlush
+ *
+ * DESCRIPTION : This function sends what it can of a queue straight away, the rest is left to the writer thread
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *
+ * RETURNS : void
+ */
+void outputQueueFlush(OutputQueue *queue)
+{
+    pthread_mutex_lock(&queue->queueMutex);
+    if (!queue->isClosed && !queue->isWaitingForWriter)
+    {
+        flushQueue(queue);
+    }
+    pthread_mutex_unlock(&queue->queueMutex);
+}
+
+/*
+ * FUNCTION : outputQueueAppendText
+ *
+ * DESCRIPTION : This function queues a single line for one connection (pings, stats, replies)
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *              const char *text : The line, without the frame end.
+ *
+ * RETURNS : int : 0 if the line was queued, -1 otherwise.
+ */
+int outputQueueAppendText(OutputQueue *queue, const char *text)
+{
+    OutboundMessage *message = outboundMessageCreate(text, strlen(text));
+    if (message == NULL)
+    {
+        return -1;
+    }
+    int appendResult = outputQueueAppend(queue, message);
+    outboundMessageRelease(message);
+    return appendResult;
+}
+
+/*
+ * FUNCTION : outputQueueAppendControl
+ *
+ * DESCRIPTION : This function queues a control line for one connection (pings, refusals) on the control lane, so it
+ * goes out ahead of any chat traffic still queued, and sends what it can straight away. The control lane has its own
+ * small limit: a client that lets OUTPUT_CONTROL_LIMIT_BYTES of it pile up isn't reading at all and is shut down.
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *              const char *text : The line, without the frame end.
+ *
+ * RETURNS : int : 0 if the line was queued, -1 if the queue is closed or the client stopped reading (errno ENOBUFS).
+ */
+int outputQueueAppendControl(OutputQueue *queue, const char *text)
+{
+    OutboundMessage *message = outboundMessageCreate(text, strlen(text));
+    OutputQueueEntry *entry = malloc(sizeof(OutputQueueEntry));
+    if (message == NULL || entry == NULL)
+    {
+        if (message != NULL)
+        {
+            outboundMessageRelease(message);
+        }
+        free(entry);
+        errno = ENOMEM;
+        return -1;
+    }
+    entry->next = NULL;
+    entry->message = message;
+    entry->stream = NULL;
+
+    int appendResult = 0;
+    pthread_mutex_lock(&queue->queueMutex);
+    if (queue->isClosed)
+    {
+        errno = EPIPE;
+        appendResult = -1;
+    }
+    else if (queue->controlBytes + message->length > OUTPUT_CONTROL_LIMIT_BYTES)
+    {
+        // Same as a bulk backlog over its limit, its reader wakes up with an error and removes it
+        shutDownQueue(queue);
+        errno = ENOBUFS;
+        appendResult = -1;
+    }
+    else
+    {
+        if (queue->controlTail != NULL)
+        {
+            queue->controlTail->next = entry;
+        }
+        else
+        {
+            queue->controlHead = entry;
+        }
+        queue->controlTail = entry;
+        queue->controlBytes += message->length;
+        memoryCharge(queue->memoryAccount, MEMORY_OUTPUT, sizeof(OutputQueueEntry));
+        entry = NULL;
+        __atomic_add_fetch(&totalQueuedFrames, 1, __ATOMIC_RELAXED);
+        if (!queue->isWaitingForWriter)
+        {
+            flushQueue(queue);
+        }
+    }
+    pthread_mutex_unlock(&queue->queueMutex);
+
+    if (entry != NULL)
+    {
+        free(entry);
+        outboundMessageRelease(message);
+    }
+    return appendResult;
+}
+
+/*
+ * FUNCTION : outputQueueAppendStream
+ *
+ * DESCRIPTION : This function queues a file to send in chunks and sends what it can straight away. The file bytes
+ * don't count against OUTPUT_QUEUE_LIMIT_BYTES, they are read from the file as the peer takes them.
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *              OutboundStream *stream : The stream, released through its release function once the queue is done
+ *                                       with it (straight away if it can't be queued).
+ *
+ * RETURNS : int : 0 if the stream was queued, -1 otherwise.
+ */
+int outputQueueAppendStream(OutputQueue *queue, OutboundStream *stream)
+{
+    OutputQueueEntry *entry = malloc(sizeof(OutputQueueEntry));
+    pthread_mutex_lock(&queue->queueMutex);
+    if (entry == NULL || queue->isClosed)
+    {
+        pthread_mutex_unlock(&queue->queueMutex);
+        free(entry);
+        stream->release(stream);
+        return -1;
+    }
+
+    entry->message = NULL;
+    entry->stream = stream;
+    entry->chunkHeaderLength = 0;
+    entry->chunkRemaining = 0;
+    appendEntry(queue, entry);
+    memoryCharge(queue->memoryAccount, MEMORY_OUTPUT, sizeof(OutputQueueEntry));
+    __atomic_add_fetch(&totalQueuedFrames, 1, __ATOMIC_RELAXED);
+    if (!queue->isWaitingForWriter)
+    {
+        flushQueue(queue);
+    }
+    pthread_mutex_unlock(&queue->queueMutex);
+    return 0;
+}
+
+/*
+ * FUNCTION : outputQueueRunWhenIdle
+ *
+ * DESCRIPTION : This function runs something on the transport with nothing else being sent, but only if every
+ * queued byte has already gone out (used to switch a connection to shared memory without reordering frames).
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *              int (*action)(Transport *transport) : What to run.
+ *
+ * RETURNS : int : 1 if the action ran, 0 if frames were still queued.
+ */
+int outputQueueRunWhenIdle(OutputQueue *queue, int (*action)(Transport *transport))
+{
+    int wasIdle = 0;
+    pthread_mutex_lock(&queue->queueMutex);
+    if (queue->head == NULL && queue->compressedBlock == NULL && queue->controlHead == NULL && !queue->isClosed)
+    {
+        action(queue->transport);
+        wasIdle = 1;
+    }
+    pthread_mutex_unlock(&queue->queueMutex);
+    return wasIdle;
+}
+
+/*
+ * FUNCTION : outputQueueClose
+ *
+ * DESCRIPTION : This function stops a queue for a connection that is going away and throws away what is left in it.
+ * Once it returns nothing sends on the transport through this queue again.
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *
+ * RETURNS : void
+ */
+void outputQueueClose(OutputQueue *queue)
+{
+    pthread_mutex_lock(&queue->queueMutex);
+    queue->isClosed = 1;
+    discardQueued(queue);
+    unregisterFromWriter(queue);
+
+    // The next connection on this slot starts uncompressed
+    if (queue->compressor != NULL)
+    {
+        free(queue->compressor);
+        queue->compressor = NULL;
+        memoryRelease(queue->memoryAccount, MEMORY_COMPRESSION, sizeof(LzWindow));
+    }
+    pthread_mutex_unlock(&queue->queueMutex);
+}
+
+/*
+ * FUNCTION : outputQueueShed
+ *
+ * DESCRIPTION : This function disconnects a client to get memory back, the same way as one whose backlog passed
+ * OUTPUT_QUEUE_LIMIT_BYTES: what is queued is thrown away and its reader wakes up with an error and removes it
+ *
+ * PARAMETERS : OutputQueue *queue : The client's queue.
+ *
+ * RETURNS : int : 0 if the client was shed, -1 if its queue was already closed.
+ */
+int outputQueueShed(OutputQueue *queue)
+{
+    int shedResult = -1;
+    pthread_mutex_lock(&queue->queueMutex);
+    if (!queue->isClosed)
+    {
+        shutDownQueue(queue);
+        shedResult = 0;
+    }
+    pthread_mutex_unlock(&queue->queueMutex);
+    return shedResult;
+}
+
+/*
+ * FUNCTION : outputQueueEnableCompression
+ *
+ * DESCRIPTION : This function queues the reply agreeing to compression and starts compressing batches after it.
+ * Everything already queued, the reply included, goes out as it is, so the peer knows before the first block.
+ *
+ * PARAMETERS : OutputQueue *queue : The queue.
+ *              const char *acceptText : The reply, without the frame end.
+ *
+ * RETURNS : int : 0 on success, -1 if the queue is closed or memory ran out.
+ */
+int outputQueueEnableCompression(OutputQueue *queue, const char *acceptText)
+{
+    LzWindow *compressor = malloc(sizeof(LzWindow));
+    OutboundMessage *reply = outboundMessageCreate(acceptText, strlen(acceptText));
+    if (compressor == NULL || reply == NULL)
+    {
+        free(compressor);
+        if (reply != NULL)
+        {
+            outboundMessageRelease(reply);
+        }
+        return -1;
+    }
+    lzWindowInitialize(compressor);
+
+    pthread_mutex_lock(&queue->queueMutex);
+    int enableResult = queueMessage(queue, reply);
+    if (enableResult == 0)
+    {
+        // Asked again: the peer starts its window over when it reads the reply, so this end does too
+        if (queue->compressor != NULL)
+        {
+            free(queue->compressor);
+            memoryRelease(queue->memoryAccount, MEMORY_COMPRESSION, sizeof(LzWindow));
+        }
+        queue->compressor = compressor;
+        memoryCharge(queue->memoryAccount, MEMORY_COMPRESSION, sizeof(LzWindow));
+        compressor = NULL;
+        queue->uncompressedEntries = 0;
+        for (OutputQueueEntry *entry = queue->head; entry != NULL; entry = entry->next)
+        {
+            queue->uncompressedEntries++;
+        }
+        if (!queue->isWaitingForWriter)
+        {
+            flushQueue(queue);
+        }
+    }
+    pthread_mutex_unlock(&queue->queueMutex);
+
+    free(compressor);
+    outboundMessageRelease(reply);
+    return enableResult;
+}
+
+/*
+ * FUNCTION : outputQueueCompressionCounts
+ *
+ * DESCRIPTION : This function reports how much compression has saved across every connection (for stats)
+ *
+ * PARAMETERS : unsigned long *batches : Set to the compressed blocks sent.
+ *              unsigned long *rawBytes : Set to the bytes of the frames that went into them.
+ *              unsigned long *sentBytes : Set to the bytes actually sent for them, headers included.
+ *
+ * RETURNS : void
+ */
+void outputQueueCompressionCounts(unsigned long *batches, unsigned long *rawBytes, unsigned long *sentBytes)
+{
+    *batches = __atomic_load_n(&compressedBatches, __ATOMIC_RELAXED);
+    *rawBytes = __atomic_load_n(&compressedRawBytes, __ATOMIC_RELAXED);
+    *sentBytes = __atomic_load_n(&compressedSentBytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * FUNCTION : outputWriterThread
+ *
+ * DESCRIPTION : This function is the single thread that finishes sends the peer wasn't ready for. It polls the
+ * sockets of waiting queues for room (shared memory rings have nothing to poll, so those are retried on a short
+ * timeout). The list is only a hint, a queue that was closed or reused in the meantime just flushes as normal.
+ *
+ * PARAMETERS : void *unused : Not used.
+ *
+ * RETURNS : void * : Never returns.
+ */
+static void *outputWriterThread(void *unused)
+{
+    OutputQueue *pollQueues[OUTPUT_WRITER_MAX_WAITING];
+    struct pollfd writerPolls[OUTPUT_WRITER_MAX_WAITING + 1];
+
+    while (1)
+    {
+        int queueCount = 0;
+        int hasSharedMemory = 0;
+        writerPolls[0].fd = writerDoorbell;
+        writerPolls[0].events = POLLIN;
+
+        pthread_mutex_lock(&writerMutex);
+        for (OutputQueue *queue = waitingQueues; queue != NULL && queueCount < OUTPUT_WRITER_MAX_WAITING; queue = queue->nextWaiting)
+        {
+            pollQueues[queueCount] = queue;
+            writerPolls[queueCount + 1].fd = queue->transport->socket;
+            writerPolls[queueCount + 1].events = POLLOUT;
+            if (queue->transport->kind == TRANSPORT_SHARED_MEMORY)
+            {
+                writerPolls[queueCount + 1].events = 0;
+                hasSharedMemory = 1;
+            }
+            queueCount++;
+        }
+        pthread_mutex_unlock(&writerMutex);
+
+        if (poll(writerPolls, queueCount + 1, hasSharedMemory ? OUTPUT_WRITER_RETRY_MS : -1) < 0 && errno != EINTR)
+        {
+            perror("writer poll failed");
+            continue;
+        }
+        if (writerPolls[0].revents & POLLIN)
+        {
+            eventfd_t doorbellCount;
+            eventfd_read(writerDoorbell, &doorbellCount);
+        }
+
+        for (int i = 0; i < queueCount; i++)
+        {
+            if (writerPolls[i + 1].revents == 0 && writerPolls[i + 1].events != 0)
+            {
+                continue;
+            }
+            pthread_mutex_lock(&pollQueues[i]->queueMutex);
+            if (pollQueues[i]->isWaitingForWriter)
+            {
+                flushQueue(pollQueues[i]);
+            }
+            pthread_mutex_unlock(&pollQueues[i]->queueMutex);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * FUNCTION : outputQueueStartWriter
+ *
+ * DESCRIPTION : This function starts the writer thread
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : int : 0 on success, -1 on error.
+ */
+int outputQueueStartWriter(void)
+{
+    writerDoorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (writerDoorbell < 0)
+    {
+        perror("eventfd failed");
+        return -1;
+    }
+
+    pthread_t threadId;
+    if (pthread_create(&threadId, NULL, outputWriterThread, NULL) != 0)
+    {
+        perror("pthread_create failed");
+        return -1;
+    }
+    pthread_detach(threadId);
+    return 0;
+}
+
+/*
+ * FUNCTION : outputQueueTotalFrames
+ *
+ * DESCRIPTION : This function returns how many frames are waiting across every queue
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : int : The number of frames.
+ */
+int outputQueueTotalFrames(void)
+{
+    return __atomic_load_n(&totalQueuedFrames, __ATOMIC_RELAXED);
+}
+
+/*
+ * FUNCTION : outputQueueControlCounts
+ *
+ * DESCRIPTION : This function reports how the control lane has been used across every connection (for stats)
+ *
+ * PARAMETERS : unsigned long *sent : Set to the control frames sent.
+ *              unsigned long *ahead : Set to how many of them went out while bulk frames were still queued.
+ *
+ * RETURNS : void
+ */
+void outputQueueControlCounts(unsigned long *sent, unsigned long *ahead)
+{
+    *sent = __atomic_load_n(&controlFramesSent, __ATOMIC_RELAXED);
+    *ahead = __atomic_load_n(&controlFramesAhead, __ATOMIC_RELAXED);
+}
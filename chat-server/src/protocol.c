@@ -0,0 +1,209 @@
+#include "../inc/protocol.h"
+#include "../../Common/inc/scan.h"
+#include "../../Common/inc/utf8.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * FUNCTION : nextField
+ *
+ * DESCRIPTION : This function finds the next field of a frame the way strtok does (empty fields are skipped), but
+ * without writing into the frame and with a vector scan for the separator
+ *
+ * PARAMETERS : const char **cursor : Where the search starts, moved to the separator after the field.
+ *              const char *frameEnd : End of the frame.
+ *              size_t *fieldLength : Set to the length of the field.
+ *
+ * RETURNS : const char * : Start of the field, or NULL if there are no more.
+ */
+static const char *nextField(const char **cursor, const char *frameEnd, size_t *fieldLength)
+{
+    const char *fieldStart = *cursor;
+    while (fieldStart < frameEnd && *fieldStart == PROTOCOL_FIELD_SEPARATOR[0])
+    {
+        fieldStart++;
+    }
+    if (fieldStart == frameEnd)
+    {
+        return NULL;
+    }
+
+    const char *fieldEnd = scanFindByte(fieldStart, frameEnd - fieldStart, PROTOCOL_FIELD_SEPARATOR[0]);
+    if (fieldEnd == NULL)
+    {
+        fieldEnd = frameEnd;
+    }
+    *fieldLength = fieldEnd - fieldStart;
+    *cursor = fieldEnd;
+    return fieldStart;
+}
+
+/*
+ * FUNCTION : copyField
+ *
+ * DESCRIPTION : This function copies a field into a fixed size buffer, cutting it off (between characters) if it
+ * doesn't fit
+ *
+ * PARAMETERS : char *destination : Where to put the field.
+ *              size_t destinationSize : Size of the buffer.
+ *              const char *field : Start of the field.
+ *              size_t fieldLength : Length of the field.
+ *
+ * RETURNS : void
+ */
+static void copyField(char *destination, size_t destinationSize, const char *field, size_t fieldLength)
+{
+    if (fieldLength > destinationSize - 1)
+    {
+        fieldLength = utf8TrimLength(field, destinationSize - 1);
+    }
+    memcpy(destination, field, fieldLength);
+    destination[fieldLength] = '\0';
+}
+
+/*
+ * FUNCTION : parseProtocolMessage
+ *
+ * DESCRIPTION : This function splits a client frame into its IP, username, message count and message text.
+ * It runs on the worker pool, so it keeps no state between calls (unlike strtok).
+ *
+ * PARAMETERS : const char *protocolMessage : The raw protocol message string (without the frame end).
+ *              ProtocolMessage *message : Where to put the fields, missing ones are left empty.
+ *
+ * RETURNS : void
+ */
+void parseProtocolMessage(const char *protocolMessage, ProtocolMessage *message)
+{
+    message->clientIP[0] = '\0';
+    message->username[0] = '\0';
+    message->messageCount = -1;
+    message->messageText[0] = '\0';
+
+    const char *cursor = protocolMessage;
+    const char *frameEnd = protocolMessage + strnlen(protocolMessage, PROTOCOL_PARSE_LIMIT);
+    size_t fieldLength;
+
+    // Pull out the IP address
+    const char *field = nextField(&cursor, frameEnd, &fieldLength);
+    if (field != NULL)
+    {
+        copyField(message->clientIP, sizeof(message->clientIP), field, fieldLength);
+
+        // Pull the username
+        field = nextField(&cursor, frameEnd, &fieldLength);
+    }
+    if (field != NULL)
+    {
+        copyField(message->username, sizeof(message->username), field, fieldLength);
+
+        // Pull the message COUNT (to check if it is one message up to 40 chars, or parts of an 80 char message)
+        field = nextField(&cursor, frameEnd, &fieldLength);
+    }
+    if (field != NULL)
+    {
+        message->messageCount = atoi(field);
+
+        // Pull the message
+        field = nextField(&cursor, frameEnd, &fieldLength);
+    }
+    if (field != NULL)
+    {
+        copyField(message->messageText, sizeof(message->messageText), field, fieldLength);
+    }
+
+    // What every client will print, so no terminal control characters
+    int isUsernameAscii = protocolSanitizeText(message->username);
+    int isTextAscii = protocolSanitizeText(message->messageText);
+    message->isPrintableAscii = isUsernameAscii && isTextAscii;
+}
+
+/*
+ * FUNCTION : protocolSanitizeText
+ *
+ * DESCRIPTION : This function replaces control characters (C0 and C1) and bytes that aren't valid UTF-8 in text
+ * with '?', one per byte. Almost all text is plain printable ASCII, which one vector check confirms without looking
+ * at each byte.
+ *
+ * PARAMETERS : char *text : The text to clean up in place.
+ *
+ * RETURNS : int : 1 if the text was all printable ASCII (and left alone), 0 if not.
+ */
+int protocolSanitizeText(char *text)
+{
+    size_t textLength = strlen(text);
+    if (scanIsPrintableAscii(text, textLength))
+    {
+        return 1;
+    }
+    for (size_t i = 0; i < textLength;)
+    {
+        unsigned int codepoint;
+        size_t characterLength = utf8DecodeNext(text + i, textLength - i, &codepoint);
+        if (characterLength == 0)
+        {
+            text[i++] = '?';
+            continue;
+        }
+        if (codepoint < SCAN_PRINTABLE_FIRST || (codepoint >= 0x7f && codepoint < 0xa0))
+        {
+            memset(text + i, '?', characterLength);
+        }
+        i += characterLength;
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : formatBroadcastMessage
+ *
+ * DESCRIPTION : This function builds the line every client is sent for a chat message. The username and text are
+ * padded by the columns they take on a terminal, not their bytes, so lines with wide or accented characters line up
+ * (plain ASCII, nearly every line, is padded by its length).
+ *
+ * PARAMETERS : const ProtocolMessage *message : The parsed client frame.
+ *              char *buffer : Where to put the line.
+ *              size_t bufferSize : Size of the buffer.
+ *
+ * RETURNS : int : Length of the line (snprintf rules, may be more than fit).
+ */
+int formatBroadcastMessage(const ProtocolMessage *message, char *buffer, size_t bufferSize)
+{
+    if (message->isPrintableAscii)
+    {
+        return snprintf(buffer, bufferSize, "%-*s [%-*s] >> %-*s", 1, message->clientIP, PROTOCOL_USERNAME_COLUMNS,
+                        message->username, PROTOCOL_TEXT_COLUMNS, message->messageText);
+    }
+    int usernamePad = PROTOCOL_USERNAME_COLUMNS - utf8DisplayWidth(message->username, strlen(message->username));
+    int textPad = PROTOCOL_TEXT_COLUMNS - utf8DisplayWidth(message->messageText, strlen(message->messageText));
+    return snprintf(buffer, bufferSize, "%-*s [%s%*s] >> %s%*s", 1, message->clientIP, message->username,
+                    usernamePad > 0 ? usernamePad : 0, "", message->messageText, textPad > 0 ? textPad : 0, "");
+}
+
+/*
+ * FUNCTION : protocolMessageText
+ *
+ * DESCRIPTION : This function finds the message text of a frame without copying or splitting it.
+ * The reader threads use it to spot control verbs (bye, stats) before handing the frame to the pool.
+ *
+ * PARAMETERS : const char *protocolMessage : The raw protocol message string.
+ *
+ * RETURNS : const char * : Start of the message text, or NULL if the frame has fewer than 4 fields.
+ */
+const char *protocolMessageText(const char *protocolMessage)
+{
+    const char *field = protocolMessage;
+    size_t remainingLength = strlen(protocolMessage);
+    for (int i = 0; i < PROTOCOL_TEXT_FIELD; i++)
+    {
+        const char *separator = scanFindByte(field, remainingLength, PROTOCOL_FIELD_SEPARATOR[0]);
+        if (separator == NULL)
+        {
+            return NULL;
+        }
+        remainingLength -= separator + 1 - field;
+        field = separator + 1;
+    }
+    return field;
+}
+
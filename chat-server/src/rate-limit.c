@@ -0,0 +1,100 @@
+#include "../inc/rate-limit.h"
+#include "../inc/server-clock.h"
+
+/*
+ * FUNCTION : tokenBucketInitialize
+ *
+ * DESCRIPTION : This function starts a bucket full, so a new client can send a burst straight away
+ *
+ * PARAMETERS : TokenBucket *bucket : The bucket to initialize.
+ *              int burstSize : The most frames the bucket can hold.
+ *
+ * RETURNS : void
+ */
+void tokenBucketInitialize(TokenBucket *bucket, int burstSize)
+{
+    bucket->milliTokens = (long long)burstSize * 1000;
+    bucket->lastRefillNs = monotonicNanoseconds();
+    bucket->framesAllowed = 0;
+    bucket->framesThrottled = 0;
+}
+
+/*
+ * FUNCTION : refillBucket
+ *
+ * DESCRIPTION : This function tops the bucket up for the time that passed
+ *
+ * PARAMETERS : TokenBucket *bucket : The connection's bucket.
+ *              int framesPerSecond : Refill rate.
+ *              int burstSize : The most frames the bucket can hold.
+ *
+ * RETURNS : void
+ */
+static void refillBucket(TokenBucket *bucket, int framesPerSecond, int burstSize)
+{
+    long long now = monotonicNanoseconds();
+    long long elapsedNs = now - bucket->lastRefillNs;
+    long long capacity = (long long)burstSize * 1000;
+
+    // Refill: framesPerSecond * 1000 milli-tokens per second of elapsed time
+    long long refill = elapsedNs * framesPerSecond / 1000000LL;
+    if (refill > 0)
+    {
+        bucket->milliTokens += refill;
+        if (bucket->milliTokens > capacity)
+        {
+            bucket->milliTokens = capacity;
+        }
+        bucket->lastRefillNs = now;
+    }
+}
+
+/*
+ * FUNCTION : tokenBucketTake
+ *
+ * DESCRIPTION : This function tops the bucket up for the time that passed and tries to take one token for a frame.
+ * Only the thread reading the connection touches its bucket, so no locking is needed.
+ *
+ * PARAMETERS : TokenBucket *bucket : The connection's bucket.
+ *              int framesPerSecond : Refill rate.
+ *              int burstSize : The most frames the bucket can hold.
+ *
+ * RETURNS : long long : 0 if the frame may go through, otherwise nanoseconds until a token will be available.
+ */
+long long tokenBucketTake(TokenBucket *bucket, int framesPerSecond, int burstSize)
+{
+    refillBucket(bucket, framesPerSecond, burstSize);
+    if (bucket->milliTokens >= 1000)
+    {
+        bucket->milliTokens -= 1000;
+        bucket->framesAllowed++;
+        return 0;
+    }
+
+    // Work out how long until the missing part of a token has dripped in (at least 1ns)
+    bucket->framesThrottled++;
+    long long missing = 1000 - bucket->milliTokens;
+    return missing * 1000000LL / framesPerSecond + 1;
+}
+
+/*
+ * FUNCTION : tokenBucketWait
+ *
+ * DESCRIPTION : This function tops the bucket up and says whether a frame would have to wait, without taking a
+ * token or counting anything (for a thread that must not be the one to wait)
+ *
+ * PARAMETERS : TokenBucket *bucket : The connection's bucket.
+ *              int framesPerSecond : Refill rate.
+ *              int burstSize : The most frames the bucket can hold.
+ *
+ * RETURNS : long long : 0 if a token is there, otherwise nanoseconds until one will be.
+ */
+long long tokenBucketWait(TokenBucket *bucket, int framesPerSecond, int burstSize)
+{
+    refillBucket(bucket, framesPerSecond, burstSize);
+    if (bucket->milliTokens >= 1000)
+    {
+        return 0;
+    }
+    return (1000 - bucket->milliTokens) * 1000000LL / framesPerSecond + 1;
+}
@@ -0,0 +1,756 @@
+#define _GNU_SOURCE
+#include "../inc/search-index.h"
+#include "../inc/memory-budget.h"
+#include <fcntl.h>
+
+// Position in one term's postings while a query walks them from newest to oldest
+typedef struct
+{
+    const TermPostings *postings;
+    int segmentIndex; // Segment decoded into documents, -1 before the first
+    unsigned int documents[SEARCH_SEGMENT_POSTINGS];
+} PostingCursor;
+
+/*
+ * FUNCTION : hashTerm
+ *
+ * DESCRIPTION : This function hashes a term for the term table (FNV-1a)
+ *
+ * PARAMETERS : const char *term : The term.
+ *
+ * RETURNS : unsigned int : The hash.
+ */
+static unsigned int hashTerm(const char *term)
+{
+    unsigned int hash = 2166136261u;
+    for (const unsigned char *termByte = (const unsigned char *)term; *termByte != '\0'; termByte++)
+    {
+        hash = (hash ^ *termByte) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * FUNCTION : isTermByte
+ *
+ * DESCRIPTION : This function says whether a byte is part of a word. Letters, digits and anything outside ASCII
+ * (so UTF-8 words stay whole) are, everything else separates words.
+ *
+ * PARAMETERS : unsigned char textByte : The byte.
+ *
+ * RETURNS : int : 1 if it is part of a word, 0 otherwise.
+ */
+static int isTermByte(unsigned char textByte)
+{
+    return textByte >= 0x80 || isalnum(textByte);
+}
+
+/*
+ * FUNCTION : nextTerm
+ *
+ * DESCRIPTION : This function cuts the next word out of some text, lower case and at most SEARCH_TERM_MAX_LENGTH bytes
+ *
+ * PARAMETERS : const char **text : Where to start, moved past the word.
+ *              char *term : Room for SEARCH_TERM_MAX_LENGTH bytes and the terminator.
+ *
+ * RETURNS : int : Length of the word, 0 when there are no more.
+ */
+static int nextTerm(const char **text, char *term)
+{
+    const unsigned char *textByte = (const unsigned char *)*text;
+    while (*textByte != '\0' && !isTermByte(*textByte))
+    {
+        textByte++;
+    }
+
+    int termLength = 0;
+    for (; *textByte != '\0' && isTermByte(*textByte); textByte++)
+    {
+        if (termLength < SEARCH_TERM_MAX_LENGTH)
+        {
+            term[termLength++] = tolower(*textByte);
+        }
+    }
+    term[termLength] = '\0';
+    *text = (const char *)textByte;
+    return termLength;
+}
+
+/*
+ * FUNCTION : userTerm
+ *
+ * DESCRIPTION : This function makes the term a user's messages are indexed under
+ *
+ * PARAMETERS : const char *userName : The user name (as the client sent it).
+ *              char *term : Room for SEARCH_TERM_MAX_LENGTH + 2 bytes.
+ *
+ * RETURNS : void
+ */
+static void userTerm(const char *userName, char *term)
+{
+    int termLength = 0;
+    term[termLength++] = SEARCH_USER_TERM_MARKER;
+    for (; *userName != '\0' && termLength <= SEARCH_TERM_MAX_LENGTH; userName++)
+    {
+        if (*userName != ' ')
+        {
+            term[termLength++] = tolower((unsigned char)*userName);
+        }
+    }
+    term[termLength] = '\0';
+}
+
+/*
+ * FUNCTION : findTermSlot
+ *
+ * DESCRIPTION : This function finds where a term is, or would go, in the term table. indexMutex must be held.
+ *
+ * PARAMETERS : TermPostings **terms : The table.
+ *              unsigned int capacity : Its size (a power of two).
+ *              const char *term : The term.
+ *
+ * RETURNS : unsigned int : The slot, holding the term or empty.
+ */
+static unsigned int findTermSlot(TermPostings **terms, unsigned int capacity, const char *term)
+{
+    unsigned int slot = hashTerm(term) & (capacity - 1);
+    while (terms[slot] != NULL && strcmp(terms[slot]->term, term) != 0)
+    {
+        slot = (slot + 1) & (capacity - 1);
+    }
+    return slot;
+}
+
+/*
+ * FUNCTION : growTermTable
+ *
+ * DESCRIPTION : This function doubles the term table. indexMutex must be held.
+ *
+ * PARAMETERS : SearchIndex *index : The index.
+ *
+ * RETURNS : int : 0 on success, -1 if it couldn't be allocated.
+ */
+static int growTermTable(SearchIndex *index)
+{
+    unsigned int newCapacity = index->termCapacity * 2;
+    TermPostings **newTerms = calloc(newCapacity, sizeof(TermPostings *));
+    if (newTerms == NULL)
+    {
+        return -1;
+    }
+    for (unsigned int i = 0; i < index->termCapacity; i++)
+    {
+        if (index->terms[i] != NULL)
+        {
+            newTerms[findTermSlot(newTerms, newCapacity, index->terms[i]->term)] = index->terms[i];
+        }
+    }
+    free(index->terms);
+    memoryCharge(NULL, MEMORY_SEARCH, (long long)(newCapacity - index->termCapacity) * sizeof(TermPostings *));
+    index->terms = newTerms;
+    index->termCapacity = newCapacity;
+    return 0;
+}
+
+/*
+ * FUNCTION : addPosting
+ *
+ * DESCRIPTION : This function records that a document contains a term. Documents only ever arrive in increasing
+ * order, so the posting goes on the end of the term's open segment as a varint of the gap from the last one.
+ * indexMutex must be held.
+ *
+ * PARAMETERS : SearchIndex *index : The index.
+ *              const char *term : The term.
+ *              unsigned int document : The document.
+ *
+ * RETURNS : void
+ */
+static void addPosting(SearchIndex *index, const char *term, unsigned int document)
+{
+    if ((index->termCount + 1) * 10 >= index->termCapacity * 7 && growTermTable(index) < 0)
+    {
+        return;
+    }
+
+    unsigned int slot = findTermSlot(index->terms, index->termCapacity, term);
+    TermPostings *postings = index->terms[slot];
+    if (postings == NULL)
+    {
+        postings = malloc(sizeof(TermPostings) + strlen(term) + 1);
+        if (postings == NULL)
+        {
+            return;
+        }
+        postings->documentCount = 0;
+        postings->segmentCount = 0;
+        postings->segmentCapacity = 0;
+        postings->segments = NULL;
+        strcpy(postings->term, term);
+        memoryCharge(NULL, MEMORY_SEARCH, sizeof(TermPostings) + strlen(term) + 1);
+        index->terms[slot] = postings;
+        index->termCount++;
+    }
+
+    PostingSegment *segment = postings->segmentCount > 0 ? &postings->segments[postings->segmentCount - 1] : NULL;
+    if (segment != NULL && segment->lastDocument == document)
+    {
+        // The word came up twice in one message
+        return;
+    }
+
+    if (segment == NULL || segment->postingCount == SEARCH_SEGMENT_POSTINGS)
+    {
+        if (postings->segmentCount == postings->segmentCapacity)
+        {
+            int newCapacity = postings->segmentCapacity > 0 ? postings->segmentCapacity * 2 : 1;
+            PostingSegment *newSegments = realloc(postings->segments, newCapacity * sizeof(PostingSegment));
+            if (newSegments == NULL)
+            {
+                return;
+            }
+            memoryCharge(NULL, MEMORY_SEARCH, (long long)(newCapacity - postings->segmentCapacity) * sizeof(PostingSegment));
+            postings->segments = newSegments;
+            postings->segmentCapacity = newCapacity;
+        }
+        unsigned char *segmentBytes = malloc(SEARCH_SEGMENT_BYTES);
+        if (segmentBytes == NULL)
+        {
+            return;
+        }
+
+        // The full one never changes again, give back the room it didn't use
+        if (segment != NULL)
+        {
+            segment = &postings->segments[postings->segmentCount - 1];
+            unsigned char *trimmedBytes = realloc(segment->bytes, segment->byteLength);
+            if (trimmedBytes != NULL)
+            {
+                segment->bytes = trimmedBytes;
+                memoryRelease(NULL, MEMORY_SEARCH, SEARCH_SEGMENT_BYTES - segment->byteLength);
+            }
+        }
+        memoryCharge(NULL, MEMORY_SEARCH, SEARCH_SEGMENT_BYTES);
+
+        segment = &postings->segments[postings->segmentCount++];
+        segment->firstDocument = document;
+        segment->lastDocument = document;
+        segment->postingCount = 0;
+        segment->byteLength = 0;
+        segment->bytes = segmentBytes;
+    }
+
+    // The first posting of a segment is its firstDocument, a gap of 0
+    unsigned int gap = document - segment->lastDocument;
+    while (gap >= 0x80)
+    {
+        segment->bytes[segment->byteLength++] = (unsigned char)(gap | 0x80);
+        gap >>= 7;
+    }
+    segment->bytes[segment->byteLength++] = (unsigned char)gap;
+    segment->lastDocument = document;
+    segment->postingCount++;
+    postings->documentCount++;
+}
+
+/*
+ * FUNCTION : decodeSegment
+ *
+ * DESCRIPTION : This function turns a segment back into document numbers
+ *
+ * PARAMETERS : const PostingSegment *segment : The segment.
+ *              unsigned int *documents : Room for SEARCH_SEGMENT_POSTINGS numbers.
+ *
+ * RETURNS : void
+ */
+static void decodeSegment(const PostingSegment *segment, unsigned int *documents)
+{
+    const unsigned char *segmentByte = segment->bytes;
+    unsigned int document = segment->firstDocument;
+    for (int i = 0; i < segment->postingCount; i++)
+    {
+        unsigned int gap = 0;
+        int shift = 0;
+        while (*segmentByte & 0x80)
+        {
+            gap |= (unsigned int)(*segmentByte++ & 0x7f) << shift;
+            shift += 7;
+        }
+        gap |= (unsigned int)*segmentByte++ << shift;
+        document += gap;
+        documents[i] = document;
+    }
+}
+
+/*
+ * FUNCTION : cursorSeekAtMost
+ *
+ * DESCRIPTION : This function finds the newest document in a term's postings that is no newer than the one given.
+ * Segments are found by their first document without decoding them, and only the one that holds the answer is decoded.
+ *
+ * PARAMETERS : PostingCursor *cursor : The term's cursor.
+ *              unsigned int document : The newest document wanted.
+ *
+ * RETURNS : long : The document, or -1 if the term isn't in any document that old.
+ */
+static long cursorSeekAtMost(PostingCursor *cursor, unsigned int document)
+{
+    const TermPostings *postings = cursor->postings;
+
+    // Last segment starting at or before the document
+    int lowSegment = 0;
+    int highSegment = postings->segmentCount - 1;
+    int foundSegment = -1;
+    while (lowSegment <= highSegment)
+    {
+        int middleSegment = (lowSegment + highSegment) / 2;
+        if (postings->segments[middleSegment].firstDocument <= document)
+        {
+            foundSegment = middleSegment;
+            lowSegment = middleSegment + 1;
+        }
+        else
+        {
+            highSegment = middleSegment - 1;
+        }
+    }
+    if (foundSegment < 0)
+    {
+        return -1;
+    }
+
+    const PostingSegment *segment = &postings->segments[foundSegment];
+    if (segment->lastDocument <= document)
+    {
+        return segment->lastDocument;
+    }
+    if (cursor->segmentIndex != foundSegment)
+    {
+        decodeSegment(segment, cursor->documents);
+        cursor->segmentIndex = foundSegment;
+    }
+
+    // Last posting at or before the document (the first one always is)
+    int lowPosting = 0;
+    int highPosting = segment->postingCount - 1;
+    while (lowPosting < highPosting)
+    {
+        int middlePosting = (lowPosting + highPosting + 1) / 2;
+        if (cursor->documents[middlePosting] <= document)
+        {
+            lowPosting = middlePosting;
+        }
+        else
+        {
+            highPosting = middlePosting - 1;
+        }
+    }
+    return cursor->documents[lowPosting];
+}
+
+/*
+ * FUNCTION : firstDocumentAt
+ *
+ * DESCRIPTION : This function finds the first document stamped at or after a time. indexMutex must be held.
+ *
+ * PARAMETERS : SearchIndex *index : The index.
+ *              long long serverMs : The time.
+ *
+ * RETURNS : unsigned int : The document (documentCount if they are all older).
+ */
+static unsigned int firstDocumentAt(SearchIndex *index, long long serverMs)
+{
+    unsigned int lowDocument = 0;
+    unsigned int highDocument = index->documentCount;
+    while (lowDocument < highDocument)
+    {
+        unsigned int middleDocument = lowDocument + (highDocument - lowDocument) / 2;
+        if (index->documents[middleDocument].serverMs < serverMs)
+        {
+            lowDocument = middleDocument + 1;
+        }
+        else
+        {
+            highDocument = middleDocument;
+        }
+    }
+    return lowDocument;
+}
+
+/*
+ * FUNCTION : searchIndexInitialize
+ *
+ * DESCRIPTION : This function sets up an empty index and its document file
+ *
+ * PARAMETERS : SearchIndex *index : The index.
+ *
+ * RETURNS : int : 0 on success, -1 on error.
+ */
+int searchIndexInitialize(SearchIndex *index)
+{
+    pthread_mutex_init(&index->indexMutex, NULL);
+    pthread_mutex_init(&index->pendingMutex, NULL);
+    pthread_mutex_init(&index->flushMutex, NULL);
+    index->pendingHead = NULL;
+    index->pendingTail = NULL;
+    index->documentFile = open(SEARCH_DOCUMENT_DIRECTORY, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (index->documentFile < 0)
+    {
+        char documentPath[] = SEARCH_DOCUMENT_DIRECTORY "/chat-search-XXXXXX";
+        index->documentFile = mkstemp(documentPath);
+        if (index->documentFile < 0)
+        {
+            return -1;
+        }
+        unlink(documentPath);
+    }
+    index->documentFileLength = 0;
+    index->documents = NULL;
+    index->documentCount = 0;
+    index->documentCapacity = 0;
+    index->termCount = 0;
+    index->termCapacity = SEARCH_INITIAL_TERM_CAPACITY;
+    index->terms = calloc(index->termCapacity, sizeof(TermPostings *));
+    if (index->terms == NULL)
+    {
+        return -1;
+    }
+    memoryCharge(NULL, MEMORY_SEARCH, index->termCapacity * sizeof(TermPostings *));
+    return 0;
+}
+
+/*
+ * FUNCTION : searchIndexAdd
+ *
+ * DESCRIPTION : This function queues a message that was just broadcast to be indexed (every word in its text, and
+ * its user) by the next searchIndexFlush. Called on the broadcast path, so it only copies the message and links it.
+ *
+ * PARAMETERS : SearchIndex *index : The index.
+ *              unsigned long sequence : The broadcast's sequence number.
+ *              long long serverMs : When it was stamped.
+ *              const char *userName : Who sent it.
+ *              const char *text : What they wrote (the part that is searched).
+ *              const char *line : The line as broadcast (what a match sends back).
+ *
+ * RETURNS : void
+ */
+void searchIndexAdd(SearchIndex *index, unsigned long sequence, long long serverMs, const char *userName, const char *text, const char *line)
+{
+    size_t lineLength = strlen(line);
+    if (lineLength >= SEARCH_RESULT_TEXT_SIZE)
+    {
+        lineLength = SEARCH_RESULT_TEXT_SIZE - 1;
+    }
+    size_t userLength = strlen(userName) + 1;
+    size_t textLength = strlen(text) + 1;
+
+    PendingDocument *pending = malloc(sizeof(PendingDocument) + userLength + textLength + lineLength);
+    if (pending == NULL)
+    {
+        return;
+    }
+    memoryCharge(NULL, MEMORY_SEARCH, sizeof(PendingDocument) + userLength + textLength + lineLength);
+    pending->next = NULL;
+    pending->sequence = sequence;
+    pending->serverMs = serverMs;
+    pending->textStart = userLength;
+    pending->lineStart = userLength + textLength;
+    pending->lineLength = lineLength;
+    memcpy(pending->data, userName, userLength);
+    memcpy(pending->data + pending->textStart, text, textLength);
+    memcpy(pending->data + pending->lineStart, line, lineLength);
+
+    pthread_mutex_lock(&index->pendingMutex);
+    if (index->pendingTail != NULL)
+    {
+        index->pendingTail->next = pending;
+    }
+    else
+    {
+        index->pendingHead = pending;
+    }
+    index->pendingTail = pending;
+    pthread_mutex_unlock(&index->pendingMutex);
+}
+
+/*
+ * FUNCTION : searchIndexFlush
+ *
+ * DESCRIPTION : This function indexes everything queued by searchIndexAdd. The lines of the whole batch go to the
+ * document file in one write, before indexMutex is taken, so queries only wait for the postings to be added.
+ *
+ * PARAMETERS : SearchIndex *index : The index.
+ *
+ * RETURNS : void
+ */
+void searchIndexFlush(SearchIndex *index)
+{
+    pthread_mutex_lock(&index->flushMutex);
+    pthread_mutex_lock(&index->pendingMutex);
+    PendingDocument *batch = index->pendingHead;
+    index->pendingHead = NULL;
+    index->pendingTail = NULL;
+    pthread_mutex_unlock(&index->pendingMutex);
+    if (batch == NULL)
+    {
+        pthread_mutex_unlock(&index->flushMutex);
+        return;
+    }
+
+    // The batch's lines back to back, where the file ends now
+    size_t batchLength = 0;
+    unsigned int batchCount = 0;
+    for (PendingDocument *pending = batch; pending != NULL; pending = pending->next)
+    {
+        batchLength += pending->lineLength;
+        batchCount++;
+    }
+    char *lines = malloc(batchLength > 0 ? batchLength : 1);
+    int isWritten = 0;
+    if (lines != NULL)
+    {
+        size_t linesLength = 0;
+        for (PendingDocument *pending = batch; pending != NULL; pending = pending->next)
+        {
+            memcpy(lines + linesLength, pending->data + pending->lineStart, pending->lineLength);
+            linesLength += pending->lineLength;
+        }
+        isWritten = pwrite(index->documentFile, lines, batchLength, index->documentFileLength) == (ssize_t)batchLength;
+        free(lines);
+    }
+
+    pthread_mutex_lock(&index->indexMutex);
+    if (isWritten && index->documentCount + batchCount > index->documentCapacity)
+    {
+        unsigned int newCapacity = index->documentCapacity > 0 ? index->documentCapacity : 1024;
+        while (newCapacity < index->documentCount + batchCount)
+        {
+            newCapacity *= 2;
+        }
+        SearchDocument *newDocuments = realloc(index->documents, newCapacity * sizeof(SearchDocument));
+        if (newDocuments != NULL)
+        {
+            memoryCharge(NULL, MEMORY_SEARCH, (long long)(newCapacity - index->documentCapacity) * sizeof(SearchDocument));
+            index->documents = newDocuments;
+            index->documentCapacity = newCapacity;
+        }
+        else
+        {
+            isWritten = 0;
+        }
+    }
+    while (batch != NULL)
+    {
+        PendingDocument *pending = batch;
+        batch = pending->next;
+        if (isWritten)
+        {
+            unsigned int document = index->documentCount++;
+            SearchDocument *record = &index->documents[document];
+            record->sequence = pending->sequence;
+            // Workers can queue a hair out of order, keep the times sorted so a time range stays a binary search
+            record->serverMs = document > 0 && index->documents[document - 1].serverMs > pending->serverMs
+                                   ? index->documents[document - 1].serverMs
+                                   : pending->serverMs;
+            record->textOffset = index->documentFileLength;
+            record->textLength = pending->lineLength;
+            index->documentFileLength += pending->lineLength;
+
+            char term[SEARCH_TERM_MAX_LENGTH + 2];
+            const char *text = pending->data + pending->textStart;
+            userTerm(pending->data, term);
+            addPosting(index, term, document);
+            while (nextTerm(&text, term) > 0)
+            {
+                addPosting(index, term, document);
+            }
+        }
+        memoryRelease(NULL, MEMORY_SEARCH, sizeof(PendingDocument) + pending->lineStart + pending->lineLength);
+        free(pending);
+    }
+    pthread_mutex_unlock(&index->indexMutex);
+    pthread_mutex_unlock(&index->flushMutex);
+}
+
+/*
+ * FUNCTION : searchParseQuery
+ *
+ * DESCRIPTION : This function reads a query: words that must all be in a message, and optionally user:NAME,
+ * after:MS, before:MS and limit:COUNT
+ *
+ * PARAMETERS : const char *queryText : The query as the client sent it.
+ *              SearchQuery *query : Where to put it.
+ *
+ * RETURNS : void
+ */
+void searchParseQuery(const char *queryText, SearchQuery *query)
+{
+    query->termCount = 0;
+    query->afterMs = 0;
+    query->beforeMs = 0;
+    query->limit = SEARCH_DEFAULT_RESULTS;
+
+    while (*queryText != '\0')
+    {
+        while (*queryText == ' ')
+        {
+            queryText++;
+        }
+        const char *wordEnd = queryText;
+        while (*wordEnd != '\0' && *wordEnd != ' ')
+        {
+            wordEnd++;
+        }
+
+        if (strncmp(queryText, SEARCH_USER_PREFIX, strlen(SEARCH_USER_PREFIX)) == 0 && query->termCount < SEARCH_MAX_QUERY_TERMS)
+        {
+            char userName[SEARCH_TERM_MAX_LENGTH + 1];
+            snprintf(userName, sizeof(userName), "%.*s", (int)(wordEnd - queryText - strlen(SEARCH_USER_PREFIX)), queryText + strlen(SEARCH_USER_PREFIX));
+            userTerm(userName, query->terms[query->termCount++]);
+        }
+        else if (strncmp(queryText, SEARCH_AFTER_PREFIX, strlen(SEARCH_AFTER_PREFIX)) == 0)
+        {
+            query->afterMs = strtoll(queryText + strlen(SEARCH_AFTER_PREFIX), NULL, 10);
+        }
+        else if (strncmp(queryText, SEARCH_BEFORE_PREFIX, strlen(SEARCH_BEFORE_PREFIX)) == 0)
+        {
+            query->beforeMs = strtoll(queryText + strlen(SEARCH_BEFORE_PREFIX), NULL, 10);
+        }
+        else if (strncmp(queryText, SEARCH_LIMIT_PREFIX, strlen(SEARCH_LIMIT_PREFIX)) == 0)
+        {
+            query->limit = atoi(queryText + strlen(SEARCH_LIMIT_PREFIX));
+        }
+        else
+        {
+            // Split the same way messages were, "don't" is two words
+            char word[SEARCH_MAX_QUERY_TERMS * (SEARCH_TERM_MAX_LENGTH + 2)];
+            snprintf(word, sizeof(word), "%.*s", (int)(wordEnd - queryText), queryText);
+            const char *wordText = word;
+            while (query->termCount < SEARCH_MAX_QUERY_TERMS && nextTerm(&wordText, query->terms[query->termCount]) > 0)
+            {
+                query->termCount++;
+            }
+        }
+        queryText = wordEnd;
+    }
+
+    if (query->limit <= 0 || query->limit > SEARCH_MAX_RESULTS)
+    {
+        query->limit = query->limit <= 0 ? SEARCH_DEFAULT_RESULTS : SEARCH_MAX_RESULTS;
+    }
+}
+
+/*
+ * FUNCTION : searchIndexQuery
+ *
+ * DESCRIPTION : This function finds the most recent messages that match a query. The postings of every term are
+ * walked from newest to oldest together, starting with the rarest, each one jumping straight to the next document
+ * the others could match, so the work depends on the matches and the rarest term rather than on the whole log.
+ * Without any terms the newest messages in the time range match.
+ *
+ * PARAMETERS : SearchIndex *index : The index.
+ *              const SearchQuery *query : The query.
+ *              SearchResult *results : Room for maxResults matches.
+ *              int maxResults : Most matches to return.
+ *
+ * RETURNS : int : Number of matches, newest first.
+ */
+int searchIndexQuery(SearchIndex *index, const SearchQuery *query, SearchResult *results, int maxResults)
+{
+    PostingCursor cursors[SEARCH_MAX_QUERY_TERMS];
+    SearchDocument matches[SEARCH_MAX_RESULTS];
+    int limit = query->limit < maxResults ? query->limit : maxResults;
+    if (limit > SEARCH_MAX_RESULTS)
+    {
+        limit = SEARCH_MAX_RESULTS;
+    }
+    int matchCount = 0;
+
+    // Everything broadcast before the query can be found by it
+    searchIndexFlush(index);
+
+    pthread_mutex_lock(&index->indexMutex);
+    long lowDocument = query->afterMs > 0 ? firstDocumentAt(index, query->afterMs) : 0;
+    long candidate = (query->beforeMs > 0 ? firstDocumentAt(index, query->beforeMs) : index->documentCount) - 1L;
+
+    int cursorCount = 0;
+    int isMissingTerm = 0;
+    for (int i = 0; i < query->termCount && !isMissingTerm; i++)
+    {
+        TermPostings *postings = index->terms[findTermSlot(index->terms, index->termCapacity, query->terms[i])];
+        if (postings == NULL)
+        {
+            isMissingTerm = 1;
+            break;
+        }
+
+        // Keep them rarest first, the first one drives the walk
+        int position = cursorCount++;
+        while (position > 0 && cursors[position - 1].postings->documentCount > postings->documentCount)
+        {
+            cursors[position].postings = cursors[position - 1].postings;
+            position--;
+        }
+        cursors[position].postings = postings;
+    }
+    for (int i = 0; i < cursorCount; i++)
+    {
+        cursors[i].segmentIndex = -1;
+    }
+
+    while (!isMissingTerm && matchCount < limit && candidate >= lowDocument)
+    {
+        long document = cursorCount > 0 ? cursorSeekAtMost(&cursors[0], candidate) : candidate;
+        if (document < lowDocument)
+        {
+            break;
+        }
+
+        int isMatch = 1;
+        for (int i = 1; i < cursorCount; i++)
+        {
+            long otherDocument = cursorSeekAtMost(&cursors[i], document);
+            if (otherDocument != document)
+            {
+                // Nothing newer than this term's next document can match
+                isMatch = 0;
+                candidate = otherDocument;
+                break;
+            }
+        }
+        if (isMatch)
+        {
+            matches[matchCount++] = index->documents[document];
+            candidate = document - 1;
+        }
+    }
+    pthread_mutex_unlock(&index->indexMutex);
+
+    // The text never changes once written, read it without holding up new messages
+    for (int i = 0; i < matchCount; i++)
+    {
+        results[i].sequence = matches[i].sequence;
+        results[i].serverMs = matches[i].serverMs;
+        ssize_t readLength = pread(index->documentFile, results[i].text, matches[i].textLength, matches[i].textOffset);
+        results[i].text[readLength > 0 ? readLength : 0] = '\0';
+    }
+    return matchCount;
+}
+
+/*
+ * FUNCTION : searchIndexSize
+ *
+ * DESCRIPTION : This function reports how much is indexed (stats)
+ *
+ * PARAMETERS : SearchIndex *index : The index.
+ *              unsigned int *documentCount : Set to the number of messages.
+ *              unsigned int *termCount : Set to the number of distinct terms.
+ *
+ * RETURNS : void
+ */
+void searchIndexSize(SearchIndex *index, unsigned int *documentCount, unsigned int *termCount)
+{
+    pthread_mutex_lock(&index->indexMutex);
+    *documentCount = index->documentCount;
+    *termCount = index->termCount;
+    pthread_mutex_unlock(&index->indexMutex);
+}
@@ -0,0 +1,51 @@
+#include "../inc/server-clock.h"
+
+/*
+ * FUNCTION : monotonicNanoseconds
+ *
+ * DESCRIPTION : This function reads the monotonic clock (never jumps when the wall clock is changed)
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : long long : Nanoseconds since an arbitrary fixed point.
+ */
+long long monotonicNanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * NANOSECONDS_PER_SECOND + now.tv_nsec;
+}
+
+// Wall clock time as of the last timer tick (milliseconds since the epoch)
+static long long cachedWallClockMs = 0;
+
+/*
+ * FUNCTION : coarseClockUpdate
+ *
+ * DESCRIPTION : This function refreshes the cached wall clock, called once per timer tick so stamping a message
+ * is a plain load instead of a clock read
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : void
+ */
+void coarseClockUpdate(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    __atomic_store_n(&cachedWallClockMs, (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000, __ATOMIC_RELAXED);
+}
+
+/*
+ * FUNCTION : coarseClockMilliseconds
+ *
+ * DESCRIPTION : This function returns the cached wall clock (accurate to one timer tick)
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : long long : Milliseconds since the Unix epoch.
+ */
+long long coarseClockMilliseconds(void)
+{
+    return __atomic_load_n(&cachedWallClockMs, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,333 @@
+#include "../inc/state-snapshot.h"
+#include "../inc/server-clock.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Shared state, written by the timer thread (and main before it starts)
+SnapshotStats snapshotStats;
+
+static MessageHistory *snapshotHistory = NULL;
+static char snapshotPath[SNAPSHOT_PATH_SIZE];
+static char snapshotTemporaryPath[SNAPSHOT_PATH_SIZE + 8];
+static pid_t writerPid = -1;               // Child writing a snapshot, -1 when there is none
+static long long lastSnapshotMs = 0;       // When the last child was started (coarse wall clock)
+static unsigned long lastRecordedCount = 0; // History recordedCount at the last snapshot
+
+/*
+ * FUNCTION : alignedMessageBytes
+ *
+ * DESCRIPTION : This function works out how much room a frame takes in a snapshot file
+ *
+ * PARAMETERS : const OutboundMessage *message : The frame.
+ *
+ * RETURNS : unsigned long : Its image size, padded to SNAPSHOT_ALIGNMENT.
+ */
+static unsigned long alignedMessageBytes(const OutboundMessage *message)
+{
+    unsigned long imageBytes = offsetof(OutboundMessage, data) + message->length;
+    return (imageBytes + SNAPSHOT_ALIGNMENT - 1) & ~(unsigned long)(SNAPSHOT_ALIGNMENT - 1);
+}
+
+/*
+ * FUNCTION : writeFully
+ *
+ * DESCRIPTION : This function writes a whole buffer, however many writes it takes
+ *
+ * PARAMETERS : int file : Where to write.
+ *              const void *data : The bytes.
+ *              size_t length : How many.
+ *
+ * RETURNS : int : 0 on success, -1 on error.
+ */
+static int writeFully(int file, const void *data, size_t length)
+{
+    const char *cursor = data;
+    while (length > 0)
+    {
+        ssize_t writtenBytes = write(file, cursor, length);
+        if (writtenBytes <= 0)
+        {
+            return -1;
+        }
+        cursor += writtenBytes;
+        length -= writtenBytes;
+    }
+    return 0;
+}
+
+/*
+ * FUNCTION : writeSnapshot
+ *
+ * DESCRIPTION : This function writes the history out to a new file and moves it over the old one once it is on
+ * disk, so a crash part way leaves the last snapshot as it was. Runs in the forked child, so it only uses the
+ * stack and plain system calls.
+ *
+ * PARAMETERS : const MessageHistory *history : The child's copy of the history.
+ *
+ * RETURNS : int : 0 on success, -1 on error.
+ */
+static int writeSnapshot(const MessageHistory *history)
+{
+    unsigned long oldestKept = history->recordedCount > HISTORY_CAPACITY ? history->recordedCount - HISTORY_CAPACITY : 0;
+    SnapshotEntry entries[HISTORY_CAPACITY];
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LENGTH);
+    header.version = SNAPSHOT_VERSION;
+    header.headerSize = sizeof(SnapshotHeader);
+    header.entrySize = sizeof(SnapshotEntry);
+    header.messageHeaderSize = offsetof(OutboundMessage, data);
+    header.messageCount = history->recordedCount - oldestKept;
+    header.nextSequence = history->nextSequence;
+    header.writtenMs = coarseClockMilliseconds();
+
+    // Lay the frames out after the table
+    unsigned long offset = sizeof(SnapshotHeader) + header.messageCount * sizeof(SnapshotEntry);
+    for (unsigned long position = oldestKept; position < history->recordedCount; position++)
+    {
+        SnapshotEntry *entry = &entries[position - oldestKept];
+        entry->sequence = history->sequences[position % HISTORY_CAPACITY];
+        entry->offset = offset;
+        offset += alignedMessageBytes(history->messages[position % HISTORY_CAPACITY]);
+    }
+    header.fileLength = offset;
+
+    int file = open(snapshotTemporaryPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (file < 0)
+    {
+        return -1;
+    }
+    int writeResult = writeFully(file, &header, sizeof(header));
+    if (writeResult == 0)
+    {
+        writeResult = writeFully(file, entries, header.messageCount * sizeof(SnapshotEntry));
+    }
+    for (unsigned long position = oldestKept; writeResult == 0 && position < history->recordedCount; position++)
+    {
+        // The image a loader uses in place: no references until the history takes one, never freed
+        const OutboundMessage *message = history->messages[position % HISTORY_CAPACITY];
+        OutboundMessage image;
+        char padding[SNAPSHOT_ALIGNMENT] = {0};
+        memset(&image, 0, sizeof(image));
+        image.referenceCount = 0;
+        image.isMapped = 1;
+        image.length = message->length;
+        writeResult = writeFully(file, &image, offsetof(OutboundMessage, data));
+        if (writeResult == 0)
+        {
+            writeResult = writeFully(file, message->data, message->length);
+        }
+        if (writeResult == 0)
+        {
+            writeResult = writeFully(file, padding, alignedMessageBytes(message) - offsetof(OutboundMessage, data) - message->length);
+        }
+    }
+    if (writeResult == 0)
+    {
+        writeResult = fsync(file);
+    }
+    close(file);
+    if (writeResult == 0)
+    {
+        writeResult = rename(snapshotTemporaryPath, snapshotPath);
+    }
+    if (writeResult < 0)
+    {
+        unlink(snapshotTemporaryPath);
+    }
+    return writeResult;
+}
+
+/*
+ * FUNCTION : isSnapshotValid
+ *
+ * DESCRIPTION : This function checks a mapped snapshot was written by this layout and that every offset, length and
+ * sequence number in it stays inside the file and in order, before anything points into it
+ *
+ * PARAMETERS : const char *mapping : The mapped file.
+ *              unsigned long mappingLength : Its size.
+ *
+ * RETURNS : int : 1 if it can be used, 0 if not.
+ */
+static int isSnapshotValid(const char *mapping, unsigned long mappingLength)
+{
+    const SnapshotHeader *header = (const SnapshotHeader *)mapping;
+    if (mappingLength < sizeof(SnapshotHeader) || memcmp(header->magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LENGTH) != 0 ||
+        header->version != SNAPSHOT_VERSION || header->headerSize != sizeof(SnapshotHeader) ||
+        header->entrySize != sizeof(SnapshotEntry) || header->messageHeaderSize != offsetof(OutboundMessage, data) ||
+        header->fileLength != mappingLength || header->messageCount > HISTORY_CAPACITY ||
+        sizeof(SnapshotHeader) + header->messageCount * sizeof(SnapshotEntry) > mappingLength)
+    {
+        return 0;
+    }
+
+    const SnapshotEntry *entries = (const SnapshotEntry *)(mapping + sizeof(SnapshotHeader));
+    for (unsigned int i = 0; i < header->messageCount; i++)
+    {
+        if (entries[i].offset % SNAPSHOT_ALIGNMENT != 0 || entries[i].offset > mappingLength - offsetof(OutboundMessage, data) ||
+            (i > 0 && entries[i].sequence <= entries[i - 1].sequence) || entries[i].sequence >= header->nextSequence)
+        {
+            return 0;
+        }
+        const OutboundMessage *message = (const OutboundMessage *)(mapping + entries[i].offset);
+        if (!message->isMapped || message->length == 0 ||
+            message->length > mappingLength - entries[i].offset - offsetof(OutboundMessage, data) ||
+            message->data[message->length - 1] != PROTOCOL_FRAME_END)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * FUNCTION : stateSnapshotLoad
+ *
+ * DESCRIPTION : This function starts the history off from a snapshot, if there is one. The file is mapped private
+ * and the history points at the frames in it, which are never unmapped (a reference count write copies just its
+ * page). Call before any client or thread can see the history.
+ *
+ * PARAMETERS : MessageHistory *history : The history, just initialized.
+ *              const char *path : The snapshot file.
+ *
+ * RETURNS : int : Broadcasts restored (0 without a usable file).
+ */
+int stateSnapshotLoad(MessageHistory *history, const char *path)
+{
+    long long startNs = monotonicNanoseconds();
+    int file = open(path, O_RDONLY | O_CLOEXEC);
+    if (file < 0)
+    {
+        return 0;
+    }
+    struct stat fileStatus;
+    char *mapping = MAP_FAILED;
+    if (fstat(file, &fileStatus) == 0 && fileStatus.st_size >= (off_t)sizeof(SnapshotHeader))
+    {
+        mapping = mmap(NULL, fileStatus.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+    }
+    close(file);
+    if (mapping == MAP_FAILED)
+    {
+        printf("Snapshot %s ignored: can't be mapped\n", path);
+        return 0;
+    }
+    if (!isSnapshotValid(mapping, fileStatus.st_size))
+    {
+        printf("Snapshot %s ignored: not one this server wrote\n", path);
+        munmap(mapping, fileStatus.st_size);
+        return 0;
+    }
+
+    const SnapshotHeader *header = (const SnapshotHeader *)mapping;
+    const SnapshotEntry *entries = (const SnapshotEntry *)(mapping + sizeof(SnapshotHeader));
+    for (unsigned int i = 0; i < header->messageCount; i++)
+    {
+        historyRestore(history, entries[i].sequence, (OutboundMessage *)(mapping + entries[i].offset));
+    }
+
+    snapshotStats.restoredMessages = header->messageCount;
+    snapshotStats.loadMicroseconds = (monotonicNanoseconds() - startNs) / 1000;
+    lastRecordedCount = history->recordedCount;
+    printf("Restored %u messages from %s (taken %llds ago) in %lldus\n", header->messageCount, path,
+           (coarseClockMilliseconds() - header->writtenMs) / 1000, snapshotStats.loadMicroseconds);
+    return header->messageCount;
+}
+
+/*
+ * FUNCTION : stateSnapshotStart
+ *
+ * DESCRIPTION : This function turns periodic snapshots on
+ *
+ * PARAMETERS : MessageHistory *history : The history to snapshot.
+ *              const char *path : Where to keep the snapshot (written next to it first, then moved over it).
+ *
+ * RETURNS : int : 0 on success, -1 if the path is too long.
+ */
+int stateSnapshotStart(MessageHistory *history, const char *path)
+{
+    if (strlen(path) >= sizeof(snapshotPath))
+    {
+        return -1;
+    }
+    snprintf(snapshotPath, sizeof(snapshotPath), "%s", path);
+    snprintf(snapshotTemporaryPath, sizeof(snapshotTemporaryPath), "%s.tmp", path);
+    snapshotHistory = history;
+    snapshotStats.isActive = 1;
+    lastSnapshotMs = coarseClockMilliseconds();
+    return 0;
+}
+
+/*
+ * FUNCTION : stateSnapshotWriteIfDue
+ *
+ * DESCRIPTION : This function is called from the timer thread. It collects the last child once it has finished, and
+ * forks a new one when SNAPSHOT_INTERVAL_SECONDS have passed and something was broadcast. The fork happens with
+ * historyMutex held, so the child's copy is never caught part way through a broadcast.
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : void
+ */
+void stateSnapshotWriteIfDue(void)
+{
+    if (snapshotHistory == NULL)
+    {
+        return;
+    }
+
+    if (writerPid > 0)
+    {
+        int writerStatus;
+        if (waitpid(writerPid, &writerStatus, WNOHANG) == 0)
+        {
+            return;
+        }
+        writerPid = -1;
+        if (WIFEXITED(writerStatus) && WEXITSTATUS(writerStatus) == 0)
+        {
+            struct stat fileStatus;
+            snapshotStats.written++;
+            snapshotStats.lastBytes = stat(snapshotPath, &fileStatus) == 0 ? fileStatus.st_size : 0;
+        }
+        else
+        {
+            // Try again next interval even if nothing new is broadcast
+            snapshotStats.failed++;
+            lastRecordedCount = 0;
+        }
+    }
+
+    long long nowMs = coarseClockMilliseconds();
+    if (nowMs - lastSnapshotMs < SNAPSHOT_INTERVAL_SECONDS * 1000LL)
+    {
+        return;
+    }
+    lastSnapshotMs = nowMs;
+
+    pthread_mutex_lock(&snapshotHistory->historyMutex);
+    if (snapshotHistory->recordedCount != lastRecordedCount)
+    {
+        pid_t childPid = fork();
+        if (childPid == 0)
+        {
+            _exit(writeSnapshot(snapshotHistory) == 0 ? 0 : 1);
+        }
+        if (childPid < 0)
+        {
+            perror("snapshot fork failed");
+            snapshotStats.failed++;
+        }
+        else
+        {
+            writerPid = childPid;
+            lastRecordedCount = snapshotHistory->recordedCount;
+        }
+    }
+    pthread_mutex_unlock(&snapshotHistory->historyMutex);
+}
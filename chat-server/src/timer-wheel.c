@@ -0,0 +1,203 @@
+#include "../inc/timer-wheel.h"
+
+/*
+ * FUNCTION : unlinkTimerEntry
+ *
+ * DESCRIPTION : This function removes an entry from whatever slot list it is currently in
+ *
+ * PARAMETERS : TimerEntry *entry : The entry to unlink.
+ *
+ * RETURNS : void
+ */
+static void unlinkTimerEntry(TimerEntry *entry)
+{
+    entry->previous->next = entry->next;
+    entry->next->previous = entry->previous;
+    entry->next = NULL;
+    entry->previous = NULL;
+    entry->isArmed = 0;
+}
+
+/*
+ * FUNCTION : placeTimerEntry
+ *
+ * DESCRIPTION : This function puts an entry into the slot matching its expiry tick.
+ * Entries close to expiring go into level 0, entries further out go into the coarser levels and
+ * get cascaded down as the wheel turns. The wheel mutex must be held.
+ *
+ * PARAMETERS : TimerWheel *wheel : The wheel to place the entry in.
+ *              TimerEntry *entry : The entry to place (expiryTick must already be set).
+ *
+ * RETURNS : void
+ */
+static void placeTimerEntry(TimerWheel *wheel, TimerEntry *entry)
+{
+    unsigned long ticksLeft = entry->expiryTick - wheel->currentTick;
+    int level = 0;
+
+    // Find the first level whose range covers the remaining ticks
+    while (level < TIMER_WHEEL_LEVELS - 1 && ticksLeft >= (1UL << (TIMER_WHEEL_SLOT_BITS * (level + 1))))
+    {
+        level++;
+    }
+
+    // Anything past the last level is clamped to the furthest slot we can represent
+    if (ticksLeft >= (1UL << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)))
+    {
+        entry->expiryTick = wheel->currentTick + (1UL << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) - 1;
+    }
+
+    int slot = (entry->expiryTick >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_SLOT_MASK;
+    TimerEntry *head = &wheel->slotHeads[level][slot];
+
+    // Add to the tail of the slot list
+    entry->next = head;
+    entry->previous = head->previous;
+    head->previous->next = entry;
+    head->previous = entry;
+    entry->isArmed = 1;
+}
+
+/*
+ * FUNCTION : cascadeTimerSlot
+ *
+ * DESCRIPTION : This function moves every entry of a coarse slot back into the wheel,
+ * which drops them into a finer level now that their expiry is closer
+ *
+ * PARAMETERS : TimerWheel *wheel : The wheel being advanced.
+ *              int level : The level of the slot to cascade.
+ *              int slot : The slot index to cascade.
+ *
+ * RETURNS : void
+ */
+static void cascadeTimerSlot(TimerWheel *wheel, int level, int slot)
+{
+    TimerEntry *head = &wheel->slotHeads[level][slot];
+    while (head->next != head)
+    {
+        TimerEntry *entry = head->next;
+        unlinkTimerEntry(entry);
+        placeTimerEntry(wheel, entry);
+    }
+}
+
+/*
+ * FUNCTION : timerWheelInitialize
+ *
+ * DESCRIPTION : This function sets every slot to an empty list and starts the wheel at tick 0
+ *
+ * PARAMETERS : TimerWheel *wheel : The wheel to initialize.
+ *
+ * RETURNS : void
+ */
+void timerWheelInitialize(TimerWheel *wheel)
+{
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+        {
+            wheel->slotHeads[level][slot].next = &wheel->slotHeads[level][slot];
+            wheel->slotHeads[level][slot].previous = &wheel->slotHeads[level][slot];
+        }
+    }
+    wheel->currentTick = 0;
+    pthread_mutex_init(&wheel->wheelMutex, NULL);
+}
+
+/*
+ * FUNCTION : timerWheelArm
+ *
+ * DESCRIPTION : This function (re)arms an entry to fire after a number of ticks. If the entry is
+ * already armed it is moved, so calling this on every bit of activity just pushes the deadline out.
+ *
+ * PARAMETERS : TimerWheel *wheel : The wheel to arm the entry on.
+ *              TimerEntry *entry : The entry to arm.
+ *              unsigned long ticks : How many ticks from now the entry should fire (minimum 1).
+ *              unsigned long (*callback)(TimerEntry *entry) : Function called when the entry fires.
+ *
+ * RETURNS : void
+ */
+void timerWheelArm(TimerWheel *wheel, TimerEntry *entry, unsigned long ticks, unsigned long (*callback)(TimerEntry *entry))
+{
+    if (ticks == 0)
+    {
+        ticks = 1;
+    }
+
+    pthread_mutex_lock(&wheel->wheelMutex);
+    if (entry->isArmed)
+    {
+        unlinkTimerEntry(entry);
+    }
+    entry->callback = callback;
+    entry->expiryTick = wheel->currentTick + ticks;
+    placeTimerEntry(wheel, entry);
+    pthread_mutex_unlock(&wheel->wheelMutex);
+}
+
+/*
+ * FUNCTION : timerWheelCancel
+ *
+ * DESCRIPTION : This function disarms an entry. Once this returns the callback is not running
+ * and will not run for this entry, so the owner is free to release it.
+ *
+ * PARAMETERS : TimerWheel *wheel : The wheel the entry was armed on.
+ *              TimerEntry *entry : The entry to cancel.
+ *
+ * RETURNS : void
+ */
+void timerWheelCancel(TimerWheel *wheel, TimerEntry *entry)
+{
+    pthread_mutex_lock(&wheel->wheelMutex);
+    if (entry->isArmed)
+    {
+        unlinkTimerEntry(entry);
+    }
+    pthread_mutex_unlock(&wheel->wheelMutex);
+}
+
+/*
+ * FUNCTION : timerWheelAdvance
+ *
+ * DESCRIPTION : This function turns the wheel forward, cascading coarse slots as each level wraps and
+ * running the callback of every entry that expires along the way
+ *
+ * PARAMETERS : TimerWheel *wheel : The wheel to advance.
+ *              unsigned long elapsedTicks : How many ticks have passed since the last call.
+ *
+ * RETURNS : void
+ */
+void timerWheelAdvance(TimerWheel *wheel, unsigned long elapsedTicks)
+{
+    pthread_mutex_lock(&wheel->wheelMutex);
+    while (elapsedTicks-- > 0)
+    {
+        wheel->currentTick++;
+
+        // When a level wraps, pull the next slot of the level above it down (highest level first)
+        for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--)
+        {
+            unsigned long lowerBits = wheel->currentTick & ((1UL << (TIMER_WHEEL_SLOT_BITS * level)) - 1);
+            if (lowerBits == 0)
+            {
+                cascadeTimerSlot(wheel, level, (wheel->currentTick >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_SLOT_MASK);
+            }
+        }
+
+        // Fire everything in the current level 0 slot
+        TimerEntry *head = &wheel->slotHeads[0][wheel->currentTick & TIMER_WHEEL_SLOT_MASK];
+        while (head->next != head)
+        {
+            TimerEntry *entry = head->next;
+            unlinkTimerEntry(entry);
+
+            unsigned long rearmTicks = entry->callback(entry);
+            if (rearmTicks > 0)
+            {
+                entry->expiryTick = wheel->currentTick + rearmTicks;
+                placeTimerEntry(wheel, entry);
+            }
+        }
+    }
+    pthread_mutex_unlock(&wheel->wheelMutex);
+}
@@ -0,0 +1,169 @@
+#include "../inc/traffic-capture.h"
+#include "../inc/memory-budget.h"
+#include "../inc/server-clock.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Shared state, written under captureMutex and by the timer thread
+CaptureStats captureStats;
+
+static int captureFile = -1;
+static pthread_mutex_t captureMutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char *pendingRecords = NULL;  // Encoded records waiting for the timer thread (under captureMutex)
+static size_t pendingLength = 0;
+static unsigned long pendingCount = 0;
+static unsigned char *writingRecords = NULL;  // Records being written (timer thread only), swapped with pendingRecords
+static long long lastRecordNs = 0;            // When the last record was taken, records only store the gap
+static unsigned long nextConnectionId = 0;
+
+/*
+ * FUNCTION : trafficCaptureStart
+ *
+ * DESCRIPTION : This function creates the capture file (replacing one already there) and starts recording
+ *
+ * PARAMETERS : const char *path : Where to write it.
+ *
+ * RETURNS : int : 0 on success, -1 on error (errno set).
+ */
+int trafficCaptureStart(const char *path)
+{
+    pendingRecords = malloc(CAPTURE_BUFFER_BYTES);
+    writingRecords = malloc(CAPTURE_BUFFER_BYTES);
+    int file = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (pendingRecords == NULL || writingRecords == NULL || file < 0 ||
+        write(file, CAPTURE_MAGIC, CAPTURE_MAGIC_LENGTH) != CAPTURE_MAGIC_LENGTH)
+    {
+        if (file >= 0)
+        {
+            close(file);
+        }
+        free(pendingRecords);
+        free(writingRecords);
+        pendingRecords = NULL;
+        writingRecords = NULL;
+        return -1;
+    }
+    memoryCharge(NULL, MEMORY_CAPTURE, 2 * CAPTURE_BUFFER_BYTES);
+    captureStats.bytesWritten = CAPTURE_MAGIC_LENGTH;
+    lastRecordNs = monotonicNanoseconds();
+    __atomic_store_n(&captureFile, file, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * FUNCTION : trafficCaptureIsActive
+ *
+ * DESCRIPTION : This function says whether the server is capturing, so callers can skip the work of a record
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : int : 1 if it is, 0 if not.
+ */
+int trafficCaptureIsActive(void)
+{
+    return __atomic_load_n(&captureFile, __ATOMIC_ACQUIRE) >= 0;
+}
+
+/*
+ * FUNCTION : trafficCaptureNextConnectionId
+ *
+ * DESCRIPTION : This function numbers a new client connection for its records
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : unsigned long : The id, from 1 up.
+ */
+unsigned long trafficCaptureNextConnectionId(void)
+{
+    return __atomic_add_fetch(&nextConnectionId, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * FUNCTION : trafficCaptureRecord
+ *
+ * DESCRIPTION : This function records something a client sent, stamped with the time it is called. Does nothing
+ * unless the server is capturing. If the buffer is full (the disk fell behind) the record is dropped and counted.
+ *
+ * PARAMETERS : int kind : CAPTURE_RECORD_*.
+ *              unsigned long connectionId : The client's connection id.
+ *              const char *payload : The frame, NULL for records without one.
+ *              size_t length : Bytes of the frame, or raw upload bytes for CAPTURE_RECORD_UPLOAD.
+ *
+ * RETURNS : void
+ */
+void trafficCaptureRecord(int kind, unsigned long connectionId, const char *payload, size_t length)
+{
+    if (!trafficCaptureIsActive())
+    {
+        return;
+    }
+
+    CaptureRecord record = {kind, 0, connectionId, length, payload};
+    size_t payloadLength = kind == CAPTURE_RECORD_UPLOAD ? 0 : length;
+
+    // The time is taken under the lock so records in the file are in time order
+    pthread_mutex_lock(&captureMutex);
+    if (pendingLength + CAPTURE_RECORD_OVERHEAD + payloadLength > CAPTURE_BUFFER_BYTES)
+    {
+        __atomic_add_fetch(&captureStats.recordsDropped, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&captureMutex);
+        return;
+    }
+    long long nowNs = monotonicNanoseconds();
+    record.deltaMicroseconds = (unsigned long long)(nowNs - lastRecordNs) / 1000;
+    // Keep the remainder, so rounding doesn't make a long capture drift
+    lastRecordNs += (long long)record.deltaMicroseconds * 1000;
+    pendingLength += captureEncodeRecord(pendingRecords + pendingLength, &record);
+    pendingCount++;
+    pthread_mutex_unlock(&captureMutex);
+}
+
+/*
+ * FUNCTION : trafficCaptureFlush
+ *
+ * DESCRIPTION : This function writes the records that piled up since the last call to the capture file. Called by
+ * the timer thread every tick, so a killed server loses no more than a tick of traffic.
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : void
+ */
+void trafficCaptureFlush(void)
+{
+    if (!trafficCaptureIsActive())
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&captureMutex);
+    unsigned char *records = pendingRecords;
+    size_t recordsLength = pendingLength;
+    unsigned long recordCount = pendingCount;
+    pendingRecords = writingRecords;
+    pendingLength = 0;
+    pendingCount = 0;
+    writingRecords = records;
+    pthread_mutex_unlock(&captureMutex);
+
+    size_t writtenLength = 0;
+    while (writtenLength < recordsLength)
+    {
+        ssize_t writeResult = write(captureFile, records + writtenLength, recordsLength - writtenLength);
+        if (writeResult < 0)
+        {
+            // Stop rather than leave a file with a hole in it
+            perror("capture write failed");
+            int file = captureFile;
+            __atomic_store_n(&captureFile, -1, __ATOMIC_RELEASE);
+            close(file);
+            return;
+        }
+        writtenLength += writeResult;
+    }
+    __atomic_add_fetch(&captureStats.recordsWritten, recordCount, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&captureStats.bytesWritten, recordsLength, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,268 @@
+#include "../inc/worker-pool.h"
+#include "../inc/low-latency.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// The deques, one per worker
+static WorkDeque workerDeques[WORKER_POOL_MAX_WORKERS];
+static int poolWorkerCount = 0;
+
+// Idle workers sleep here until something is submitted
+static pthread_mutex_t sleepMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workAvailable = PTHREAD_COND_INITIALIZER;
+static int queuedItemCount = 0;
+
+// Which worker the calling thread is (-1 for threads outside the pool)
+static __thread int currentWorkerIndex = -1;
+
+/*
+ * FUNCTION : pushBottom
+ *
+ * DESCRIPTION : This function adds an item at the owner's end of a deque
+ *
+ * PARAMETERS : WorkDeque *deque : The deque to push onto.
+ *              WorkItem *item : The item to push.
+ *
+ * RETURNS : int : 1 if the item was pushed, 0 if the deque is full.
+ */
+static int pushBottom(WorkDeque *deque, WorkItem *item)
+{
+    int wasPushed = 0;
+    pthread_mutex_lock(&deque->dequeMutex);
+    if (deque->bottom - deque->top < WORKER_DEQUE_CAPACITY)
+    {
+        deque->items[deque->bottom % WORKER_DEQUE_CAPACITY] = item;
+        deque->bottom++;
+        wasPushed = 1;
+    }
+    pthread_mutex_unlock(&deque->dequeMutex);
+    return wasPushed;
+}
+
+/*
+ * FUNCTION : popBottom
+ *
+ * DESCRIPTION : This function takes the newest item from the owner's end of a deque (it is the most likely to
+ * still be in cache)
+ *
+ * PARAMETERS : WorkDeque *deque : The deque to pop from.
+ *
+ * RETURNS : WorkItem * : The item, or NULL if the deque is empty.
+ */
+static WorkItem *popBottom(WorkDeque *deque)
+{
+    WorkItem *item = NULL;
+    pthread_mutex_lock(&deque->dequeMutex);
+    if (deque->bottom != deque->top)
+    {
+        deque->bottom--;
+        item = deque->items[deque->bottom % WORKER_DEQUE_CAPACITY];
+    }
+    pthread_mutex_unlock(&deque->dequeMutex);
+    return item;
+}
+
+/*
+ * FUNCTION : stealTop
+ *
+ * DESCRIPTION : This function takes the oldest item from another worker's deque
+ *
+ * PARAMETERS : WorkDeque *deque : The deque to steal from.
+ *
+ * RETURNS : WorkItem * : The item, or NULL if the deque is empty.
+ */
+static WorkItem *stealTop(WorkDeque *deque)
+{
+    WorkItem *item = NULL;
+    pthread_mutex_lock(&deque->dequeMutex);
+    if (deque->bottom != deque->top)
+    {
+        item = deque->items[deque->top % WORKER_DEQUE_CAPACITY];
+        deque->top++;
+    }
+    pthread_mutex_unlock(&deque->dequeMutex);
+    return item;
+}
+
+/*
+ * FUNCTION : findWork
+ *
+ * DESCRIPTION : This function gets the next item for a worker: its own deque first, then every other deque
+ * starting with its neighbour
+ *
+ * PARAMETERS : int workerIndex : The worker looking for work.
+ *
+ * RETURNS : WorkItem * : The item, or NULL if there is nothing anywhere.
+ */
+static WorkItem *findWork(int workerIndex)
+{
+    WorkItem *item = popBottom(&workerDeques[workerIndex]);
+    for (int offset = 1; item == NULL && offset < poolWorkerCount; offset++)
+    {
+        item = stealTop(&workerDeques[(workerIndex + offset) % poolWorkerCount]);
+    }
+    if (item != NULL)
+    {
+        __atomic_sub_fetch(&queuedItemCount, 1, __ATOMIC_ACQ_REL);
+    }
+    return item;
+}
+
+/*
+ * FUNCTION : workerThread
+ *
+ * DESCRIPTION : This function is the loop each pool thread runs: find work, run it, sleep when there is none.
+ * In low-latency mode the thread is pinned to a worker core and spins instead of sleeping, so a submit never has to
+ * wake it (unless the network threads took every core, then it sleeps as usual).
+ *
+ * PARAMETERS : void *workerIndexPointer : The worker's index (cast from intptr_t).
+ *
+ * RETURNS : void * : Never returns.
+ */
+static void *workerThread(void *workerIndexPointer)
+{
+    currentWorkerIndex = (int)(long)workerIndexPointer;
+    int isSpinning = lowLatencyWorkerCoreCount() > 0;
+    unsigned int idleRounds = 0;
+    if (isSpinning)
+    {
+        lowLatencyPinWorker(currentWorkerIndex);
+    }
+
+    while (1)
+    {
+        WorkItem *item = findWork(currentWorkerIndex);
+        if (item != NULL)
+        {
+            item->run(item);
+            idleRounds = 0;
+            continue;
+        }
+        if (isSpinning)
+        {
+            // Only the count is read while spinning, the deques' locks are left alone until there is work
+            while (__atomic_load_n(&queuedItemCount, __ATOMIC_ACQUIRE) == 0)
+            {
+                lowLatencyBackoff(&idleRounds);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&sleepMutex);
+        while (__atomic_load_n(&queuedItemCount, __ATOMIC_ACQUIRE) == 0)
+        {
+            pthread_cond_wait(&workAvailable, &sleepMutex);
+        }
+        pthread_mutex_unlock(&sleepMutex);
+    }
+    return NULL;
+}
+
+/*
+ * FUNCTION : workerPoolStart
+ *
+ * DESCRIPTION : This function starts the pool threads
+ *
+ * PARAMETERS : int workerCount : Number of workers (clamped to 1..WORKER_POOL_MAX_WORKERS).
+ *
+ * RETURNS : int : Number of workers started, or -1 if none could be.
+ */
+int workerPoolStart(int workerCount)
+{
+    if (workerCount < 1)
+    {
+        workerCount = 1;
+    }
+    if (workerCount > WORKER_POOL_MAX_WORKERS)
+    {
+        workerCount = WORKER_POOL_MAX_WORKERS;
+    }
+
+    for (int i = 0; i < workerCount; i++)
+    {
+        pthread_mutex_init(&workerDeques[i].dequeMutex, NULL);
+        workerDeques[i].top = 0;
+        workerDeques[i].bottom = 0;
+    }
+    poolWorkerCount = workerCount;
+
+    for (int i = 0; i < workerCount; i++)
+    {
+        pthread_t threadId;
+        if (pthread_create(&threadId, NULL, workerThread, (void *)(long)i) != 0)
+        {
+            perror("pthread_create failed");
+            if (i == 0)
+            {
+                return -1;
+            }
+            // Work submitted to the missing workers' deques still gets stolen by the running ones
+            break;
+        }
+        pthread_detach(threadId);
+    }
+    return workerCount;
+}
+
+/*
+ * FUNCTION : workerPoolSubmit
+ *
+ * DESCRIPTION : This function queues an item. A worker resubmitting keeps the item on its own deque, anyone else
+ * puts it on the preferred worker's deque, and a sleeping worker is woken to take it.
+ *
+ * PARAMETERS : WorkItem *item : The item to run.
+ *              int preferredWorker : Worker to queue on when called from outside the pool (any number, it wraps).
+ *
+ * RETURNS : void
+ */
+void workerPoolSubmit(WorkItem *item, int preferredWorker)
+{
+    int workerIndex = currentWorkerIndex >= 0 ? currentWorkerIndex : preferredWorker % poolWorkerCount;
+
+    // Count it before it becomes visible so findWork can never take the count below zero
+    __atomic_add_fetch(&queuedItemCount, 1, __ATOMIC_ACQ_REL);
+
+    // A full deque just means trying the next one (and giving the workers a moment once all of them were full)
+    int offset = 0;
+    while (!pushBottom(&workerDeques[(workerIndex + offset) % poolWorkerCount], item))
+    {
+        offset++;
+        if (offset % poolWorkerCount == 0)
+        {
+            sched_yield();
+        }
+    }
+
+    pthread_mutex_lock(&sleepMutex);
+    pthread_cond_signal(&workAvailable);
+    pthread_mutex_unlock(&sleepMutex);
+}
+
+/*
+ * FUNCTION : workerPoolSize
+ *
+ * DESCRIPTION : This function returns how many workers the pool has
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : int : The number of workers.
+ */
+int workerPoolSize(void)
+{
+    return poolWorkerCount;
+}
+
+/*
+ * FUNCTION : workerPoolCurrentWorker
+ *
+ * DESCRIPTION : This function tells a piece of work which worker it is running on
+ *
+ * PARAMETERS : None
+ *
+ * RETURNS : int : The worker index, or -1 when called from a thread outside the pool.
+ */
+int workerPoolCurrentWorker(void)
+{
+    return currentWorkerIndex;
+}